@@ -32,8 +32,8 @@ struct entry {
     Memory_Type type;
 };
 
-static int pool_size, next_pool_slot;
-static struct entry *pool;
+static THREAD_LOCAL int pool_size, next_pool_slot;
+static THREAD_LOCAL struct entry *pool;
 
 void
 begin_code_allocation()
@@ -0,0 +1,244 @@
+/*****************************************************************************
+ * Worker threads for the pure computation of built-in functions
+ *****************************************************************************/
+
+#include "my-unistd.h"
+
+#include "background.h"
+#include "config.h"
+#include "execute.h"
+#include "functions.h"
+#include "log.h"
+#include "options.h"
+#include "storage.h"
+#include "structures.h"
+#include "tasks.h"
+#include "utils.h"
+
+#ifdef THREADED_BUILTINS
+
+#include <errno.h>
+#include <pthread.h>
+#include "my-signal.h"
+
+#include "net_multi.h"
+
+/* Jobs go onto the `pending' list for the workers and, once WORK is done,
+ * onto the `done' list for the main thread, which hears about them through
+ * a pipe registered with the network module.  Both lists are guarded by
+ * job_lock.  Every job not yet finished is also on the `jobs' list, which
+ * only the main thread uses, so that queued_tasks() and kill_task() can
+ * see the suspended tasks; a killed job's vm is freed at once and the job
+ * itself once its WORK is done.
+ */
+
+typedef struct job {
+    struct job *next;		/* on the pending or done list */
+    struct job *next_job;	/* on the jobs list */
+    vm the_vm;			/* 0 once the task is killed */
+    background_work work;
+    background_finish finish;
+    void *data;
+} job;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_ready = PTHREAD_COND_INITIALIZER;
+static job *pending = 0, **pending_tail = &pending;
+static job *done = 0, **done_tail = &done;
+
+static job *jobs = 0;
+static int started = 0;
+static int wakeup_fds[2];
+
+static void *
+worker(void *arg)
+{
+    sigset_t signals;
+    job *j;
+    int wake;
+
+    (void) arg;
+
+    /* Signals are for the main thread, apart from those raised by a fault
+     * in this one.
+     */
+    sigfillset(&signals);
+    sigdelset(&signals, SIGSEGV);
+    sigdelset(&signals, SIGBUS);
+    sigdelset(&signals, SIGILL);
+    sigdelset(&signals, SIGFPE);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    pthread_mutex_lock(&job_lock);
+    for (;;) {
+	while (!pending)
+	    pthread_cond_wait(&job_ready, &job_lock);
+	j = pending;
+	if (!(pending = j->next))
+	    pending_tail = &pending;
+	pthread_mutex_unlock(&job_lock);
+
+	(*j->work) (j->data);
+
+	pthread_mutex_lock(&job_lock);
+	wake = !done;
+	j->next = 0;
+	*done_tail = j;
+	done_tail = &j->next;
+	if (wake)
+	    while (write(wakeup_fds[1], "", 1) < 0 && errno == EINTR)
+		continue;
+    }
+
+    return 0;
+}
+
+static void
+unlink_job(job * j)
+{
+    job **jj;
+
+    for (jj = &jobs; *jj != j; jj = &(*jj)->next_job);
+    *jj = j->next_job;
+}
+
+static void
+finish_jobs(int fd, void *data)
+{
+    char buffer[100];
+    job *j, *next;
+
+    (void) data;
+
+    while (read(fd, buffer, sizeof(buffer)) > 0)
+	continue;
+
+    pthread_mutex_lock(&job_lock);
+    j = done;
+    done = 0;
+    done_tail = &done;
+    pthread_mutex_unlock(&job_lock);
+
+    for (; j; j = next) {
+	next = j->next;
+	unlink_job(j);
+	if (j->the_vm)
+	    resume_task(j->the_vm, (*j->finish) (j->data, 0));
+	else
+	    free_var((*j->finish) (j->data, 1));
+	myfree(j, M_TASK);
+    }
+}
+
+static task_enum_action
+background_enumerator(task_closure closure, void *data)
+{
+    job *j;
+
+    for (j = jobs; j; j = j->next_job) {
+	task_enum_action tea;
+
+	if (!j->the_vm)
+	    continue;
+	tea = (*closure) (j->the_vm, "background", data);
+	if (tea == TEA_KILL)
+	    j->the_vm = 0;
+	if (tea != TEA_CONTINUE)
+	    return tea;
+    }
+
+    return TEA_CONTINUE;
+}
+
+/* Returns false if the workers couldn't be started, in which case jobs are
+ * run on the spot.
+ */
+static int
+start_workers(void)
+{
+    static int failed = 0;
+    pthread_t thread;
+    int i;
+
+    if (started || failed)
+	return started;
+
+    if (pipe(wakeup_fds) < 0) {
+	log_perror("BACKGROUND: Creating wakeup pipe");
+	failed = 1;
+	return 0;
+    }
+    if (!network_set_nonblocking(wakeup_fds[0])) {
+	log_perror("BACKGROUND: Making wakeup pipe nonblocking");
+	close(wakeup_fds[0]);
+	close(wakeup_fds[1]);
+	failed = 1;
+	return 0;
+    }
+    for (i = 0; i < BACKGROUND_THREADS; i++)
+	if (pthread_create(&thread, 0, worker, 0) != 0)
+	    break;
+	else
+	    pthread_detach(thread);
+    if (i == 0) {
+	errlog("BACKGROUND: Can't start worker threads\n");
+	close(wakeup_fds[0]);
+	close(wakeup_fds[1]);
+	failed = 1;
+	return 0;
+    }
+    network_register_fd(wakeup_fds[0], finish_jobs, 0, 0);
+    register_task_queue(background_enumerator);
+    oklog("BACKGROUND: Started %d worker thread%s\n", i, i == 1 ? "" : "s");
+    started = 1;
+
+    return 1;
+}
+
+static enum error
+background_suspender(vm the_vm, void *data)
+{
+    job *j = data;
+
+    j->the_vm = the_vm;
+    j->next_job = jobs;
+    jobs = j;
+
+    pthread_mutex_lock(&job_lock);
+    j->next = 0;
+    *pending_tail = j;
+    pending_tail = &j->next;
+    pthread_cond_signal(&job_ready);
+    pthread_mutex_unlock(&job_lock);
+
+    return E_NONE;
+}
+
+#endif				/* THREADED_BUILTINS */
+
+package
+background_suspend(background_work work, background_finish finish,
+		   void *data)
+{
+    Var r;
+
+#ifdef THREADED_BUILTINS
+    if (start_workers()) {
+	job *j = mymalloc(sizeof(job), M_TASK);
+
+	j->work = work;
+	j->finish = finish;
+	j->data = data;
+	return make_suspend_pack(background_suspender, j);
+    }
+#endif
+
+    (*work) (data);
+    r = (*finish) (data, 0);
+    if (r.type == TYPE_ERR)
+	return make_error_pack(r.v.err);
+    else
+	return make_var_pack(r);
+}
+
+char rcsid_background[] = "$Id$";
@@ -0,0 +1,37 @@
+/* Running the pure computation of a built-in function on a worker thread.
+ *
+ * A built-in function with a lot of work to do on plain C data (hashing a
+ * long string, say) can hand that work to background_suspend(), which
+ * suspends the calling task while one of a small pool of worker threads
+ * runs WORK and resumes it with whatever FINISH returns.  Everything but
+ * WORK runs on the main thread; WORK gets only DATA and must not touch MOO
+ * values, the database, the pattern cache or anything else the main thread
+ * uses, nor allocate with mymalloc() (which keeps unlocked statistics).
+ * Strings WORK reads should be str_ref()ed while it runs, and its output
+ * buffers allocated beforehand.
+ *
+ * FINISH is always called exactly once, on the main thread, and must free
+ * DATA.  If KILLED is true the task was killed in the meantime and the
+ * value FINISH returns is thrown away; otherwise it is the value of the
+ * builtin call, and an error value is raised in the task as usual.
+ *
+ * A server built without thread support, or with BACKGROUND_THREADS set to
+ * zero in options.h, runs WORK and FINISH on the spot, so a builtin needn't
+ * care; it should call background_suspend() only when there's at least
+ * BACKGROUND_MIN_BYTES of work, since suspending lets other tasks run in
+ * the middle of the call.
+ */
+
+#ifndef Background_h
+#define Background_h
+
+#include "functions.h"
+#include "structures.h"
+
+typedef void (*background_work) (void *data);
+typedef Var(*background_finish) (void *data, int killed);
+
+extern package background_suspend(background_work work,
+				  background_finish finish, void *data);
+
+#endif
@@ -23,6 +23,7 @@ extern void register_list(void);
 extern void register_log(void);
 extern void register_numbers(void);
 extern void register_objects(void);
+extern void register_parallel(void);
 extern void register_property(void);
 extern void register_server(void);
 extern void register_tasks(void);
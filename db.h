@@ -38,6 +38,26 @@ extern int db_initialize(int *pargc, char ***pargv);
 				 * database args were valid.
 				 */
 
+extern void db_set_dump_format(int binary);
+				/* Chooses between the text and binary formats
+				 * for dumps.  By default, the server dumps in
+				 * whichever format it loaded.
+				 */
+
+extern void db_set_read_only(void);
+				/* Makes db_load() leave the journal alone,
+				 * neither replaying it nor starting a new
+				 * segment, for programs that only look at the
+				 * database; it mustn't be changed or dumped.
+				 */
+
+extern int db_set_dump_compression(int compress);
+				/* Chooses whether dumps are compressed with
+				 * zlib; they aren't by default.  Compressed
+				 * databases are recognized when loaded.
+				 * Returns false if this server can't compress.
+				 */
+
 extern int db_load(void);
 				/* Does any necessary long-running preparations
 				 * of the database, such as loading significant
@@ -61,6 +81,36 @@ extern int db_flush(enum db_flush_type);
 				 * argument.  Returns true on success.
 				 */
 
+extern void db_checkpoint_finished(int success);
+				/* Tell the database module how the checkpoint
+				 * begun by the last db_flush(FLUSH_ALL_NOW)
+				 * turned out, once a forked checkpointer has
+				 * exited.
+				 */
+
+extern int db_checkpoint_written(int *success);
+				/* Finishes the checkpoint begun by the last
+				 * db_flush(FLUSH_ALL_NOW), if it was being
+				 * written by another thread and that's done,
+				 * returning true and setting *SUCCESS to tell
+				 * how it turned out; db_checkpoint_finished()
+				 * must still be called.  Returns false if
+				 * there was no such checkpoint or it isn't
+				 * written yet.
+				 */
+
+extern void db_checkpoint_overhead(long notify_usecs, long io_usecs);
+				/* Notes the time the server spent on other
+				 * things just before the next checkpoint, to
+				 * be reported with it.
+				 */
+
+extern Var db_checkpoint_stats(void);
+				/* Returns a list describing each of the most
+				 * recent checkpoints, oldest first; see
+				 * db_file.c for the fields.
+				 */
+
 extern int64_t db_disk_size(void);
 				/* Return the total size, in bytes, of the most
 				 * recent full representation of the database
@@ -81,6 +131,11 @@ extern Objid db_create_object(void);
 				/* Creates a new object with parent & location
 				 * == #-1.  Returns new object's id number.
 				 */
+extern Objid db_create_recycled_object(void);
+				/* Like db_create_object(), but gives the new
+				 * object the lowest recycled object number,
+				 * if there is one.
+				 */
 
 extern Objid db_last_used_objid(void);
 extern void db_reset_last_used_objid(void);
@@ -103,6 +158,12 @@ extern Objid db_renumber_object(Objid);
 				 * object number.  Returns its new number.
 				 */
 
+extern Var db_owner_references(Objid);
+				/* Returns a list of the objects that name the
+				 * given one as the owner of themselves or of
+				 * any of their verbs or properties.
+				 */
+
 extern int valid(Objid);
 
 extern int db_object_bytes(Objid);
@@ -127,6 +188,11 @@ extern void db_set_object_name(Objid oid, const char *name);
 
 extern Objid db_object_parent(Objid);
 extern int db_count_children(Objid);
+extern Var db_children_list(Objid);
+				/* Returns a new reference to a list of OID's
+				 * children, cached until the next change to
+				 * that list.
+				 */
 extern int db_for_all_children(Objid,
 			       int (*)(void *, Objid),
 			       void *);
@@ -134,10 +200,22 @@ extern int db_for_all_children(Objid,
 				 * following functions are called during a call
 				 * to db_for_all_children():
 				 *      db_create_object()
+				 *      db_create_recycled_object()
 				 *      db_destroy_object()
 				 *      db_renumber_object()
 				 *      db_change_parent()
 				 */
+extern Var db_object_ancestors(Objid);
+				/* Returns a new reference to the list of
+				 * OID's ancestors, nearest first.  The list
+				 * is cached and shared with OID's siblings
+				 * until some chparent() or renumber() affects
+				 * it.
+				 */
+extern int db_object_isa(Objid oid, Objid ancestor);
+				/* True iff ANCESTOR is OID or one of its
+				 * ancestors.
+				 */
 extern int db_change_parent(Objid oid, Objid parent);
 				/* db_change_parent() returns true (and
 				 * actually changes the parent of OID) iff
@@ -149,6 +227,8 @@ extern int db_change_parent(Objid oid, Objid parent);
 
 extern Objid db_object_location(Objid);
 extern int db_count_contents(Objid);
+extern Var db_contents_list(Objid);
+				/* Like db_children_list(), for contents. */
 extern int db_for_all_contents(Objid,
 			       int (*)(void *, Objid),
 			       void *);
@@ -275,6 +355,7 @@ enum bi_prop {
 typedef struct {
     enum bi_prop built_in;	/* true iff property is a built-in one */
     Objid definer;		/* if !built_in, the object defining prop */
+    Objid oid;			/* the object the handle is on */
     void *ptr;			/* null iff property not found */
 } db_prop_handle;
 
@@ -19,11 +19,20 @@
  * Routines for initializing, loading, dumping, and shutting down the database
  *****************************************************************************/
 
+#include "my-fcntl.h"
+#include "my-signal.h"
 #include "my-stat.h"
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
 #include "my-unistd.h"
 #include "my-stdio.h"
 #include "my-stdlib.h"
 #include "my-string.h"
+#include "my-time.h"
+#if HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
 
 #include "config.h"
 #include "db.h"
@@ -33,21 +42,50 @@
 #include "list.h"
 #include "log.h"
 #include "options.h"
+#include "program.h"
 #include "server.h"
 #include "storage.h"
 #include "streams.h"
 #include "str_intern.h"
+#include "sym_table.h"
 #include "tasks.h"
 #include "timers.h"
+#include "utils.h"
 #include "version.h"
 #include "waif.h"
 
+#if THREADED_DB_LOAD || defined(SNAPSHOT_CHECKPOINTS)
+#include <pthread.h>
+#endif
+
 static char *input_db_name, *dump_db_name;
 static int dump_generation = 0;
 static const char *header_format_string
 = "** LambdaMOO Database, Format Version %u **\n";
 
 DB_Version dbio_input_version;
+
+static int binary_input = 0;	/* loading a binary DB? */
+static Num dump_stamp = 0;	/* the journal checkpoint stamp of the DB
+				 * loaded or being dumped; see db_journal.c */
+static char *journal_db_name = 0;	/* the name the loaded DB's journal
+					 * segments are under, if it says */
+static int binary_dumps = -1;	/* dump in the binary format?  -1 means
+				 * `in the same format as the input DB' */
+static int compress_dumps = 0;	/* write dumps through zlib? */
+static int loading_base = 0;	/* loading the base of a delta DB? */
+static int read_only = 0;	/* leave the journal alone? */
+
+/* The full dump that delta DBs are currently written against; see `Delta DB
+ * files' below.
+ */
+static char *base_db_name = 0;	/* 0 if there's none */
+static Num base_stamp;
+static Num base_size;
+static Objid base_nobjs;	/* the number of objects in the base */
+static int num_deltas = 0;	/* deltas written against it so far */
+static int force_full = 0;	/* the next checkpoint mustn't be a delta */
+static int dump_is_delta = 0;	/* the newest dump on disk is a delta */
 
 
 /*********** Verb and property I/O ***********/
@@ -56,6 +94,7 @@ static void
 read_verbdef(Verbdef * v)
 {
     v->name = dbio_read_string_intern();
+    make_immortal(v->name);
     v->owner = dbio_read_objid();
     v->perms = dbio_read_num();
     v->prep = dbio_read_num();
@@ -76,6 +115,8 @@ static Propdef
 read_propdef(void)
 {
     const char *name = dbio_read_string_intern();
+
+    make_immortal(name);
     return dbpriv_new_propdef(name);
 }
 
@@ -102,42 +143,123 @@ write_propval(Pval * p)
 }
 
 
-/*********** Object I/O ***********/
+/*********** Cold objects ***********/
 
-static int
-read_object(void)
+#ifdef LAZY_DB_LOAD
+
+/* A binary DB with no WAIFs in it is loaded lazily: at first only the hot
+ * fields of each object (those in the parallel arrays) are read, and the
+ * rest stays in the mapped file until dbpriv_read_cold_object() is asked
+ * for it.  The file stays mapped for as long as the server runs.  Binary
+ * dumps copy cold objects straight out of it, without reading them in.
+ */
+static const char *cold_map;	/* 0 if nothing was loaded lazily */
+static const char *cold_index;	/* its OIDX section */
+static const char *cold_objs_end;	/* the end of its OBJS section */
+static const char *cold_progs_end;	/* the end of its PROG section */
+static Objid cold_count;	/* how many objects it holds */
+static long *cold_programs;	/* where in it each object's first verb
+				 * program is, or 0 if it has none */
+static DB_Version cold_version;
+
+/* The fields kept in the parallel arrays: flags, owner, location, contents,
+ * next, parent, child and sibling.
+ */
+#define NUM_HOT_FIELDS	8
+
+/* Positions the input just after the hot fields of cold object OID,
+ * returning its name and setting *END to the end of its record.
+ */
+static const char *
+seek_cold_object(Objid oid, const char **end)
 {
-    Objid oid;
-    Object *o;
-    char s[20];
+    const char *start, *name;
     int i;
-    Verbdef *v, **prevv;
-    int nprops;
 
-    if (dbio_scanf("#%"SCNdN, &oid) != 1 || oid != db_last_used_objid() + 1)
+    dbpriv_set_dbio_binary_input(cold_index + 8 * oid,
+				 cold_index + 8 * cold_count);
+    start = cold_map + dbpriv_dbio_read_fixed64();
+    *end = (oid + 1 < cold_count ? cold_map + dbpriv_dbio_read_fixed64()
+	    : cold_objs_end);
+    dbpriv_set_dbio_binary_input(start, *end);
+    (void) dbio_read_num();	/* recycled objects are never cold */
+    name = dbio_read_string();
+    for (i = 0; i < NUM_HOT_FIELDS; i++)
+	(void) dbio_read_num();
+
+    return name;
+}
+
+/* Positions the input at cold object OID's first verb program, returning
+ * false if it has none.
+ */
+static int
+seek_cold_programs(Objid oid)
+{
+    if (!cold_programs[oid])
 	return 0;
-    dbio_read_line(s, sizeof(s));
+    dbpriv_set_dbio_binary_input(cold_map + cold_programs[oid],
+				 cold_progs_end);
+    return 1;
+}
 
-    if (strcmp(s, " recycled\n") == 0) {
-	dbpriv_new_recycled_object();
-	return 1;
-    } else if (strcmp(s, "\n") != 0)
+/* Reads the header of OID's next verb program, returning false once there
+ * are no more; the source follows.
+ */
+static int
+next_cold_program(Objid oid, Num * vnum)
+{
+    if (dbpriv_dbio_input_position() >= cold_progs_end
+	|| dbio_read_objid() != oid)
 	return 0;
+    *vnum = dbio_read_num();
+    return 1;
+}
 
-    o = dbpriv_new_object();
-    o->name = dbio_read_string_intern();
-    (void) dbio_read_string();	/* discard old handles string */
-    o->flags = dbio_read_num();
+static int
+count_cold_programs(Objid oid)
+{
+    int nprogs = 0;
+    Num vnum;
+
+    if (seek_cold_programs(oid))
+	while (next_cold_program(oid, &vnum)) {
+	    (void) dbpriv_dbio_read_program_source();
+	    nprogs++;
+	}
+
+    return nprogs;
+}
+
+#endif				/* LAZY_DB_LOAD */
+
+
+
+/*********** Object I/O ***********/
+
+static void
+read_hot_fields(Objid oid)
+{
+    dbpriv_flags[oid] = dbio_read_num();
 
-    o->owner = dbio_read_objid();
+    dbpriv_owner[oid] = dbio_read_objid();
 
-    o->location = dbio_read_objid();
-    o->contents = dbio_read_objid();
-    o->next = dbio_read_objid();
+    dbpriv_location[oid] = dbio_read_objid();
+    dbpriv_contents[oid] = dbio_read_objid();
+    dbpriv_next[oid] = dbio_read_objid();
+
+    dbpriv_parent[oid] = dbio_read_objid();
+    dbpriv_child[oid] = dbio_read_objid();
+    dbpriv_sibling[oid] = dbio_read_objid();
+}
 
-    o->parent = dbio_read_objid();
-    o->child = dbio_read_objid();
-    o->sibling = dbio_read_objid();
+/* Reads the rest of object O, after its name and hot fields. */
+static void
+read_cold_fields(Object * o)
+{
+    int i;
+    Verbdef *v, **prevv;
+    int nprops;
 
     o->verbdefs = 0;
     prevv = &(o->verbdefs);
@@ -167,38 +289,174 @@ read_object(void)
     for (i = 0; i < nprops; i++) {
 	read_propval(o->propval + i);
     }
+}
 
-    return 1;
+static void
+read_object_fields(Object * o)
+{
+    o->name = dbio_read_string_intern();
+    if (!binary_input)
+	(void) dbio_read_string();	/* discard old handles string */
+    read_hot_fields(o->id);
+    read_cold_fields(o);
 }
 
+#ifdef LAZY_DB_LOAD
+
+/* A program that doesn't compile, or names a verb the object hasn't got,
+ * would have stopped an eager load; here it can only be logged and left
+ * out.
+ */
 static void
-write_object(Objid oid)
+read_cold_programs(Object * o)
 {
-    Object *o;
+    char name[50];
+    Num vnum, i;
     Verbdef *v;
-    int i;
-    int nverbdefs, nprops;
+    const char *source;
 
-    if (!valid(oid)) {
-	dbio_printf("#%"PRIdN" recycled\n", oid);
+    if (!seek_cold_programs(o->id))
 	return;
+    while (next_cold_program(o->id, &vnum)) {
+	source = dbpriv_dbio_read_program_source();
+	sprintf(name, "#%"PRIdN":%"PRIdN, o->id, vnum);
+	for (v = o->verbdefs, i = 0; v && i < vnum; v = v->next, i++)
+	    ;
+	if (!v)
+	    errlog("READ_COLD_OBJECT: Unknown verb index: %s\n", name);
+	else if (!(v->program = dbpriv_dbio_compile_program(cold_version,
+							   source, 0, name)))
+	    errlog("READ_COLD_OBJECT: Unparsable program %s\n", name);
+	else
+	    /* As for an eager load, in read_verb_programs(). */
+	    program_immortalize_literals(v->program);
     }
-    o = dbpriv_find_object(oid);
+}
 
-    dbio_printf("#%"PRIdN"\n", oid);
-    dbio_write_string(o->name);
-    dbio_write_string("");	/* placeholder for old handles string */
-    dbio_write_num(o->flags);
+void
+dbpriv_read_cold_object(Object * o)
+{
+    Saved_Input saved;
+    const char *end;
+
+    /* This can happen in the middle of reading anything else, such as the
+     * journal.
+     */
+    dbpriv_save_dbio_input(&saved);
+    dbio_input_version = cold_version;
+    TRY {
+	o->name = str_intern(seek_cold_object(o->id, &end));
+	read_cold_fields(o);
+	read_cold_programs(o);
+    }
+    EXCEPT(dbpriv_dbio_truncated)
+	panic("DBPRIV_READ_COLD_OBJECT: Database file is damaged!");
+    ENDTRY;
+    dbpriv_restore_dbio_input(&saved);
+}
+
+#else				/* !LAZY_DB_LOAD */
+
+void
+dbpriv_read_cold_object(Object * o)
+{
+    (void) o;
+    panic("DBPRIV_READ_COLD_OBJECT: Lazy loading not configured!");
+}
+
+#endif				/* LAZY_DB_LOAD */
+
+static int
+read_object(void)
+{
+    Objid oid;
+    char s[20];
+
+    if (binary_input) {
+	oid = db_last_used_objid() + 1;
+	if (!dbio_read_num()) {
+	    dbpriv_new_recycled_object();
+	    return 1;
+	}
+    } else {
+	if (dbio_scanf("#%"SCNdN, &oid) != 1
+	    || oid != db_last_used_objid() + 1)
+	    return 0;
+	dbio_read_line(s, sizeof(s));
+
+	if (strcmp(s, " recycled\n") == 0) {
+	    dbpriv_new_recycled_object();
+	    return 1;
+	} else if (strcmp(s, "\n") != 0)
+	    return 0;
+    }
+
+    read_object_fields(dbpriv_new_object());
+    return 1;
+}
+
+/* Reads object OID from a delta DB, which is always in the text format,
+ * into a slot freed for it.
+ */
+static int
+read_delta_object(Objid oid)
+{
+    Objid n;
+    char s[20];
+
+    if (dbio_scanf("#%"SCNdN, &n) != 1 || n != oid)
+	return 0;
+    dbio_read_line(s, sizeof(s));
+
+    if (strcmp(s, " recycled\n") == 0)
+	return 1;
+    else if (strcmp(s, "\n") != 0)
+	return 0;
+
+    read_object_fields(dbpriv_new_object_at(oid));
+    return 1;
+}
+
+static volatile int dump_cancelled = 0;	/* give up the dump being written */
+
+static void
+write_hot_fields(Object_Version * ver)
+{
+    dbio_write_num(ver->flags);
+
+    dbio_write_objid(ver->owner);
+
+    dbio_write_objid(ver->location);
+    dbio_write_objid(ver->contents);
+    dbio_write_objid(ver->next);
 
-    dbio_write_objid(o->owner);
+    dbio_write_objid(ver->parent);
+    dbio_write_objid(ver->child);
+    dbio_write_objid(ver->sibling);
+}
+
+static void
+write_object_version(Objid oid, Object_Version * ver, int binary)
+{
+    Object *o = ver->o;
+    Verbdef *v;
+    int i;
+    int nverbdefs;
 
-    dbio_write_objid(o->location);
-    dbio_write_objid(o->contents);
-    dbio_write_objid(o->next);
+    if (binary) {
+	dbio_write_num(o != 0);
+	if (!o)
+	    return;
+    } else if (!o) {
+	dbio_printf("#%"PRIdN" recycled\n", oid);
+	return;
+    } else
+	dbio_printf("#%"PRIdN"\n", oid);
 
-    dbio_write_objid(o->parent);
-    dbio_write_objid(o->child);
-    dbio_write_objid(o->sibling);
+    dbio_write_string(o->name);
+    if (!binary)
+	dbio_write_string("");	/* placeholder for old handles string */
+    write_hot_fields(ver);
 
     for (v = o->verbdefs, nverbdefs = 0; v; v = v->next)
 	nverbdefs++;
@@ -211,12 +469,60 @@ write_object(Objid oid)
     for (i = 0; i < o->propdefs.cur_length; i++)
 	write_propdef(&o->propdefs.l[i]);
 
-    nprops = dbpriv_count_properties(oid);
-
-    dbio_write_num(nprops);
-    for (i = 0; i < nprops; i++)
+    dbio_write_num(ver->nprops);
+    for (i = 0; i < ver->nprops; i++)
 	write_propval(o->propval + i);
 }
+
+#ifdef LAZY_DB_LOAD
+
+/* Writes cold object OID, with the hot fields in VER, by copying the rest
+ * of it from the DB file.  Only binary dumps can do that; objects going
+ * into a text one are read in before it starts.
+ */
+static void
+write_cold_object(Objid oid, Object_Version * ver, int binary)
+{
+    const char *name, *rest, *end;
+
+    if (!binary)
+	panic("WRITE_COLD_OBJECT: Cold object in a text dump!");
+    name = seek_cold_object(oid, &end);
+    rest = dbpriv_dbio_input_position();
+
+    dbio_write_num(1);
+    dbio_write_string(name);
+    write_hot_fields(ver);
+    dbpriv_dbio_write_bytes(rest, end - rest);
+}
+
+#endif				/* LAZY_DB_LOAD */
+
+/* Writes OID as it is in the database being dumped.  The object is held
+ * still while it is written, in case that's from a snapshot.
+ */
+static void
+write_object(Objid oid, int binary)
+{
+    Object_Version ver;
+
+    if (dump_cancelled)
+	RAISE(dbpriv_dbio_failed, 0);
+    dbpriv_snapshot_lock();
+    TRY {
+	dbpriv_object_version(oid, &ver);
+#ifdef LAZY_DB_LOAD
+	if (ver.o == COLD_OBJECT)
+	    write_cold_object(oid, &ver, binary);
+	else
+#endif
+	    write_object_version(oid, &ver, binary);
+    }
+    FINALLY {
+	dbpriv_snapshot_unlock();
+    }
+    ENDTRY;
+}
 
 
 /*********** File-level Input ***********/
@@ -240,21 +546,20 @@ validate_hierarchies(void)
 
     oklog("VALIDATE: Phase 1: Check for invalid objects ...\n");
     for (oid = 0; oid < size; oid++) {
-	Object *o = dbpriv_find_object(oid);
-
 	MAYBE_LOG_PROGRESS;
-	if (o) {
-	    if (o->location == NOTHING && o->next != NOTHING) {
-		o->next = NOTHING;
+	if (valid(oid)) {
+	    if (dbpriv_location[oid] == NOTHING
+		&& dbpriv_next[oid] != NOTHING) {
+		dbpriv_next[oid] = NOTHING;
 		fixed_nexts++;
 	    }
 #	    define CHECK(field, name) 					\
 	    {								\
-	        if (o->field != NOTHING					\
-		    && !dbpriv_find_object(o->field)) {			\
+	        if (dbpriv_##field[oid] != NOTHING			\
+		    && !valid(dbpriv_##field[oid])) {			\
 		    errlog("VALIDATE: #%"PRIdN".%s = #%"PRIdN" <invalid> ... fixed.\n", \
-			   oid, name, o->field);			\
-		    o->field = NOTHING;				  	\
+			   oid, name, dbpriv_##field[oid]);		\
+		    dbpriv_##field[oid] = NOTHING;		  	\
 		}							\
 	    }
 
@@ -275,20 +580,18 @@ validate_hierarchies(void)
 
     oklog("VALIDATE: Phase 2: Check for cycles ...\n");
     for (oid = 0; oid < size; oid++) {
-	Object *o = dbpriv_find_object(oid);
-
 	MAYBE_LOG_PROGRESS;
-	if (o) {
+	if (valid(oid)) {
 #	    define CHECK(start, field, name)			\
 	    {							\
 		Objid slower = start;				\
 		Objid faster = slower;				\
 		while (faster != NOTHING) {			\
-		    faster = dbpriv_find_object(faster)->field;	\
+		    faster = dbpriv_##field[faster];		\
 		    if (faster == NOTHING)			\
 			break;					\
-		    faster = dbpriv_find_object(faster)->field;	\
-		    slower = dbpriv_find_object(slower)->field;	\
+		    faster = dbpriv_##field[faster];		\
+		    slower = dbpriv_##field[slower];		\
 		    if (faster == slower) {			\
 			errlog("VALIDATE: Cycle in `%s' chain of #%"PRIdN"\n", \
 			       name, oid);			\
@@ -298,15 +601,15 @@ validate_hierarchies(void)
 		}						\
 	    }
 
-	    CHECK(o->parent, parent, "parent");
-	    CHECK(o->child, sibling, "child");
-	    CHECK(o->location, location, "location");
-	    CHECK(o->contents, next, "contents");
+	    CHECK(dbpriv_parent[oid], parent, "parent");
+	    CHECK(dbpriv_child[oid], sibling, "child");
+	    CHECK(dbpriv_location[oid], location, "location");
+	    CHECK(dbpriv_contents[oid], next, "contents");
 
 #	    undef CHECK
 
 	    /* setup for phase 3:  set two temp flags on every object */
-	    o->flags |= (3<<FLAG_FIRST_TEMP);
+	    dbpriv_flags[oid] |= (3<<FLAG_FIRST_TEMP);
 	}
     }
 
@@ -315,21 +618,17 @@ validate_hierarchies(void)
 
     oklog("VALIDATE: Phase 3a: Finding delusional parents ...\n");
     for (oid = 0; oid < size; oid++) {
-	Object *o = dbpriv_find_object(oid);
-
 	MAYBE_LOG_PROGRESS;
-	if (o) {
+	if (valid(oid)) {
 #	    define CHECK(up, down, down_name, across, FLAG)	\
 	    {							\
 		Objid	oidkid;					\
-		Object *okid;					\
 								\
-		for (oidkid = o->down;				\
+		for (oidkid = dbpriv_##down[oid];		\
 		     oidkid != NOTHING;				\
-		     oidkid = okid->across) {			\
+		     oidkid = dbpriv_##across[oidkid]) {	\
 								\
-		    okid = dbpriv_find_object(oidkid);		\
-		    if (okid->up != oid) {			\
+		    if (dbpriv_##up[oidkid] != oid) {		\
 			errlog(					\
 			    "VALIDATE: #%"PRIdN" erroneously on #%"PRIdN"'s %s list.\n", \
 			    oidkid, oid, down_name);		\
@@ -337,7 +636,7 @@ validate_hierarchies(void)
 		    }						\
 		    else {					\
 			/* mark okid as properly claimed */	\
-			okid->flags &= ~(1<<(FLAG));		\
+			dbpriv_flags[oidkid] &= ~(1<<(FLAG));	\
 		    }						\
 		}						\
 	    }
@@ -351,16 +650,15 @@ validate_hierarchies(void)
 
     oklog("VALIDATE: Phase 3b: Finding delusional children ...\n");
     for (oid = 0; oid < size; oid++) {
-	Object *o = dbpriv_find_object(oid);
-
 	MAYBE_LOG_PROGRESS;
-	if (o) {
+	if (valid(oid)) {
 #	    define CHECK(up, up_name, down_name, FLAG)			\
 	    {								\
 		/* If oid is unclaimed, up must be NOTHING */		\
-		if ((o->flags & (1<<(FLAG))) && o->up != NOTHING) {	\
+		if ((dbpriv_flags[oid] & (1<<(FLAG)))			\
+		    && dbpriv_##up[oid] != NOTHING) {			\
 		    errlog("VALIDATE: #%"PRIdN" not in %s (#%"PRIdN")'s %s list.\n", \
-			   oid, up_name, o->up, down_name);		\
+			   oid, up_name, dbpriv_##up[oid], down_name);	\
 		    broken = 1;						\
 		}							\
 	    }
@@ -369,7 +667,7 @@ validate_hierarchies(void)
 	    CHECK(location, "location", "contents", FLAG_FIRST_TEMP+1);
 
 	    /* clear temp flags */
-	    o->flags &= ~(3<<FLAG_FIRST_TEMP);
+	    dbpriv_flags[oid] &= ~(3<<FLAG_FIRST_TEMP);
 
 #	    undef CHECK
 	}
@@ -392,42 +690,35 @@ fmt_verb_name(void *data)
     return reset_stream(s);
 }
 
+/* Checks the object hierarchies once every object is in, and computes what
+ * the DB doesn't store.
+ */
 static int
-read_db_file(void)
+finish_objects(void)
 {
     Objid oid;
-    Num i, nobjs, nprogs, nusers, vnum, dummy;
-    Var user_list;
-    db_verb_handle h;
-    Program *program;
-
-    waif_before_loading();
 
-    if (dbio_scanf(header_format_string, &dbio_input_version) != 1)
-	dbio_input_version = DBV_Prehistory;
-
-    if (!check_version(dbio_input_version)) {
-	errlog("READ_DB_FILE: Unknown DB version number: %d\n",
-	       dbio_input_version);
-	return 0;
-    }
-    /* I use a `dummy' variable here and elsewhere instead of the `*'
-     * assignment-suppression syntax of `scanf' because it allows more
-     * straightforward error checking; unfortunately, the standard says that
-     * suppressed assignments are not counted in determining the returned value
-     * of `scanf'...
-     */
-    if (dbio_scanf("%"SCNdN"\n%"SCNdN"\n%"SCNdN"\n%"SCNdN"\n",
-		   &nobjs, &nprogs, &dummy, &nusers) != 4) {
-	errlog("READ_DB_FILE: Bad header\n");
+    if (!validate_hierarchies()) {
+	errlog("READ_DB_FILE: Errors in object hierarchies.\n");
 	return 0;
     }
-    user_list = new_list(nusers);
-    for (i = 1; i <= nusers; i++) {
-	user_list.v.list[i].type = TYPE_OBJ;
-	user_list.v.list[i].v.obj = dbio_read_objid();
-    }
-    dbpriv_set_all_users(user_list);
+    for (oid = 0; oid <= db_last_used_objid(); oid++)
+	if (valid(oid)) {
+	    if (dbpriv_parent[oid] == NOTHING)
+		dbpriv_fix_verb_parents(oid);
+	    else
+		dbpriv_nchildren[dbpriv_parent[oid]]++;
+	    if (dbpriv_location[oid] != NOTHING)
+		dbpriv_ncontents[dbpriv_location[oid]]++;
+	}
+
+    return 1;
+}
+
+static int
+read_objects(Num nobjs)
+{
+    Num i;
 
     oklog("LOADING: Reading %"PRIdN" objects...\n", nobjs);
     for (i = 1; i <= nobjs; i++) {
@@ -439,113 +730,1241 @@ read_db_file(void)
 	    oklog("LOADING: Done reading %"PRIdN" objects ...\n", i);
     }
 
-    if (!validate_hierarchies()) {
-	errlog("READ_DB_FILE: Errors in object hierarchies.\n");
-	return 0;
+    /* The base of a delta isn't finished until the delta is in. */
+    return loading_base || finish_objects();
+}
+
+/* Verb programs are read in two passes: first their source text is
+ * collected, then it is compiled, on several threads where that's
+ * possible, and the results installed in the order they were read.
+ */
+
+typedef struct {
+    Objid oid;
+    Num vnum;
+    char *source;
+    Program *program;
+} Pending_Program;
+
+static Pending_Program *pending_programs;
+static Num num_pending_programs, next_pending_program;
+
+static const char *
+fmt_pending_program(void *data)
+{
+    Pending_Program *pp = data;
+    db_verb_handle h = db_find_indexed_verb(pp->oid, pp->vnum + 1);
+
+    return fmt_verb_name(&h);
+}
+
+static void
+compile_pending_program(Pending_Program * pp)
+{
+    pp->program = dbpriv_dbio_compile_program(dbio_input_version,
+					      pp->source,
+					      fmt_pending_program, pp);
+}
+
+#if THREADED_DB_LOAD
+
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *
+compile_pending_programs(void *arg)
+{
+    Num i;
+
+    for (;;) {
+	pthread_mutex_lock(&pending_lock);
+	i = next_pending_program++;
+	pthread_mutex_unlock(&pending_lock);
+	if (i >= num_pending_programs)
+	    break;
+	compile_pending_program(&pending_programs[i]);
+    }
+    return arg;
+}
+
+static int
+compile_all_pending_programs(void)
+{
+    long nthreads = DB_LOAD_THREADS;
+    pthread_t *threads;
+    int i, started, err;
+
+    if (nthreads == 0)
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nthreads > num_pending_programs)
+	nthreads = num_pending_programs;
+    if (nthreads <= 1) {
+	compile_pending_programs(0);
+	return 1;
     }
+    /* The shared empty string and list and the builtin variable names are
+     * set up on first use; make sure that happens here rather than in a
+     * race between the threads.
+     */
+    free_str(str_dup(""));
+    free_var(new_list(0));
+    free_names(new_builtin_names(dbio_input_version));
+
+    /* This thread does its share of the work as well. */
+    threads = mymalloc((nthreads - 1) * sizeof(pthread_t), M_DB_LOAD);
+    for (started = 0; started < nthreads - 1; started++)
+	if ((err = pthread_create(&threads[started], 0,
+				  compile_pending_programs, 0)) != 0) {
+	    errlog("COMPILE_ALL_PENDING_PROGRAMS: Can't start thread: %s\n",
+		   strerror(err));
+	    break;
+	}
+    compile_pending_programs(0);
+    for (i = 0; i < started; i++)
+	pthread_join(threads[i], 0);
+    myfree(threads, M_DB_LOAD);
+
+    return started + 1;
+}
+
+#else				/* !THREADED_DB_LOAD */
+
+static int
+compile_all_pending_programs(void)
+{
+    for (; next_pending_program < num_pending_programs;
+	 next_pending_program++)
+	compile_pending_program(&pending_programs[next_pending_program]);
+    return 1;
+}
+
+#endif				/* THREADED_DB_LOAD */
+
+static int
+read_verb_programs(Num nprogs, int (*read_header) (Objid *, Num *))
+{
+    Pending_Program *pp;
+    Num i;
+    int nthreads, ok = 1;
+
     oklog("LOADING: Reading %"PRIdN" MOO verb programs...\n", nprogs);
+    pending_programs = mymalloc(nprogs * sizeof(Pending_Program), M_DB_LOAD);
+    num_pending_programs = next_pending_program = 0;
     for (i = 1; i <= nprogs; i++) {
-	if (dbio_scanf("#%"SCNdN":%"SCNdN"\n", &oid, &vnum) != 2) {
+	pp = &pending_programs[i - 1];
+	if (!(*read_header) (&pp->oid, &pp->vnum)) {
 	    errlog("READ_DB_FILE: Bad program header, i = %"PRIdN".\n", i);
-	    return 0;
+	    ok = 0;
+	    break;
 	}
-	if (!valid(oid)) {
+	if (!valid(pp->oid)) {
 	    errlog("READ_DB_FILE: Verb for non-existant object: #%"PRIdN":%"PRIdN".\n",
-		   oid, vnum);
-	    return 0;
-	}
-	h = db_find_indexed_verb(oid, vnum + 1);	/* DB file is 0-based. */
-	if (!h.ptr) {
-	    errlog("READ_DB_FILE: Unknown verb index: #%"PRIdN":%"PRIdN".\n", oid, vnum);
-	    return 0;
+		   pp->oid, pp->vnum);
+	    ok = 0;
+	    break;
 	}
-	program = dbio_read_program(dbio_input_version, fmt_verb_name, &h);
-	if (!program) {
-	    errlog("READ_DB_FILE: Unparsable program #%"PRIdN":%"PRIdN".\n", oid, vnum);
-	    return 0;
+	if (!db_find_indexed_verb(pp->oid, pp->vnum + 1).ptr) {
+	    /* DB file is 0-based. */
+	    errlog("READ_DB_FILE: Unknown verb index: #%"PRIdN":%"PRIdN".\n",
+		   pp->oid, pp->vnum);
+	    ok = 0;
+	    break;
 	}
-	db_set_verb_program(h, program);
+	pp->source = dbpriv_dbio_read_program_source();
+	pp->program = 0;
+	num_pending_programs = i;
 	if (i == nprogs || log_report_progress())
 	    oklog("LOADING: Done reading %"PRIdN" verb programs...\n", i);
     }
 
-    oklog("LOADING: Reading forked and suspended tasks...\n");
-    if (!read_task_queue()) {
-	errlog("READ_DB_FILE: Can't read task queue.\n");
-	return 0;
+    if (ok) {
+	nthreads = compile_all_pending_programs();
+	oklog("LOADING: Compiled %"PRIdN" verb programs on %d thread%s\n",
+	      nprogs, nthreads, nthreads == 1 ? "" : "s");
     }
-    oklog("LOADING: Reading list of formerly active connections...\n");
-    if (!read_active_connections()) {
-	errlog("DB_READ: Can't read active connections.\n");
-	return 0;
+    for (i = 0; i < num_pending_programs; i++) {
+	pp = &pending_programs[i];
+	if (!binary_input)
+	    free_str(pp->source);
+	if (ok && !pp->program) {
+	    errlog("READ_DB_FILE: Unparsable program #%"PRIdN":%"PRIdN".\n",
+		   pp->oid, pp->vnum);
+	    ok = 0;
+	}
+	if (ok) {
+	    program_immortalize_literals(pp->program);
+	    db_set_verb_program(db_find_indexed_verb(pp->oid, pp->vnum + 1),
+				pp->program);
+	}
+	else if (pp->program)
+	    free_program(pp->program);
     }
+    myfree(pending_programs, M_DB_LOAD);
+    pending_programs = 0;
 
-    waif_after_loading();
-    return 1;
+    return ok;
 }
-
 
-/*********** File-level Output ***********/
+/* The active connections may be followed by the name of the DB file the
+ * journal segments since this checkpoint are named after, which needn't
+ * be the one being dumped to now.  Older servers stop reading before it.
+ */
+static const char *journal_tag = "journal segments named after\n";
 
 static int
-write_db_file(const char *reason)
+read_journal_name(void)
+{
+    char c;
+    int i = dbio_scanf("journal segments named after%c", &c);
+
+    if (i == EOF)		/* older database format */
+	return 1;
+    if (i != 1 || c != '\n') {
+	errlog("READ_DB_FILE: Bad journal name tag.\n");
+	return 0;
+    }
+    if (journal_db_name)
+	free_str(journal_db_name);
+    journal_db_name = str_dup(dbio_read_string());
+    return 1;
+}
+
+static int
+read_tasks_and_connections(void)
+{
+    oklog("LOADING: Reading forked and suspended tasks...\n");
+    if (!read_task_queue()) {
+	errlog("READ_DB_FILE: Can't read task queue.\n");
+	return 0;
+    }
+    oklog("LOADING: Reading list of formerly active connections...\n");
+    if (!read_active_connections()) {
+	errlog("DB_READ: Can't read active connections.\n");
+	return 0;
+    }
+    return read_journal_name();
+}
+
+static int
+read_text_program_header(Objid * oid, Num * vnum)
+{
+    return dbio_scanf("#%"SCNdN":%"SCNdN"\n", oid, vnum) == 2;
+}
+
+static int
+read_db_file(void)
+{
+    Num i, nobjs, nprogs, nusers;
+    Var user_list;
+
+    waif_before_loading();
+
+    if (dbio_scanf(header_format_string, &dbio_input_version) != 1)
+	dbio_input_version = DBV_Prehistory;
+
+    if (!check_version(dbio_input_version)) {
+	errlog("READ_DB_FILE: Unknown DB version number: %d\n",
+	       dbio_input_version);
+	return 0;
+    }
+    /* The third number was once an unused `dummy'; it now holds the journal
+     * checkpoint stamp, which older servers wrote as 0.
+     */
+    if (dbio_scanf("%"SCNdN"\n%"SCNdN"\n%"SCNdN"\n%"SCNdN"\n",
+		   &nobjs, &nprogs, &dump_stamp, &nusers) != 4) {
+	errlog("READ_DB_FILE: Bad header\n");
+	return 0;
+    }
+    user_list = new_list(nusers);
+    for (i = 1; i <= nusers; i++) {
+	user_list.v.list[i].type = TYPE_OBJ;
+	user_list.v.list[i].v.obj = dbio_read_objid();
+    }
+    dbpriv_set_all_users(user_list);
+
+    if (!read_objects(nobjs))
+	return 0;
+
+    if (!read_verb_programs(nprogs, read_text_program_header))
+	return 0;
+
+    if (!loading_base && !read_tasks_and_connections())
+	return 0;
+
+    waif_after_loading();
+    return 1;
+}
+
+
+/*********** File-level Output ***********/
+
+/* What is being dumped: the objects up to DUMP_MAX_OID, the users and, for
+ * a delta, the objects flagged in DUMP_DIRTY.  These are copies when the
+ * dump is being written from a snapshot.  DUMP_WAIFS says whether there
+ * were any WAIFs when it started.
+ */
+static Objid dump_max_oid;
+static Var dump_users;
+static char *dump_dirty;
+static int dump_waifs;
+
+/* The text of the task queue and active connections, when that had to be
+ * written out when the dump was started; otherwise 0.
+ */
+static char *dump_task_text;
+static size_t dump_task_length;
+
+static int
+count_programs(Objid oid)
+{
+    Object_Version ver;
+    Verbdef *v;
+    int nprogs = 0;
+
+    dbpriv_snapshot_lock();
+    dbpriv_object_version(oid, &ver);
+#ifdef LAZY_DB_LOAD
+    if (ver.o == COLD_OBJECT)
+	nprogs = count_cold_programs(oid);
+#endif
+    if (ver.o && ver.o != COLD_OBJECT)
+	for (v = ver.o->verbdefs; v; v = v->next)
+	    if (v->program)
+		nprogs++;
+    dbpriv_snapshot_unlock();
+
+    return nprogs;
+}
+
+static int
+count_verb_programs(void)
 {
     Objid oid;
-    Objid max_oid = db_last_used_objid();
+    int nprogs = 0;
+
+    for (oid = 0; oid <= dump_max_oid; oid++)
+	nprogs += count_programs(oid);
+
+    return nprogs;
+}
+
+static void
+write_tasks_and_connections(const char *reason)
+{
+    const char *name;
+
+    if (dump_task_text) {
+	dbpriv_dbio_write_bytes(dump_task_text, dump_task_length);
+	return;
+    }
+    oklog("%s: Writing forked and suspended tasks...\n", reason);
+    write_task_queue();
+    oklog("%s: Writing list of formerly active connections...\n", reason);
+    write_active_connections();
+    if ((name = dbpriv_journal_name())) {
+	dbio_printf("%s", journal_tag);
+	dbio_write_string(name);
+    }
+}
+
+#ifdef LAZY_DB_LOAD
+
+/* Copies the verb programs of cold object OID from the DB file into a
+ * binary dump.
+ */
+static void
+write_cold_programs(Objid oid, int *count, int nprogs, const char *reason)
+{
+    Num vnum;
+
+    if (!seek_cold_programs(oid))
+	return;
+    while (next_cold_program(oid, &vnum)) {
+	dbio_write_objid(oid);
+	dbio_write_num(vnum);
+	dbio_write_string(dbpriv_dbio_read_program_source());
+	if (++*count == nprogs || log_report_progress())
+	    oklog("%s: Done writing %d verb programs...\n", reason, *count);
+    }
+}
+
+#endif				/* LAZY_DB_LOAD */
+
+static void
+write_object_programs(Objid oid, Object_Version * ver, int binary,
+		      int *count, int nprogs, const char *reason)
+{
     Verbdef *v;
+    int vcount = 0;
+
+#ifdef LAZY_DB_LOAD
+    if (ver->o == COLD_OBJECT) {
+	write_cold_programs(oid, count, nprogs, reason);
+	return;
+    }
+#endif
+    if (!ver->o)
+	return;
+    for (v = ver->o->verbdefs; v; v = v->next) {
+	if (v->program) {
+	    if (binary) {
+		dbio_write_objid(oid);
+		dbio_write_num(vcount);
+	    } else
+		dbio_printf("#%"PRIdN":%d\n", oid, vcount);
+	    dbio_write_program(v->program);
+	    if (++*count == nprogs || log_report_progress())
+		oklog("%s: Done writing %d verb programs...\n",
+		      reason, *count);
+	}
+	vcount++;
+    }
+}
+
+/* Writes the verb programs of OID, counting them in *COUNT out of the
+ * NPROGS being written.  This is the last the dump needs of OID.
+ */
+static void
+write_programs(Objid oid, int binary, int *count, int nprogs,
+	       const char *reason)
+{
+    Object_Version ver;
+
+    if (dump_cancelled)
+	RAISE(dbpriv_dbio_failed, 0);
+    dbpriv_snapshot_lock();
+    TRY {
+	dbpriv_object_version(oid, &ver);
+	write_object_programs(oid, &ver, binary, count, nprogs, reason);
+	dbpriv_snapshot_done(oid);
+    }
+    FINALLY {
+	dbpriv_snapshot_unlock();
+    }
+    ENDTRY;
+}
+
+static void
+write_text_db_sections(const char *reason)
+{
+    Objid oid;
+    Objid max_oid = dump_max_oid;
+    Var user_list = dump_users;
+    int i, nprogs = count_verb_programs();
+
+    dbio_printf(header_format_string, current_version);
+    dbio_printf("%"PRIdN"\n%d\n%"PRIdN"\n%"PRIdN"\n",
+		max_oid + 1, nprogs, dump_stamp, user_list.v.list[0].v.num);
+    for (i = 1; i <= user_list.v.list[0].v.num; i++)
+	dbio_write_objid(user_list.v.list[i].v.obj);
+    oklog("%s: Writing %"PRIdN" objects...\n", reason, max_oid + 1);
+    for (oid = 0; oid <= max_oid; oid++) {
+	write_object(oid, 0);
+	if (oid == max_oid || log_report_progress())
+	    oklog("%s: Done writing %"PRIdN" objects...\n", reason, oid + 1);
+    }
+    oklog("%s: Writing %d MOO verb programs...\n", reason, nprogs);
+    for (i = 0, oid = 0; oid <= max_oid; oid++)
+	write_programs(oid, 0, &i, nprogs, reason);
+    write_tasks_and_connections(reason);
+}
+
+
+/*********** Binary DB files ***********/
+
+/* A binary DB starts with a text line like the text format's header, so
+ * that `head' still says what it is.  The rest is a series of sections,
+ * each encoded by DBIO in its binary format:
+ *
+ *	HEAD	number of objects, verb programs and users, then the users
+ *	OBJS	each object in turn, as for the text format but without the
+ *		"#N" line; a recycled object is just a 0
+ *	OIDX	the file offset of each object in OBJS, as 8 fixed bytes
+ *	PROG	object, verb index and source text of each verb program
+ *	TASK	the task queue and active connections, in the text format
+ *	CKPT	the journal checkpoint stamp (optional; 0 if missing)
+ *	WAIF	whether there are any WAIFs in the database (optional; it
+ *		can only be loaded lazily if this says there aren't)
+ *
+ * followed by a section table (count, then tag/offset/length of each)
+ * and a fixed 16-byte trailer holding the table's offset and a magic
+ * number.  The loader maps the whole file and finds everything through
+ * the table.
+ */
+
+static const char *binary_header_format_string
+= "** LambdaMOO Binary Database, Format Version %u **\n";
+
+#define BINARY_DB_MAGIC		0x54434553424f4f4dULL	/* "MOOBSECT" */
+#define BINARY_DB_TRAILER	16
+#define MAX_SECTIONS		16
+
+struct section {
+    const char *tag;
+    long offset, length;
+};
+
+static struct section sections[MAX_SECTIONS];
+static int num_sections;
+
+static struct section *
+section_named(const char *tag)
+{
+    int i;
+
+    for (i = 0; i < num_sections; i++)
+	if (!strcmp(sections[i].tag, tag))
+	    return &sections[i];
+
+    return 0;
+}
+
+static int
+lookup_section(const char *map, const char *tag)
+{
+    struct section *s = section_named(tag);
+
+    if (!s)
+	return 0;
+    dbpriv_set_dbio_binary_input(map + s->offset,
+				 map + s->offset + s->length);
+    return 1;
+}
+
+static int
+find_section(const char *map, const char *tag)
+{
+    if (lookup_section(map, tag))
+	return 1;
+
+    errlog("READ_DB_FILE: Missing `%s' section\n", tag);
+    return 0;
+}
+
+static int
+read_section_table(const char *map, size_t size)
+{
+    uint64_t table;
+    int i;
+
+    if (size < BINARY_DB_TRAILER) {
+	errlog("READ_DB_FILE: Binary database too short\n");
+	return 0;
+    }
+    dbpriv_set_dbio_binary_input(map + size - BINARY_DB_TRAILER, map + size);
+    table = dbpriv_dbio_read_fixed64();
+    if (dbpriv_dbio_read_fixed64() != BINARY_DB_MAGIC
+	|| table > size - BINARY_DB_TRAILER) {
+	errlog("READ_DB_FILE: Bad binary database trailer\n");
+	return 0;
+    }
+    dbpriv_set_dbio_binary_input(map + table, map + size - BINARY_DB_TRAILER);
+    num_sections = dbio_read_num();
+    if (num_sections < 0 || num_sections > MAX_SECTIONS) {
+	errlog("READ_DB_FILE: Bad section count: %d\n", num_sections);
+	return 0;
+    }
+    for (i = 0; i < num_sections; i++) {
+	sections[i].tag = dbio_read_string();
+	sections[i].offset = dbio_read_num();
+	sections[i].length = dbio_read_num();
+	if (sections[i].offset < 0 || sections[i].length < 0
+	    || (uint64_t) sections[i].offset > table
+	    || (uint64_t) sections[i].length > table - sections[i].offset) {
+	    errlog("READ_DB_FILE: Bad `%s' section\n", sections[i].tag);
+	    return 0;
+	}
+    }
+
+    return 1;
+}
+
+static int
+read_task_island(void)
+{
+    return read_tasks_and_connections();
+}
+
+static int
+read_binary_program_header(Objid * oid, Num * vnum)
+{
+    *oid = dbio_read_objid();
+    *vnum = dbio_read_num();
+    return 1;
+}
+
+#ifdef LAZY_DB_LOAD
+
+/* Sets up to load the NOBJS objects of the binary DB in MAP lazily,
+ * returning false if that can't be done.
+ */
+static int
+can_load_lazily(const char *map, Num nobjs)
+{
+    struct section *objs = section_named("OBJS");
+    struct section *oidx = section_named("OIDX");
+    struct section *prog = section_named("PROG");
+
+    if (!lookup_section(map, "WAIF") || dbio_read_num() != 0
+	|| !objs || !oidx || !prog || oidx->length != 8 * nobjs)
+	return 0;
+
+    cold_map = map;
+    cold_index = map + oidx->offset;
+    cold_objs_end = map + objs->offset + objs->length;
+    cold_progs_end = map + prog->offset + prog->length;
+    cold_count = nobjs;
+    cold_version = dbio_input_version;
+    return 1;
+}
+
+/* Reads just the hot fields of each object, finding them by the index. */
+static int
+read_cold_objects(Num nobjs)
+{
+    struct section *objs = section_named("OBJS");
+    uint64_t start, end;
+    Objid oid;
+
+    oklog("LOADING: Reading %"PRIdN" objects lazily...\n", nobjs);
+    for (oid = 0; oid < nobjs; oid++) {
+	dbpriv_set_dbio_binary_input(cold_index + 8 * oid,
+				     cold_index + 8 * nobjs);
+	start = dbpriv_dbio_read_fixed64();
+	end = (oid + 1 < nobjs ? dbpriv_dbio_read_fixed64()
+	       : (uint64_t) (objs->offset + objs->length));
+	if (start < (uint64_t) objs->offset || start > end
+	    || end > (uint64_t) (objs->offset + objs->length)) {
+	    errlog("READ_DB_FILE: Bad index entry for object #%"PRIdN".\n",
+		   oid);
+	    return 0;
+	}
+	dbpriv_set_dbio_binary_input(cold_map + start, cold_map + end);
+	if (!dbio_read_num())
+	    dbpriv_new_recycled_object();
+	else {
+	    dbpriv_new_cold_object();
+	    (void) dbio_read_string();
+	    read_hot_fields(oid);
+	    /* All dbpriv_fix_verb_parents() needs to know of a cold object
+	     * is whether it has any verbs.
+	     */
+	    if (dbio_read_num() > 0)
+		dbpriv_verb_parent[oid] = oid;
+	}
+	if (oid + 1 == nobjs || log_report_progress())
+	    oklog("LOADING: Done reading %"PRIdN" objects ...\n", oid + 1);
+    }
+
+    return loading_base || finish_objects();
+}
+
+/* Notes where each object's verb programs start in the PROG section, which
+ * has them in object order.
+ */
+static int
+index_cold_programs(Num nprogs)
+{
+    Num i, vnum;
+    Objid oid, last = NOTHING;
+    const char *pos;
+
+    oklog("LOADING: Indexing %"PRIdN" MOO verb programs...\n", nprogs);
+    cold_programs = mymalloc(cold_count * sizeof(long) + 1, M_OBJECT_TABLE);
+    memset(cold_programs, 0, cold_count * sizeof(long));
+    for (i = 1; i <= nprogs; i++) {
+	pos = dbpriv_dbio_input_position();
+	oid = dbio_read_objid();
+	vnum = dbio_read_num();
+	(void) dbpriv_dbio_read_program_source();
+	if (oid < last || oid >= cold_count || !valid(oid) || vnum < 0) {
+	    errlog("READ_DB_FILE: Bad program header, i = %"PRIdN".\n", i);
+	    return 0;
+	}
+	if (oid != last)
+	    cold_programs[oid] = pos - cold_map;
+	last = oid;
+    }
+
+    return 1;
+}
+
+#endif				/* LAZY_DB_LOAD */
+
+/* Reads the objects and verb programs of the binary DB in MAP, lazily if
+ * LAZY and that's possible.
+ */
+static int
+read_binary_objects(const char *map, Num nobjs, Num nprogs, int lazy)
+{
+#ifdef LAZY_DB_LOAD
+    if (lazy && can_load_lazily(map, nobjs))
+	return (read_cold_objects(nobjs) && find_section(map, "PROG")
+		&& index_cold_programs(nprogs));
+#else
+    (void) lazy;
+#endif
+    return (find_section(map, "OBJS") && read_objects(nobjs)
+	    && find_section(map, "PROG")
+	    && read_verb_programs(nprogs, read_binary_program_header));
+}
+
+static int
+read_binary_sections(const char *map, size_t size, int lazy)
+{
+    Num i, nobjs, nprogs, nusers;
+    Var user_list;
+
+    if (!read_section_table(map, size))
+	return 0;
+    dump_stamp = lookup_section(map, "CKPT") ? dbio_read_num() : 0;
+
+    if (!find_section(map, "HEAD"))
+	return 0;
+    nobjs = dbio_read_num();
+    nprogs = dbio_read_num();
+    nusers = dbio_read_num();
+    user_list = new_list(nusers);
+    for (i = 1; i <= nusers; i++) {
+	user_list.v.list[i].type = TYPE_OBJ;
+	user_list.v.list[i].v.obj = dbio_read_objid();
+    }
+    dbpriv_set_all_users(user_list);
+
+    if (!read_binary_objects(map, nobjs, nprogs, lazy))
+	return 0;
+
+    return loading_base || (find_section(map, "TASK")
+			    && dbpriv_dbio_read_text(read_task_island));
+}
+
+/* Reads the binary DB in MAP, lazily if LAZY and that's possible; the map
+ * must then be kept.
+ */
+static int
+read_binary_db_file(const char *map, size_t size, int lazy)
+{
+    volatile int success;
+
+    waif_before_loading();
+
+    TRY {
+	success = read_binary_sections(map, size, lazy);
+    }
+    EXCEPT(dbpriv_dbio_truncated)
+	success = 0;
+    ENDTRY;
+
+    if (success)
+	waif_after_loading();
+    return success;
+}
+
+static const char *task_island_reason;
+
+static void
+write_task_island(void)
+{
+    write_tasks_and_connections(task_island_reason);
+}
+
+static void
+begin_section(const char *tag)
+{
+    sections[num_sections].tag = tag;
+    sections[num_sections].offset = dbpriv_dbio_output_position();
+}
+
+static void
+end_section(void)
+{
+    sections[num_sections].length = dbpriv_dbio_output_position()
+	- sections[num_sections].offset;
+    num_sections++;
+}
+
+static void
+write_binary_db_sections(const char *reason)
+{
+    Objid oid;
+    Objid max_oid = dump_max_oid;
+    Var user_list = dump_users;
+    int i;
+    volatile int nprogs = count_verb_programs();
+    long *offsets = mymalloc((max_oid + 1) * sizeof(long), M_OBJECT_TABLE);
+    long table;
+
+    dbio_printf(binary_header_format_string, current_version);
+    dbpriv_set_dbio_binary_output(1);
+    num_sections = 0;
+
+    TRY {
+	begin_section("HEAD");
+	dbio_write_num(max_oid + 1);
+	dbio_write_num(nprogs);
+	dbio_write_num(user_list.v.list[0].v.num);
+	for (i = 1; i <= user_list.v.list[0].v.num; i++)
+	    dbio_write_objid(user_list.v.list[i].v.obj);
+	end_section();
+
+	oklog("%s: Writing %"PRIdN" objects...\n", reason, max_oid + 1);
+	begin_section("OBJS");
+	for (oid = 0; oid <= max_oid; oid++) {
+	    offsets[oid] = dbpriv_dbio_output_position();
+	    write_object(oid, 1);
+	    if (oid == max_oid || log_report_progress())
+		oklog("%s: Done writing %"PRIdN" objects...\n", reason, oid + 1);
+	}
+	end_section();
+
+	begin_section("OIDX");
+	for (oid = 0; oid <= max_oid; oid++)
+	    dbpriv_dbio_write_fixed64(offsets[oid]);
+	end_section();
+
+	oklog("%s: Writing %d MOO verb programs...\n", reason, nprogs);
+	begin_section("PROG");
+	for (i = 0, oid = 0; oid <= max_oid; oid++)
+	    write_programs(oid, 1, &i, nprogs, reason);
+	end_section();
+
+	begin_section("TASK");
+	task_island_reason = reason;
+	dbpriv_dbio_write_text(write_task_island);
+	end_section();
+
+	begin_section("CKPT");
+	dbio_write_num(dump_stamp);
+	end_section();
+
+	begin_section("WAIF");
+	dbio_write_num(dump_waifs);
+	end_section();
+
+	table = dbpriv_dbio_output_position();
+	dbio_write_num(num_sections);
+	for (i = 0; i < num_sections; i++) {
+	    dbio_write_string(sections[i].tag);
+	    dbio_write_num(sections[i].offset);
+	    dbio_write_num(sections[i].length);
+	}
+	dbpriv_dbio_write_fixed64(table);
+	dbpriv_dbio_write_fixed64(BINARY_DB_MAGIC);
+    }
+    FINALLY {
+	myfree(offsets, M_OBJECT_TABLE);
+	dbpriv_set_dbio_binary_output(0);
+    }
+    ENDTRY;
+}
+
+
+
+/*********** Delta DB files ***********/
+
+/* A delta DB holds only what has changed since a full dump, its `base',
+ * which it names; loading it means loading the base and then replacing the
+ * objects it holds.  It is always in the text format:
+ *
+ *	the header line
+ *	the base's file name, stamp and size, and how many deltas have been
+ *	    written against it, this one included
+ *	the number of objects, then the number and list of those in the delta
+ *	the number of verb programs, the stamp and the users, as in a full DB
+ *	each object in the delta, then each program of those objects
+ *	the task queue and active connections
+ *
+ * The deltas against a base are cumulative, so only the newest one matters.
+ * The server keeps the base it is using as a hard link, output-db-file with
+ * `.base' appended, while its deltas replace output-db-file.
+ */
+
+static const char *delta_header_format_string
+= "** LambdaMOO Delta Database, Format Version %u **\n";
+
+static int
+in_delta(Objid oid)
+{
+    return dump_dirty[oid] || oid >= base_nobjs;
+}
+
+static void
+write_delta_db_sections(const char *reason)
+{
+    Objid oid;
+    Objid max_oid = dump_max_oid;
+    Objid ndelta = 0;
+    Var user_list = dump_users;
+    int i, nprogs = 0;
+
+    for (oid = 0; oid <= max_oid; oid++)
+	if (in_delta(oid)) {
+	    ndelta++;
+	    nprogs += count_programs(oid);
+	}
+
+    dbio_printf(delta_header_format_string, current_version);
+    dbio_write_string(base_db_name);
+    dbio_write_num(base_stamp);
+    dbio_write_num(base_size);
+    dbio_write_num(num_deltas + 1);
+    dbio_write_num(max_oid + 1);
+    dbio_write_num(ndelta);
+    for (oid = 0; oid <= max_oid; oid++)
+	if (in_delta(oid))
+	    dbio_write_objid(oid);
+    dbio_printf("%d\n%"PRIdN"\n%"PRIdN"\n",
+		nprogs, dump_stamp, user_list.v.list[0].v.num);
+    for (i = 1; i <= user_list.v.list[0].v.num; i++)
+	dbio_write_objid(user_list.v.list[i].v.obj);
+
+    oklog("%s: Writing %"PRIdN" changed objects of %"PRIdN"...\n",
+	  reason, ndelta, max_oid + 1);
+    for (i = 0, oid = 0; oid <= max_oid; oid++)
+	if (in_delta(oid)) {
+	    write_object(oid, 0);
+	    if (++i == ndelta || log_report_progress())
+		oklog("%s: Done writing %d changed objects...\n", reason, i);
+	}
+
+    oklog("%s: Writing %d MOO verb programs...\n", reason, nprogs);
+    for (i = 0, oid = 0; oid <= max_oid; oid++)
+	if (in_delta(oid))
+	    write_programs(oid, 0, &i, nprogs, reason);
+    write_tasks_and_connections(reason);
+}
+
+/* Decides whether the checkpoint about to be made can be a delta, and if
+ * so makes sure that the base is where the delta will say it is.
+ */
+static int
+choose_delta(void)
+{
+#if INCREMENTAL_CHECKPOINTS > 0
+    Stream *s;
+    char *link_name, *temp_name;
+    int ok;
+
+    if (force_full || !base_db_name || num_deltas >= INCREMENTAL_CHECKPOINTS
+	|| dbpriv_count_dirty() * 4 > db_last_used_objid() + 1
+	|| waifs_in_use())
+	return 0;
+
+    s = new_stream(100);
+    stream_printf(s, "%s.base", dump_db_name);
+    link_name = str_dup(reset_stream(s));
+    ok = 1;
+    if (strcmp(base_db_name, link_name) != 0) {
+	/* The base is usually the last full dump, about to be replaced by
+	 * this delta; link it where the delta expects it, in one step.
+	 */
+	stream_printf(s, "%s.new", link_name);
+	temp_name = reset_stream(s);
+	remove(temp_name);
+	if (link(base_db_name, temp_name) != 0
+	    || rename(temp_name, link_name) != 0) {
+	    log_perror("Linking base of incremental checkpoint");
+	    remove(temp_name);
+	    ok = 0;
+	} else {
+	    free_str(base_db_name);
+	    base_db_name = link_name;
+	    link_name = 0;
+	}
+    }
+    if (link_name)
+	free_str(link_name);
+    free_stream(s);
+
+    return ok;
+#else
+    return 0;
+#endif
+}
+
+static void
+remove_base_link(void)
+{
+    Stream *s = new_stream(100);
+
+    stream_printf(s, "%s.base", dump_db_name);
+    remove(reset_stream(s));
+    free_stream(s);
+}
+
+/* Makes the full DB just loaded from NAME, whose size is SIZE, the base for
+ * later deltas.
+ */
+static void
+set_base(const char *name, Num size)
+{
+    if (base_db_name)
+	free_str(base_db_name);
+    base_db_name = str_dup(name);
+    base_stamp = dump_stamp;
+    base_size = size;
+    base_nobjs = db_last_used_objid() + 1;
+    num_deltas = 0;
+    dbpriv_clear_dirty();
+}
+
+static char *
+map_db_file(FILE * f, size_t * size)
+{
+    struct stat st;
+    char *map;
+
+    if (fstat(fileno(f), &st) < 0) {
+	log_perror("Examining input database");
+	return 0;
+    }
+    *size = st.st_size;
+#if HAVE_MMAP
+    map = mmap(0, *size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (map == MAP_FAILED) {
+	log_perror("Mapping input database");
+	return 0;
+    }
+#else
+    map = mymalloc(*size, M_STRING);
+    rewind(f);
+    if (fread(map, 1, *size, f) != *size) {
+	log_perror("Reading input database");
+	myfree(map, M_STRING);
+	return 0;
+    }
+#endif
+    return map;
+}
+
+static void
+unmap_db_file(char *map, size_t size)
+{
+#if HAVE_MMAP
+    munmap(map, size);
+#else
+    myfree(map, M_STRING);
+#endif
+}
+
+/* If the DB file *F is compressed, replaces it with a stream of its
+ * uncompressed contents, which are left in *DATA and *SIZE for the caller to
+ * free once the stream is closed; otherwise sets *DATA to 0.
+ */
+static int
+uncompress_db_file(FILE ** f, char **data, size_t * size)
+{
+    FILE *m;
+
+    *data = 0;
+    if (!dbpriv_dbio_compressed(*f))
+	return 1;
+    if (!(*data = dbpriv_dbio_inflate(*f, size)))
+	return 0;
+    if (!(m = fmemopen(*data, *size, "r"))) {
+	log_perror("Reading uncompressed database");
+	myfree(*data, M_DB_LOAD);
+	*data = 0;
+	return 0;
+    }
+    fclose(*f);
+    *f = m;
+
+    return 1;
+}
+
+/* Reads the full DB in F, in either format; DATA and SIZE are its contents
+ * if uncompress_db_file() left them in memory.
+ */
+static int
+read_full_db_file(FILE * f, char *data, size_t size)
+{
+    char line[100];
+    int success;
+
+    binary_input = 0;
+    if (fgets(line, sizeof(line), f)
+	&& sscanf(line, binary_header_format_string,
+		  &dbio_input_version) == 1) {
+	char *map = data ? data : map_db_file(f, &size);
+
+	binary_input = 1;
+	if (!check_version(dbio_input_version)) {
+	    errlog("READ_DB_FILE: Unknown DB version number: %d\n",
+		   dbio_input_version);
+	    success = 0;
+	} else
+	    success = map && read_binary_db_file(map, size, !data);
+#ifdef LAZY_DB_LOAD
+	if (map == cold_map)
+	    map = 0;		/* the cold objects are still in it */
+#endif
+	if (map && !data)
+	    unmap_db_file(map, size);
+    } else {
+	rewind(f);
+	dbpriv_set_dbio_input(f);
+	success = read_db_file();
+    }
+
+    return success;
+}
+
+/* Reads the delta DB in F, whose header line has been read, and its base. */
+static int
+read_delta_db_file(FILE * f)
+{
+    char *name, *data;
+    FILE *base;
+    struct stat st;
+    size_t data_size;
+    Num i, stamp, size, ndeltas, nobjs, ndelta, nprogs, nusers;
+    Objid *oids, count, nfree;
     Var user_list;
-    int i;
-    volatile int nprogs = 0;
-    volatile int success = 1;
+    int ok, base_binary;
 
-    waif_before_saving();
+    if (!check_version(dbio_input_version)) {
+	errlog("READ_DB_FILE: Unknown DB version number: %d\n",
+	       dbio_input_version);
+	return 0;
+    }
+    dbpriv_set_dbio_input(f);
+    name = str_dup(dbio_read_string());
+    stamp = dbio_read_num();
+    size = dbio_read_num();
+    ndeltas = dbio_read_num();
+    nobjs = dbio_read_num();
+    ndelta = dbio_read_num();
+    if (nobjs < 0 || ndelta < 0 || ndelta > nobjs) {
+	errlog("READ_DB_FILE: Bad delta header\n");
+	free_str(name);
+	return 0;
+    }
 
-    for (oid = 0; oid <= max_oid; oid++) {
-	if (valid(oid))
-	    for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next)
-		if (v->program)
-		    nprogs++;
+    if (!(base = fopen(name, "r"))) {
+	log_perror("Opening base of delta database");
+	free_str(name);
+	return 0;
     }
+    if (fstat(fileno(base), &st) < 0 || st.st_size != size) {
+	errlog("READ_DB_FILE: %s is not the base of this delta\n", name);
+	fclose(base);
+	free_str(name);
+	return 0;
+    }
+    oklog("LOADING: %s, the base of the delta\n", name);
+    loading_base = 1;
+    ok = (uncompress_db_file(&base, &data, &data_size)
+	  && read_full_db_file(base, data, data_size));
+    loading_base = 0;
+    fclose(base);
+    if (data)
+	myfree(data, M_DB_LOAD);
+    if (ok && dump_stamp != stamp) {
+	errlog("READ_DB_FILE: %s is not the base of this delta\n", name);
+	ok = 0;
+    }
+    if (!ok) {
+	free_str(name);
+	return 0;
+    }
+    set_base(name, size);
+    free_str(name);
+    num_deltas = ndeltas;
+    base_binary = binary_input;
 
-    user_list = db_all_users();
+    /* Free the objects the delta replaces, along with any the base has
+     * beyond the delta's end.
+     */
+    count = base_nobjs;
+    nfree = ndelta + (count > nobjs ? count - nobjs : 0);
+    oids = mymalloc(nfree * sizeof(Objid) + 1, M_DB_LOAD);
+    dbpriv_set_dbio_input(f);
+    binary_input = 0;
+    for (i = 0; i < ndelta; i++)
+	oids[i] = dbio_read_objid();
+    for (; i < nfree; i++)
+	oids[i] = nobjs + i - ndelta;
+    dbpriv_discard_objects(oids, nfree);
+    if (count > nobjs)
+	dbpriv_truncate_objects(nobjs);
+
+    if (dbio_scanf("%"SCNdN"\n%"SCNdN"\n%"SCNdN"\n",
+		   &nprogs, &dump_stamp, &nusers) != 3) {
+	errlog("READ_DB_FILE: Bad delta header\n");
+	myfree(oids, M_DB_LOAD);
+	return 0;
+    }
+    free_var(db_all_users());
+    user_list = new_list(nusers);
+    for (i = 1; i <= nusers; i++) {
+	user_list.v.list[i].type = TYPE_OBJ;
+	user_list.v.list[i].v.obj = dbio_read_objid();
+    }
+    dbpriv_set_all_users(user_list);
 
-    TRY {
-	dbio_printf(header_format_string, current_version);
-	dbio_printf("%"PRIdN"\n%d\n%d\n%"PRIdN"\n",
-		    max_oid + 1, nprogs, 0, user_list.v.list[0].v.num);
-	for (i = 1; i <= user_list.v.list[0].v.num; i++)
-	    dbio_write_objid(user_list.v.list[i].v.obj);
-	oklog("%s: Writing %"PRIdN" objects...\n", reason, max_oid + 1);
-	for (oid = 0; oid <= max_oid; oid++) {
-	    write_object(oid);
-	    if (oid == max_oid || log_report_progress())
-		oklog("%s: Done writing %"PRIdN" objects...\n", reason, oid + 1);
+    waif_before_loading();
+    oklog("LOADING: Reading %"PRIdN" changed objects...\n", ndelta);
+    for (i = 0; i < ndelta; i++) {
+	if (!read_delta_object(oids[i])) {
+	    errlog("READ_DB_FILE: Bad object #%"PRIdN".\n", oids[i]);
+	    myfree(oids, M_DB_LOAD);
+	    return 0;
 	}
-	oklog("%s: Writing %d MOO verb programs...\n", reason, nprogs);
-	for (i = 0, oid = 0; oid <= max_oid; oid++)
-	    if (valid(oid)) {
-		int vcount = 0;
-
-		for (v = dbpriv_find_object(oid)->verbdefs; v; v = v->next) {
-		    if (v->program) {
-			dbio_printf("#%"PRIdN":%d\n", oid, vcount);
-			dbio_write_program(v->program);
-			if (++i == nprogs || log_report_progress())
-			    oklog("%s: Done writing %d verb programs...\n",
-				  reason, i);
-		    }
-		    vcount++;
-		}
-	    }
-	oklog("%s: Writing forked and suspended tasks...\n", reason);
-	write_task_queue();
-	oklog("%s: Writing list of formerly active connections...\n", reason);
-	write_active_connections();
+	if (i + 1 == ndelta || log_report_progress())
+	    oklog("LOADING: Done reading %"PRIdN" changed objects ...\n",
+		  i + 1);
+    }
+    while (db_last_used_objid() + 1 < nobjs)
+	dbpriv_new_recycled_object();
+
+    ok = (finish_objects()
+	  && read_verb_programs(nprogs, read_text_program_header)
+	  && read_tasks_and_connections());
+    if (ok) {
+	waif_after_loading();
+	/* Until the next full dump, the delta's objects stay in every delta. */
+	dbpriv_clear_dirty();
+	for (i = 0; i < ndelta; i++)
+	    dbpriv_mark_dirty(oids[i]);
+	dump_is_delta = 1;
+    }
+    myfree(oids, M_DB_LOAD);
+    binary_input = base_binary;	/* later full dumps match the base */
+
+    return ok;
+}
+
+
+static int
+write_db_sections(int fd, const char *reason, int delta)
+{
+    volatile int success = 1;
+
+    if (!dbpriv_begin_dbio_dump(fd, compress_dumps))
+	return 0;
+
+    TRY {
+	if (delta)
+	    write_delta_db_sections(reason);
+	else if (binary_dumps)
+	    write_binary_db_sections(reason);
+	else
+	    write_text_db_sections(reason);
     }
     EXCEPT(dbpriv_dbio_failed)
 	success = 0;
     ENDTRY;
 
+    return dbpriv_end_dbio_dump(success);
+}
+
+static int
+write_db_file(int fd, const char *reason, int delta)
+{
+    int success;
+
+    waif_before_saving();
+    success = write_db_sections(fd, reason, delta);
     waif_after_saving();
 
     return success;
@@ -557,13 +1976,372 @@ typedef enum {
 const char *reason_names[] =
 {"DUMPING", "CHECKPOINTING", "PANIC-DUMPING"};
 
+static int pending_delta;	/* the checkpoint being written is a delta */
+static Num pending_stamp;
+static Objid pending_nobjs;
+
+/* Puts the dump written to TEMP_NAME in place, if it's not a panic dump. */
+static int
+install_dump(Dump_Reason reason, const char *temp_name, int delta)
+{
+    oklog("%s on %s finished\n", reason_names[reason], temp_name);
+    if (reason == DUMP_PANIC)
+	return 1;
+
+    remove(dump_db_name);
+    if (rename(temp_name, dump_db_name) != 0) {
+	log_perror("Renaming temporary dump file");
+	return 0;
+    }
+    dbpriv_journal_discard(dump_stamp);
+    if (!delta)
+	remove_base_link();
+
+    return 1;
+}
+
+static long
+usecs_since(struct timeval *start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, 0);
+    return usecs_between(start, &now);
+}
+
+
+/*********** Checkpoint statistics ***********/
+
+typedef struct {
+    time_t start;
+    const char *mode;		/* "fork", "snapshot" or "unforked" */
+    int delta;
+    int success;
+    long notify_usec;		/* running #0:checkpoint_started */
+    long io_usec;		/* network I/O done before starting it */
+    long pause_usec;		/* the server was held up starting it */
+    long write_usec;		/* from the start until it was on disk */
+    int64_t bytes;
+    long faults;		/* minor page faults in the server meanwhile */
+    Objid copies;		/* objects saved from the snapshot */
+    long copy_usec;		/* time spent saving them */
+} Checkpoint_Stats;
+
+#define CHECKPOINT_STATS_KEPT	20
+
+static Checkpoint_Stats checkpoint_stats[CHECKPOINT_STATS_KEPT];
+static int stats_count = 0, stats_next = 0;
+static Checkpoint_Stats current_stats;
+static struct timeval stats_start;
+static struct timeval stats_written;	/* if known when it's recorded */
+static int stats_written_known = 0;
+static long stats_faults;
+static long pending_notify_usec = 0, pending_io_usec = 0;
+
+static long
+minor_faults(void)
+{
+#if HAVE_GETRUSAGE
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+	return ru.ru_minflt;
+#endif
+    return 0;
+}
+
+static void
+begin_checkpoint_stats(void)
+{
+    gettimeofday(&stats_start, 0);
+    stats_faults = minor_faults();
+
+    memset(&current_stats, 0, sizeof(current_stats));
+    current_stats.start = stats_start.tv_sec;
+    current_stats.notify_usec = pending_notify_usec;
+    current_stats.io_usec = pending_io_usec;
+    pending_notify_usec = pending_io_usec = 0;
+}
+
+static void
+checkpoint_paused(const char *mode)
+{
+    current_stats.mode = mode;
+    current_stats.pause_usec = usecs_since(&stats_start);
+}
+
+static void
+end_checkpoint_stats(int success, int64_t bytes)
+{
+    Checkpoint_Stats *cs = &current_stats;
+
+    if (!stats_written_known)
+	gettimeofday(&stats_written, 0);
+    stats_written_known = 0;
+    if (!cs->mode)		/* it never got started */
+	cs->mode = "fork";
+    cs->success = success;
+    cs->write_usec = usecs_between(&stats_start, &stats_written);
+    cs->bytes = bytes;
+    cs->faults = minor_faults() - stats_faults;
+
+    checkpoint_stats[stats_next] = *cs;
+    stats_next = (stats_next + 1) % CHECKPOINT_STATS_KEPT;
+    if (stats_count < CHECKPOINT_STATS_KEPT)
+	stats_count++;
+}
+
+#ifdef SNAPSHOT_CHECKPOINTS
+
+/* The writer thread, started with the first snapshot checkpoint, writes each
+ * one from the snapshot while the main thread goes on running tasks; the
+ * main thread polls db_checkpoint_written() to learn when it's done and
+ * finishes up there, so that only the main thread ever renames files or
+ * touches the journal.
+ */
+
+static pthread_mutex_t writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t writer_thread;
+static int writer_started = 0;
+static enum {
+    WRITER_IDLE, WRITER_BUSY, WRITER_DONE
+} writer_state = WRITER_IDLE;
+
+static struct {
+    int fd;
+    char *temp_name;
+    int delta;
+    int success;
+    struct timeval written;
+} writer_job;
+
+static void *
+checkpoint_writer(void *arg)
+{
+    sigset_t signals;
+    int success;
+
+    (void) arg;
+
+    /* Signals are for the main thread, apart from those raised by a fault
+     * in this one.
+     */
+    sigfillset(&signals);
+    sigdelset(&signals, SIGSEGV);
+    sigdelset(&signals, SIGBUS);
+    sigdelset(&signals, SIGILL);
+    sigdelset(&signals, SIGFPE);
+    pthread_sigmask(SIG_BLOCK, &signals, 0);
+
+    pthread_mutex_lock(&writer_mutex);
+    for (;;) {
+	while (writer_state != WRITER_BUSY)
+	    pthread_cond_wait(&writer_cond, &writer_mutex);
+	pthread_mutex_unlock(&writer_mutex);
+
+	success = write_db_sections(writer_job.fd,
+				    reason_names[DUMP_CHECKPOINT],
+				    writer_job.delta);
+	if (success)
+	    fsync(writer_job.fd);
+	else if (!dump_cancelled)
+	    log_perror("Trying to dump database");
+	close(writer_job.fd);
+	gettimeofday(&writer_job.written, 0);
+
+	pthread_mutex_lock(&writer_mutex);
+	writer_job.success = success;
+	writer_state = WRITER_DONE;
+	pthread_cond_broadcast(&writer_cond);
+    }
+
+    return 0;
+}
+
+static void
+capture_tasks(void)
+{
+    task_island_reason = reason_names[DUMP_CHECKPOINT];
+    dump_task_text = dbpriv_dbio_capture_text(write_task_island,
+					      &dump_task_length);
+}
+
+/* Hands the checkpoint about to be written to TEMP_NAME to the writer
+ * thread, returning false if it can't be started.
+ */
+static int
+start_snapshot_checkpoint(const char *temp_name, int delta)
+{
+    int fd;
+    Objid oid;
+
+    if ((fd = open(temp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+	log_perror("Opening temporary dump file");
+	return 0;
+    }
+    TRY {
+	capture_tasks();
+    }
+    EXCEPT(dbpriv_dbio_failed) {
+	log_perror("Saving task queue for checkpoint");
+	dump_task_text = 0;
+    }
+    ENDTRY;
+    if (!dump_task_text) {
+	close(fd);
+	remove(temp_name);
+	return 0;
+    }
+    if (!writer_started) {
+	if (pthread_create(&writer_thread, 0, checkpoint_writer, 0) != 0) {
+	    errlog("Can't start checkpoint writer thread\n");
+	    free(dump_task_text);
+	    dump_task_text = 0;
+	    close(fd);
+	    remove(temp_name);
+	    return 0;
+	}
+	writer_started = 1;
+    }
+
+    dbpriv_open_snapshot();
+    if (delta) {
+	dump_dirty = mymalloc(dump_max_oid + 1, M_OBJECT_TABLE);
+	memcpy(dump_dirty, dbpriv_dirty, dump_max_oid + 1);
+	/* Changes to objects not in the delta needn't be saved. */
+	for (oid = 0; oid <= dump_max_oid; oid++)
+	    if (!in_delta(oid))
+		dbpriv_snapshot_done(oid);
+    }
+
+    writer_job.fd = fd;
+    writer_job.temp_name = str_dup(temp_name);
+    writer_job.delta = delta;
+    dump_cancelled = 0;
+    pthread_mutex_lock(&writer_mutex);
+    writer_state = WRITER_BUSY;
+    pthread_cond_broadcast(&writer_cond);
+    pthread_mutex_unlock(&writer_mutex);
+
+    return 1;
+}
+
+/* Waits for the writer, if WAIT, and finishes the checkpoint it has written,
+ * returning true iff there was one.
+ */
+static int
+finish_snapshot_checkpoint(int wait, int *success)
+{
+    pthread_mutex_lock(&writer_mutex);
+    if (writer_state == WRITER_BUSY && wait)
+	while (writer_state == WRITER_BUSY)
+	    pthread_cond_wait(&writer_cond, &writer_mutex);
+    if (writer_state != WRITER_DONE) {
+	pthread_mutex_unlock(&writer_mutex);
+	return 0;
+    }
+    writer_state = WRITER_IDLE;
+    pthread_mutex_unlock(&writer_mutex);
+    dump_cancelled = 0;
+
+    *success = writer_job.success;
+    if (*success)
+	*success = install_dump(DUMP_CHECKPOINT, writer_job.temp_name,
+				writer_job.delta);
+    else {
+	remove(writer_job.temp_name);
+	errlog("Abandoning checkpoint attempt...\n");
+    }
+    stats_written = writer_job.written;
+    stats_written_known = 1;
+    current_stats.copies = dbpriv_close_snapshot(&current_stats.copy_usec);
+    oklog("CHECKPOINTING: %"PRIdN" objects copied while writing\n",
+	  current_stats.copies);
+
+    free_str(writer_job.temp_name);
+    free(dump_task_text);
+    dump_task_text = 0;
+    if (dump_dirty != dbpriv_dirty)
+	myfree(dump_dirty, M_OBJECT_TABLE);
+    dump_dirty = 0;
+    free_var(dump_users);
+
+    return 1;
+}
+
+#endif				/* SNAPSHOT_CHECKPOINTS */
+
+#ifdef LAZY_DB_LOAD
+
+/* Only a binary dump can copy cold objects from the DB file, so any that a
+ * text one is going to write are read in first, here rather than by a
+ * checkpoint thread.
+ */
+static void
+read_dump_objects(int delta)
+{
+    Objid oid;
+
+    if (!cold_map || (binary_dumps && !delta))
+	return;
+    for (oid = 0; oid <= dump_max_oid; oid++)
+	if (!delta || in_delta(oid))
+	    dbpriv_find_object(oid);
+}
+
+#endif				/* LAZY_DB_LOAD */
+
 static int
 dump_database(Dump_Reason reason)
 {
-    Stream *s = new_stream(100);
+    Stream *s;
     char *temp_name;
-    FILE *f;
+    int fd;
     int success;
+    int delta;
+
+#ifdef SNAPSHOT_CHECKPOINTS
+    if (writer_started && !pthread_equal(pthread_self(), writer_thread)) {
+	/* Only one dump is written at a time, and a panic dump doesn't wait
+	 * for a checkpoint to be written but makes it give up.
+	 */
+	if (reason == DUMP_PANIC)
+	    dump_cancelled = 1;
+	if (finish_snapshot_checkpoint(1, &success))
+	    db_checkpoint_finished(success);
+    }
+#endif
+
+    if (reason == DUMP_CHECKPOINT)
+	begin_checkpoint_stats();
+    s = new_stream(100);
+    delta = reason == DUMP_CHECKPOINT && choose_delta();
+
+    /* Changes made while a checkpoint is being written go into a new
+     * journal segment, which the checkpoint's stamp names; any other dump
+     * has every change in it.
+     */
+    dump_stamp = dbpriv_journal_checkpoint(reason == DUMP_CHECKPOINT);
+    dump_max_oid = db_last_used_objid();
+    dump_users = var_ref(db_all_users());
+    dump_dirty = dbpriv_dirty;
+    dump_waifs = waifs_in_use();
+#ifdef LAZY_DB_LOAD
+    read_dump_objects(delta);
+#endif
+
+    if (reason == DUMP_CHECKPOINT) {
+	/* A full checkpoint becomes the new base once it's safely on disk;
+	 * until then, changes are counted against it.
+	 */
+	pending_delta = delta;
+	current_stats.delta = delta;
+	pending_stamp = dump_stamp;
+	pending_nobjs = db_last_used_objid() + 1;
+	if (!delta)
+	    dbpriv_clear_dirty();
+    }
 
   retryDumping:
 
@@ -584,12 +2362,34 @@ dump_database(Dump_Reason reason)
     reset_command_history();
 #else
     if (reason == DUMP_CHECKPOINT) {
+#ifdef SNAPSHOT_CHECKPOINTS
+	/* WAIFs are marked up in place while they're written, so a dump with
+	 * any of them must still be made by a forked child.
+	 */
+	if (!waifs_in_use()) {
+	    success = start_snapshot_checkpoint(temp_name, delta);
+	    if (success) {
+		reset_command_history();
+		checkpoint_paused("snapshot");
+		oklog("CHECKPOINTING: snapshot taken in %ld usec\n",
+		      current_stats.pause_usec);
+	    } else
+		free_var(dump_users);
+	    free_stream(s);
+	    return success;
+	}
+#endif
 	switch (fork_server("checkpointer")) {
 	case FORK_PARENT:
 	    reset_command_history();
+	    checkpoint_paused("fork");
+	    oklog("CHECKPOINTING: forked in %ld usec\n",
+		  current_stats.pause_usec);
+	    free_var(dump_users);
 	    free_stream(s);
 	    return 1;
 	case FORK_ERROR:
+	    free_var(dump_users);
 	    free_stream(s);
 	    return 0;
 	case FORK_CHILD:
@@ -600,11 +2400,10 @@ dump_database(Dump_Reason reason)
 #endif
 
     success = 1;
-    if ((f = fopen(temp_name, "w")) != 0) {
-	dbpriv_set_dbio_output(f);
-	if (!write_db_file(reason_names[reason])) {
+    if ((fd = open(temp_name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) >= 0) {
+	if (!write_db_file(fd, reason_names[reason], delta)) {
 	    log_perror("Trying to dump database");
-	    fclose(f);
+	    close(fd);
 	    remove(temp_name);
 	    if (reason == DUMP_CHECKPOINT) {
 		errlog("Abandoning checkpoint attempt...\n");
@@ -618,34 +2417,32 @@ dump_database(Dump_Reason reason)
 		goto retryDumping;
 	    }
 	} else {
-	    fflush(f);
-	    fsync(fileno(f));
-	    fclose(f);
-	    oklog("%s on %s finished\n", reason_names[reason], temp_name);
-	    if (reason != DUMP_PANIC) {
-		remove(dump_db_name);
-		if (rename(temp_name, dump_db_name) != 0) {
-		    log_perror("Renaming temporary dump file");
-		    success = 0;
-		}
-	    }
+	    fsync(fd);
+	    close(fd);
+	    success = install_dump(reason, temp_name, delta);
 	}
     } else {
 	log_perror("Opening temporary dump file");
 	success = 0;
     }
 
+    free_var(dump_users);
     free_stream(s);
 
 #ifndef UNFORKED_CHECKPOINTS
     if (reason == DUMP_CHECKPOINT)
 	/* We're a child, so we'd better go away. */
 	exit(!success);
+#else
+    if (reason == DUMP_CHECKPOINT) {
+	checkpoint_paused("unforked");
+	db_checkpoint_finished(success);
+    }
 #endif
 
     return success;
 }
-
+
 
 /*********** External interface ***********/
 
@@ -681,24 +2478,85 @@ db_initialize(int *pargc, char ***pargv)
     return 1;
 }
 
+void
+db_set_dump_format(int binary)
+{
+    binary_dumps = binary;
+}
+
+void
+db_set_read_only(void)
+{
+    read_only = 1;
+}
+
+int
+db_set_dump_compression(int compress)
+{
+#if COMPRESSED_DUMPS
+    compress_dumps = compress;
+    return 1;
+#else
+    return !compress;
+#endif
+}
+
 int
 db_load(void)
 {
-    dbpriv_set_dbio_input(input_db);
+    char line[100];
+    struct stat st;
+    char *data;
+    size_t size;
+    int success;
 
     str_intern_open(0);
 
     oklog("LOADING: %s\n", input_db_name);
-    if (!read_db_file()) {
+    if (!uncompress_db_file(&input_db, &data, &size))
+	success = 0;
+    else if (fgets(line, sizeof(line), input_db)
+	     && sscanf(line, delta_header_format_string,
+		       &dbio_input_version) == 1)
+	success = read_delta_db_file(input_db);
+    else {
+	rewind(input_db);
+	success = read_full_db_file(input_db, data, size);
+	if (success) {
+	    if (stat(input_db_name, &st) == 0)
+		set_base(input_db_name, st.st_size);
+	    else
+		force_full = 1;
+	}
+    }
+    if (!success) {
 	errlog("DB_LOAD: Cannot load database!\n");
 	return 0;
     }
-    oklog("LOADING: %s done, will dump new database on %s\n",
-	  input_db_name, dump_db_name);
+    if (binary_dumps < 0)
+	binary_dumps = binary_input;
+    if (read_only)
+	oklog("LOADING: %s done\n", input_db_name);
+    else
+	oklog("LOADING: %s done, will dump new %s database on %s\n",
+	      input_db_name, binary_dumps ? "binary" : "text", dump_db_name);
+
+    if (!read_only && journal_db_name
+	&& strcmp(journal_db_name, dump_db_name) != 0)
+	oklog("JOURNAL: Journal segments stay named after %s\n",
+	      journal_db_name);
+    if (!read_only
+	&& !dbpriv_journal_replay(journal_db_name ? journal_db_name
+				  : dump_db_name, dump_stamp)) {
+	errlog("DB_LOAD: Cannot replay journal!\n");
+	return 0;
+    }
 
     str_intern_close();
 
     fclose(input_db);
+    if (data)
+	myfree(data, M_DB_LOAD);
     return 1;
 }
 
@@ -709,12 +2567,21 @@ db_flush(enum db_flush_type type)
 
     switch (type) {
     case FLUSH_IF_FULL:
+	dbpriv_journal_flush(0);
+	success = 1;
+	break;
+
     case FLUSH_ONE_SECOND:
+	dbpriv_journal_flush(1);
 	success = 1;
 	break;
 
     case FLUSH_ALL_NOW:
 	success = dump_database(DUMP_CHECKPOINT);
+#ifndef UNFORKED_CHECKPOINTS
+	if (!success)
+	    db_checkpoint_finished(0);
+#endif
 	break;
 
     case FLUSH_PANIC:
@@ -725,6 +2592,96 @@ db_flush(enum db_flush_type type)
     return success;
 }
 
+void
+db_checkpoint_finished(int success)
+{
+    struct stat st;
+    int on_disk = success && stat(dump_db_name, &st) == 0;
+
+    end_checkpoint_stats(success, on_disk ? st.st_size : 0);
+    if (pending_delta) {
+	if (success) {
+	    num_deltas++;
+	    dump_is_delta = 1;
+	}
+    } else if (on_disk) {
+	if (base_db_name)
+	    free_str(base_db_name);
+	base_db_name = str_dup(dump_db_name);
+	base_stamp = pending_stamp;
+	base_size = st.st_size;
+	base_nobjs = pending_nobjs;
+	num_deltas = 0;
+	force_full = 0;
+	dump_is_delta = 0;
+    } else
+	/* The changes cleared away for it are only in memory now. */
+	force_full = 1;
+}
+
+int
+db_checkpoint_written(int *success)
+{
+#ifdef SNAPSHOT_CHECKPOINTS
+    return finish_snapshot_checkpoint(0, success);
+#else
+    (void) success;
+    return 0;
+#endif
+}
+
+void
+db_checkpoint_overhead(long notify_usecs, long io_usecs)
+{
+    pending_notify_usec = notify_usecs;
+    pending_io_usec = io_usecs;
+}
+
+static void
+set_int(Var * v, Num n)
+{
+    v->type = TYPE_INT;
+    v->v.num = n;
+}
+
+/* Each checkpoint is described by the list
+ *   {START-TIME, MODE, DELTA, SUCCESS, NOTIFY-USECS, IO-USECS, PAUSE-USECS,
+ *    WRITE-USECS, BYTES, BYTES-PER-SECOND, FAULTS, COPIES, COPY-USECS}
+ * as in Checkpoint_Stats, BYTES being the size of the file on disk.
+ */
+Var
+db_checkpoint_stats(void)
+{
+    Var r = new_list(stats_count);
+    int i;
+
+    for (i = 1; i <= stats_count; i++) {
+	Checkpoint_Stats *cs
+	= &checkpoint_stats[(stats_next - stats_count + i - 1
+			     + CHECKPOINT_STATS_KEPT) % CHECKPOINT_STATS_KEPT];
+	Var s = new_list(13);
+
+	set_int(&s.v.list[1], cs->start);
+	s.v.list[2].type = TYPE_STR;
+	s.v.list[2].v.str = str_dup(cs->mode);
+	set_int(&s.v.list[3], cs->delta);
+	set_int(&s.v.list[4], cs->success);
+	set_int(&s.v.list[5], cs->notify_usec);
+	set_int(&s.v.list[6], cs->io_usec);
+	set_int(&s.v.list[7], cs->pause_usec);
+	set_int(&s.v.list[8], cs->write_usec);
+	set_int(&s.v.list[9], cs->bytes);
+	set_int(&s.v.list[10], cs->write_usec > 0
+		? (Num) ((double) cs->bytes * 1000000 / cs->write_usec) : 0);
+	set_int(&s.v.list[11], cs->faults);
+	set_int(&s.v.list[12], cs->copies);
+	set_int(&s.v.list[13], cs->copy_usec);
+	r.v.list[i] = s;
+    }
+
+    return r;
+}
+
 int64_t
 db_disk_size(void)
 {
@@ -734,7 +2691,7 @@ db_disk_size(void)
 	&& stat(input_db_name, &st) < 0)
 	return -1;
     else
-	return st.st_size;
+	return st.st_size + (dump_is_delta ? base_size : 0);
 }
 
 void
@@ -744,6 +2701,8 @@ db_shutdown()
 
     free_str(input_db_name);
     free_str(dump_db_name);
+    if (base_db_name)
+	free_str(base_db_name);
 }
 
 char rcsid_db_file[] = "$Id$";
@@ -21,6 +21,7 @@
 
 #include "config.h"
 #include <ctype.h>
+#include <errno.h>
 #include <float.h>
 #include "my-stdarg.h"
 #include "my-stdio.h"
@@ -33,6 +34,7 @@
 #include "list.h"
 #include "log.h"
 #include "numbers.h"
+#include "options.h"
 #include "parser.h"
 #include "storage.h"
 #include "streams.h"
@@ -41,16 +43,162 @@
 #include "unparse.h"
 #include "version.h"
 #include "waif.h"
+
+#include <sys/uio.h>
+#include "my-unistd.h"
+#if THREADED_DB_LOAD
+#include <pthread.h>
+#endif
+#if COMPRESSED_DUMPS
+#include <zlib.h>
+#endif
 
 
 /*********** Input ***********/
 
-static FILE *input;
+/* Input state is per thread too (see Output, below), so that a checkpoint
+ * thread can copy cold objects out of a lazily loaded DB.
+ */
+static THREAD_LOCAL FILE *input;
+
+/* In binary mode, input comes from a block of memory (normally a mapped
+ * file) instead of from INPUT.
+ */
+static THREAD_LOCAL int binary_input = 0;
+static THREAD_LOCAL const unsigned char *bin_pos, *bin_end;
 
 void
 dbpriv_set_dbio_input(FILE * f)
 {
     input = f;
+    binary_input = 0;
+}
+
+void
+dbpriv_set_dbio_binary_input(const char *start, const char *end)
+{
+    bin_pos = (const unsigned char *) start;
+    bin_end = (const unsigned char *) end;
+    binary_input = 1;
+}
+
+const char *
+dbpriv_dbio_input_position(void)
+{
+    return (const char *) bin_pos;
+}
+
+void
+dbpriv_save_dbio_input(Saved_Input * s)
+{
+    s->input = input;
+    s->binary = binary_input;
+    s->pos = (const char *) bin_pos;
+    s->end = (const char *) bin_end;
+    s->version = dbio_input_version;
+}
+
+void
+dbpriv_restore_dbio_input(const Saved_Input * s)
+{
+    input = s->input;
+    binary_input = s->binary;
+    bin_pos = (const unsigned char *) s->pos;
+    bin_end = (const unsigned char *) s->end;
+    dbio_input_version = s->version;
+}
+
+int
+dbpriv_dbio_compressed(FILE * f)
+{
+    int c1 = getc(f), c2 = getc(f);
+
+    rewind(f);
+    return c1 == 0x1f && c2 == 0x8b;	/* the gzip magic number */
+}
+
+char *
+dbpriv_dbio_inflate(FILE * f, size_t * size)
+{
+#if COMPRESSED_DUMPS
+    gzFile gz;
+    char *data;
+    size_t max = 1 << 20;
+    int n;
+
+    rewind(f);
+    if (!(gz = gzdopen(dup(fileno(f)), "rb"))) {
+	log_perror("DBIO: Opening compressed database");
+	return 0;
+    }
+    gzbuffer(gz, 1 << 18);
+    data = mymalloc(max, M_DB_LOAD);
+    *size = 0;
+    while ((n = gzread(gz, data + *size, max - *size)) > 0) {
+	*size += n;
+	if (*size == max) {
+	    max *= 2;
+	    data = myrealloc(data, max, M_DB_LOAD);
+	}
+    }
+    if (n < 0) {
+	int err;
+
+	errlog("DBIO: Bad compressed database: %s\n", gzerror(gz, &err));
+	myfree(data, M_DB_LOAD);
+	data = 0;
+    }
+    gzclose(gz);
+
+    return data;
+#else
+    errlog("DBIO: This server can't read compressed databases\n");
+    return 0;
+#endif
+}
+
+Exception dbpriv_dbio_truncated;
+
+static const unsigned char *
+bin_take(size_t n)
+{
+    const unsigned char *p = bin_pos;
+
+    if ((size_t) (bin_end - bin_pos) < n) {
+	errlog("DBIO: Binary database truncated or corrupt\n");
+	RAISE(dbpriv_dbio_truncated, 0);
+    }
+    bin_pos += n;
+    return p;
+}
+
+static uint64_t
+bin_read_varint(void)
+{
+    uint64_t u = 0;
+    int shift = 0;
+    unsigned char c;
+
+    do {
+	c = *bin_take(1);
+	u |= (uint64_t) (c & 0x7f) << shift;
+	shift += 7;
+    } while ((c & 0x80) && shift < 64);
+
+    return u;
+}
+
+uint64_t
+dbpriv_dbio_read_fixed64(void)
+{
+    const unsigned char *p = bin_take(8);
+    uint64_t u = 0;
+    int i;
+
+    for (i = 7; i >= 0; i--)
+	u = (u << 8) | p[i];
+
+    return u;
 }
 
 void
@@ -80,6 +228,11 @@ dbio_read_num(void)
     char *p;
     long long i;
 
+    if (binary_input) {
+	uint64_t u = bin_read_varint();
+
+	return (int64_t) (u >> 1) ^ -(int64_t) (u & 1);
+    }
     fgets(s, sizeof(s), input);
     i = strtoll(s, &p, 10);
     if (isspace(*s) || *p != '\n')
@@ -95,6 +248,12 @@ dbio_read_float(void)
     char *p;
     double d;
 
+    if (binary_input) {
+	uint64_t u = dbpriv_dbio_read_fixed64();
+
+	memcpy(&d, &u, sizeof(d));
+	return d;
+    }
     fgets(s, 40, input);
     d = strtod(s, &p);
     if (isspace(*s) || *p != '\n')
@@ -116,6 +275,27 @@ dbio_read_string(void)
     static char buffer[1024];
     int len, used_stream = 0;
 
+    if (binary_input) {
+	/* Strings are stored with a trailing null, so we can hand out a
+	 * pointer straight into the input block.
+	 */
+	uint64_t n = bin_read_varint();
+	const char *p;
+
+	/* Check N against what's left before adding one, which a corrupt
+	 * length could wrap around.
+	 */
+	if (n >= (uint64_t) (bin_end - bin_pos)) {
+	    errlog("DBIO: Binary database truncated or corrupt\n");
+	    RAISE(dbpriv_dbio_truncated, 0);
+	}
+	p = (const char *) bin_take(n + 1);
+	if (p[n] != '\0') {
+	    errlog("DBIO_READ_STRING: Unterminated string\n");
+	    RAISE(dbpriv_dbio_truncated, 0);
+	}
+	return p;
+    }
     if (str == 0)
 	str = new_stream(1024);
 
@@ -151,6 +331,41 @@ dbio_read_string_intern(void)
 }
 
 
+/* Some things (WAIFs and the task queue) are still written in the text
+ * format even in a binary DB; they appear there as a string holding the
+ * text, a `text island'.
+ */
+int
+dbpriv_dbio_read_text(int (*reader) (void))
+{
+    const char *text = dbio_read_string();
+    const unsigned char *pos = bin_pos, *end = bin_end;
+    FILE *saved = input;
+    FILE *f = fmemopen((void *) text, strlen(text), "r");
+    int r;
+
+    if (!f) {
+	log_perror("DBIO: Opening text island");
+	return 0;
+    }
+    dbpriv_set_dbio_input(f);
+    r = reader();
+    fclose(f);
+    input = saved;
+    dbpriv_set_dbio_binary_input((const char *) pos, (const char *) end);
+
+    return r;
+}
+
+static Var island_value;
+
+static int
+read_waif_island(void)
+{
+    island_value = read_waif();
+    return 1;
+}
+
 Var
 dbio_read_var(void)
 {
@@ -187,11 +402,16 @@ dbio_read_var(void)
 	    r.v.list[i + 1] = dbio_read_var();
 	break;
     case _TYPE_WAIF:
-	r = read_waif();
+	if (binary_input) {
+	    if (!dbpriv_dbio_read_text(read_waif_island))
+		island_value = zero;
+	    r = island_value;
+	} else
+	    r = read_waif();
 	break;
     default:
 	errlog("DBIO_READ_VAR: Unknown type (%d) at DB file pos. %ld\n",
-	       l, ftell(input));
+	       l, binary_input ? -1L : ftell(input));
 	r = zero;
 	break;
     }
@@ -213,18 +433,35 @@ program_name(struct state *s)
 	return (*s->fmtr) (s->data);
 }
 
+#if THREADED_DB_LOAD
+/* Keeps the two lines of a message together when programs are being
+ * compiled on several threads; it also covers the name formatter, which
+ * isn't reentrant.
+ */
+static pthread_mutex_t parser_log_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define LOCK_PARSER_LOG()	pthread_mutex_lock(&parser_log_lock)
+#  define UNLOCK_PARSER_LOG()	pthread_mutex_unlock(&parser_log_lock)
+#else
+#  define LOCK_PARSER_LOG()
+#  define UNLOCK_PARSER_LOG()
+#endif
+
 static void
 my_error(void *data, const char *msg)
 {
+    LOCK_PARSER_LOG();
     errlog("PARSER: Error in %s:\n", program_name(data));
     errlog("           %s\n", msg);
+    UNLOCK_PARSER_LOG();
 }
 
 static void
 my_warning(void *data, const char *msg)
 {
+    LOCK_PARSER_LOG();
     oklog("PARSER: Warning in %s:\n", program_name(data));
     oklog("           %s\n", msg);
+    UNLOCK_PARSER_LOG();
 }
 
 static int
@@ -248,11 +485,70 @@ my_getc(void *data)
 static Parser_Client parser_client =
 {my_error, my_warning, my_getc};
 
+struct bin_state {
+    struct state s;		/* must be first, for my_error/my_warning */
+    const char *p;
+};
+
+static int
+bin_getc(void *data)
+{
+    struct bin_state *bs = data;
+
+    if (*bs->p == '\0')
+	return EOF;
+    return (unsigned char) *bs->p++;
+}
+
+static Parser_Client string_parser_client =
+{my_error, my_warning, bin_getc};
+
+Program *
+dbpriv_dbio_compile_program(DB_Version version, const char *source,
+			    const char *(*fmtr) (void *), void *data)
+{
+    struct bin_state bs;
+
+    bs.s.prev_char = '\n';
+    bs.s.fmtr = fmtr;
+    bs.s.data = data;
+    bs.p = source;
+    return parse_program(version, string_parser_client, &bs);
+}
+
+char *
+dbpriv_dbio_read_program_source(void)
+{
+    static Stream *str = 0;
+    int c, prev_char = '\n';
+
+    if (binary_input)
+	return (char *) dbio_read_string();
+
+    if (str == 0)
+	str = new_stream(1024);
+    while ((c = fgetc(input)) != EOF) {
+	if (c == '.' && prev_char == '\n') {
+	    /* end-of-verb marker in DB */
+	    fgetc(input);	/* skip next newline */
+	    break;
+	}
+	stream_add_char(str, c);
+	prev_char = c;
+    }
+    if (c == EOF)
+	errlog("DBIO_READ_PROGRAM_SOURCE: Unexpected EOF\n");
+    return str_dup(reset_stream(str));
+}
+
 Program *
 dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
 {
     struct state s;
 
+    if (binary_input)
+	return dbpriv_dbio_compile_program(version, dbio_read_string(),
+					   fmtr, data);
     s.prev_char = '\n';
     s.fmtr = fmtr;
     s.data = data;
@@ -264,42 +560,314 @@ dbio_read_program(DB_Version version, const char *(*fmtr) (void *), void *data)
 
 Exception dbpriv_dbio_failed;
 
-static FILE *output;
+/* Output state is per thread, so that a checkpoint can be written by one
+ * thread while another journals changes.
+ */
+static THREAD_LOCAL FILE *output;
+static THREAD_LOCAL int binary_output = 0;
+
+/* Dumps don't go through stdio.  Their output collects in a large,
+ * page-aligned buffer that goes to the file descriptor in big writes, and
+ * through zlib first when the dump is compressed.  A string too big to be
+ * worth copying goes out in the same writev() as the buffer ahead of it.
+ */
+
+#define DUMP_BUFFER_SIZE	(1 << 20)
+#define DUMP_BUFFER_ALIGN	4096
+
+static THREAD_LOCAL int dumping = 0;	/* output going to the dump? */
+static THREAD_LOCAL int dump_fd;
+static THREAD_LOCAL char *dump_block, *dump_buffer;
+static THREAD_LOCAL size_t dump_length;	/* bytes waiting in dump_buffer */
+static THREAD_LOCAL long dump_position;	/* bytes of output before those */
+#if COMPRESSED_DUMPS
+static THREAD_LOCAL int dump_compressed;
+static THREAD_LOCAL z_stream dump_zstream;
+static THREAD_LOCAL char *dump_zbuffer;
+#endif
 
 void
 dbpriv_set_dbio_output(FILE * f)
 {
     output = f;
+    binary_output = 0;
+}
+
+void
+dbpriv_set_dbio_binary_output(int yes)
+{
+    binary_output = yes;
+}
+
+long
+dbpriv_dbio_output_position(void)
+{
+    return dumping ? dump_position + (long) dump_length : ftell(output);
+}
+
+static void
+write_fully(struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+	ssize_t n = writev(dump_fd, iov, iovcnt);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    RAISE(dbpriv_dbio_failed, 0);
+	}
+	while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+	    n -= iov->iov_len;
+	    iov++;
+	    iovcnt--;
+	}
+	if (iovcnt > 0) {
+	    iov->iov_base = (char *) iov->iov_base + n;
+	    iov->iov_len -= n;
+	}
+    }
+}
+
+#if COMPRESSED_DUMPS
+
+/* Runs the given bytes through the compressor, writing out its output
+ * whenever its buffer fills.
+ */
+static void
+deflate_bytes(const void *p, size_t n, int flush)
+{
+    struct iovec iov;
+    int r;
+
+    dump_zstream.next_in = (Bytef *) p;
+    dump_zstream.avail_in = n;
+    do {
+	r = deflate(&dump_zstream, flush);
+	if (r == Z_STREAM_ERROR)
+	    RAISE(dbpriv_dbio_failed, 0);
+	if (dump_zstream.avail_out == 0 || r == Z_STREAM_END) {
+	    iov.iov_base = dump_zbuffer;
+	    iov.iov_len = DUMP_BUFFER_SIZE - dump_zstream.avail_out;
+	    write_fully(&iov, 1);
+	    dump_zstream.next_out = (Bytef *) dump_zbuffer;
+	    dump_zstream.avail_out = DUMP_BUFFER_SIZE;
+	}
+    } while (flush == Z_FINISH ? r != Z_STREAM_END
+	     : dump_zstream.avail_in > 0);
+}
+
+#endif				/* COMPRESSED_DUMPS */
+
+/* Writes out the buffer, followed by the N bytes at P. */
+static void
+flush_dump(const void *p, size_t n)
+{
+    struct iovec iov[2];
+    int iovcnt = 0;
+
+#if COMPRESSED_DUMPS
+    if (dump_compressed) {
+	deflate_bytes(dump_buffer, dump_length, Z_NO_FLUSH);
+	deflate_bytes(p, n, Z_NO_FLUSH);
+    } else
+#endif
+    {
+	if (dump_length > 0) {
+	    iov[iovcnt].iov_base = dump_buffer;
+	    iov[iovcnt++].iov_len = dump_length;
+	}
+	if (n > 0) {
+	    iov[iovcnt].iov_base = (void *) p;
+	    iov[iovcnt++].iov_len = n;
+	}
+	write_fully(iov, iovcnt);
+    }
+    dump_position += dump_length + n;
+    dump_length = 0;
+}
+
+static void
+write_bytes(const void *p, size_t n)
+{
+    if (!dumping) {
+	if (fwrite(p, 1, n, output) != n)
+	    RAISE(dbpriv_dbio_failed, 0);
+    } else if (n <= DUMP_BUFFER_SIZE - dump_length) {
+	memcpy(dump_buffer + dump_length, p, n);
+	dump_length += n;
+    } else if (n >= DUMP_BUFFER_SIZE / 4)
+	flush_dump(p, n);
+    else {
+	flush_dump(0, 0);
+	memcpy(dump_buffer, p, n);
+	dump_length = n;
+    }
+}
+
+int
+dbpriv_begin_dbio_dump(int fd, int compress)
+{
+#if COMPRESSED_DUMPS
+    if (compress) {
+	dump_zstream.zalloc = Z_NULL;
+	dump_zstream.zfree = Z_NULL;
+	dump_zstream.opaque = Z_NULL;
+	/* 16 more window bits asks for a gzip header */
+	if (deflateInit2(&dump_zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+	    errlog("DBIO: Can't start compressing dump\n");
+	    return 0;
+	}
+	dump_zbuffer = mymalloc(DUMP_BUFFER_SIZE, M_DB_DUMP);
+	dump_zstream.next_out = (Bytef *) dump_zbuffer;
+	dump_zstream.avail_out = DUMP_BUFFER_SIZE;
+    }
+    dump_compressed = compress;
+#else
+    if (compress) {
+	errlog("DBIO: This server can't compress dumps\n");
+	return 0;
+    }
+#endif
+    dump_block = mymalloc(DUMP_BUFFER_SIZE + DUMP_BUFFER_ALIGN, M_DB_DUMP);
+    dump_buffer = (char *) (((uintptr_t) dump_block + DUMP_BUFFER_ALIGN - 1)
+			    & ~(uintptr_t) (DUMP_BUFFER_ALIGN - 1));
+    dump_fd = fd;
+    dump_length = 0;
+    dump_position = 0;
+    binary_output = 0;
+    dumping = 1;
+
+    return 1;
+}
+
+int
+dbpriv_end_dbio_dump(int success)
+{
+    if (success) {
+	TRY {
+	    flush_dump(0, 0);
+#if COMPRESSED_DUMPS
+	    if (dump_compressed)
+		deflate_bytes(0, 0, Z_FINISH);
+#endif
+	}
+	EXCEPT(dbpriv_dbio_failed)
+	    success = 0;
+	ENDTRY;
+    }
+#if COMPRESSED_DUMPS
+    if (dump_compressed) {
+	deflateEnd(&dump_zstream);
+	myfree(dump_zbuffer, M_DB_DUMP);
+    }
+#endif
+    myfree(dump_block, M_DB_DUMP);
+    dumping = 0;
+
+    return success;
+}
+
+static void
+bin_write_bytes(const void *p, size_t n)
+{
+    write_bytes(p, n);
+}
+
+static void
+bin_write_varint(uint64_t u)
+{
+    unsigned char buf[10];
+    int n = 0;
+
+    while (u >= 0x80) {
+	buf[n++] = (u & 0x7f) | 0x80;
+	u >>= 7;
+    }
+    buf[n++] = u;
+    bin_write_bytes(buf, n);
+}
+
+void
+dbpriv_dbio_write_fixed64(uint64_t u)
+{
+    unsigned char buf[8];
+    int i;
+
+    for (i = 0; i < 8; i++, u >>= 8)
+	buf[i] = u & 0xff;
+    bin_write_bytes(buf, 8);
+}
+
+static void
+bin_write_string(const char *s, size_t len)
+{
+    bin_write_varint(len);
+    bin_write_bytes(s, len);
+    bin_write_bytes("", 1);
 }
 
 void
 dbio_printf(const char *format,...)
 {
     va_list args;
+    int n;
 
     va_start(args, format);
-    if (vfprintf(output, format, args) < 0)
-	RAISE(dbpriv_dbio_failed, 0);
+    if (!dumping) {
+	n = vfprintf(output, format, args);
+	va_end(args);
+	if (n < 0)
+	    RAISE(dbpriv_dbio_failed, 0);
+	return;
+    }
+    n = vsnprintf(dump_buffer + dump_length, DUMP_BUFFER_SIZE - dump_length,
+		  format, args);
     va_end(args);
+    if (n < 0)
+	RAISE(dbpriv_dbio_failed, 0);
+    if ((size_t) n < DUMP_BUFFER_SIZE - dump_length)
+	dump_length += n;
+    else {
+	char *text;
+
+	/* Didn't fit; format it again on its own. */
+	text = mymalloc(n + 1, M_DB_DUMP);
+	va_start(args, format);
+	vsnprintf(text, n + 1, format, args);
+	va_end(args);
+	TRY {
+	    write_bytes(text, n);
+	}
+	FINALLY {
+	    myfree(text, M_DB_DUMP);
+	}
+	ENDTRY;
+    }
 }
 
 void
 dbio_write_num(int64_t n)
 {
+    if (binary_output) {
+	/* zig-zag encoding keeps small negative numbers short */
+	bin_write_varint(((uint64_t) n << 1) ^ (uint64_t) (n >> 63));
+	return;
+    }
     dbio_printf("%"PRId64"\n", n);
 }
 
 void
 dbio_write_float(double d)
 {
-    static const char *fmt = 0;
-    static char buffer[10];
+    if (binary_output) {
+	uint64_t u;
 
-    if (!fmt) {
-	sprintf(buffer, "%%.%dg\n", DBL_DIG + 4);
-	fmt = buffer;
+	memcpy(&u, &d, sizeof(u));
+	dbpriv_dbio_write_fixed64(u);
+	return;
     }
-    dbio_printf(fmt, d);
+    dbio_printf("%.*g\n", DBL_DIG + 4, d);
 }
 
 void
@@ -311,7 +879,70 @@ dbio_write_objid(Objid oid)
 void
 dbio_write_string(const char *s)
 {
-    dbio_printf("%s\n", s ? s : "");
+    if (binary_output) {
+	if (!s)
+	    s = "";
+	bin_write_string(s, strlen(s));
+	return;
+    }
+    if (s)
+	write_bytes(s, strlen(s));
+    write_bytes("\n", 1);
+}
+
+void
+dbpriv_dbio_write_bytes(const char *p, size_t n)
+{
+    write_bytes(p, n);
+}
+
+char *
+dbpriv_dbio_capture_text(void (*writer) (void), size_t * len)
+{
+    FILE *saved = output;
+    int saved_binary = binary_output;
+    int saved_dumping = dumping;
+    char *text = 0;
+    FILE *f = open_memstream(&text, len);
+
+    if (!f)
+	RAISE(dbpriv_dbio_failed, 0);
+    output = f;
+    binary_output = 0;
+    dumping = 0;
+    TRY {
+	writer();
+    }
+    FINALLY {
+	fclose(f);
+	output = saved;
+	binary_output = saved_binary;
+	dumping = saved_dumping;
+    }
+    ENDTRY;
+
+    return text;
+}
+
+void
+dbpriv_dbio_write_text(void (*writer) (void))
+{
+    size_t len;
+    char *text = dbpriv_dbio_capture_text(writer, &len);
+
+    TRY {
+	bin_write_string(text, len);
+    }
+    FINALLY {
+	free(text);
+    }
+    ENDTRY;
+}
+
+static void
+write_waif_island(void)
+{
+    write_waif(island_value);
 }
 
 void
@@ -343,7 +974,11 @@ dbio_write_var(Var v)
 	    dbio_write_var(v.v.list[i + 1]);
 	break;
     case TYPE_WAIF:
-	write_waif(v);
+	if (binary_output) {
+	    island_value = v;
+	    dbpriv_dbio_write_text(write_waif_island);
+	} else
+	    write_waif(v);
 	break;
     }
 }
@@ -351,12 +986,30 @@ dbio_write_var(Var v)
 static void
 receiver(void *data, const char *line)
 {
-    dbio_printf("%s\n", line);
+    write_bytes(line, strlen(line));
+    write_bytes("\n", 1);
+}
+
+static void
+stream_receiver(void *data, const char *line)
+{
+    stream_add_string(data, line);
+    stream_add_char(data, '\n');
 }
 
 void
 dbio_write_program(Program * program)
 {
+    if (binary_output) {
+	static THREAD_LOCAL Stream *s = 0;
+
+	if (!s)
+	    s = new_stream(1000);
+	unparse_program(program, stream_receiver, s, 1, 0, MAIN_VECTOR);
+	bin_write_string(stream_contents(s), stream_length(s));
+	reset_stream(s);
+	return;
+    }
     unparse_program(program, receiver, 0, 1, 0, MAIN_VECTOR);
     dbio_printf(".\n");
 }
@@ -0,0 +1,817 @@
+/*****************************************************************************
+ * The write-ahead journal of changes made to the database since the last
+ * checkpoint, and its replay on startup
+ *****************************************************************************/
+
+#include <errno.h>
+#include "my-fcntl.h"
+#include "my-stat.h"
+#include "my-stdio.h"
+#include "my-stdlib.h"
+#include "my-string.h"
+#include "my-time.h"
+#include "my-unistd.h"
+
+#include "config.h"
+#include "db.h"
+#include "db_io.h"
+#include "db_private.h"
+#include "list.h"
+#include "log.h"
+#include "options.h"
+#include "program.h"
+#include "storage.h"
+#include "streams.h"
+#include "timers.h"
+#include "utils.h"
+#include "version.h"
+
+#ifdef JOURNAL_CHANGES
+
+/* The journal is a chain of segment files named after the output DB,
+ * `<dump>.journal.<n>'.  Each checkpoint closes the current segment and
+ * opens segment n+1, and the checkpoint's DB records n+1 as its stamp, so
+ * replaying the segments from the stamp onward on top of that DB brings it
+ * up to date.  Segments older than the stamp of the DB on disk are removed
+ * once that DB is safely in place.  The DB also records the name the
+ * segments are under, and a server started from it with another output
+ * DB keeps using that name, so that the chain isn't broken.
+ *
+ * A segment is a header line followed by records, each of which is a line
+ * `@<length> <hash>' followed by that many bytes of text-format DBIO output:
+ * the name of the operation and then its arguments.  The hash lets replay
+ * tell a record that was cut short by a crash from a complete one.
+ *
+ * Records collect in memory and are written out when the main loop calls
+ * db_flush(), once per pass, so all of the changes made by the tasks run
+ * in a pass share one write(); fsync() is done at most once every
+ * JOURNAL_SYNC_MSECS, or whenever the server is idle.
+ */
+
+#define HEADER_PREFIX	"** LambdaMOO Journal, Checkpoint %"
+
+static const char *header_format_string = HEADER_PREFIX PRIdN " **\n";
+
+#define FLUSH_THRESHOLD	(1024 * 1024)
+
+static char *journal_base;	/* dump file name the segments are named after */
+static Num journal_seq = 0;	/* number of the open segment, if any */
+static int journal_fd = -1;
+static Stream *pending;		/* records not yet written */
+static int unsynced = 0;	/* written but not yet fsync()ed? */
+static int64_t last_sync;	/* in monotonic_usecs() */
+
+static FILE *scratch;		/* the record being built */
+static char *scratch_buffer;
+static size_t scratch_size;
+static int lossy;		/* the record is to be dropped */
+static int warned_lossy;
+
+static const char *
+segment_name(Num seq)
+{
+    static Stream *s = 0;
+
+    if (!s)
+	s = new_stream(100);
+    stream_printf(s, "%s.journal.%" PRIdN, journal_base, seq);
+    return reset_stream(s);
+}
+
+static unsigned
+record_hash(const char *p, size_t len)
+{
+    unsigned h = 2166136261U;	/* FNV-1a */
+
+    while (len-- > 0) {
+	h ^= (unsigned char) *p++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+static int
+write_all(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+	ssize_t n = write(fd, p, len);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return 0;
+	}
+	p += n;
+	len -= n;
+    }
+    return 1;
+}
+
+static void
+remove_segments_after(Num seq)
+{
+    while (remove(segment_name(++seq)) == 0)
+	oklog("JOURNAL: Removed stale %s\n", segment_name(seq));
+}
+
+static void
+close_segment(void)
+{
+    if (journal_fd >= 0) {
+	close(journal_fd);
+	journal_fd = -1;
+    }
+    reset_stream(pending);
+    unsynced = 0;
+}
+
+static int
+open_segment(Num seq, int fresh)
+{
+    const char *name = segment_name(seq);
+    int fd = open(name, O_WRONLY | O_CREAT | O_APPEND | (fresh ? O_TRUNC : 0),
+		  0666);
+
+    journal_seq = seq;
+    warned_lossy = 0;
+    if (fd < 0) {
+	log_perror("JOURNAL: Opening journal segment");
+	errlog("JOURNAL: Not journaling changes until the next "
+	       "checkpoint\n");
+	return 0;
+    }
+    if (fresh) {
+	char header[100];
+
+	sprintf(header, header_format_string, seq);
+	if (!write_all(fd, header, strlen(header)) || fsync(fd) < 0) {
+	    log_perror("JOURNAL: Writing journal header");
+	    close(fd);
+	    return 0;
+	}
+	remove_segments_after(seq);
+    }
+    journal_fd = fd;
+    last_sync = monotonic_usecs();
+
+    return 1;
+}
+
+/*********** Writing records ***********/
+
+int
+dbpriv_journal_begin(const char *op)
+{
+    if (journal_fd < 0)
+	return 0;
+    if (!scratch
+	&& !(scratch = open_memstream(&scratch_buffer, &scratch_size))) {
+	log_perror("JOURNAL: Opening record buffer");
+	return 0;
+    }
+    rewind(scratch);
+    lossy = 0;
+    dbpriv_set_dbio_output(scratch);
+    dbio_write_string(op);
+
+    return 1;
+}
+
+static int
+contains_waif(Var v)
+{
+    int i;
+
+    if (v.type == TYPE_WAIF)
+	return 1;
+    if (v.type == TYPE_LIST)
+	for (i = 1; i <= v.v.list[0].v.num; i++)
+	    if (contains_waif(v.v.list[i]))
+		return 1;
+    return 0;
+}
+
+void
+dbpriv_journal_write_var(Var v, int placeholder)
+{
+    /* Writing a WAIF outside of a dump would upset its bookkeeping. */
+    if (contains_waif(v)) {
+	if (!warned_lossy) {
+	    errlog("JOURNAL: Values containing WAIFs are not journaled and "
+		   "will be lost in a crash before the next checkpoint\n");
+	    warned_lossy = 1;
+	}
+	if (placeholder)
+	    dbio_write_var(zero);
+	else
+	    lossy = 1;
+    } else
+	dbio_write_var(v);
+}
+
+void
+dbpriv_journal_end(void)
+{
+    long len;
+
+    fflush(scratch);
+    len = ftell(scratch);
+    if (lossy)
+	return;
+    stream_printf(pending, "@%ld %u\n", len, record_hash(scratch_buffer, len));
+    stream_add_bytes(pending, scratch_buffer, len);
+    if (stream_length(pending) > FLUSH_THRESHOLD)
+	dbpriv_journal_flush(0);
+}
+
+void
+dbpriv_journal_flush(int sync)
+{
+    int64_t now;
+
+    if (journal_fd < 0)
+	return;
+    if (stream_length(pending) > 0) {
+	if (!write_all(journal_fd, stream_contents(pending),
+		       stream_length(pending))) {
+	    log_perror("JOURNAL: Writing journal");
+	    errlog("JOURNAL: Not journaling changes until the next "
+		   "checkpoint\n");
+	    close_segment();
+	    return;
+	}
+	reset_stream(pending);
+	unsynced = 1;
+    }
+    if (!unsynced)
+	return;
+    now = monotonic_usecs();
+    if (!sync && now - last_sync < (int64_t) JOURNAL_SYNC_MSECS * 1000)
+	return;
+    if (fsync(journal_fd) < 0)
+	log_perror("JOURNAL: Syncing journal");
+    last_sync = now;
+    unsynced = 0;
+}
+
+Num
+dbpriv_journal_checkpoint(int reopen)
+{
+    Num seq = journal_seq ? journal_seq + 1 : time(0);
+
+    dbpriv_journal_flush(1);
+    close_segment();
+    if (reopen)
+	open_segment(seq, 1);
+    else
+	journal_seq = seq;
+
+    return seq;
+}
+
+void
+dbpriv_journal_discard(Num stamp)
+{
+    Num seq;
+
+    for (seq = stamp - 1; seq > 0 && remove(segment_name(seq)) == 0; seq--)
+	;
+}
+
+const char *
+dbpriv_journal_name(void)
+{
+    return journal_base;
+}
+
+/*********** Replay ***********/
+
+/* Each of these reads the arguments of one kind of record, as written by
+ * the corresponding mutator in db_objects.c, db_properties.c or
+ * db_verbs.c, and applies it through the same mutator.  The journal is not
+ * open yet, so nothing is journaled again.  They return false if the
+ * record doesn't fit the database.
+ */
+
+static int
+replay_create(void)
+{
+    Objid oid = dbio_read_objid();
+
+    if (oid <= db_last_used_objid())
+	return db_create_recycled_object() == oid;
+    return db_create_object() == oid;
+}
+
+static int
+replay_destroy(void)
+{
+    Objid oid = dbio_read_objid();
+
+    if (!valid(oid)
+	|| dbpriv_location[oid] != NOTHING || dbpriv_contents[oid] != NOTHING
+	|| dbpriv_parent[oid] != NOTHING || dbpriv_child[oid] != NOTHING)
+	return 0;
+    db_destroy_object(oid);
+    return 1;
+}
+
+static int
+replay_renumber(void)
+{
+    Objid old = dbio_read_objid();
+    Objid new = dbio_read_objid();
+
+    return valid(old) && db_renumber_object(old) == new;
+}
+
+static int
+replay_reset_max(void)
+{
+    db_reset_last_used_objid();
+    return 1;
+}
+
+static int
+replay_owner(void)
+{
+    Objid oid = dbio_read_objid();
+    Objid owner = dbio_read_objid();
+
+    if (!valid(oid))
+	return 0;
+    db_set_object_owner(oid, owner);
+    return 1;
+}
+
+static int
+replay_name(void)
+{
+    Objid oid = dbio_read_objid();
+    const char *name = dbio_read_string();
+
+    if (!valid(oid))
+	return 0;
+    db_set_object_name(oid, str_dup(name));
+    return 1;
+}
+
+static int
+replay_parent(void)
+{
+    Objid oid = dbio_read_objid();
+    Objid parent = dbio_read_objid();
+
+    return valid(oid) && (parent == NOTHING || valid(parent))
+	&& db_change_parent(oid, parent);
+}
+
+static int
+replay_location(void)
+{
+    Objid oid = dbio_read_objid();
+    Objid location = dbio_read_objid();
+
+    if (!valid(oid))
+	return 0;
+    db_change_location(oid, location);
+    return 1;
+}
+
+static int
+replay_flag(void)
+{
+    Objid oid = dbio_read_objid();
+    db_object_flag f = dbio_read_num();
+    int on = dbio_read_num();
+
+    if (!valid(oid) || f < 0 || f >= FLAG_FIRST_TEMP)
+	return 0;
+    if (on)
+	db_set_object_flag(oid, f);
+    else
+	db_clear_object_flag(oid, f);
+    return 1;
+}
+
+static int
+replay_add_prop(void)
+{
+    Objid oid = dbio_read_objid();
+    const char *name = str_dup(dbio_read_string());
+    Var value = dbio_read_var();
+    Objid owner = dbio_read_objid();
+    unsigned flags = dbio_read_num();
+    int ok = valid(oid) && db_add_propdef(oid, name, value, owner, flags);
+
+    if (!ok)
+	free_var(value);
+    free_str(name);
+    return ok;
+}
+
+static int
+replay_rename_prop(void)
+{
+    Objid oid = dbio_read_objid();
+    const char *old = str_dup(dbio_read_string());
+    const char *new = str_dup(dbio_read_string());
+    int ok = valid(oid) && db_rename_propdef(oid, old, new);
+
+    free_str(old);
+    free_str(new);
+    return ok;
+}
+
+static int
+replay_delete_prop(void)
+{
+    Objid oid = dbio_read_objid();
+    const char *name = str_dup(dbio_read_string());
+    int ok = valid(oid) && db_delete_propdef(oid, name);
+
+    free_str(name);
+    return ok;
+}
+
+static int
+read_prop_handle(db_prop_handle * h)
+{
+    Objid oid = dbio_read_objid();
+    Num index = dbio_read_num();
+
+    if (!valid(oid) || index < 0 || index >= dbpriv_count_properties(oid))
+	return 0;
+    h->built_in = BP_NONE;
+    h->definer = NOTHING;	/* not needed by the setters */
+    h->oid = oid;
+    h->ptr = dbpriv_find_object(oid)->propval + index;
+    return 1;
+}
+
+static int
+replay_prop_value(void)
+{
+    db_prop_handle h;
+
+    if (!read_prop_handle(&h))
+	return 0;
+    db_set_property_value(h, dbio_read_var());
+    return 1;
+}
+
+static int
+replay_prop_owner(void)
+{
+    db_prop_handle h;
+
+    if (!read_prop_handle(&h))
+	return 0;
+    db_set_property_owner(h, dbio_read_objid());
+    return 1;
+}
+
+static int
+replay_prop_flags(void)
+{
+    db_prop_handle h;
+
+    if (!read_prop_handle(&h))
+	return 0;
+    db_set_property_flags(h, dbio_read_num());
+    return 1;
+}
+
+static int
+replay_add_verb(void)
+{
+    Objid oid = dbio_read_objid();
+    const char *names = str_dup(dbio_read_string());
+    Objid owner = dbio_read_objid();
+    unsigned flags = dbio_read_num();
+    db_arg_spec dobj = dbio_read_num();
+    db_prep_spec prep = dbio_read_num();
+    db_arg_spec iobj = dbio_read_num();
+
+    if (!valid(oid)) {
+	free_str(names);
+	return 0;
+    }
+    db_add_verb(oid, names, owner, flags, dobj, prep, iobj);
+    return 1;
+}
+
+static int
+read_verb_handle(db_verb_handle * h)
+{
+    Objid oid = dbio_read_objid();
+    Num index = dbio_read_num();
+
+    if (!valid(oid) || index < 0)
+	return 0;
+    *h = db_find_indexed_verb(oid, index + 1);
+    return h->ptr != 0;
+}
+
+static int
+replay_verb_names(void)
+{
+    db_verb_handle h;
+
+    if (!read_verb_handle(&h))
+	return 0;
+    db_set_verb_names(h, str_dup(dbio_read_string()));
+    return 1;
+}
+
+static int
+replay_verb_owner(void)
+{
+    db_verb_handle h;
+
+    if (!read_verb_handle(&h))
+	return 0;
+    db_set_verb_owner(h, dbio_read_objid());
+    return 1;
+}
+
+static int
+replay_verb_flags(void)
+{
+    db_verb_handle h;
+
+    if (!read_verb_handle(&h))
+	return 0;
+    db_set_verb_flags(h, dbio_read_num());
+    return 1;
+}
+
+static int
+replay_verb_args(void)
+{
+    db_verb_handle h;
+    db_arg_spec dobj, iobj;
+    db_prep_spec prep;
+
+    if (!read_verb_handle(&h))
+	return 0;
+    dobj = dbio_read_num();
+    prep = dbio_read_num();
+    iobj = dbio_read_num();
+    db_set_verb_arg_specs(h, dobj, prep, iobj);
+    return 1;
+}
+
+static const char *
+fmt_journal_verb(void *data)
+{
+    (void) data;
+
+    return "journaled verb";
+}
+
+static int
+replay_verb_code(void)
+{
+    db_verb_handle h;
+    Program *program;
+
+    if (!read_verb_handle(&h))
+	return 0;
+    program = dbio_read_program(current_version, fmt_journal_verb, 0);
+    if (!program)
+	return 0;
+    db_set_verb_program(h, program);
+    return 1;
+}
+
+static int
+replay_delete_verb(void)
+{
+    db_verb_handle h;
+
+    if (!read_verb_handle(&h))
+	return 0;
+    db_delete_verb(h);
+    return 1;
+}
+
+static struct {
+    const char *op;
+    int (*replay) (void);
+} ops[] = {
+    { "create", replay_create },
+    { "destroy", replay_destroy },
+    { "renumber", replay_renumber },
+    { "reset_max", replay_reset_max },
+    { "owner", replay_owner },
+    { "name", replay_name },
+    { "parent", replay_parent },
+    { "location", replay_location },
+    { "flag", replay_flag },
+    { "add_prop", replay_add_prop },
+    { "rename_prop", replay_rename_prop },
+    { "delete_prop", replay_delete_prop },
+    { "prop_value", replay_prop_value },
+    { "prop_owner", replay_prop_owner },
+    { "prop_flags", replay_prop_flags },
+    { "add_verb", replay_add_verb },
+    { "verb_names", replay_verb_names },
+    { "verb_owner", replay_verb_owner },
+    { "verb_flags", replay_verb_flags },
+    { "verb_args", replay_verb_args },
+    { "verb_code", replay_verb_code },
+    { "delete_verb", replay_delete_verb }
+};
+
+static int
+replay_record(const char *payload, size_t len)
+{
+    FILE *f = fmemopen((void *) payload, len, "r");
+    const char *op;
+    unsigned i;
+    int ok = 0;
+
+    if (!f) {
+	log_perror("JOURNAL: Opening record");
+	return 0;
+    }
+    dbpriv_set_dbio_input(f);
+    op = dbio_read_string();
+    for (i = 0; i < Arraysize(ops); i++)
+	if (!strcmp(op, ops[i].op)) {
+	    ok = ops[i].replay();
+	    break;
+	}
+    fclose(f);
+
+    return ok;
+}
+
+/* Returns -1 if segment SEQ doesn't exist, 0 if it couldn't be replayed,
+ * 1 if it was replayed in full and 2 if its tail was torn off by a crash,
+ * in which case the segment has been truncated after its last whole record.
+ */
+static int
+replay_segment(Num seq, int *count)
+{
+    const char *name = segment_name(seq);
+    FILE *f = fopen(name, "r");
+    struct stat st;
+    char *buffer, *pos, *end, *eol;
+    Num header_seq, len;
+    int result = 1;
+
+    if (!f) {
+	if (errno == ENOENT)
+	    return -1;
+	log_perror("JOURNAL: Opening journal segment");
+	return 0;
+    }
+    if (fstat(fileno(f), &st) < 0) {
+	log_perror("JOURNAL: Examining journal segment");
+	fclose(f);
+	return 0;
+    }
+    buffer = mymalloc(st.st_size + 1, M_STRING);
+    if (fread(buffer, 1, st.st_size, f) != (size_t) st.st_size) {
+	log_perror("JOURNAL: Reading journal segment");
+	myfree(buffer, M_STRING);
+	fclose(f);
+	return 0;
+    }
+    fclose(f);
+    buffer[st.st_size] = '\0';
+    end = buffer + st.st_size;
+
+    oklog("JOURNAL: Replaying %s ...\n", name);
+    *count = 0;
+    if (!(eol = memchr(buffer, '\n', st.st_size))
+	|| sscanf(buffer, HEADER_PREFIX SCNdN, &header_seq) != 1
+	|| header_seq != seq) {
+	/* A segment's header is synced before anything is written after
+	 * it, so this one was never used.
+	 */
+	errlog("JOURNAL: Bad header in %s; ignoring it\n", name);
+	myfree(buffer, M_STRING);
+	remove(name);
+	return -1;
+    }
+    for (pos = eol + 1; pos < end; pos = eol + 1 + len) {
+	unsigned hash;
+	int n;
+
+	if (!(eol = memchr(pos, '\n', end - pos))
+	    || sscanf(pos, "@%" SCNdN " %u%n", &len, &hash, &n) != 2
+	    || pos + n != eol
+	    || len < 0 || len > end - (eol + 1)
+	    || record_hash(eol + 1, len) != hash) {
+	    errlog("JOURNAL: %s is torn after %d records; truncating it\n",
+		   name, *count);
+	    if (truncate(name, pos - buffer) < 0)
+		log_perror("JOURNAL: Truncating journal segment");
+	    result = 2;
+	    break;
+	}
+	if (!replay_record(eol + 1, len)) {
+	    errlog("JOURNAL: Cannot apply record %d of %s\n", *count + 1,
+		   name);
+	    result = 0;
+	    break;
+	}
+	++*count;
+    }
+    myfree(buffer, M_STRING);
+
+    return result;
+}
+
+int
+dbpriv_journal_replay(const char *base, Num stamp)
+{
+    DB_Version saved_version = dbio_input_version;
+    Num seq, last = 0;
+    int count, total = 0, r = -1;
+
+    journal_base = str_dup(base);
+    pending = new_stream(10000);
+
+    if (stamp == 0) {
+	oklog("JOURNAL: Database has no checkpoint stamp; "
+	      "journaling starts with the next checkpoint\n");
+	return 1;
+    }
+    dbio_input_version = current_version;
+    for (seq = stamp;; seq++) {
+	r = replay_segment(seq, &count);
+	if (r < 0)
+	    break;
+	if (r == 0) {
+	    dbio_input_version = saved_version;
+	    return 0;
+	}
+	last = seq;
+	total += count;
+	if (r == 2)
+	    break;
+    }
+    dbio_input_version = saved_version;
+    if (last) {
+	oklog("JOURNAL: Replayed %d changes\n", total);
+	remove_segments_after(last);
+	open_segment(last, 0);
+    } else
+	open_segment(stamp, 1);
+
+    return 1;
+}
+
+#else				/* !JOURNAL_CHANGES */
+
+int
+dbpriv_journal_begin(const char *op)
+{
+    return 0;
+}
+
+void
+dbpriv_journal_write_var(Var v, int placeholder)
+{
+}
+
+void
+dbpriv_journal_end(void)
+{
+}
+
+void
+dbpriv_journal_flush(int sync)
+{
+}
+
+Num
+dbpriv_journal_checkpoint(int reopen)
+{
+    return 0;
+}
+
+void
+dbpriv_journal_discard(Num stamp)
+{
+}
+
+const char *
+dbpriv_journal_name(void)
+{
+    return 0;
+}
+
+int
+dbpriv_journal_replay(const char *base, Num stamp)
+{
+    return 1;
+}
+
+#endif				/* JOURNAL_CHANGES */
+
+char rcsid_db_journal[] = "$Id$";
@@ -21,27 +21,96 @@
 
 #include "config.h"
 #include "db.h"
+#include "db_io.h"
 #include "db_private.h"
 #include "list.h"
+#include "options.h"
+#include "parallel.h"
 #include "program.h"
 #include "storage.h"
 #include "utils.h"
+#include "my-stdlib.h"
 #include "my-string.h"
+#include "my-time.h"
+
+#ifdef SNAPSHOT_CHECKPOINTS
+#include <pthread.h>
+#endif
 
 static Object **objects;
 static int num_objects = 0;
 static int max_objects = 0;
 
+Object dbpriv_cold_object;
+
+Objid *dbpriv_owner;
+Objid *dbpriv_location, *dbpriv_contents, *dbpriv_next;
+Objid *dbpriv_parent, *dbpriv_child, *dbpriv_sibling;
+int *dbpriv_flags;
+int *dbpriv_ncontents, *dbpriv_nchildren;
+Objid *dbpriv_verb_parent;
+char *dbpriv_dirty;
+
 static Var all_users;
+
+/* Recycled object numbers, in a heap with the lowest on top.  Numbers go in
+ * as objects are destroyed and come out once they're found to be in use
+ * again; a stale heap is rebuilt from scratch when next needed.
+ */
+static Objid *free_heap;
+static int free_count = 0, free_max = 0;
+static int free_heap_stale = 1;
+
+/* For each object number, the objects that may name it as the owner of
+ * themselves or of one of their verbs or properties.  A list keeps objects
+ * that no longer do until it is pruned.  The index is built the first time
+ * it's needed and kept up by the mutators from then on.
+ */
+typedef struct {
+    Objid *l;
+    int len, max;
+} Referrers;
+
+static Referrers *referrers = 0;
+static Objid referrers_size;	/* numbers with an entry in REFERRERS */
+static Referrers far_referrers;	/* for all the numbers above those */
 
 
 /*********** Objects qua objects ***********/
 
+static Object *
+read_cold_object(Objid oid)
+{
+    Object *o;
+
+    /* Parents first, so that counting an object's properties never needs
+     * anything read in.
+     */
+    if (dbpriv_parent[oid] != NOTHING)
+	dbpriv_find_object(dbpriv_parent[oid]);
+
+    o = mymalloc(sizeof(Object), M_OBJECT);
+    o->id = oid;
+    o->waif_propdefs = NULL;
+    o->contents_list.type = o->children_list.type = TYPE_NONE;
+    o->lineage.type = TYPE_NONE;
+    dbpriv_read_cold_object(o);
+
+    /* A checkpoint thread may be looking at the table. */
+    dbpriv_snapshot_lock();
+    objects[oid] = o;
+    dbpriv_snapshot_unlock();
+
+    return o;
+}
+
 Object *
 dbpriv_find_object(Objid oid)
 {
     if (oid < 0 || oid >= num_objects)
 	return 0;
+    else if (objects[oid] == COLD_OBJECT)
+	return read_cold_object(oid);
     else
 	return objects[oid];
 }
@@ -49,7 +118,25 @@ dbpriv_find_object(Objid oid)
 int
 valid(Objid oid)
 {
-    return dbpriv_find_object(oid) != 0;
+    return oid >= 0 && oid < num_objects && objects[oid] != 0;
+}
+
+/* Returns OID's object if it is in memory, without reading it in. */
+static Object *
+warm_object(Objid oid)
+{
+    return objects[oid] == COLD_OBJECT ? 0 : objects[oid];
+}
+
+static int
+has_verbdefs(Objid oid)
+{
+    /* A cold object's verb parent says whether it has any verbs (see
+     * dbpriv_fix_verb_parents()).
+     */
+    if (objects[oid] == COLD_OBJECT)
+	return dbpriv_verb_parent[oid] == oid;
+    return objects[oid]->verbdefs != 0;
 }
 
 Objid
@@ -61,64 +148,831 @@ db_last_used_objid(void)
 void
 db_reset_last_used_objid(void)
 {
-    while (!objects[num_objects - 1])
+    PARALLEL_SERIAL();
+    while (!objects[num_objects - 1]) {
+	dbpriv_mark_dirty(num_objects - 1);	/* the number may be reused */
 	num_objects--;
+    }
+    if (dbpriv_journal_begin("reset_max"))
+	dbpriv_journal_end();
+}
+
+/* Journals OP with arguments A and B, for the many changes described by a
+ * pair of object numbers.
+ */
+static void
+journal_objids(const char *op, Objid a, Objid b)
+{
+    if (dbpriv_journal_begin(op)) {
+	dbio_write_objid(a);
+	dbio_write_objid(b);
+	dbpriv_journal_end();
+    }
 }
 
+#define GROW(array, size) \
+    (array = myrealloc(array, (size) * sizeof(*array), M_OBJECT_TABLE))
+
 static void
 ensure_new_object(void)
 {
     if (max_objects == 0) {
 	max_objects = 100;
 	objects = mymalloc(max_objects * sizeof(Object *), M_OBJECT_TABLE);
+	dbpriv_owner = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_location = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_contents = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_next = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_parent = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_child = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_sibling = mymalloc(max_objects * sizeof(Objid), M_OBJECT_TABLE);
+	dbpriv_flags = mymalloc(max_objects * sizeof(int), M_OBJECT_TABLE);
+	dbpriv_ncontents = mymalloc(max_objects * sizeof(int), M_OBJECT_TABLE);
+	dbpriv_nchildren = mymalloc(max_objects * sizeof(int), M_OBJECT_TABLE);
+	dbpriv_verb_parent = mymalloc(max_objects * sizeof(Objid),
+				      M_OBJECT_TABLE);
+	dbpriv_dirty = mymalloc(max_objects, M_OBJECT_TABLE);
+	memset(dbpriv_dirty, 0, max_objects);
     }
     if (num_objects >= max_objects) {
-	int i;
-	Object **new;
-
-	new = mymalloc(max_objects * 2 * sizeof(Object *), M_OBJECT_TABLE);
-	for (i = 0; i < max_objects; i++)
-	    new[i] = objects[i];
-	myfree(objects, M_OBJECT_TABLE);
-	objects = new;
+	dbpriv_snapshot_lock();
 	max_objects *= 2;
+	GROW(objects, max_objects);
+	GROW(dbpriv_owner, max_objects);
+	GROW(dbpriv_location, max_objects);
+	GROW(dbpriv_contents, max_objects);
+	GROW(dbpriv_next, max_objects);
+	GROW(dbpriv_parent, max_objects);
+	GROW(dbpriv_child, max_objects);
+	GROW(dbpriv_sibling, max_objects);
+	GROW(dbpriv_flags, max_objects);
+	GROW(dbpriv_ncontents, max_objects);
+	GROW(dbpriv_nchildren, max_objects);
+	GROW(dbpriv_verb_parent, max_objects);
+	GROW(dbpriv_dirty, max_objects);
+	memset(dbpriv_dirty + max_objects / 2, 0, max_objects / 2);
+	dbpriv_snapshot_unlock();
     }
 }
 
-Object *
-dbpriv_new_object(void)
+#undef GROW
+
+static void
+clear_hot_fields(Objid oid)
 {
-    Object *o;
+    dbpriv_owner[oid] = NOTHING;
+    dbpriv_location[oid] = dbpriv_contents[oid] = dbpriv_next[oid] = NOTHING;
+    dbpriv_parent[oid] = dbpriv_child[oid] = dbpriv_sibling[oid] = NOTHING;
+    dbpriv_flags[oid] = 0;
+    dbpriv_ncontents[oid] = dbpriv_nchildren[oid] = 0;
+    dbpriv_verb_parent[oid] = NOTHING;
+}
 
-    ensure_new_object();
-    o = objects[num_objects] = mymalloc(sizeof(Object), M_OBJECT);
-    o->id = num_objects;
+static Var
+make_list(Objid first, Objid *next, int count)
+{
+    Var r = new_list(count);
+    Objid c;
+    int i = 0;
+
+    for (c = first; c != NOTHING; c = next[c]) {
+	i++;
+	r.v.list[i].type = TYPE_OBJ;
+	r.v.list[i].v.obj = c;
+    }
+
+    return r;
+}
+
+static void
+forget_list(Var * cache)
+{
+    free_var(*cache);
+    cache->type = TYPE_NONE;
+}
+
+/* A cold object hasn't cached either list yet. */
+static void
+forget_children(Objid oid)
+{
+    Object *o = warm_object(oid);
+
+    if (o)
+	forget_list(&o->children_list);
+}
+
+static void
+forget_contents(Objid oid)
+{
+    Object *o = warm_object(oid);
+
+    if (o)
+	forget_list(&o->contents_list);
+}
+
+/* Loading objects doesn't keep either index up, so it throws them away. */
+static void
+forget_indexes(void)
+{
+    Objid oid;
+
+    free_heap_stale = 1;
+    if (referrers) {
+	for (oid = 0; oid < referrers_size; oid++)
+	    if (referrers[oid].l)
+		myfree(referrers[oid].l, M_OBJECT_TABLE);
+	myfree(referrers, M_OBJECT_TABLE);
+	referrers = 0;
+	if (far_referrers.l)
+	    myfree(far_referrers.l, M_OBJECT_TABLE);
+	far_referrers.l = 0;
+	far_referrers.len = far_referrers.max = 0;
+    }
+}
+
+static Object *
+init_object(Objid oid)
+{
+    Object *o = objects[oid] = mymalloc(sizeof(Object), M_OBJECT);
+
+    o->id = oid;
     o->waif_propdefs = NULL;
-    num_objects++;
+    o->contents_list.type = o->children_list.type = TYPE_NONE;
+    o->lineage.type = TYPE_NONE;
+    clear_hot_fields(oid);
 
     return o;
 }
 
+Object *
+dbpriv_new_object(void)
+{
+    forget_indexes();
+    ensure_new_object();
+    return init_object(num_objects++);
+}
+
 void
 dbpriv_new_recycled_object(void)
 {
+    forget_indexes();
     ensure_new_object();
+    clear_hot_fields(num_objects);
     objects[num_objects++] = 0;
 }
 
+void
+dbpriv_new_cold_object(void)
+{
+    forget_indexes();
+    ensure_new_object();
+    clear_hot_fields(num_objects);
+    objects[num_objects++] = COLD_OBJECT;
+}
+
+Object *
+dbpriv_new_object_at(Objid oid)
+{
+    forget_indexes();
+    while (num_objects <= oid)
+	dbpriv_new_recycled_object();
+    if (objects[oid])
+	panic("DBPRIV_NEW_OBJECT_AT: Slot in use!");
+
+    return init_object(oid);
+}
+
+/* Frees everything an object owns, given the length of its property value
+ * array, and the object itself.
+ */
+static void
+free_object(Object * o, int nprops)
+{
+    Verbdef *v, *w;
+    int i;
+
+    free_str(o->name);
+
+    for (i = 0; i < o->propdefs.cur_length; i++)
+	free_str(o->propdefs.l[i].name);
+    for (i = 0; i < nprops; i++)
+	free_var(o->propval[i].var);
+    if (o->propval)
+	myfree(o->propval, M_PVAL);
+    if (o->propdefs.l)
+	myfree(o->propdefs.l, M_PROPDEF);
+
+    for (v = o->verbdefs; v; v = w) {
+	if (v->program)
+	    free_program(v->program);
+	free_str(v->name);
+	w = v->next;
+	myfree(v, M_VERBDEF);
+    }
+
+    free_var(o->contents_list);
+    free_var(o->children_list);
+    free_var(o->lineage);
+
+    myfree(o, M_OBJECT);
+}
+
+void
+dbpriv_discard_objects(const Objid * oids, Objid count)
+{
+    int *nprops = mymalloc(count * sizeof(int) + 1, M_OBJECT_TABLE);
+    Objid i;
+
+    forget_indexes();
+
+    /* Count everyone's properties while all of their ancestors are still
+     * here to be counted.
+     */
+    for (i = 0; i < count; i++)
+	nprops[i] = warm_object(oids[i]) ? dbpriv_count_properties(oids[i])
+	    : 0;
+    for (i = 0; i < count; i++)
+	if (objects[oids[i]]) {
+	    if (objects[oids[i]] != COLD_OBJECT)
+		free_object(objects[oids[i]], nprops[i]);
+	    objects[oids[i]] = 0;
+	    clear_hot_fields(oids[i]);
+	}
+    myfree(nprops, M_OBJECT_TABLE);
+}
+
+void
+dbpriv_truncate_objects(Objid count)
+{
+    forget_indexes();
+    while (num_objects > count) {
+	if (objects[--num_objects])
+	    panic("DBPRIV_TRUNCATE_OBJECTS: Object still in use!");
+    }
+}
+
+static void
+live_version(Objid oid, Object_Version * v)
+{
+    v->o = valid(oid) ? objects[oid] : 0;
+    if (!v->o)
+	return;
+    v->owner = dbpriv_owner[oid];
+    v->location = dbpriv_location[oid];
+    v->contents = dbpriv_contents[oid];
+    v->next = dbpriv_next[oid];
+    v->parent = dbpriv_parent[oid];
+    v->child = dbpriv_child[oid];
+    v->sibling = dbpriv_sibling[oid];
+    v->flags = dbpriv_flags[oid];
+    v->nprops = v->o == COLD_OBJECT ? 0 : dbpriv_count_properties(oid);
+}
+
+#ifdef SNAPSHOT_CHECKPOINTS
+
+static pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int snapshot_open = 0;
+static Objid snapshot_size;
+static Object_Version **snapshot_versions;
+				/* For each object in the snapshot, 0 while
+				 * the object is unchanged, SNAPSHOT_DONE once
+				 * the writer is done with it, or else the copy
+				 * saved before it first changed. */
+static long snapshot_usecs;	/* time spent saving copies */
+static Object_Version snapshot_done_marker;
+
+#define SNAPSHOT_DONE	(&snapshot_done_marker)
+
+/* Copies everything about O that is saved, sharing values and programs. */
+static Object *
+copy_object(Object * o, int nprops)
+{
+    Object *c = mymalloc(sizeof(Object), M_OBJECT);
+    Verbdef *v, **vp;
+    int i;
+
+    c->id = o->id;
+    c->name = str_ref(o->name);
+
+    vp = &c->verbdefs;
+    for (v = o->verbdefs; v; v = v->next) {
+	*vp = mymalloc(sizeof(Verbdef), M_VERBDEF);
+	**vp = *v;
+	(*vp)->name = str_ref(v->name);
+	if (v->program)
+	    (*vp)->program = program_ref(v->program);
+	vp = &(*vp)->next;
+    }
+    *vp = 0;
+
+    c->propdefs.max_length = c->propdefs.cur_length = o->propdefs.cur_length;
+    c->propdefs.l = 0;
+    if (o->propdefs.cur_length) {
+	c->propdefs.l = mymalloc(o->propdefs.cur_length * sizeof(Propdef),
+				 M_PROPDEF);
+	for (i = 0; i < o->propdefs.cur_length; i++) {
+	    c->propdefs.l[i] = o->propdefs.l[i];
+	    c->propdefs.l[i].name = str_ref(o->propdefs.l[i].name);
+	}
+    }
+
+    c->propval = 0;
+    if (nprops) {
+	c->propval = mymalloc(nprops * sizeof(Pval), M_PVAL);
+	for (i = 0; i < nprops; i++) {
+	    c->propval[i] = o->propval[i];
+	    c->propval[i].var = var_ref(o->propval[i].var);
+	}
+    }
+
+    c->waif_propdefs = 0;
+    c->contents_list.type = c->children_list.type = TYPE_NONE;
+    c->lineage.type = TYPE_NONE;
+
+    return c;
+}
+
+static void
+save_version(Objid oid)
+{
+    Object_Version *v = mymalloc(sizeof(Object_Version), M_OBJECT);
+    struct timeval start, end;
+
+    gettimeofday(&start, 0);
+    /* Only this thread changes objects, so the copy needn't be made under
+     * the lock; the writer may finish with the object meanwhile, though.
+     */
+    live_version(oid, v);
+    if (v->o && v->o != COLD_OBJECT)
+	v->o = copy_object(v->o, v->nprops);
+    pthread_mutex_lock(&snapshot_mutex);
+    if (!snapshot_versions[oid]) {
+	snapshot_versions[oid] = v;
+	v = 0;
+    }
+    pthread_mutex_unlock(&snapshot_mutex);
+    if (v) {
+	if (v->o && v->o != COLD_OBJECT)
+	    free_object(v->o, v->nprops);
+	myfree(v, M_OBJECT);
+    }
+    gettimeofday(&end, 0);
+    snapshot_usecs += (end.tv_sec - start.tv_sec) * 1000000L
+	+ end.tv_usec - start.tv_usec;
+}
+
+void
+dbpriv_open_snapshot(void)
+{
+    size_t size = num_objects * sizeof(Object_Version *);
+
+    snapshot_size = num_objects;
+    snapshot_versions = mymalloc(size + 1, M_OBJECT_TABLE);
+    memset(snapshot_versions, 0, size);
+    snapshot_usecs = 0;
+    snapshot_open = 1;
+}
+
 Objid
-db_create_object(void)
+dbpriv_close_snapshot(long *usecs)
+{
+    Objid oid, count = 0;
+
+    for (oid = 0; oid < snapshot_size; oid++) {
+	Object_Version *v = snapshot_versions[oid];
+
+	if (v && v != SNAPSHOT_DONE) {
+	    if (v->o && v->o != COLD_OBJECT)
+		free_object(v->o, v->nprops);
+	    myfree(v, M_OBJECT);
+	    count++;
+	}
+    }
+    myfree(snapshot_versions, M_OBJECT_TABLE);
+    snapshot_open = 0;
+    *usecs = snapshot_usecs;
+
+    return count;
+}
+
+void
+dbpriv_snapshot_lock(void)
+{
+    pthread_mutex_lock(&snapshot_mutex);
+}
+
+void
+dbpriv_snapshot_unlock(void)
+{
+    pthread_mutex_unlock(&snapshot_mutex);
+}
+
+void
+dbpriv_snapshot_done(Objid oid)
+{
+    if (snapshot_open && !snapshot_versions[oid])
+	snapshot_versions[oid] = SNAPSHOT_DONE;
+}
+
+#else				/* !SNAPSHOT_CHECKPOINTS */
+
+void
+dbpriv_open_snapshot(void)
+{
+    panic("DBPRIV_OPEN_SNAPSHOT: Snapshots not configured!");
+}
+
+Objid
+dbpriv_close_snapshot(long *usecs)
+{
+    *usecs = 0;
+    return 0;
+}
+
+void
+dbpriv_snapshot_lock(void)
+{
+}
+
+void
+dbpriv_snapshot_unlock(void)
+{
+}
+
+void
+dbpriv_snapshot_done(Objid oid)
+{
+    (void) oid;
+}
+
+#endif				/* SNAPSHOT_CHECKPOINTS */
+
+void
+dbpriv_object_version(Objid oid, Object_Version * v)
+{
+#ifdef SNAPSHOT_CHECKPOINTS
+    if (snapshot_open && oid < snapshot_size && snapshot_versions[oid]
+	&& snapshot_versions[oid] != SNAPSHOT_DONE) {
+	*v = *snapshot_versions[oid];
+	return;
+    }
+#endif
+    live_version(oid, v);
+}
+
+void
+dbpriv_mark_dirty(Objid oid)
+{
+    dbpriv_dirty[oid] = 1;
+#ifdef SNAPSHOT_CHECKPOINTS
+    if (snapshot_open && oid < snapshot_size && !snapshot_versions[oid])
+	save_version(oid);
+#endif
+}
+
+void
+dbpriv_mark_all_dirty(void)
+{
+#ifdef SNAPSHOT_CHECKPOINTS
+    Objid oid;
+
+    if (snapshot_open)
+	for (oid = 0; oid < snapshot_size; oid++)
+	    if (!snapshot_versions[oid])
+		save_version(oid);
+#endif
+    memset(dbpriv_dirty, 1, num_objects);
+}
+
+void
+dbpriv_clear_dirty(void)
+{
+    memset(dbpriv_dirty, 0, max_objects);
+}
+
+Objid
+dbpriv_count_dirty(void)
+{
+    Objid oid, count = 0;
+
+    for (oid = 0; oid < num_objects; oid++)
+	count += dbpriv_dirty[oid];
+    return count;
+}
+
+/* Returns the object after OID in a preorder walk of ROOT's subtree, or
+ * NOTHING when the walk is done.  Each object's parent is visited before
+ * the object itself.
+ */
+static Objid
+next_in_subtree(Objid root, Objid oid)
+{
+    if (dbpriv_child[oid] != NOTHING)
+	return dbpriv_child[oid];
+    while (oid != root && dbpriv_sibling[oid] == NOTHING)
+	oid = dbpriv_parent[oid];
+    return oid == root ? NOTHING : dbpriv_sibling[oid];
+}
+
+void
+dbpriv_mark_subtree_dirty(Objid root)
+{
+    Objid oid;
+
+    for (oid = root; oid != NOTHING; oid = next_in_subtree(root, oid))
+	dbpriv_mark_dirty(oid);
+}
+
+void
+dbpriv_fix_verb_parents(Objid root)
+{
+    Objid oid;
+
+    for (oid = root; oid != NOTHING; oid = next_in_subtree(root, oid)) {
+	Objid parent = dbpriv_parent[oid];
+
+	if (has_verbdefs(oid))
+	    dbpriv_verb_parent[oid] = oid;
+	else if (parent == NOTHING)
+	    dbpriv_verb_parent[oid] = NOTHING;
+	else
+	    dbpriv_verb_parent[oid] = dbpriv_verb_parent[parent];
+    }
+}
+
+static void
+invalidate_lineages(Objid root)
+{
+    Objid oid;
+
+    for (oid = root; oid != NOTHING; oid = next_in_subtree(root, oid)) {
+	Object *o = warm_object(oid);
+
+	if (o) {
+	    free_var(o->lineage);
+	    o->lineage.type = TYPE_NONE;
+	}
+    }
+}
+
+static void
+push_free_objid(Objid oid)
+{
+    int i;
+
+    if (free_count == free_max) {
+	free_max = free_max ? 2 * free_max : 100;
+	free_heap = (free_heap
+		     ? myrealloc(free_heap, free_max * sizeof(Objid),
+				 M_OBJECT_TABLE)
+		     : mymalloc(free_max * sizeof(Objid), M_OBJECT_TABLE));
+    }
+    for (i = free_count++; i > 0 && free_heap[(i - 1) / 2] > oid;
+	 i = (i - 1) / 2)
+	free_heap[i] = free_heap[(i - 1) / 2];
+    free_heap[i] = oid;
+}
+
+static void
+pop_free_objid(void)
+{
+    Objid last = free_heap[--free_count];
+    int i = 0, child;
+
+    while ((child = 2 * i + 1) < free_count) {
+	if (child + 1 < free_count && free_heap[child + 1] < free_heap[child])
+	    child++;
+	if (free_heap[child] >= last)
+	    break;
+	free_heap[i] = free_heap[child];
+	i = child;
+    }
+    free_heap[i] = last;
+}
+
+static void
+note_free_objid(Objid oid)
+{
+    if (free_heap_stale)
+	return;
+    else if (free_count >= num_objects)
+	/* Mostly numbers reused since; start over when next needed. */
+	free_heap_stale = 1;
+    else
+	push_free_objid(oid);
+}
+
+/* Returns the lowest recycled object number, or NOTHING if there isn't
+ * one.
+ */
+static Objid
+lowest_free_objid(void)
+{
+    if (free_heap_stale) {
+	Objid oid;
+
+	free_count = 0;
+	for (oid = 0; oid < num_objects; oid++)
+	    if (!objects[oid])
+		push_free_objid(oid);
+	free_heap_stale = 0;
+    }
+    while (free_count > 0
+	   && (free_heap[0] >= num_objects || objects[free_heap[0]]))
+	pop_free_objid();
+
+    return free_count > 0 ? free_heap[0] : NOTHING;
+}
+
+/* Returns true if OID names an owner from LO up to (but not including) HI
+ * for itself or for one of its verbs or properties.  OID may be recycled.
+ */
+static int
+names_owner(Objid oid, Objid lo, Objid hi)
 {
     Object *o;
+    Verbdef *v;
+    Pval *p;
+    int i, count;
+
+#define IN_RANGE(x)	((x) >= lo && (x) < hi)
+
+    if (!valid(oid))
+	return 0;
+    o = objects[oid];
+    if (IN_RANGE(dbpriv_owner[oid]))
+	return 1;
+    for (v = o->verbdefs; v; v = v->next)
+	if (IN_RANGE(v->owner))
+	    return 1;
+    count = dbpriv_count_properties(oid);
+    for (i = 0, p = o->propval; i < count; i++, p++)
+	if (IN_RANGE(p->owner))
+	    return 1;
+
+#undef IN_RANGE
+
+    return 0;
+}
+
+static int
+compare_objids(const void *a, const void *b)
+{
+    Objid x = *(const Objid *) a, y = *(const Objid *) b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Drops the duplicates from R and the objects that no longer name an owner
+ * from LO up to HI.
+ */
+static void
+prune_referrers(Referrers * r, Objid lo, Objid hi)
+{
+    int i, len = 0;
+
+    qsort(r->l, r->len, sizeof(Objid), compare_objids);
+    for (i = 0; i < r->len; i++)
+	if ((len == 0 || r->l[i] != r->l[len - 1])
+	    && names_owner(r->l[i], lo, hi))
+	    r->l[len++] = r->l[i];
+    r->len = len;
+}
+
+static void
+add_referrer(Referrers * r, Objid oid, Objid lo, Objid hi)
+{
+    if (r->len > 0 && r->l[r->len - 1] == oid)
+	return;
+    if (r->len == r->max) {
+	prune_referrers(r, lo, hi);
+	if (r->len * 2 >= r->max) {
+	    r->max = r->max ? 2 * r->max : 4;
+	    r->l = (r->l
+		    ? myrealloc(r->l, r->max * sizeof(Objid), M_OBJECT_TABLE)
+		    : mymalloc(r->max * sizeof(Objid), M_OBJECT_TABLE));
+	}
+    }
+    r->l[r->len++] = oid;
+}
+
+void
+dbpriv_note_owner(Objid oid, Objid owner)
+{
+    if (!referrers || owner < 0)
+	return;
+    else if (owner < referrers_size)
+	add_referrer(&referrers[owner], oid, owner, owner + 1);
+    else
+	add_referrer(&far_referrers, oid, referrers_size, MAXOBJ);
+}
+
+static void
+note_owners(Objid oid)
+{
+    Object *o = objects[oid];
+    Verbdef *v;
+    int i, count;
+
+    dbpriv_note_owner(oid, dbpriv_owner[oid]);
+    for (v = o->verbdefs; v; v = v->next)
+	dbpriv_note_owner(oid, v->owner);
+    count = dbpriv_count_properties(oid);
+    for (i = 0; i < count; i++)
+	dbpriv_note_owner(oid, o->propval[i].owner);
+}
+
+void
+dbpriv_note_subtree_owners(Objid root)
+{
+    Objid oid;
+
+    if (referrers)
+	for (oid = root; oid != NOTHING; oid = next_in_subtree(root, oid))
+	    note_owners(oid);
+}
+
+/* The index covers every object, so building it reads in any cold ones. */
+static void
+read_all_cold_objects(void)
+{
+    Objid oid;
+
+    for (oid = 0; oid < num_objects; oid++)
+	if (objects[oid] == COLD_OBJECT)
+	    read_cold_object(oid);
+}
+
+/* Builds the owner index, or extends it to cover every object number. */
+static void
+index_owners(void)
+{
     Objid oid;
 
-    o = dbpriv_new_object();
-    oid = o->id;
+    if (!referrers) {
+	read_all_cold_objects();
+	referrers_size = max_objects;
+	referrers = mymalloc(referrers_size * sizeof(Referrers),
+			     M_OBJECT_TABLE);
+	memset(referrers, 0, referrers_size * sizeof(Referrers));
+	for (oid = 0; oid < num_objects; oid++)
+	    if (objects[oid])
+		note_owners(oid);
+    } else if (referrers_size < num_objects) {
+	Referrers far = far_referrers;
+	int i;
+
+	referrers = myrealloc(referrers, max_objects * sizeof(Referrers),
+			      M_OBJECT_TABLE);
+	memset(referrers + referrers_size, 0,
+	       (max_objects - referrers_size) * sizeof(Referrers));
+	referrers_size = max_objects;
+	far_referrers.l = 0;
+	far_referrers.len = far_referrers.max = 0;
+	for (i = 0; i < far.len; i++)
+	    if (valid(far.l[i]))
+		note_owners(far.l[i]);
+	if (far.l)
+	    myfree(far.l, M_OBJECT_TABLE);
+    }
+}
+
+Var
+db_owner_references(Objid oid)
+{
+    Referrers *r;
+    Var list;
+    int i;
+
+    index_owners();
+    r = &referrers[oid];
+    prune_referrers(r, oid, oid + 1);
+    list = new_list(r->len);
+    for (i = 0; i < r->len; i++) {
+	list.v.list[i + 1].type = TYPE_OBJ;
+	list.v.list[i + 1].v.obj = r->l[i];
+    }
+
+    return list;
+}
+
+/* Makes a new, empty object numbered OID, which is either recycled or the
+ * next one after the last used.
+ */
+static Objid
+create_object(Objid oid)
+{
+    Object *o;
+
+    PARALLEL_SERIAL();
+    if (oid == num_objects) {
+	ensure_new_object();
+	num_objects++;
+    }
+    dbpriv_mark_dirty(oid);
+    o = init_object(oid);
 
     o->name = str_dup("");
-    o->flags = 0;
-    o->parent = o->child = o->sibling = NOTHING;
-    o->location = o->contents = o->next = NOTHING;
 
     o->propval = 0;
 
@@ -128,25 +982,44 @@ db_create_object(void)
 
     o->verbdefs = 0;
 
+    if (dbpriv_journal_begin("create")) {
+	dbio_write_objid(oid);
+	dbpriv_journal_end();
+    }
+
     return oid;
 }
 
+Objid
+db_create_object(void)
+{
+    return create_object(num_objects);
+}
+
+Objid
+db_create_recycled_object(void)
+{
+    Objid oid = lowest_free_objid();
+
+    return create_object(oid == NOTHING ? num_objects : oid);
+}
+
 void
 db_destroy_object(Objid oid)
 {
     Object *o = dbpriv_find_object(oid);
-    Verbdef *v, *w;
-    int i;
 
+    PARALLEL_SERIAL();
     db_priv_affected_callable_verb_lookup();
 
     if (!o)
 	panic("DB_DESTROY_OBJECT: Invalid object!");
 
-    if (o->location != NOTHING || o->contents != NOTHING
-	|| o->parent != NOTHING || o->child != NOTHING)
+    if (dbpriv_location[oid] != NOTHING || dbpriv_contents[oid] != NOTHING
+	|| dbpriv_parent[oid] != NOTHING || dbpriv_child[oid] != NOTHING)
 	panic("DB_DESTROY_OBJECT: Not a barren orphan!");
 
+    dbpriv_mark_dirty(oid);
     if (is_user(oid)) {
 	Var t;
 
@@ -154,144 +1027,185 @@ db_destroy_object(Objid oid)
 	t.v.obj = oid;
 	all_users = setremove(all_users, t);
     }
-    free_str(o->name);
 
-    for (i = 0; i < o->propdefs.cur_length; i++) {
-	/* As an orphan, the only properties on this object are the ones
-	 * defined on it directly, so these two arrays must be the same length.
-	 */
-	free_str(o->propdefs.l[i].name);
-	free_var(o->propval[i].var);
-    }
-    if (o->propval)
-	myfree(o->propval, M_PVAL);
-    if (o->propdefs.l)
-	myfree(o->propdefs.l, M_PROPDEF);
+    /* As an orphan, the only properties on this object are the ones
+     * defined on it directly, so its two property arrays are the same
+     * length.
+     */
+    free_object(o, o->propdefs.cur_length);
+    objects[oid] = 0;
+    clear_hot_fields(oid);
+    note_free_objid(oid);
 
-    for (v = o->verbdefs; v; v = w) {
-	if (v->program)
-	    free_program(v->program);
-	free_str(v->name);
-	w = v->next;
-	myfree(v, M_VERBDEF);
+    if (dbpriv_journal_begin("destroy")) {
+	dbio_write_objid(oid);
+	dbpriv_journal_end();
     }
+}
 
-    myfree(objects[oid], M_OBJECT);
-    objects[oid] = 0;
+/* Replaces FROM by TO wherever OID names FROM as an owner. */
+static void
+replace_owner(Objid oid, Objid from, Objid to)
+{
+    Object *o = objects[oid];
+    Verbdef *v;
+    Pval *p;
+    int i, count;
+
+    if (dbpriv_owner[oid] == from)
+	dbpriv_owner[oid] = to;
+    for (v = o->verbdefs; v; v = v->next)
+	if (v->owner == from)
+	    v->owner = to;
+    count = dbpriv_count_properties(oid);
+    for (i = 0, p = o->propval; i < count; i++, p++)
+	if (p->owner == from)
+	    p->owner = to;
 }
 
 Objid
 db_renumber_object(Objid old)
 {
-    Objid new;
-    Object *o;
+    Objid new = lowest_free_objid();
+    Objid *refs;
+    int i, nrefs;
 
+    PARALLEL_SERIAL();
     db_priv_affected_callable_verb_lookup();
 
-    for (new = 0; new < old; new++) {
-	if (objects[new] == 0) {
-	    /* Change the identity of the object. */
-	    o = objects[new] = objects[old];
-	    objects[old] = 0;
-	    objects[new]->id = new;
-
-	    /* Fix up the parent/children hierarchy */
-	    {
-		Objid oid, *oidp;
-
-		if (o->parent != NOTHING) {
-		    oidp = &objects[o->parent]->child;
-		    while (*oidp != old && *oidp != NOTHING)
-			oidp = &objects[*oidp]->sibling;
-		    if (*oidp == NOTHING)
-			panic("Object not in parent's children list");
-		    *oidp = new;
-		}
-		for (oid = o->child;
-		     oid != NOTHING;
-		     oid = objects[oid]->sibling)
-		    objects[oid]->parent = new;
-	    }
-
-	    /* Fix up the location/contents hierarchy */
-	    {
-		Objid oid, *oidp;
-
-		if (o->location != NOTHING) {
-		    oidp = &objects[o->location]->contents;
-		    while (*oidp != old && *oidp != NOTHING)
-			oidp = &objects[*oidp]->next;
-		    if (*oidp == NOTHING)
-			panic("Object not in location's contents list");
-		    *oidp = new;
-		}
-		for (oid = o->contents;
-		     oid != NOTHING;
-		     oid = objects[oid]->next)
-		    objects[oid]->location = new;
-	    }
-
-	    /* Fix up the list of users, if necessary */
-	    if (is_user(new)) {
-		int i;
+    /* There are no recycled objects less than `old', so keep its number. */
+    if (new == NOTHING || new > old)
+	return old;
+
+    /* Besides the neighbours of `old' in the hierarchies, only the objects
+     * that may name `old' or `new' as an owner need fixing.  A cold object
+     * is found in the DB file by its number, so `old' is read in first.
+     */
+    dbpriv_find_object(old);
+    index_owners();
+    nrefs = referrers[old].len + referrers[new].len;
+    refs = mymalloc(nrefs * sizeof(Objid) + 1, M_OBJECT_TABLE);
+    memcpy(refs, referrers[old].l, referrers[old].len * sizeof(Objid));
+    memcpy(refs + referrers[old].len, referrers[new].l,
+	   referrers[new].len * sizeof(Objid));
+    referrers[old].len = referrers[new].len = 0;
+    qsort(refs, nrefs, sizeof(Objid), compare_objids);
+
+    dbpriv_mark_dirty(old);
+    dbpriv_mark_dirty(new);
+
+    /* Change the identity of the object. */
+    objects[new] = objects[old];
+    objects[old] = 0;
+    objects[new]->id = new;
+
+    dbpriv_owner[new] = dbpriv_owner[old];
+    dbpriv_location[new] = dbpriv_location[old];
+    dbpriv_contents[new] = dbpriv_contents[old];
+    dbpriv_next[new] = dbpriv_next[old];
+    dbpriv_parent[new] = dbpriv_parent[old];
+    dbpriv_child[new] = dbpriv_child[old];
+    dbpriv_sibling[new] = dbpriv_sibling[old];
+    dbpriv_flags[new] = dbpriv_flags[old];
+    dbpriv_ncontents[new] = dbpriv_ncontents[old];
+    dbpriv_nchildren[new] = dbpriv_nchildren[old];
+    clear_hot_fields(old);
+    note_free_objid(old);
+
+    /* Fix up the parent/children hierarchy */
+    {
+	Objid oid, prev, *oidp;
+
+	if ((prev = dbpriv_parent[new]) != NOTHING) {
+	    oidp = &dbpriv_child[prev];
+	    while (*oidp != old && *oidp != NOTHING)
+		oidp = &dbpriv_sibling[prev = *oidp];
+	    if (*oidp == NOTHING)
+		panic("Object not in parent's children list");
+	    dbpriv_mark_dirty(prev);
+	    *oidp = new;
+	    forget_children(dbpriv_parent[new]);
+	}
+	for (oid = dbpriv_child[new];
+	     oid != NOTHING;
+	     oid = dbpriv_sibling[oid]) {
+	    dbpriv_mark_dirty(oid);
+	    dbpriv_parent[oid] = new;
+	}
+    }
+    dbpriv_fix_verb_parents(new);
+    invalidate_lineages(new);
+
+    /* Fix up the location/contents hierarchy */
+    {
+	Objid oid, prev, *oidp;
+
+	if ((prev = dbpriv_location[new]) != NOTHING) {
+	    oidp = &dbpriv_contents[prev];
+	    while (*oidp != old && *oidp != NOTHING)
+		oidp = &dbpriv_next[prev = *oidp];
+	    if (*oidp == NOTHING)
+		panic("Object not in location's contents list");
+	    dbpriv_mark_dirty(prev);
+	    *oidp = new;
+	    forget_contents(dbpriv_location[new]);
+	}
+	for (oid = dbpriv_contents[new];
+	     oid != NOTHING;
+	     oid = dbpriv_next[oid]) {
+	    dbpriv_mark_dirty(oid);
+	    dbpriv_location[oid] = new;
+	}
+    }
 
-		for (i = 1; i <= all_users.v.list[0].v.num; i++)
-		    if (all_users.v.list[i].v.obj == old) {
-			all_users.v.list[i].v.obj = new;
-			break;
-		    }
-	    }
-	    /* Fix the owners of verbs, properties and objects */
-	    {
-		Objid oid;
-
-		for (oid = 0; oid < num_objects; oid++) {
-		    Object *o = objects[oid];
-		    Verbdef *v;
-		    Pval *p;
-		    int i, count;
-
-		    if (!o)
-			continue;
-
-		    if (o->owner == new)
-			o->owner = NOTHING;
-		    else if (o->owner == old)
-			o->owner = new;
-
-		    for (v = o->verbdefs; v; v = v->next)
-			if (v->owner == new)
-			    v->owner = NOTHING;
-			else if (v->owner == old)
-			    v->owner = new;
-
-		    count = dbpriv_count_properties(oid);
-		    p = o->propval;
-		    for (i = 0; i < count; i++)
-			if (p[i].owner == new)
-			    p[i].owner = NOTHING;
-			else if (p[i].owner == old)
-			    p[i].owner = new;
-		}
+    /* Fix up the list of users, if necessary */
+    if (is_user(new)) {
+	for (i = 1; i <= all_users.v.list[0].v.num; i++)
+	    if (all_users.v.list[i].v.obj == old) {
+		all_users.v.list[i].v.obj = new;
+		break;
 	    }
+    }
 
-	    return new;
+    /* Fix the owners of verbs, properties and objects.  Any object listed
+     * as `new' is a stale entry for the recycled one.
+     */
+    for (i = 0; i < nrefs; i++) {
+	Objid oid = refs[i] == old ? new : refs[i];
+
+	if (refs[i] == new || (i > 0 && refs[i] == refs[i - 1])
+	    || !valid(oid))
+	    continue;
+	if (names_owner(oid, new, new + 1) || names_owner(oid, old, old + 1)) {
+	    dbpriv_mark_dirty(oid);
+	    replace_owner(oid, new, NOTHING);
+	    replace_owner(oid, old, new);
+	    if (names_owner(oid, new, new + 1))
+		add_referrer(&referrers[new], oid, new, new + 1);
 	}
     }
+    myfree(refs, M_OBJECT_TABLE);
+    /* The other lists name the object by its old number. */
+    note_owners(new);
 
-    /* There are no recycled objects less than `old', so keep its number. */
-    return old;
+    journal_objids("renumber", old, new);
+    return new;
 }
 
+/* Bytes used by one object's share of the parallel arrays */
+#define HOT_FIELD_BYTES	(8 * sizeof(Objid) + 3 * sizeof(int))
+
 int
 db_object_bytes(Objid oid)
 {
-    Object *o = objects[oid];
+    Object *o = dbpriv_find_object(oid);
     int i, len, count;
     Verbdef *v;
 
-    count = sizeof(Object) + sizeof(Object *);
+    count = sizeof(Object) + sizeof(Object *) + HOT_FIELD_BYTES;
     count += memo_strlen(o->name) + 1;
+    if (o->lineage.type == TYPE_LIST)
+	count += value_bytes(o->lineage);
 
     for (v = o->verbdefs; v; v = v->next) {
 	count += sizeof(Verbdef);
@@ -318,47 +1232,66 @@ db_object_bytes(Objid oid)
 Objid
 db_object_owner(Objid oid)
 {
-    return objects[oid]->owner;
+    PARALLEL_READ(oid, PSLOT_OWNER);
+    return dbpriv_owner[oid];
 }
 
 void
 db_set_object_owner(Objid oid, Objid owner)
 {
-    objects[oid]->owner = owner;
+    PARALLEL_WRITE(oid, PSLOT_OWNER);
+    dbpriv_mark_dirty(oid);
+    dbpriv_owner[oid] = owner;
+    dbpriv_note_owner(oid, owner);
+    journal_objids("owner", oid, owner);
 }
 
 const char *
 db_object_name(Objid oid)
 {
-    return objects[oid]->name;
+    PARALLEL_READ(oid, PSLOT_NAME);
+    return dbpriv_find_object(oid)->name;
 }
 
 void
 db_set_object_name(Objid oid, const char *name)
 {
-    Object *o = objects[oid];
+    Object *o = dbpriv_find_object(oid);
 
+    PARALLEL_WRITE(oid, PSLOT_NAME);
+    dbpriv_mark_dirty(oid);
     if (o->name)
 	free_str(o->name);
     o->name = name;
+
+    if (dbpriv_journal_begin("name")) {
+	dbio_write_objid(oid);
+	dbio_write_string(name);
+	dbpriv_journal_end();
+    }
 }
 
 Objid
 db_object_parent(Objid oid)
 {
-    return objects[oid]->parent;
+    return dbpriv_parent[oid];
 }
 
 int
 db_count_children(Objid oid)
 {
-    Objid c;
-    int i = 0;
+    return dbpriv_nchildren[oid];
+}
 
-    for (c = objects[oid]->child; c != NOTHING; c = objects[c]->sibling)
-	i++;
+Var
+db_children_list(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
 
-    return i;
+    if (o->children_list.type == TYPE_NONE)
+	o->children_list = make_list(dbpriv_child[oid], dbpriv_sibling,
+				     dbpriv_nchildren[oid]);
+    return var_ref(o->children_list);
 }
 
 int
@@ -366,41 +1299,107 @@ db_for_all_children(Objid oid, int (*func) (void *, Objid), void *data)
 {
     Objid c;
 
-    for (c = objects[oid]->child; c != NOTHING; c = objects[c]->sibling)
+    for (c = dbpriv_child[oid]; c != NOTHING; c = dbpriv_sibling[c])
 	if (func(data, c))
 	    return 1;
 
     return 0;
 }
 
+static Var
+lineage(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
+
+    if (o->lineage.type == TYPE_NONE) {
+	Objid parent = dbpriv_parent[oid];
+	Var l;
+
+	if (parent == NOTHING) {
+	    l = new_list(1);
+	} else {
+	    Var pl = lineage(parent);
+	    int i;
+
+	    l = new_list(pl.v.list[0].v.num + 1);
+	    for (i = 1; i <= pl.v.list[0].v.num; i++)
+		l.v.list[i + 1] = pl.v.list[i];
+	}
+	l.v.list[1].type = TYPE_OBJ;
+	l.v.list[1].v.obj = oid;
+	o->lineage = l;
+    }
+    return o->lineage;
+}
+
+Var
+db_object_ancestors(Objid oid)
+{
+    Objid parent = dbpriv_parent[oid];
+
+    if (parent == NOTHING)
+	return new_list(0);
+    return var_ref(lineage(parent));
+}
+
+int
+db_object_isa(Objid oid, Objid ancestor)
+{
+    Objid parent = dbpriv_parent[oid];
+    Var l;
+    int i;
+
+    /* Check against the parent's lineage, rather than OID's own, so that
+     * leaf objects never need one of their own.
+     */
+    if (oid == ancestor)
+	return 1;
+    if (parent == NOTHING)
+	return 0;
+    l = lineage(parent);
+    for (i = 1; i <= l.v.list[0].v.num; i++)
+	if (l.v.list[i].v.obj == ancestor)
+	    return 1;
+
+    return 0;
+}
+
+/* These mark every object whose links they change as dirty, except WHAT,
+ * which the caller must have marked already.
+ */
+
 #define LL_REMOVE(where, listname, what, nextname) { \
     Objid lid; \
-    if (objects[where]->listname == what) \
-	objects[where]->listname = objects[what]->nextname; \
-    else { \
-	for (lid = objects[where]->listname; lid != NOTHING; \
-	      lid = objects[lid]->nextname) { \
-	    if (objects[lid]->nextname == what) { \
-		objects[lid]->nextname = objects[what]->nextname; \
+    if (listname[where] == what) { \
+	dbpriv_mark_dirty(where); \
+	listname[where] = nextname[what]; \
+    } else { \
+	for (lid = listname[where]; lid != NOTHING; \
+	      lid = nextname[lid]) { \
+	    if (nextname[lid] == what) { \
+		dbpriv_mark_dirty(lid); \
+		nextname[lid] = nextname[what]; \
 		break; \
 	    } \
 	} \
     } \
-    objects[what]->nextname = NOTHING; \
+    nextname[what] = NOTHING; \
 }
 
 #define LL_APPEND(where, listname, what, nextname) { \
     Objid lid; \
-    if (objects[where]->listname == NOTHING) { \
-	objects[where]->listname = what; \
+    if (listname[where] == NOTHING) { \
+	dbpriv_mark_dirty(where); \
+	listname[where] = what; \
     } else { \
-	for (lid = objects[where]->listname; \
-	     objects[lid]->nextname != NOTHING; \
-	     lid = objects[lid]->nextname) \
+	for (lid = listname[where]; \
+	     nextname[lid] != NOTHING; \
+	     lid = nextname[lid]) \
 	    ; \
-	objects[lid]->nextname = what; \
+	dbpriv_mark_dirty(lid); \
+	nextname[lid] = what; \
     } \
-    objects[what]->nextname = NOTHING; \
+    nextname[what] = NOTHING; \
 }
 
 int
@@ -411,7 +1410,9 @@ db_change_parent(Objid oid, Objid parent)
     if (!dbpriv_check_properties_for_chparent(oid, parent))
 	return 0;
 
-    if (objects[oid]->child == NOTHING && objects[oid]->verbdefs == NULL) {
+    PARALLEL_SERIAL();
+
+    if (dbpriv_child[oid] == NOTHING && !has_verbdefs(oid)) {
 	/* Since this object has no children and no verbs, we know that it
 	   can't have had any part in affecting verb lookup, since we use first
 	   parent with verbs as a key in the verb lookup cache. */
@@ -424,36 +1425,56 @@ db_change_parent(Objid oid, Objid parent)
 	db_priv_affected_callable_verb_lookup();
     }
 
-    old_parent = objects[oid]->parent;
+    old_parent = dbpriv_parent[oid];
 
-    if (old_parent != NOTHING)
-	LL_REMOVE(old_parent, child, oid, sibling);
+    /* Everything below OID inherits a different set of properties. */
+    dbpriv_mark_subtree_dirty(oid);
 
-    if (parent != NOTHING)
-	LL_APPEND(parent, child, oid, sibling);
+    if (old_parent != NOTHING) {
+	LL_REMOVE(old_parent, dbpriv_child, oid, dbpriv_sibling);
+	dbpriv_nchildren[old_parent]--;
+	forget_children(old_parent);
+    }
+    if (parent != NOTHING) {
+	LL_APPEND(parent, dbpriv_child, oid, dbpriv_sibling);
+	dbpriv_nchildren[parent]++;
+	forget_children(parent);
+    }
 
-    objects[oid]->parent = parent;
+    dbpriv_parent[oid] = parent;
+    dbpriv_fix_verb_parents(oid);
+    invalidate_lineages(oid);
     dbpriv_fix_properties_after_chparent(oid, old_parent);
+    dbpriv_note_subtree_owners(oid);
 
+    journal_objids("parent", oid, parent);
     return 1;
 }
 
 Objid
 db_object_location(Objid oid)
 {
-    return objects[oid]->location;
+    PARALLEL_READ(oid, PSLOT_LOCATION);
+    return dbpriv_location[oid];
 }
 
 int
 db_count_contents(Objid oid)
 {
-    Objid c;
-    int i = 0;
+    PARALLEL_READ(oid, PSLOT_CONTENTS);
+    return dbpriv_ncontents[oid];
+}
 
-    for (c = objects[oid]->contents; c != NOTHING; c = objects[c]->next)
-	i++;
+Var
+db_contents_list(Objid oid)
+{
+    Object *o = dbpriv_find_object(oid);
 
-    return i;
+    PARALLEL_READ(oid, PSLOT_CONTENTS);
+    if (o->contents_list.type == TYPE_NONE)
+	o->contents_list = make_list(dbpriv_contents[oid], dbpriv_next,
+				     dbpriv_ncontents[oid]);
+    return var_ref(o->contents_list);
 }
 
 int
@@ -461,7 +1482,8 @@ db_for_all_contents(Objid oid, int (*func) (void *, Objid), void *data)
 {
     Objid c;
 
-    for (c = objects[oid]->contents; c != NOTHING; c = objects[c]->next)
+    PARALLEL_READ(oid, PSLOT_CONTENTS);
+    for (c = dbpriv_contents[oid]; c != NOTHING; c = dbpriv_next[c])
 	if (func(data, c))
 	    return 1;
 
@@ -471,27 +1493,55 @@ db_for_all_contents(Objid oid, int (*func) (void *, Objid), void *data)
 void
 db_change_location(Objid oid, Objid location)
 {
-    Objid old_location = objects[oid]->location;
-
-    if (valid(old_location))
-	LL_REMOVE(old_location, contents, oid, next);
-
-    if (valid(location))
-	LL_APPEND(location, contents, oid, next);
+    Objid old_location = dbpriv_location[oid];
+
+    PARALLEL_WRITE(oid, PSLOT_LOCATION);
+    PARALLEL_WRITE(old_location, PSLOT_CONTENTS);
+    PARALLEL_WRITE(location, PSLOT_CONTENTS);
+    dbpriv_mark_dirty(oid);
+    if (valid(old_location)) {
+	LL_REMOVE(old_location, dbpriv_contents, oid, dbpriv_next);
+	dbpriv_ncontents[old_location]--;
+	forget_contents(old_location);
+    }
+    if (valid(location)) {
+	LL_APPEND(location, dbpriv_contents, oid, dbpriv_next);
+	dbpriv_ncontents[location]++;
+	forget_contents(location);
+    }
 
-    objects[oid]->location = location;
+    dbpriv_location[oid] = location;
+    journal_objids("location", oid, location);
 }
 
 int
 db_object_has_flag(Objid oid, db_object_flag f)
 {
-    return (objects[oid]->flags & (1 << f)) != 0;
+    PARALLEL_READ(oid, PSLOT_FLAGS);
+    return (dbpriv_flags[oid] & (1 << f)) != 0;
+}
+
+/* Called before F is changed. */
+static void
+flag_changing(Objid oid, db_object_flag f, int on)
+{
+    PARALLEL_WRITE(oid, PSLOT_FLAGS);
+    if (f >= FLAG_FIRST_TEMP)	/* not saved */
+	return;
+    dbpriv_mark_dirty(oid);
+    if (dbpriv_journal_begin("flag")) {
+	dbio_write_objid(oid);
+	dbio_write_num(f);
+	dbio_write_num(on);
+	dbpriv_journal_end();
+    }
 }
 
 void
 db_set_object_flag(Objid oid, db_object_flag f)
 {
-    objects[oid]->flags |= (1 << f);
+    flag_changing(oid, f, 1);
+    dbpriv_flags[oid] |= (1 << f);
     if (f == FLAG_USER) {
 	Var v;
 
@@ -504,7 +1554,8 @@ db_set_object_flag(Objid oid, db_object_flag f)
 void
 db_clear_object_flag(Objid oid, db_object_flag f)
 {
-    objects[oid]->flags &= ~(1 << f);
+    flag_changing(oid, f, 0);
+    dbpriv_flags[oid] &= ~(1 << f);
     if (f == FLAG_USER) {
 	Var v;
 
@@ -58,26 +58,27 @@ typedef struct Pval {
     short perms;
 } Pval;
 
+/* The hot fields of an object (its place in the parent and location
+ * hierarchies, its owner and flags) live in the dbpriv_* arrays below,
+ * indexed by object number.  Object holds only the rest.
+ */
 typedef struct Object {
     Objid id;
-    Objid owner;
-    Objid location;
-    Objid contents;
-    Objid next;
-
-    Objid parent;
-    Objid child;
-    Objid sibling;
-
 
     const char *name;
-    int flags;
 
     Verbdef *verbdefs;
     Proplist propdefs;
     Pval *propval;
 
     void *waif_propdefs;
+
+    Var contents_list;		/* caches of contents and children() as */
+    Var children_list;		/* lists, TYPE_NONE until next asked for */
+
+    Var lineage;		/* {id, parent, grandparent, ...}, shared as
+				 * the ancestors() of all of id's children;
+				 * TYPE_NONE until computed */
 } Object;
 
 /*********** Verb cache support ***********/
@@ -123,6 +124,133 @@ extern void dbpriv_new_recycled_object(void);
 
 extern Object *dbpriv_find_object(Objid);
 				/* Returns 0 if given object is not valid.
+				 * A cold object is read in first.
+				 */
+
+/* With LAZY_DB_LOAD, the objects of a binary DB start out `cold': only the
+ * parallel arrays are filled in at load time, and the rest of each object
+ * stays in the mapped file until dbpriv_find_object() first asks for it.
+ * The table holds this marker for such an object meanwhile.  The ancestors
+ * of an object in memory are always in memory too.
+ */
+extern Object dbpriv_cold_object;
+#define COLD_OBJECT	(&dbpriv_cold_object)
+
+extern void dbpriv_new_cold_object(void);
+				/* Like dbpriv_new_object(), but leaves the
+				 * object cold.
+				 */
+extern void dbpriv_read_cold_object(Object *);
+				/* Fills in everything but the parallel arrays
+				 * for the given cold object from the DB file
+				 * (in db_file.c).
+				 */
+
+extern Object *dbpriv_new_object_at(Objid);
+				/* Like dbpriv_new_object(), but for the given
+				 * number, which must be free.  Numbers skipped
+				 * over on the way are left recycled.
+				 */
+
+extern void dbpriv_discard_objects(const Objid *oids, Objid count);
+				/* Frees the given objects, any of which may
+				 * already be recycled, leaving their numbers
+				 * recycled.  Unlike db_destroy_object(), the
+				 * objects needn't be orphans; nothing pointing
+				 * at them is fixed up.
+				 */
+
+extern void dbpriv_truncate_objects(Objid count);
+				/* Forgets all object numbers from COUNT on,
+				 * all of which must be recycled.
+				 */
+
+/* renumber() and owner_references() use an index from each object number to
+ * the objects that name it as an owner.  Once it exists, every change of an
+ * owner is reported to it, after the change is complete.
+ */
+extern void dbpriv_note_owner(Objid oid, Objid owner);
+				/* OID now names OWNER as the owner of itself
+				 * or of one of its verbs or properties.
+				 */
+extern void dbpriv_note_subtree_owners(Objid root);
+				/* Any property owner anywhere under ROOT may
+				 * have changed.
+				 */
+
+/* One flag per object number, set just before anything about the object
+ * that is saved in the database changes.  The incremental checkpoints in
+ * db_file.c write only the objects marked here.
+ */
+extern char *dbpriv_dirty;
+
+extern void dbpriv_mark_dirty(Objid);
+extern void dbpriv_mark_subtree_dirty(Objid);
+				/* Marks the object and all its descendants,
+				 * whose property values depend on what it
+				 * defines and inherits.
+				 */
+extern void dbpriv_mark_all_dirty(void);
+extern void dbpriv_clear_dirty(void);
+extern Objid dbpriv_count_dirty(void);
+
+/* Everything about an object that is saved in the database. */
+typedef struct Object_Version {
+    Object *o;			/* 0 if the object is recycled, or
+				 * COLD_OBJECT */
+    Objid owner;
+    Objid location, contents, next;
+    Objid parent, child, sibling;
+    int flags;
+    int nprops;			/* the length of o->propval, unless cold */
+} Object_Version;
+
+extern void dbpriv_object_version(Objid, Object_Version *);
+				/* Fills in the given object as it is now or,
+				 * while a snapshot is open, as it was when
+				 * the snapshot was taken.
+				 */
+
+/* A snapshot lets another thread write out the database as it was when the
+ * snapshot was opened while the main thread goes on changing it.  Until the
+ * writer says it is done with an object, dbpriv_mark_dirty() saves a copy of
+ * the object as it was before its first change, so every change must be
+ * preceded by marking each object it affects.  The writer reads each object
+ * between dbpriv_snapshot_lock() and dbpriv_snapshot_unlock(), which also
+ * keep the object tables from moving under it; only the main thread opens
+ * and closes snapshots.
+ */
+extern void dbpriv_open_snapshot(void);
+extern Objid dbpriv_close_snapshot(long *usecs);
+				/* Frees the saved copies, returning how many
+				 * there were and setting *USECS to the time
+				 * spent making them.
+				 */
+extern void dbpriv_snapshot_lock(void);
+extern void dbpriv_snapshot_unlock(void);
+extern void dbpriv_snapshot_done(Objid);
+
+/* Parallel arrays of the hot per-object fields.  Walking up the parent
+ * chain, checking flags or moving an object touches only these, never the
+ * Object itself.  Entries for recycled objects are meaningless.
+ */
+extern Objid *dbpriv_owner;
+extern Objid *dbpriv_location, *dbpriv_contents, *dbpriv_next;
+extern Objid *dbpriv_parent, *dbpriv_child, *dbpriv_sibling;
+extern int *dbpriv_flags;
+extern int *dbpriv_ncontents, *dbpriv_nchildren;
+
+extern Objid *dbpriv_verb_parent;
+				/* The nearest of an object and its ancestors
+				 * that defines any verbs, or NOTHING.  This
+				 * is the key for the callable verb cache.
+				 */
+
+extern void dbpriv_fix_verb_parents(Objid);
+				/* Recompute dbpriv_verb_parent for the given
+				 * object and its descendants.  Must be called
+				 * whenever the object's parent changes or it
+				 * gains its first verb or loses its last one.
 				 */
 
 /*********** Properties ***********/
@@ -164,6 +292,139 @@ extern Exception dbpriv_dbio_failed;
 
 extern void dbpriv_set_dbio_input(FILE *);
 extern void dbpriv_set_dbio_output(FILE *);
+				/* Both of these also select the text format.
+				 */
+
+extern int dbpriv_begin_dbio_dump(int fd, int compress);
+extern int dbpriv_end_dbio_dump(int success);
+				/* Send output to the file descriptor FD, in
+				 * the text format, through a large buffer and
+				 * compressed with zlib if COMPRESS, until the
+				 * end, which writes out whatever is left if
+				 * SUCCESS and returns whether that worked.
+				 * The begin returns false if the dump can't
+				 * be made as asked.
+				 */
+
+extern int dbpriv_dbio_compressed(FILE *);
+extern char *dbpriv_dbio_inflate(FILE *, size_t * size);
+				/* Tell whether a DB file is compressed, and
+				 * return its uncompressed contents in memory
+				 * from M_DB_LOAD, or 0 on failure.
+				 */
+
+/* The binary DB format encodes the same values as the text format, but
+ * numbers are zig-zag varints, floats are 8 raw bytes and strings are a
+ * varint length followed by the bytes and a null.  Input in this format
+ * is decoded straight out of a block of memory.
+ */
+extern void dbpriv_set_dbio_binary_input(const char *start,
+					 const char *end);
+extern uint64_t dbpriv_dbio_read_fixed64(void);
+extern const char *dbpriv_dbio_input_position(void);
+				/* Where the next binary input comes from. */
+
+typedef struct Saved_Input {
+    FILE *input;
+    int binary;
+    const char *pos, *end;
+    DB_Version version;
+} Saved_Input;
+
+extern void dbpriv_save_dbio_input(Saved_Input *);
+extern void dbpriv_restore_dbio_input(const Saved_Input *);
+				/* Lets a cold object be read in, in the
+				 * middle of reading something else.
+				 */
+
+extern Exception dbpriv_dbio_truncated;
+				/* Raised by DBIO when binary input runs past
+				 * the end of its block.
+				 */
+
+extern void dbpriv_set_dbio_binary_output(int);
+				/* Switches the current output between the
+				 * text and binary formats.
+				 */
+extern long dbpriv_dbio_output_position(void);
+extern void dbpriv_dbio_write_fixed64(uint64_t);
+
+extern void dbpriv_dbio_write_text(void (*writer) (void));
+extern int dbpriv_dbio_read_text(int (*reader) (void));
+				/* Embed a stretch of text-format output, as
+				 * produced by WRITER, in binary output as a
+				 * single string, and read it back the same
+				 * way.
+				 */
+
+extern char *dbpriv_dbio_capture_text(void (*writer) (void), size_t * len);
+				/* Returns, as a new string of length *LEN for
+				 * the caller to free, the text-format output
+				 * of WRITER.
+				 */
+extern void dbpriv_dbio_write_bytes(const char *, size_t);
+				/* Copies output captured earlier into the
+				 * current output as it stands.
+				 */
+
+extern char *dbpriv_dbio_read_program_source(void);
+				/* Reads the source of a verb program, as
+				 * dbio_read_program() would, without parsing
+				 * it.  For a binary DB the result points into
+				 * the input block; otherwise it is a new
+				 * string for the caller to free.
+				 */
+extern Program *dbpriv_dbio_compile_program(DB_Version, const char *source,
+					    const char *(*fmtr) (void *),
+					    void *data);
+				/* Parses SOURCE, reporting errors as
+				 * dbio_read_program() does.  This may be
+				 * called on several threads at once.
+				 */
+
+/*********** Journal ***********/
+
+extern int dbpriv_journal_begin(const char *op);
+extern void dbpriv_journal_write_var(Var, int placeholder);
+extern void dbpriv_journal_end(void);
+				/* A mutator journals a change with
+				 *   if (dbpriv_journal_begin("op")) {
+				 *	dbio_write_...(...);
+				 *	dbpriv_journal_end();
+				 *   }
+				 * writing values with dbpriv_journal_write_var()
+				 * rather than dbio_write_var().  The begin
+				 * returns false if nothing is being journaled.
+				 * A value that can't be journaled (one holding
+				 * a WAIF) is written as 0 if PLACEHOLDER, for
+				 * records whose other effects must still be
+				 * replayed, and otherwise drops the record.
+				 */
+
+extern void dbpriv_journal_flush(int sync);
+				/* Writes out the records made so far, and
+				 * fsync()s the journal if SYNC is true or it
+				 * hasn't been for JOURNAL_SYNC_MSECS.
+				 */
+
+extern Num dbpriv_journal_checkpoint(int reopen);
+				/* Ends the current journal segment, starting
+				 * a new one if REOPEN, and returns the stamp
+				 * for the checkpoint being made.
+				 */
+extern void dbpriv_journal_discard(Num stamp);
+				/* Removes the segments made obsolete by a
+				 * checkpoint with the given stamp.
+				 */
+extern const char *dbpriv_journal_name(void);
+				/* Returns the name the segments are named
+				 * after, or 0 if nothing is being journaled.
+				 */
+extern int dbpriv_journal_replay(const char *base, Num stamp);
+				/* Replays the segments named after BASE from
+				 * STAMP onward and starts journaling; returns
+				 * false if they don't fit the database.
+				 */
 
 #endif /* DB_PRIVATE_h */
 
@@ -21,8 +21,10 @@
 
 #include "config.h"
 #include "db.h"
+#include "db_io.h"
 #include "db_private.h"
 #include "list.h"
+#include "parallel.h"
 #include "storage.h"
 #include "utils.h"
 #include "waif.h"
@@ -43,7 +45,8 @@ dbpriv_count_properties(Objid oid)
     Object *o;
     int nprops = 0;
 
-    for (o = dbpriv_find_object(oid); o; o = dbpriv_find_object(o->parent))
+    for (o = dbpriv_find_object(oid); o;
+	 o = dbpriv_find_object(dbpriv_parent[o->id]))
 	nprops += o->propdefs.cur_length;
 
     return nprops;
@@ -64,9 +67,9 @@ property_defined_at_or_below(const char *pname, int phash, Objid oid)
 	    && !mystrcasecmp(props->l[i].name, pname))
 	    return 1;
 
-    for (c = dbpriv_find_object(oid)->child;
+    for (c = dbpriv_child[oid];
 	 c != NOTHING;
-	 c = dbpriv_find_object(c)->sibling)
+	 c = dbpriv_sibling[c])
 	if (property_defined_at_or_below(pname, phash, c))
 	    return 1;
 
@@ -84,6 +87,7 @@ insert_prop(Objid oid, int pos, Pval pval)
     new_propval = mymalloc(nprops * sizeof(Pval), M_PVAL);
 
     o = dbpriv_find_object(oid);
+    dbpriv_mark_dirty(oid);
 
     free_waif_propdefs(o->waif_propdefs);
     o->waif_propdefs = NULL;
@@ -94,7 +98,7 @@ insert_prop(Objid oid, int pos, Pval pval)
     new_propval[pos] = pval;
     new_propval[pos].var = var_ref(pval.var);
     if (new_propval[pos].perms & PF_CHOWN)
-	new_propval[pos].owner = o->owner;
+	new_propval[pos].owner = dbpriv_owner[oid];
 
     for (i = pos + 1; i < nprops; i++)
 	new_propval[i] = o->propval[i - 1];
@@ -112,9 +116,9 @@ insert_prop_recursively(Objid root, int root_pos, Pval pv)
     insert_prop(root, root_pos, pv);
     pv.var.type = TYPE_CLEAR;	/* do after initial insert_prop so only
 				   children will be TYPE_CLEAR */
-    for (c = dbpriv_find_object(root)->child;
+    for (c = dbpriv_child[root];
 	 c != NOTHING;
-	 c = dbpriv_find_object(c)->sibling) {
+	 c = dbpriv_sibling[c]) {
 	int new_prop_count = dbpriv_find_object(c)->propdefs.cur_length;
 
 	insert_prop_recursively(c, new_prop_count + root_pos, pv);
@@ -135,6 +139,8 @@ db_add_propdef(Objid oid, const char *pname, Var value, Objid owner,
     if (h.ptr || property_defined_at_or_below(pname, str_hash(pname), oid))
 	return 0;
 
+    PARALLEL_SERIAL();
+    dbpriv_mark_subtree_dirty(oid);
     o = dbpriv_find_object(oid);
     if (o->propdefs.cur_length == o->propdefs.max_length) {
 	Propdef *old_props = o->propdefs.l;
@@ -156,6 +162,16 @@ db_add_propdef(Objid oid, const char *pname, Var value, Objid owner,
     pval.perms = flags;
 
     insert_prop_recursively(oid, o->propdefs.cur_length - 1, pval);
+    dbpriv_note_subtree_owners(oid);
+
+    if (dbpriv_journal_begin("add_prop")) {
+	dbio_write_objid(oid);
+	dbio_write_string(pname);
+	dbpriv_journal_write_var(value, 1);
+	dbio_write_objid(owner);
+	dbio_write_num(flags);
+	dbpriv_journal_end();
+    }
 
     return 1;
 }
@@ -168,7 +184,7 @@ rename_prop_recursively(Objid root, const char *old, const char *new)
 
     if (o->waif_propdefs)
 	waif_rename_propdef(o, old, new);
-    for (c = o->child; c != NOTHING; c = dbpriv_find_object(c)->sibling)
+    for (c = dbpriv_child[root]; c != NOTHING; c = dbpriv_sibling[c])
 	rename_prop_recursively(c, old, new);
 }
 
@@ -192,11 +208,20 @@ db_rename_propdef(Objid oid, const char *old, const char *new)
 		|| property_defined_at_or_below(new, str_hash(new), oid))
 		    return 0;
 	    }
+	    PARALLEL_SERIAL();
+	    dbpriv_mark_dirty(oid);
 	    rename_prop_recursively(oid, props->l[i].name, new);
 	    free_str(props->l[i].name);
 	    props->l[i].name = str_ref(new);
 	    props->l[i].hash = str_hash(new);
 
+	    if (dbpriv_journal_begin("rename_prop")) {
+		dbio_write_objid(oid);
+		dbio_write_string(old);
+		dbio_write_string(new);
+		dbpriv_journal_end();
+	    }
+
 	    return 1;
 	}
     }
@@ -213,6 +238,7 @@ remove_prop(Objid oid, int pos)
 
     o = dbpriv_find_object(oid);
     nprops = dbpriv_count_properties(oid);
+    dbpriv_mark_dirty(oid);
 
     free_waif_propdefs(o->waif_propdefs);
     o->waif_propdefs = NULL;
@@ -239,9 +265,9 @@ remove_prop_recursively(Objid root, int root_pos)
     Objid c;
 
     remove_prop(root, root_pos);
-    for (c = dbpriv_find_object(root)->child;
+    for (c = dbpriv_child[root];
 	 c != NOTHING;
-	 c = dbpriv_find_object(c)->sibling) {
+	 c = dbpriv_sibling[c]) {
 	int new_prop_count = dbpriv_find_object(c)->propdefs.cur_length;
 
 	remove_prop_recursively(c, new_prop_count + root_pos);
@@ -262,6 +288,8 @@ db_delete_propdef(Objid oid, const char *pname)
 
 	p = props->l[i];
 	if (p.hash == hash && !mystrcasecmp(p.name, pname)) {
+	    PARALLEL_SERIAL();
+	    dbpriv_mark_subtree_dirty(oid);
 	    if (p.name)
 		free_str(p.name);
 
@@ -286,6 +314,12 @@ db_delete_propdef(Objid oid, const char *pname)
 	    props->cur_length--;
 	    remove_prop_recursively(oid, i);
 
+	    if (dbpriv_journal_begin("delete_prop")) {
+		dbio_write_objid(oid);
+		dbio_write_string(pname);
+		dbpriv_journal_end();
+	    }
+
 	    return 1;
 	}
     }
@@ -313,23 +347,6 @@ db_for_all_propdefs(Objid oid, int (*func) (void *, const char *), void *data)
     return 0;
 }
 
-struct contents_data {
-    Var r;
-    int i;
-};
-
-static int
-add_to_list(void *data, Objid c)
-{
-    struct contents_data *d = data;
-
-    d->i++;
-    d->r.v.list[d->i].type = TYPE_OBJ;
-    d->r.v.list[d->i].v.obj = c;
-
-    return 0;
-}
-
 static void
 get_bi_value(db_prop_handle h, Var * value)
 {
@@ -369,15 +386,7 @@ get_bi_value(db_prop_handle h, Var * value)
 	value->v.obj = db_object_location(oid);
 	break;
     case BP_CONTENTS:
-	{
-	    struct contents_data d;
-
-	    d.r = new_list(db_count_contents(oid));
-	    d.i = 0;
-	    db_for_all_contents(oid, add_to_list, &d);
-
-	    *value = d.r;
-	}
+	*value = db_contents_list(oid);
 	break;
     default:
 	panic("Unknown built-in property in GET_BI_VALUE!");
@@ -438,6 +447,7 @@ db_find_property(Objid oid, const char *name, Var * value)
 	    ret = oid;
 	    h.built_in = ptable[i].prop;
 	    h.definer = NOTHING;
+	    h.oid = oid;
 	    h.ptr = &ret;
 	    if (value)
 		get_bi_value(h, value);
@@ -446,8 +456,10 @@ db_find_property(Objid oid, const char *name, Var * value)
     }
 
     h.built_in = BP_NONE;
+    h.oid = oid;
     n = 0;
-    for (o = dbpriv_find_object(oid); o; o = dbpriv_find_object(o->parent)) {
+    for (o = dbpriv_find_object(oid); o;
+	 o = dbpriv_find_object(dbpriv_parent[o->id])) {
 	Proplist *props = &(o->propdefs);
 	Propdef *defs = props->l;
 	int length = props->cur_length;
@@ -462,10 +474,12 @@ db_find_property(Objid oid, const char *name, Var * value)
 		prop = h.ptr = o->propval + n;
 
 		if (value) {
+		    PARALLEL_READ(o->id, n);
 		    while (prop->var.type == TYPE_CLEAR) {
 			n -= o->propdefs.cur_length;
-			o = dbpriv_find_object(o->parent);
+			o = dbpriv_find_object(dbpriv_parent[o->id]);
 			prop = o->propval + n;
+			PARALLEL_READ(o->id, n);
 		    }
 		    *value = prop->var;
 		}
@@ -478,6 +492,10 @@ db_find_property(Objid oid, const char *name, Var * value)
     return h;
 }
 
+/* The slot of the non-built-in property H, for parallel.h. */
+#define PROP_SLOT(h) \
+	((Pval *) (h).ptr - dbpriv_find_object((h).oid)->propval)
+
 Var
 db_property_value(db_prop_handle h)
 {
@@ -488,20 +506,38 @@ db_property_value(db_prop_handle h)
     else {
 	Pval *prop = h.ptr;
 
+	PARALLEL_READ(h.oid, PROP_SLOT(h));
 	value = prop->var;
     }
 
     return value;
 }
 
+/* Starts journaling OP on the property H, which isn't built in. */
+static int
+begin_prop_record(const char *op, db_prop_handle h)
+{
+    if (!dbpriv_journal_begin(op))
+	return 0;
+    dbio_write_objid(h.oid);
+    dbio_write_num((Pval *) h.ptr - dbpriv_find_object(h.oid)->propval);
+    return 1;
+}
+
 void
 db_set_property_value(db_prop_handle h, Var value)
 {
     if (!h.built_in) {
 	Pval *prop = h.ptr;
 
+	PARALLEL_WRITE(h.oid, PROP_SLOT(h));
+	dbpriv_mark_dirty(h.oid);
 	free_var(prop->var);
 	prop->var = value;
+	if (begin_prop_record("prop_value", h)) {
+	    dbpriv_journal_write_var(value, 0);
+	    dbpriv_journal_end();
+	}
     } else {
 	Objid oid = *((Objid *) h.ptr);
 	db_object_flag flag;
@@ -558,6 +594,7 @@ db_property_owner(db_prop_handle h)
     } else {
 	Pval *prop = h.ptr;
 
+	PARALLEL_READ(h.oid, PROP_SLOT(h));
 	return prop->owner;
     }
 }
@@ -570,7 +607,14 @@ db_set_property_owner(db_prop_handle h, Objid oid)
     else {
 	Pval *prop = h.ptr;
 
+	PARALLEL_WRITE(h.oid, PROP_SLOT(h));
+	dbpriv_mark_dirty(h.oid);
 	prop->owner = oid;
+	dbpriv_note_owner(h.oid, oid);
+	if (begin_prop_record("prop_owner", h)) {
+	    dbio_write_objid(oid);
+	    dbpriv_journal_end();
+	}
     }
 }
 
@@ -583,6 +627,7 @@ db_property_flags(db_prop_handle h)
     } else {
 	Pval *prop = h.ptr;
 
+	PARALLEL_READ(h.oid, PROP_SLOT(h));
 	return prop->perms;
     }
 }
@@ -595,7 +640,13 @@ db_set_property_flags(db_prop_handle h, unsigned flags)
     else {
 	Pval *prop = h.ptr;
 
+	PARALLEL_WRITE(h.oid, PROP_SLOT(h));
+	dbpriv_mark_dirty(h.oid);
 	prop->perms = flags;
+	if (begin_prop_record("prop_flags", h)) {
+	    dbio_write_num(flags);
+	    dbpriv_journal_end();
+	}
     }
 }
 
@@ -611,7 +662,7 @@ static void
 fix_props(Objid oid, int parent_local, int old, int new, int common)
 {
     Object *me = dbpriv_find_object(oid);
-    Object *parent = dbpriv_find_object(me->parent);
+    Object *parent = dbpriv_find_object(dbpriv_parent[oid]);
     Pval *new_propval;
     int local = parent_local;
     int i;
@@ -620,6 +671,7 @@ fix_props(Objid oid, int parent_local, int old, int new, int common)
     /* This will invalidate waif_propdefs */
     free_waif_propdefs(me->waif_propdefs);
     me->waif_propdefs = NULL;
+    dbpriv_mark_dirty(oid);
 
     local += me->propdefs.cur_length;
 
@@ -637,7 +689,7 @@ fix_props(Objid oid, int parent_local, int old, int new, int common)
 	    new_propval[local + i] = pv;
 	    new_propval[local + i].var.type = TYPE_CLEAR;
 	    if (pv.perms & PF_CHOWN)
-		new_propval[local + i].owner = me->owner;
+		new_propval[local + i].owner = dbpriv_owner[oid];
 	}
 	for (i = 0; i < common; i++)
 	    new_propval[local + new + i] = me->propval[local + old + i];
@@ -648,7 +700,7 @@ fix_props(Objid oid, int parent_local, int old, int new, int common)
 	myfree(me->propval, M_PVAL);
     me->propval = new_propval;
 
-    for (c = me->child; c != NOTHING; c = dbpriv_find_object(c)->sibling)
+    for (c = dbpriv_child[oid]; c != NOTHING; c = dbpriv_sibling[c])
 	fix_props(c, local, old, new, common);
 }
 
@@ -660,7 +712,7 @@ dbpriv_check_properties_for_chparent(Objid oid, Objid new_parent)
 
     for (o = dbpriv_find_object(new_parent);
 	 o;
-	 o = dbpriv_find_object(o->parent)) {
+	 o = dbpriv_find_object(dbpriv_parent[o->id])) {
 	Proplist *props = &o->propdefs;
 
 	for (i = 0; i < props->cur_length; i++)
@@ -0,0 +1,437 @@
+/*****************************************************************************
+ * moodb: loads a database without starting a server, reports on what's in
+ * it and, optionally, writes it back out in either format
+ *****************************************************************************/
+
+#include "my-stdio.h"
+#include "my-stdlib.h"
+#include "my-string.h"
+#include "my-unistd.h"
+
+#include "config.h"
+#include "db.h"
+#include "db_private.h"
+#include "functions.h"
+#include "log.h"
+#include "options.h"
+#include "program.h"
+#include "storage.h"
+#include "structures.h"
+#include "utils.h"
+#include "waif.h"
+
+#if HAVE_PTHREAD_CREATE
+#include <pthread.h>
+#endif
+
+/* The biggest things of one kind seen so far, biggest first. */
+typedef struct {
+    Objid oid;
+    int index;			/* of the property value or verb */
+    int64_t size;
+    int length;			/* of a list */
+} Item;
+
+typedef struct {
+    int count;
+    Item *items;
+} Biggest;
+
+static int biggest_kept = 10;
+
+static void
+init_biggest(Biggest * b)
+{
+    b->count = 0;
+    b->items = mymalloc(biggest_kept * sizeof(Item), M_DB_LOAD);
+}
+
+static void
+note_size(Biggest * b, Objid oid, int index, int64_t size, int length)
+{
+    int i;
+
+    if (b->count == biggest_kept && size <= b->items[b->count - 1].size)
+	return;
+    if (b->count < biggest_kept)
+	b->count++;
+    for (i = b->count - 1; i > 0 && b->items[i - 1].size < size; i--)
+	b->items[i] = b->items[i - 1];
+    b->items[i].oid = oid;
+    b->items[i].index = index;
+    b->items[i].size = size;
+    b->items[i].length = length;
+}
+
+static void
+merge_biggest(Biggest * into, Biggest * from)
+{
+    int i;
+
+    for (i = 0; i < from->count; i++)
+	note_size(into, from->items[i].oid, from->items[i].index,
+		  from->items[i].size, from->items[i].length);
+    myfree(from->items, M_DB_LOAD);
+}
+
+
+/*********** Gathering statistics ***********/
+
+#define NUM_TYPES	(_TYPE_WAIF + 1)
+
+/* What's in one slice of the object numbers.  Each slice is gathered by a
+ * thread of its own, which only reads the database.
+ */
+typedef struct {
+    Objid first, last;
+    Objid objects;
+    Num values[NUM_TYPES];	/* by type, with TYPE_CLEAR for clear ones */
+    int64_t value_bytes[NUM_TYPES];
+    Num verbs, programs;
+    int64_t program_bytes;
+    Biggest parents, strings, lists, programs_by_size;
+} Stats;
+
+static void *
+gather_stats(void *data)
+{
+    Stats *s = data;
+    Objid oid;
+    int i, nprops;
+
+    for (oid = s->first; oid < s->last; oid++) {
+	Object *o = dbpriv_find_object(oid);
+	Verbdef *v;
+
+	if (!o)
+	    continue;
+	s->objects++;
+	if (dbpriv_nchildren[oid] > 0)
+	    note_size(&s->parents, oid, 0, dbpriv_nchildren[oid], 0);
+
+	nprops = dbpriv_count_properties(oid);
+	for (i = 0; i < nprops; i++) {
+	    Var value = o->propval[i].var;
+	    int type = value.type & TYPE_DB_MASK;
+	    int bytes = value_bytes(value);
+
+	    s->values[type]++;
+	    s->value_bytes[type] += bytes;
+	    if (value.type == TYPE_STR)
+		note_size(&s->strings, oid, i, memo_strlen(value.v.str), 0);
+	    else if (value.type == TYPE_LIST)
+		note_size(&s->lists, oid, i, bytes, value.v.list[0].v.num);
+	}
+
+	for (v = o->verbdefs, i = 0; v; v = v->next, i++) {
+	    s->verbs++;
+	    if (v->program) {
+		int bytes = program_bytes(v->program);
+
+		s->programs++;
+		s->program_bytes += bytes;
+		note_size(&s->programs_by_size, oid, i, bytes, 0);
+	    }
+	}
+    }
+
+    return 0;
+}
+
+static void
+merge_stats(Stats * into, Stats * from)
+{
+    int i;
+
+    into->objects += from->objects;
+    for (i = 0; i < NUM_TYPES; i++) {
+	into->values[i] += from->values[i];
+	into->value_bytes[i] += from->value_bytes[i];
+    }
+    into->verbs += from->verbs;
+    into->programs += from->programs;
+    into->program_bytes += from->program_bytes;
+    merge_biggest(&into->parents, &from->parents);
+    merge_biggest(&into->strings, &from->strings);
+    merge_biggest(&into->lists, &from->lists);
+    merge_biggest(&into->programs_by_size, &from->programs_by_size);
+}
+
+static void
+init_stats(Stats * s, Objid first, Objid last)
+{
+    memset(s, 0, sizeof(Stats));
+    s->first = first;
+    s->last = last;
+    init_biggest(&s->parents);
+    init_biggest(&s->strings);
+    init_biggest(&s->lists);
+    init_biggest(&s->programs_by_size);
+}
+
+/* Gathers statistics about the whole database into TOTAL, on NTHREADS
+ * threads, returning how many were actually used.
+ */
+static int
+gather_all_stats(Stats * total, int nthreads)
+{
+    Objid oid, nobjs = db_last_used_objid() + 1;
+    Stats *slices;
+    int i, started = 1;
+
+    if (nthreads > nobjs / 1000 + 1)	/* not worth it for small DBs */
+	nthreads = nobjs / 1000 + 1;
+    if (waifs_in_use())		/* measuring a WAIF updates it */
+	nthreads = 1;
+    /* Only this thread may read in cold objects. */
+    for (oid = 0; oid < nobjs; oid++)
+	dbpriv_find_object(oid);
+
+    slices = mymalloc(nthreads * sizeof(Stats), M_DB_LOAD);
+    for (i = 0; i < nthreads; i++)
+	init_stats(&slices[i], nobjs / nthreads * i,
+		   i == nthreads - 1 ? nobjs : nobjs / nthreads * (i + 1));
+
+#if HAVE_PTHREAD_CREATE
+    {
+	pthread_t *threads = mymalloc(nthreads * sizeof(pthread_t),
+				      M_DB_LOAD);
+
+	/* This thread gathers the first slice itself. */
+	for (; started < nthreads; started++)
+	    if (pthread_create(&threads[started], 0, gather_stats,
+			       &slices[started]) != 0)
+		break;
+	gather_stats(&slices[0]);
+	for (i = started; i < nthreads; i++)
+	    gather_stats(&slices[i]);
+	for (i = 1; i < started; i++)
+	    pthread_join(threads[i], 0);
+	myfree(threads, M_DB_LOAD);
+    }
+#else
+    for (i = 0; i < nthreads; i++)
+	gather_stats(&slices[i]);
+#endif
+
+    init_stats(total, 0, nobjs);
+    for (i = 0; i < nthreads; i++)
+	merge_stats(total, &slices[i]);
+    myfree(slices, M_DB_LOAD);
+
+    return started;
+}
+
+
+/*********** Reporting ***********/
+
+static const char *
+property_name(Objid oid, int index)
+{
+    Object *o;
+
+    /* An object's property values are in the order of its own definitions,
+     * then its parent's, and so on up.
+     */
+    for (o = dbpriv_find_object(oid); o;
+	 o = dbpriv_find_object(dbpriv_parent[o->id])) {
+	if (index < o->propdefs.cur_length)
+	    return o->propdefs.l[index].name;
+	index -= o->propdefs.cur_length;
+    }
+    return "?";
+}
+
+static const char *
+verb_name(Objid oid, int index)
+{
+    Verbdef *v = dbpriv_find_object(oid)->verbdefs;
+
+    while (index-- > 0)
+	v = v->next;
+    return v->name;
+}
+
+static const char *type_names[NUM_TYPES] =
+{"INT", "OBJ", "STR", "ERR", "LIST", "clear", "NONE", "CATCH", "FINALLY",
+ "FLOAT", "WAIF"};
+
+static void
+report_stats(Stats * s)
+{
+    Objid nobjs = db_last_used_objid() + 1;
+    Num nvalues = 0;
+    int64_t nbytes = 0;
+    int i;
+
+    for (i = 0; i < NUM_TYPES; i++) {
+	nvalues += s->values[i];
+	nbytes += s->value_bytes[i];
+    }
+
+    printf("Objects: %"PRIdN" (%"PRIdN" valid, %"PRIdN" recycled)\n",
+	   nobjs, s->objects, nobjs - s->objects);
+    printf("Property values: %"PRIdN", %"PRId64" bytes\n", nvalues, nbytes);
+    for (i = 0; i < NUM_TYPES; i++)
+	if (s->values[i])
+	    printf("  %-6s %10"PRIdN" values %14"PRId64" bytes\n",
+		   type_names[i], s->values[i], s->value_bytes[i]);
+    printf("Verbs: %"PRIdN" (%"PRIdN" programmed), "
+	   "%"PRId64" bytes of programs\n",
+	   s->verbs, s->programs, s->program_bytes);
+
+    printf("\nParents with the most children:\n");
+    for (i = 0; i < s->parents.count; i++) {
+	Item *p = &s->parents.items[i];
+
+	printf("  %10"PRId64"  #%"PRIdN" (%s)\n", p->size, p->oid,
+	       dbpriv_find_object(p->oid)->name);
+    }
+
+    printf("\nLargest verb programs, in bytes:\n");
+    for (i = 0; i < s->programs_by_size.count; i++) {
+	Item *p = &s->programs_by_size.items[i];
+
+	printf("  %10"PRId64"  #%"PRIdN":%s\n", p->size, p->oid,
+	       verb_name(p->oid, p->index));
+    }
+
+    printf("\nLargest string property values, in characters:\n");
+    for (i = 0; i < s->strings.count; i++) {
+	Item *p = &s->strings.items[i];
+
+	printf("  %10"PRId64"  #%"PRIdN".%s\n", p->size, p->oid,
+	       property_name(p->oid, p->index));
+    }
+
+    printf("\nLargest list property values, in bytes (elements):\n");
+    for (i = 0; i < s->lists.count; i++) {
+	Item *p = &s->lists.items[i];
+
+	printf("  %10"PRId64"  #%"PRIdN".%s (%d)\n", p->size, p->oid,
+	       property_name(p->oid, p->index), p->length);
+    }
+}
+
+
+/*********** Main program ***********/
+
+static void
+usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-s] [-n count] [-j threads] [-B|-T] [-z] "
+	    "[-l log-file] input-db-file [output-db-file]\n", program);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *program = argv[0];
+    const char *log_file = 0;
+    char *names[2];
+    char **pnames = names;
+    int stats = 0, nnames;
+    long nthreads = 0;
+
+    argc--;
+    argv++;
+    while (argc > 0 && argv[0][0] == '-') {
+	/* Deal with any command-line options */
+	switch (argv[0][1]) {
+	case 's':		/* Report statistics */
+	    stats = 1;
+	    break;
+	case 'n':		/* How many of the biggest things to list */
+	case 'j':		/* Threads for gathering statistics */
+	    if (argc < 2 || atol(argv[1]) <= 0)
+		usage(program);
+	    if (argv[0][1] == 'n')
+		biggest_kept = atoi(argv[1]);
+	    else
+		nthreads = atol(argv[1]);
+	    argc--;
+	    argv++;
+	    break;
+	case 'B':		/* Write the binary DB format */
+	    db_set_dump_format(1);
+	    break;
+	case 'T':		/* Write the text DB format */
+	    db_set_dump_format(0);
+	    break;
+	case 'z':		/* Compress the output */
+	    if (!db_set_dump_compression(1)) {
+		fprintf(stderr, "%s: Can't compress databases\n", program);
+		exit(1);
+	    }
+	    break;
+	case 'l':		/* Log to a file */
+	    if (argc < 2)
+		usage(program);
+	    log_file = argv[1];
+	    argc--;
+	    argv++;
+	    break;
+	default:
+	    usage(program);
+	}
+	argc--;
+	argv++;
+    }
+    if (argc < 1 || argc > 2)
+	usage(program);
+
+    if (log_file) {
+	FILE *f = fopen(log_file, "a");
+
+	if (!f) {
+	    perror("Error opening specified log file");
+	    exit(1);
+	}
+	set_log_file(f);
+    } else
+	set_log_file(stderr);
+
+    /* With no output file, nothing on disk is touched, not even the
+     * journal; the input is looked at just as it stands.
+     */
+    names[0] = argv[0];
+    if (argc == 2)
+	names[1] = argv[1];
+    else {
+	names[1] = argv[0];
+	stats = 1;
+	db_set_read_only();
+    }
+    nnames = 2;
+    if (!db_initialize(&nnames, &pnames))
+	exit(1);
+    register_bi_functions();
+
+    /* Loading also validates the object hierarchies, failing if they're
+     * broken.
+     */
+    if (!db_load())
+	exit(1);
+
+    if (stats) {
+	Stats total;
+	int used;
+
+	if (nthreads == 0)
+	    nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+	    nthreads = 1;
+	used = gather_all_stats(&total, nthreads);
+	oklog("STATISTICS: Gathered on %d thread%s\n",
+	      used, used == 1 ? "" : "s");
+	report_stats(&total);
+    }
+
+    if (argc == 2)
+	db_shutdown();
+
+    return 0;
+}
+
+char rcsid_db_tool[] = "$Id$";
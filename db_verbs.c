@@ -25,10 +25,12 @@
 
 #include "config.h"
 #include "db.h"
+#include "db_io.h"
 #include "db_private.h"
 #include "db_tune.h"
 #include "list.h"
 #include "log.h"
+#include "parallel.h"
 #include "parse_cmd.h"
 #include "program.h"
 #include "storage.h"
@@ -204,6 +206,8 @@ db_add_verb(Objid oid, const char *vnames, Objid owner, unsigned flags,
 
     db_priv_affected_callable_verb_lookup();
 
+    PARALLEL_SERIAL();
+    dbpriv_mark_dirty(oid);
     newv = mymalloc(sizeof(Verbdef), M_VERBDEF);
     newv->name = vnames;
     newv->owner = owner;
@@ -217,7 +221,21 @@ db_add_verb(Objid oid, const char *vnames, Objid owner, unsigned flags,
     } else {
 	o->verbdefs = newv;
 	count = 1;
+	dbpriv_fix_verb_parents(oid);
     }
+    dbpriv_note_owner(oid, owner);
+
+    if (dbpriv_journal_begin("add_verb")) {
+	dbio_write_objid(oid);
+	dbio_write_string(vnames);
+	dbio_write_objid(owner);
+	dbio_write_num(flags);
+	dbio_write_num(dobj);
+	dbio_write_num(prep);
+	dbio_write_num(iobj);
+	dbpriv_journal_end();
+    }
+
     return count;
 }
 
@@ -267,6 +285,25 @@ typedef struct {		/* Non-null db_verb_handles point to these */
     Verbdef *verbdef;
 } handle;
 
+/* Starts journaling OP on the verb H, naming it by its definer and its
+ * position there, as db_find_indexed_verb() counts from 1.
+ */
+static int
+begin_verb_record(const char *op, handle * h)
+{
+    Verbdef *v;
+    int index = 0;
+
+    if (!dbpriv_journal_begin(op))
+	return 0;
+    for (v = dbpriv_find_object(h->definer)->verbdefs; v != h->verbdef;
+	 v = v->next)
+	index++;
+    dbio_write_objid(h->definer);
+    dbio_write_num(index);
+    return 1;
+}
+
 void
 db_delete_verb(db_verb_handle vh)
 {
@@ -278,6 +315,11 @@ db_delete_verb(db_verb_handle vh)
 
     db_priv_affected_callable_verb_lookup();
 
+    PARALLEL_SERIAL();
+    dbpriv_mark_dirty(oid);
+    if (begin_verb_record("delete_verb", h))
+	dbpriv_journal_end();
+
     vv = o->verbdefs;
     if (vv == v)
 	o->verbdefs = v->next;
@@ -286,6 +328,8 @@ db_delete_verb(db_verb_handle vh)
 	    vv = vv->next;
 	vv->next = v->next;
     }
+    if (!o->verbdefs)
+	dbpriv_fix_verb_parents(oid);
 
     if (v->program)
 	free_program(v->program);
@@ -303,7 +347,8 @@ db_find_command_verb(Objid oid, const char *verb,
     static handle h;
     db_verb_handle vh;
 
-    for (o = dbpriv_find_object(oid); o; o = dbpriv_find_object(o->parent))
+    for (o = dbpriv_find_object(oid); o;
+	 o = dbpriv_find_object(dbpriv_parent[o->id]))
 	for (v = o->verbdefs; v; v = v->next) {
 	    db_arg_spec vdobj = (v->perms >> DOBJSHIFT) & OBJMASK;
 	    db_arg_spec viobj = (v->perms >> IOBJSHIFT) & OBJMASK;
@@ -454,6 +499,16 @@ db_log_cache_stats(void)
 
 #endif
 
+static Object *
+next_object_with_verbs(Object * o)
+{
+    Objid parent = dbpriv_parent[o->id];
+
+    if (parent == NOTHING)
+	return 0;
+    return dbpriv_find_object(dbpriv_verb_parent[parent]);
+}
+
 db_verb_handle
 db_find_callable_verb(Objid oid, const char *verb)
 {
@@ -474,16 +529,11 @@ db_find_callable_verb(Objid oid, const char *verb)
     if (vc_table == NULL)
 	make_vc_table(DEFAULT_VC_SIZE);
 
-    for (o = dbpriv_find_object(oid); o; o = dbpriv_find_object(o->parent)) {
-	if (o->verbdefs != NULL)
-	    break;
-    }
-
-    if (o) {
-	first_parent_with_verbs = o->id;
-    } else {
+    if (valid(oid))
+	first_parent_with_verbs = dbpriv_verb_parent[oid];
+    else
 	first_parent_with_verbs = NOTHING;
-    }
+    o = dbpriv_find_object(first_parent_with_verbs);
 
     hash = str_hash(verb) ^ (~first_parent_with_verbs);		/* ewww, but who cares */
     bucket = hash % vc_size;
@@ -526,7 +576,10 @@ db_find_callable_verb(Objid oid, const char *verb)
     vc_table[bucket] = new_vc;
 #endif
 
-    for ( /* from above */ ; o; o = dbpriv_find_object(o->parent))
+    /* Only objects that define verbs need to be searched, so skip straight
+     * from each one to the nearest ancestor that has some.
+     */
+    for ( /* from above */ ; o; o = next_object_with_verbs(o))
 	if ((v = find_verbdef_by_name(o, verb, 1)) != 0) {
 #ifdef VERB_CACHE
 	    new_vc->h.definer = o->id;
@@ -633,9 +686,15 @@ db_set_verb_names(db_verb_handle vh, const char *names)
     db_priv_affected_callable_verb_lookup();
 
     if (h) {
+	PARALLEL_SERIAL();
+	dbpriv_mark_dirty(h->definer);
 	if (h->verbdef->name)
 	    free_str(h->verbdef->name);
 	h->verbdef->name = names;
+	if (begin_verb_record("verb_names", h)) {
+	    dbio_write_string(names);
+	    dbpriv_journal_end();
+	}
     } else
 	panic("DB_SET_VERB_NAMES: Null handle!");
 }
@@ -657,9 +716,16 @@ db_set_verb_owner(db_verb_handle vh, Objid owner)
 {
     handle *h = (handle *) vh.ptr;
 
-    if (h)
+    if (h) {
+	PARALLEL_SERIAL();
+	dbpriv_mark_dirty(h->definer);
 	h->verbdef->owner = owner;
-    else
+	dbpriv_note_owner(h->definer, owner);
+	if (begin_verb_record("verb_owner", h)) {
+	    dbio_write_objid(owner);
+	    dbpriv_journal_end();
+	}
+    } else
 	panic("DB_SET_VERB_OWNER: Null handle!");
 }
 
@@ -683,8 +749,14 @@ db_set_verb_flags(db_verb_handle vh, unsigned flags)
     db_priv_affected_callable_verb_lookup();
 
     if (h) {
+	PARALLEL_SERIAL();
+	dbpriv_mark_dirty(h->definer);
 	h->verbdef->perms &= ~PERMMASK;
 	h->verbdef->perms |= flags;
+	if (begin_verb_record("verb_flags", h)) {
+	    dbio_write_num(flags);
+	    dbpriv_journal_end();
+	}
     } else
 	panic("DB_SET_VERB_FLAGS: Null handle!");
 }
@@ -713,9 +785,15 @@ db_set_verb_program(db_verb_handle vh, Program * program)
     /* db_priv_affected_callable_verb_lookup(); */
 
     if (h) {
+	PARALLEL_SERIAL();
+	dbpriv_mark_dirty(h->definer);
 	if (h->verbdef->program)
 	    free_program(h->verbdef->program);
 	h->verbdef->program = program;
+	if (begin_verb_record("verb_code", h)) {
+	    dbio_write_program(program);
+	    dbpriv_journal_end();
+	}
     } else
 	panic("DB_SET_VERB_PROGRAM: Null handle!");
 }
@@ -743,10 +821,18 @@ db_set_verb_arg_specs(db_verb_handle vh,
     db_priv_affected_callable_verb_lookup();
 
     if (h) {
+	PARALLEL_SERIAL();
+	dbpriv_mark_dirty(h->definer);
 	h->verbdef->perms = ((h->verbdef->perms & PERMMASK)
 			     | (dobj << DOBJSHIFT)
 			     | (iobj << IOBJSHIFT));
 	h->verbdef->prep = prep;
+	if (begin_verb_record("verb_args", h)) {
+	    dbio_write_num(dobj);
+	    dbio_write_num(prep);
+	    dbio_write_num(iobj);
+	    dbpriv_journal_end();
+	}
     } else
 	panic("DB_SET_VERB_ARG_SPECS: Null handle!");
 }
@@ -23,17 +23,17 @@
 #include "storage.h"
 #include "utils.h"
 
-static Program *program;
-static Expr **expr_stack;
-static int top_expr_stack;
+static THREAD_LOCAL Program *program;
+static THREAD_LOCAL Expr **expr_stack;
+static THREAD_LOCAL int top_expr_stack;
 
-static Byte *hot_byte;
-static void *hot_node;
-static enum {
+static THREAD_LOCAL Byte *hot_byte;
+static THREAD_LOCAL void *hot_node;
+static THREAD_LOCAL enum {
     TOP, ENDBODY, BOTTOM, DONE
 } hot_position;
 
-static int lineno;
+static THREAD_LOCAL int lineno;
 
 static void
 push_expr(Expr * expr)
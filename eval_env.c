@@ -17,6 +17,7 @@
 
 #include "config.h"
 #include "eval_env.h"
+#include "exceptions.h"
 #include "storage.h"
 #include "structures.h"
 #include "sym_table.h"
@@ -54,6 +55,13 @@ free_rt_env(Var * rt_env, unsigned size)
     for (i = 0; i < size; i++)
 	free_var(rt_env[i]);
 
+    release_rt_env(rt_env, size);
+}
+
+/* Give back the storage of an rt_env whose values have been moved elsewhere. */
+void
+release_rt_env(Var * rt_env, unsigned size)
+{
     if (size <= NUM_READY_VARS) {
 	rt_env[0].v.list = ready_size_rt_envs;
 	ready_size_rt_envs = rt_env;
@@ -72,6 +80,92 @@ copy_rt_env(Var * from, unsigned size)
     return ret;
 }
 
+/*
+ * The running task's rt_envs and rt_stacks are carved out of an arena.
+ * Activations are pushed and popped in strict LIFO order, so allocating a
+ * frame is a pointer bump and freeing it moves the pointer back.  The arena
+ * grows by chaining chunks, so frames never move once handed out.  Frames
+ * belonging to suspended and forked tasks live on the heap instead, and are
+ * moved in and out by execute.c.
+ */
+typedef struct Arena_Chunk {
+    struct Arena_Chunk *prev;
+    Var *top, *limit;
+    Var slots[1];
+} Arena_Chunk;
+
+#define ARENA_CHUNK_VARS	4096
+
+static Arena_Chunk *arena;
+static Arena_Chunk *spare_chunk;	/* keep one around to avoid thrashing */
+
+Var *
+arena_alloc(unsigned size)
+{
+    Var *ret;
+
+    if (!arena || (unsigned) (arena->limit - arena->top) < size) {
+	Arena_Chunk *c = spare_chunk;
+
+	if (c && (unsigned) (c->limit - c->slots) >= size)
+	    spare_chunk = 0;
+	else {
+	    unsigned n = MAX(size, ARENA_CHUNK_VARS);
+
+	    c = mymalloc(sizeof(Arena_Chunk) + (n - 1) * sizeof(Var),
+			 M_RT_ARENA);
+	    c->limit = c->slots + n;
+	}
+	c->top = c->slots;
+	c->prev = arena;
+	arena = c;
+    }
+    ret = arena->top;
+    arena->top += size;
+
+    return ret;
+}
+
+void
+arena_free(Var * p, unsigned size)
+{
+    if (p + size != arena->top)
+	panic("ARENA_FREE: Frame is not on top of the arena!");
+    arena->top = p;
+
+    if (p == arena->slots && arena->prev) {
+	Arena_Chunk *c = arena;
+
+	arena = c->prev;
+	if (spare_chunk)
+	    myfree(spare_chunk, M_RT_ARENA);
+	spare_chunk = c;
+    }
+}
+
+Var *
+new_arena_rt_env(unsigned size)
+{
+    Var *ret = arena_alloc(size);
+    unsigned i;
+
+    for (i = 0; i < size; i++)
+	ret[i].type = TYPE_NONE;
+
+    return ret;
+}
+
+void
+free_arena_rt_env(Var * rt_env, unsigned size)
+{
+    unsigned i;
+
+    for (i = 0; i < size; i++)
+	free_var(rt_env[i]);
+
+    arena_free(rt_env, size);
+}
+
 void
 fill_in_rt_consts(Var * env, DB_Version version)
 {
@@ -25,6 +25,12 @@
 extern Var *new_rt_env(unsigned size);
 extern void free_rt_env(Var * rt_env, unsigned size);
 extern Var *copy_rt_env(Var * from, unsigned size);
+extern void release_rt_env(Var * rt_env, unsigned size);
+
+extern Var *arena_alloc(unsigned size);
+extern void arena_free(Var * p, unsigned size);
+extern Var *new_arena_rt_env(unsigned size);
+extern void free_arena_rt_env(Var * rt_env, unsigned size);
 
 void set_rt_env_obj(Var * env, int slot, Objid o);
 void set_rt_env_str(Var * env, int slot, const char *s);
@@ -34,6 +34,7 @@ new_vm(int task_id, int stack_size)
     vm the_vm = mymalloc(sizeof(vmstruct), M_VM);
 
     the_vm->task_id = task_id;
+    the_vm->bytes_saved = 0;
     the_vm->activ_stack = mymalloc(sizeof(activation) * stack_size, M_VM);
 
     return the_vm;
@@ -111,12 +112,14 @@ read_vm(int task_id)
     the_vm->root_activ_vector = vector;
     the_vm->func_id = func_id;
 
-    for (i = 0; i <= top; i++)
+    for (i = 0; i <= top; i++) {
 	if (!read_activ(&the_vm->activ_stack[i],
 			i == 0 ? vector : MAIN_VECTOR)) {
 	    errlog("READ_VM: Bad activ number %d\n", i);
 	    return 0;
 	}
+	the_vm->bytes_saved += compact_activation(&the_vm->activ_stack[i]);
+    }
     return the_vm;
 }
 
@@ -57,9 +57,20 @@ static Num root_activ_vector;	/* root_activ_vector == MAIN_VECTOR
 /* these globals are not part of the vm because they get re-initialized
    after a suspend */
 static int ticks_remaining;
+static int work_per_tick;
+static unsigned work_uncharged;	/* less than work_per_tick */
 int task_timed_out;
 static int interpreter_is_running = 0;
-static Timer_ID task_alarm_id;
+static int64_t task_deadline;	/* in cpu_usecs() */
+static int next_deadline_check;	/* read the clock when ticks_remaining
+				   gets down to this */
+
+/* The interpreter reads the clock at backward jumps and calls once this many
+   ticks have gone by since it last did, so a task overruns its seconds by
+   little more than the time these take, plus that of the last built-in
+   function it called.  Functions that can run long check for themselves; see
+   check_task_deadline().  */
+#define DEADLINE_CHECK_TICKS	1000
 
 static const char *handler_verb_name;	/* For in-DB traceback handling */
 static Var handler_verb_args;
@@ -88,40 +99,181 @@ typedef enum {			/* Reasons for executing a FINALLY handler */
 } Finally_Reason;
 
 /*
- * Keep a pool of the common size rt_stacks around to avoid beating up on
- * malloc.  This doesn't really need tuning.  Most rt_stacks will be less
- * than size 10.  I rounded up to a size which won't waste a lot of space
- * with a powers-of-two malloc (while leaving some room for mymalloc
- * overhead, if any).
+ * The running task's rt_envs and rt_stacks come from the frame arena in
+ * eval_env.c, which requires that each activation allocate its rt_env
+ * before its rt_stack.
  */
-static Var *rt_stack_quick;
-#define RT_STACK_QUICKSIZE	15
+static void
+push_rt_stack(activation * a, Num size)
+{
+    a->base_rt_stack = a->top_rt_stack = arena_alloc(size);
+    a->rt_stack_size = size;
+}
 
 static void
-alloc_rt_stack(activation * a, Num size)
+pop_rt_stack(activation * a)
 {
-    Var *res;
+    arena_free(a->base_rt_stack, a->rt_stack_size);
+}
 
-    if (size <= RT_STACK_QUICKSIZE && rt_stack_quick) {
-	res = rt_stack_quick;
-	rt_stack_quick = rt_stack_quick[0].v.list;
-    } else {
-	res = mymalloc(MAX(size, RT_STACK_QUICKSIZE) * sizeof(Var), M_RT_STACK);
-    }
-    a->base_rt_stack = a->top_rt_stack = res;
-    a->rt_stack_size = size;
+/*
+ * Activations held by suspended tasks are kept compact, since a server may
+ * have tens of thousands of them sitting idle: the rt_env holds exactly the
+ * program's variables and the rt_stack only the values in use (either is
+ * null if that's none), while rt_stack_size remains the size to allocate
+ * when the task resumes.
+ */
+static Var *
+compact_vars(Var * from, unsigned n, Memory_Type type)
+{
+    Var *v;
+
+    if (n == 0)
+	return 0;
+    v = mymalloc(n * sizeof(Var), type);
+    memcpy(v, from, n * sizeof(Var));
+    return v;
 }
 
 static void
-free_rt_stack(activation * a)
+free_compact_vars(Var * v, Memory_Type type)
 {
-    Var *stack = a->base_rt_stack;
+    if (v)
+	myfree(v, type);
+}
 
-    if (a->rt_stack_size <= RT_STACK_QUICKSIZE) {
-	stack[0].v.list = rt_stack_quick;
-	rt_stack_quick = stack;
-    } else
-	myfree(stack, M_RT_STACK);
+/*
+ * The verb names of suspended activations are shared through this table,
+ * so that, say, a thousand tasks suspended in commands typed as `look' hold
+ * one copy of the string between them.  The table holds a reference to
+ * each string; those nobody else refers to any more are dropped whenever
+ * it fills up.
+ */
+static const char **verb_names = 0;
+static unsigned verb_names_size = 0, verb_names_count = 0;
+
+static void
+add_verb_name(const char *s)
+{
+    unsigned i = str_hash(s) & (verb_names_size - 1);
+
+    while (verb_names[i])
+	i = (i + 1) & (verb_names_size - 1);
+    verb_names[i] = s;
+    verb_names_count++;
+}
+
+static void
+rebuild_verb_names(void)
+{
+    const char **old = verb_names;
+    unsigned old_size = verb_names_size, live = 0, i;
+
+    for (i = 0; i < old_size; i++)
+	if (old[i] && refcount(old[i]) > 1)
+	    live++;
+    verb_names_size = old_size ? old_size : 256;
+    while (live * 2 >= verb_names_size)
+	verb_names_size *= 2;
+    verb_names = mymalloc(verb_names_size * sizeof(const char *), M_TASK);
+    memset(verb_names, 0, verb_names_size * sizeof(const char *));
+    verb_names_count = 0;
+    for (i = 0; i < old_size; i++)
+	if (old[i]) {
+	    if (refcount(old[i]) > 1)
+		add_verb_name(old[i]);
+	    else
+		free_str(old[i]);
+	}
+    if (old)
+	myfree(old, M_TASK);
+}
+
+/* Replaces *S by the table's copy of the same string, if any, returning the
+ * number of bytes that frees.
+ */
+static unsigned
+intern_verb_name(const char **s)
+{
+    unsigned i, saved;
+
+    if (verb_names_count * 2 >= verb_names_size)
+	rebuild_verb_names();
+    for (i = str_hash(*s) & (verb_names_size - 1); verb_names[i];
+	 i = (i + 1) & (verb_names_size - 1))
+	if (verb_names[i] == *s)
+	    return 0;
+	else if (!strcmp(verb_names[i], *s)) {
+	    saved = refcount(*s) == 1 ? memo_strlen(*s) + 1 : 0;
+	    free_str(*s);
+	    *s = str_ref(verb_names[i]);
+	    return saved;
+	}
+    add_verb_name(str_ref(*s));
+    return 0;
+}
+
+unsigned
+compact_activation(activation * a)
+{
+    unsigned nvars = a->prog->num_var_names;
+    unsigned depth = a->top_rt_stack - a->base_rt_stack;
+    unsigned saved;
+
+    saved = (a->rt_stack_size - depth
+	     + MAX(nvars, NUM_READY_VARS) - nvars) * sizeof(Var);
+    saved += intern_verb_name(&a->verb);
+    saved += intern_verb_name(&a->verbname);
+
+    return saved;
+}
+
+/* Move an activation's frame out of the arena so it can outlive the
+ * current run, or back in on resumption.  The values themselves are moved,
+ * so no reference counts change.  Frames must be moved out top-down and
+ * back in bottom-up.
+ */
+static void
+frame_to_heap(activation * a)
+{
+    activation old = *a;
+    unsigned nvars = a->prog->num_var_names;
+    unsigned depth = old.top_rt_stack - old.base_rt_stack;
+
+    a->base_rt_stack = compact_vars(old.base_rt_stack, depth, M_RT_STACK);
+    a->top_rt_stack = a->base_rt_stack + depth;
+    pop_rt_stack(&old);
+
+    a->rt_env = compact_vars(old.rt_env, nvars, M_RT_ENV);
+    arena_free(old.rt_env, nvars);
+}
+
+static Var *
+rt_env_to_arena(Var * rt_env, unsigned nvars)
+{
+    Var *env = arena_alloc(nvars);
+
+    memcpy(env, rt_env, nvars * sizeof(Var));
+    release_rt_env(rt_env, nvars);
+
+    return env;
+}
+
+static void
+frame_to_arena(activation * a)
+{
+    activation old = *a;
+    unsigned nvars = a->prog->num_var_names;
+    unsigned depth = old.top_rt_stack - old.base_rt_stack;
+
+    a->rt_env = arena_alloc(nvars);
+    memcpy(a->rt_env, old.rt_env, nvars * sizeof(Var));
+    free_compact_vars(old.rt_env, M_RT_ENV);
+
+    push_rt_stack(a, old.rt_stack_size);
+    memcpy(a->base_rt_stack, old.base_rt_stack, depth * sizeof(Var));
+    a->top_rt_stack = a->base_rt_stack + depth;
+    free_compact_vars(old.base_rt_stack, M_RT_STACK);
 }
 
 void
@@ -205,10 +357,16 @@ suspend_task(package p)
     e = (*p.u.susp.proc) (the_vm, p.u.susp.data);
     if (e != E_NONE)
 	free_vm(the_vm, 0);
+    else
+	for (i = top_activ_stack; i >= 0; i--) {
+	    frame_to_heap(&the_vm->activ_stack[i]);
+	    the_vm->bytes_saved += compact_activation(&the_vm->activ_stack[i]);
+	}
     return e;
 }
 
 static int raise_error(package p, enum outcome *outcome);
+static void pop_activation(activation *);
 
 static int
 unwind_stack(Finally_Reason why, Var value, enum outcome *outcome)
@@ -275,7 +433,7 @@ unwind_stack(Finally_Reason why, Var value, enum outcome *outcome)
 	    bi_func_data = a->bi_func_data;
 	}
 	player = a->player;
-	free_activation(a, 0);	/* 0 == don't free bi_func_data */
+	pop_activation(a);	/* doesn't free bi_func_data */
 
 	if (top_activ_stack == 0) {	/* done */
 	    if (outcome)
@@ -355,7 +513,7 @@ unwind_stack(Finally_Reason why, Var value, enum outcome *outcome)
 		    case BI_KILL:
 			break;
 		    case BI_CALL:
-			free_activation(&activ_stack[top_activ_stack--], 0);
+			pop_activation(&activ_stack[top_activ_stack--]);
 			bi_func_pc = p.u.call.pc;
 			bi_func_data = p.u.call.data;
 			break;
@@ -523,27 +681,49 @@ push_activation(void)
 	return 0;
 }
 
+static void
+free_activation_fields(activation * ap)
+{
+    free_var(ap->THIS);
+    free_var(ap->temp);
+    free_str(ap->verb);
+    free_str(ap->verbname);
+
+    free_program(ap->prog);
+}
+
+/* For activations held by a suspended task */
 void
 free_activation(activation * ap, char data_too)
 {
     Var *i;
 
-    free_rt_env(ap->rt_env, ap->prog->num_var_names);
+    for (i = ap->rt_env; i < ap->rt_env + ap->prog->num_var_names; i++)
+	free_var(*i);
+    free_compact_vars(ap->rt_env, M_RT_ENV);
 
     for (i = ap->base_rt_stack; i < ap->top_rt_stack; i++)
 	free_var(*i);
-    free_rt_stack(ap);
-    free_var(ap->THIS);
-    free_var(ap->temp);
-    free_str(ap->verb);
-    free_str(ap->verbname);
-
-    free_program(ap->prog);
+    free_compact_vars(ap->base_rt_stack, M_RT_STACK);
+    free_activation_fields(ap);
 
     if (data_too && ap->bi_func_pc && ap->bi_func_data)
 	free_data(ap->bi_func_data);
     /* else bi_func_state will be later freed by bi_function */
 }
+
+/* For activations of the running task; bi_func_data is never freed here */
+static void
+pop_activation(activation * ap)
+{
+    Var *i;
+
+    for (i = ap->base_rt_stack; i < ap->top_rt_stack; i++)
+	free_var(*i);
+    pop_rt_stack(ap);
+    free_arena_rt_env(ap->rt_env, ap->prog->num_var_names);
+    free_activation_fields(ap);
+}
 
 
 /** Set up another activation for calling a verb
@@ -616,14 +796,13 @@ call_verb2(Objid this, const char *vname, Var THIS, Var args, int do_pass)
     RUN_ACTIV.verbname = str_ref(db_verb_names(h));
     RUN_ACTIV.debug = (db_verb_flags(h) & VF_DEBUG);
 
-    alloc_rt_stack(&RUN_ACTIV, program->main_vector.max_stack);
+    RUN_ACTIV.rt_env = env = new_arena_rt_env(program->num_var_names);
+    push_rt_stack(&RUN_ACTIV, program->main_vector.max_stack);
     RUN_ACTIV.pc = 0;
     RUN_ACTIV.error_pc = 0;
     RUN_ACTIV.bi_func_pc = 0;
     RUN_ACTIV.temp.type = TYPE_NONE;
 
-    RUN_ACTIV.rt_env = env = new_rt_env(RUN_ACTIV.prog->num_var_names);
-
     fill_in_rt_consts(env, program->version);
 
     set_rt_env_var(env, SLOT_THIS, var_ref(THIS));
@@ -797,6 +976,13 @@ do {    						    	\
 
 #define JUMP(label)     (bv = bc.vector + label)
 
+/* Notices that the task is out of seconds; it is aborted at its next tick. */
+#define CHECK_DEADLINE()					\
+do {								\
+    if (ticks_remaining <= next_deadline_check)			\
+	check_task_deadline();					\
+} while (0)
+
 /* end of major run() macros */
 
     LOAD_STATE_VARIABLES();
@@ -847,6 +1033,9 @@ do {    						    	\
 	case OP_JUMP:
 	    {
 		unsigned lab = READ_BYTES(bv, bc.numbytes_label);
+
+		if (bc.vector + lab < bv)
+		    CHECK_DEADLINE();
 		JUMP(lab);
 	    }
 	    break;
@@ -961,8 +1150,11 @@ do {    						    	\
 		    free_var(list);
 		    free_var(tail);
 		    PUSH_ERROR(E_TYPE);
-		} else
+		} else {
+		    if (var_refcount(list) > 1)	/* it'll be copied */
+			charge_work(list.v.list[0].v.num);
 		    PUSH(listappend(list, tail));
+		}
 	    }
 	    break;
 
@@ -976,8 +1168,10 @@ do {    						    	\
 		    free_var(tail);
 		    free_var(list);
 		    PUSH_ERROR(E_TYPE);
-		} else
+		} else {
+		    charge_work(list.v.list[0].v.num + tail.v.list[0].v.num);
 		    PUSH(listconcat(list, tail));
+		}
 	    }
 	    break;
 
@@ -1200,7 +1394,12 @@ do {    						    	\
 		    PUSH_ERROR(E_TYPE);
 		} else {
 		    ans.type = TYPE_INT;
-		    ans.v.num = ismember(lhs, rhs, 0);
+		    ans.v.num = ismember_checked(lhs, rhs, 0);
+		    if (ans.v.num < 0)	/* aborted at the next tick */
+			ans.v.num = 0;
+		    else
+			charge_work(ans.v.num ? ans.v.num
+				    : rhs.v.list[0].v.num);
 		    PUSH(ans);
 		    free_var(rhs);
 		    free_var(lhs);
@@ -1262,6 +1461,7 @@ do {    						    	\
 		    char *str;
 		    int llen = memo_strlen(lhs.v.str);
 
+		    charge_work(llen + memo_strlen(rhs.v.str));
 		    str = mymalloc(llen + memo_strlen(rhs.v.str) + 1, M_STRING);
 		    strcpy(str, lhs.v.str);
 		    strcpy(str + llen, rhs.v.str);
@@ -1671,16 +1871,19 @@ do {    						    	\
 		f_index = READ_BYTES(bv, bc.numbytes_fork);
 		if (op == OP_FORK_WITH_ID)
 		    id = READ_BYTES(bv, bc.numbytes_var_name);
-		if (time.type != TYPE_INT) {
+		if (time.type != TYPE_INT && time.type != TYPE_FLOAT) {
 		    free_var(time);
 		    RAISE_ERROR(E_TYPE);
-		} else if (time.v.num < 0) {
+		} else if (time.type == TYPE_INT
+			   ? time.v.num < 0 : time.v.fnum < 0) {
 		    free_var(time);
 		    RAISE_ERROR(E_INVARG);
 		} else {
 		    enum error e;
 
-		    e = enqueue_forked_task2(RUN_ACTIV, f_index, time.v.num,
+		    e = enqueue_forked_task2(RUN_ACTIV, f_index,
+					     (time.type == TYPE_INT
+					      ? time.v.num : time.v.fnum),
 					op == OP_FORK_WITH_ID ? id : -1);
 		    if (e != E_NONE)
 			RAISE_ERROR(e);
@@ -1694,6 +1897,7 @@ do {    						    	\
 		Var args, verb, obj;
 		Objid class;
 
+		CHECK_DEADLINE();
 		args = POP();	/* args, should be list */
 		verb = POP();	/* verbname, should be string */
 		obj = POP();	/* objid, should be obj */
@@ -1780,6 +1984,7 @@ do {    						    	\
 		    STORE_STATE_VARIABLES();
 		    p = call_bi_func(func_id, args, 1, RUN_ACTIV.progr, 0);
 		    LOAD_STATE_VARIABLES();
+		    CHECK_DEADLINE();
 
 		    switch (p.kind) {
 		    case BI_RETURN:
@@ -2066,6 +2271,7 @@ do {    						    	\
 		    {
 			Var v;
 
+			CHECK_DEADLINE();
 			v = new_list(2);
 			v.v.list[1].type = TYPE_INT;
 			v.v.list[1].v.num = READ_BYTES(bv, bc.numbytes_stack);
@@ -2344,19 +2550,46 @@ static int timeouts_enabled = 1;	/* set to 0 in debugger to disable
 					   timeouts */
 
 static void
-task_timeout(Timer_ID id, Timer_Data data)
-{
-    task_timed_out = timeouts_enabled;
-}
-
-static Timer_ID
 setup_task_execution_limits(int seconds, int ticks)
 {
-    task_alarm_id = set_virtual_timer(seconds < 1 ? 1 : seconds,
-				      task_timeout, 0);
+    task_deadline = cpu_usecs() + (int64_t) (seconds < 1 ? 1 : seconds)
+	* 1000000;
     task_timed_out = 0;
     ticks_remaining = (ticks < 100 ? 100 : ticks);
-    return task_alarm_id;
+    next_deadline_check = ticks_remaining - DEADLINE_CHECK_TICKS;
+    work_per_tick = server_int_option("work_per_tick", DEFAULT_WORK_PER_TICK);
+    work_uncharged = 0;
+}
+
+int
+check_task_deadline(void)
+{
+    next_deadline_check = ticks_remaining - DEADLINE_CHECK_TICKS;
+    if (interpreter_is_running && !task_timed_out
+	&& cpu_usecs() >= task_deadline)
+	task_timed_out = timeouts_enabled;
+    return task_timed_out;
+}
+
+void
+charge_work(unsigned units)
+{
+    unsigned ticks;
+
+    if (!interpreter_is_running || work_per_tick <= 0)
+	return;
+    if (units < work_per_tick - work_uncharged) {
+	work_uncharged += units;
+	return;
+    }
+    units -= work_per_tick - work_uncharged;
+    ticks = 1 + units / work_per_tick;
+    work_uncharged = units % work_per_tick;
+    /* The task is aborted at its next tick if this leaves none. */
+    if (ticks_remaining <= 0 || ticks >= (unsigned) ticks_remaining)
+	ticks_remaining = 0;
+    else
+	ticks_remaining -= ticks;
 }
 
 enum outcome
@@ -2385,7 +2618,6 @@ run_interpreter(char raise, enum error e,
     ret = run(raise, e, result);
     interpreter_is_running = 0;
     task_timed_out = 0;
-    cancel_timer(task_alarm_id);
 
     if (ret == OUTCOME_ABORTED && handler_verb_name) {
 	db_verb_handle h;
@@ -2463,7 +2695,7 @@ do_task(Program * prog, int which_vector, Var * result, int is_fg, int do_db_tra
     RUN_ACTIV.prog = program_ref(prog);
 
     root_activ_vector = which_vector;	/* main or which of the forked */
-    alloc_rt_stack(&RUN_ACTIV, (which_vector == MAIN_VECTOR
+    push_rt_stack(&RUN_ACTIV, (which_vector == MAIN_VECTOR
 				? prog->main_vector.max_stack
 			  : prog->fork_vectors[which_vector].max_stack));
 
@@ -2485,8 +2717,10 @@ resume_from_previous_vm(vm the_vm, Var v)
     check_activ_stack_size(the_vm->max_stack_size);
     top_activ_stack = the_vm->top_activ_stack;
     root_activ_vector = the_vm->root_activ_vector;
-    for (i = 0; i <= top_activ_stack; i++)
+    for (i = 0; i <= top_activ_stack; i++) {
 	activ_stack[i] = the_vm->activ_stack[i];
+	frame_to_arena(&activ_stack[i]);
+    }
 
     free_vm(the_vm, 0);
 
@@ -2526,7 +2760,7 @@ do_server_program_task(Objid this, const char *verb, Var args, Objid vloc,
     check_activ_stack_size(current_max_stack_size());
     top_activ_stack = 0;
 
-    RUN_ACTIV.rt_env = env = new_rt_env(program->num_var_names);
+    RUN_ACTIV.rt_env = env = new_arena_rt_env(program->num_var_names);
     RUN_ACTIV.this = this;
     RUN_ACTIV.THIS.type = TYPE_OBJ;
     RUN_ACTIV.THIS.v.obj = this;
@@ -2561,7 +2795,7 @@ do_input_task(Objid user, Parsed_Command * pc, Objid this, db_verb_handle vh)
     check_activ_stack_size(current_max_stack_size());
     top_activ_stack = 0;
 
-    RUN_ACTIV.rt_env = env = new_rt_env(prog->num_var_names);
+    RUN_ACTIV.rt_env = env = new_arena_rt_env(prog->num_var_names);
     RUN_ACTIV.this = this;
     RUN_ACTIV.THIS.type = TYPE_OBJ;
     RUN_ACTIV.THIS.v.obj = this;
@@ -2594,7 +2828,7 @@ do_forked_task(Program * prog, Var * rt_env, activation a, int f_id)
     top_activ_stack = 0;
 
     RUN_ACTIV = a;
-    RUN_ACTIV.rt_env = rt_env;
+    RUN_ACTIV.rt_env = rt_env_to_arena(rt_env, prog->num_var_names);
 
     return do_task(prog, f_id, 0, 0/*bg*/, 1/*traceback*/);
 }
@@ -2610,7 +2844,7 @@ setup_activ_for_eval(Program * prog)
 
     RUN_ACTIV.prog = prog;
 
-    RUN_ACTIV.rt_env = env = new_rt_env(prog->num_var_names);
+    RUN_ACTIV.rt_env = env = new_arena_rt_env(prog->num_var_names);
     fill_in_rt_consts(env, prog->version);
     set_rt_env_obj(env, SLOT_PLAYER, CALLER_ACTIV.player);
     set_rt_env_obj(env, SLOT_CALLER, CALLER_ACTIV.this);
@@ -2633,7 +2867,7 @@ setup_activ_for_eval(Program * prog)
     RUN_ACTIV.verb = str_dup("");
     RUN_ACTIV.verbname = str_dup("Input to EVAL");
     RUN_ACTIV.debug = 1;
-    alloc_rt_stack(&RUN_ACTIV, RUN_ACTIV.prog->main_vector.max_stack);
+    push_rt_stack(&RUN_ACTIV, RUN_ACTIV.prog->main_vector.max_stack);
     RUN_ACTIV.pc = 0;
     RUN_ACTIV.error_pc = 0;
     RUN_ACTIV.temp.type = TYPE_NONE;
@@ -2735,11 +2969,13 @@ bf_raise(Var arglist, Byte next, void *vdata, Objid progr)
 static package
 bf_suspend(Var arglist, Byte next, void *vdata, Objid progr)
 {
-    static int seconds;
+    static double seconds;
     int nargs = arglist.v.list[0].v.num;
 
     if (nargs >= 1)
-	seconds = arglist.v.list[1].v.num;
+	seconds = (arglist.v.list[1].type == TYPE_INT
+		   ? arglist.v.list[1].v.num
+		   : arglist.v.list[1].v.fnum);
     else
 	seconds = -1;
     free_var(arglist);
@@ -2793,7 +3029,7 @@ bf_seconds_left(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
     r.type = TYPE_INT;
-    r.v.num = timer_wakeup_interval(task_alarm_id);
+    r.v.num = (MAX(task_deadline - cpu_usecs(), 0) + 999999) / 1000000;
     free_var(arglist);
     return make_var_pack(r);
 }
@@ -2891,7 +3127,7 @@ register_execute(void)
 				      bf_call_function_write,
 				      TYPE_STR);
     register_function("raise", 1, 3, bf_raise, TYPE_ANY, TYPE_STR, TYPE_ANY);
-    register_function("suspend", 0, 1, bf_suspend, TYPE_INT);
+    register_function("suspend", 0, 1, bf_suspend, TYPE_NUMERIC);
     register_function("read", 0, 2, bf_read, TYPE_OBJ, TYPE_ANY);
 
     register_function("seconds_left", 0, 0, bf_seconds_left);
@@ -3078,7 +3314,7 @@ read_activ(activation * a, int which_vector)
 {
     DB_Version version;
     unsigned int v;
-    Var *old_rt_env;
+    Var *old_rt_env, *rt_env;
     const char **old_names;
     int old_size, stack_in_use;
     unsigned i;
@@ -3105,17 +3341,23 @@ read_activ(activation * a, int which_vector)
 	errlog("READ_ACTIV: Malformed runtime environment\n");
 	return 0;
     }
-    a->rt_env = reorder_rt_env(old_rt_env, old_names, old_size, a->prog);
+    rt_env = reorder_rt_env(old_rt_env, old_names, old_size, a->prog);
+    a->rt_env = compact_vars(rt_env, a->prog->num_var_names, M_RT_ENV);
+    release_rt_env(rt_env, a->prog->num_var_names);
 
     max_stack = (which_vector == MAIN_VECTOR
 		 ? a->prog->main_vector.max_stack
 		 : a->prog->fork_vectors[which_vector].max_stack);
-    alloc_rt_stack(a, max_stack);
+    a->rt_stack_size = max_stack;
 
-    if (dbio_scanf("%d rt_stack slots in use\n", &stack_in_use) != 1) {
+    if (dbio_scanf("%d rt_stack slots in use\n", &stack_in_use) != 1
+	|| stack_in_use < 0 || stack_in_use > max_stack) {
 	errlog("READ_ACTIV: Bad stack_in_use number\n");
 	return 0;
     }
+    a->base_rt_stack = (stack_in_use
+			? mymalloc(stack_in_use * sizeof(Var), M_RT_STACK)
+			: 0);
     a->top_rt_stack = a->base_rt_stack;
     for (i = 0; i < stack_in_use; i++)
 	*(a->top_rt_stack++) = dbio_read_var();
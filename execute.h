@@ -33,7 +33,9 @@ typedef struct {
 				   vector.max_stack.  top_rt_stack
 				   always points to next empty slot;
 				   there is no need to check bounds! */
-    int rt_stack_size;		/* size of stack allocated */
+    int rt_stack_size;		/* size of stack allocated, or to be
+				   allocated when a suspended task
+				   resumes */
     unsigned pc;
     unsigned error_pc;
     Byte bi_func_pc;		/* next == 0 means a normal activation, which just
@@ -60,6 +62,11 @@ typedef struct {
 } activation;
 
 extern void free_activation(activation *, char data_too);
+extern unsigned compact_activation(activation *);
+				/* For a suspended task's activation, whose
+				 * frame is already compact; returns the bytes
+				 * that saves.
+				 */
 
 typedef struct {
     int task_id;
@@ -70,6 +77,7 @@ typedef struct {
     /* root_activ_vector == MAIN_VECTOR
        means root activation is main_vector */
     unsigned func_id;
+    unsigned bytes_saved;	/* by compact_activation() */
 } vmstruct;
 
 typedef vmstruct *vm;
@@ -114,6 +122,21 @@ extern enum outcome do_server_program_task(Objid this, const char *verb,
 extern enum outcome resume_from_previous_vm(vm the_vm, Var value);
 
 extern int task_timed_out;
+extern int check_task_deadline(void);
+				/* Reads the clock and returns true if the
+				 * running task has used up its seconds, as
+				 * task_timed_out will be from then on; the
+				 * task is aborted at its next tick.  Built-in
+				 * functions that can run long call this every
+				 * DEADLINE_CHECK_WORK units of work or so and
+				 * give up early if it's true.
+				 */
+#define DEADLINE_CHECK_WORK	65536
+extern void charge_work(unsigned units);
+				/* Charges the running task for UNITS of work
+				 * (bytes or list elements gone through);
+				 * see DEFAULT_WORK_PER_TICK in options.h.
+				 */
 extern void abort_running_task(void);
 extern void print_error_backtrace(const char *, void (*)(const char *));
 extern void output_to_log(const char *);
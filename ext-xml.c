@@ -5,6 +5,7 @@
 
 
 #include "bf_register.h"
+#include "execute.h"
 #include "functions.h"
 #include "db_tune.h"
 #include "storage.h"
@@ -175,12 +176,7 @@ xml_endElement(void *userData, const char *name)
 static package 
 parse_xml(const char *data, int bool_stream)
   {
-  /*
-   * FIXME: Feed expat smaller chunks of the string and 
-   * check for task timeout between chunks
-   *
-   */
-  int decoded_length;
+  int decoded_length, offset, chunk, last;
   const char *decoded;
   package result; 
   XML_Parser parser = XML_ParserCreate("utf-8");
@@ -189,6 +185,7 @@ parse_xml(const char *data, int bool_stream)
   
   decoded_length = strlen(data);
   decoded = data;
+  charge_work(decoded_length);
   XML_SetUserData(parser, &child);
   XML_SetElementHandler(parser, xml_startElement, xml_endElement);
   if(bool_stream) {
@@ -196,18 +193,32 @@ parse_xml(const char *data, int bool_stream)
   } else {
     XML_SetCharacterDataHandler(parser, xml_characterDataHandler);
   }
-  if (!XML_Parse(parser, decoded, decoded_length, 1)) {
-    Var r;
-    r.type = TYPE_INT;
-    r.v.num = XML_GetCurrentByteIndex(parser);
-    flush_nodes(child);
-    result = make_raise_pack(E_INVARG, 
-			     XML_ErrorString(XML_GetErrorCode(parser)),
-			     r);
-  } else {
-    finish_node(root);
-    result = make_var_pack(var_ref(root->element.v.list[4].v.list[1]));
-    free_node(root);
+  /* Feed expat the string a chunk at a time, checking for task timeout
+   * between chunks.
+   */
+  for (offset = 0;; offset += chunk) {
+    chunk = MIN(decoded_length - offset, DEADLINE_CHECK_WORK);
+    last = offset + chunk == decoded_length;
+    if (!XML_Parse(parser, decoded + offset, chunk, last)) {
+      Var r;
+      r.type = TYPE_INT;
+      r.v.num = XML_GetCurrentByteIndex(parser);
+      flush_nodes(child);
+      result = make_raise_pack(E_INVARG, 
+			       XML_ErrorString(XML_GetErrorCode(parser)),
+			       r);
+      break;
+    } else if (last) {
+      finish_node(root);
+      result = make_var_pack(var_ref(root->element.v.list[4].v.list[1]));
+      free_node(root);
+      break;
+    } else if (check_task_deadline()) {
+      /* The task is about to be aborted; any answer will do. */
+      flush_nodes(child);
+      result = make_var_pack(new_list(0));
+      break;
+    }
   }
   XML_ParserFree(parser);
   return result; 
@@ -172,6 +172,33 @@ bf_log_cache_stats(Var arglist, Byte next, void *vdata, Objid progr)
 }
 #endif
 
+#include "list.h"
+#include "ref_count.h"
+#include "utils.h"
+
+static package
+bf_refcount_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Var r;
+
+    free_var(arglist);
+
+    if (!is_wizard(progr)) {
+	return make_error_pack(E_PERM);
+    }
+    r = new_list(2);
+    r.v.list[1].type = TYPE_INT;
+#ifdef REFCOUNT_STATS
+    r.v.list[1].v.num = refcount_writes_elided;
+#else
+    r.v.list[1].v.num = -1;	/* not counted */
+#endif
+    r.v.list[2].type = TYPE_INT;
+    r.v.list[2].v.num = refcount_immortals;
+
+    return make_var_pack(r);
+}
+
 #ifdef EXPAT_XML
 extern void register_xml(void);
 #endif
@@ -187,6 +214,7 @@ register_extensions()
     register_function("log_cache_stats", 0, 0, bf_log_cache_stats);
     register_function("verb_cache_stats", 0, 0, bf_verb_cache_stats);
 #endif
+    register_function("refcount_stats", 0, 0, bf_refcount_stats);
 #ifdef EXPAT_XML
     register_xml();
 #endif
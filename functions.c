@@ -23,6 +23,7 @@
 #include "functions.h"
 #include "list.h"
 #include "log.h"
+#include "parallel.h"
 #include "server.h"
 #include "storage.h"
 #include "streams.h"
@@ -51,6 +52,7 @@ static registry bi_function_registries[] =
     register_log,
     register_numbers,
     register_objects,
+    register_parallel,
     register_property,
     register_server,
     register_tasks,
@@ -197,6 +199,8 @@ call_bi_func(unsigned n, Var arglist, Byte func_pc,
 	int k, max;
 	Var *args = arglist.v.list;
 
+	PARALLEL_BUILTIN(n);
+
 	/*
 	 * Check permissions, if protected
 	 */
@@ -19,9 +19,11 @@
 #include "my-string.h"
 #include "my-math.h"
 
+#include "background.h"
 #include "bf_register.h"
 #include "config.h"
 #include "exceptions.h"
+#include "execute.h"
 #include "functions.h"
 #include "list.h"
 #include "log.h"
@@ -51,9 +53,9 @@ new_list(int size)
 	    emptylist.v.list = mymalloc(1 * sizeof(Var), M_LIST);
 	    emptylist.v.list[0].type = TYPE_INT;
 	    emptylist.v.list[0].v.num = 0;
+	    /* every caller shares it; no reference counting needed */
+	    make_immortal(emptylist.v.list);
 	}
-	/* give the lucky winner a reference */
-	addref(emptylist.v.list);
 	return emptylist;
     }
     new.type = TYPE_LIST;
@@ -98,6 +100,21 @@ ismember(Var lhs, Var rhs, int case_matters)
     return 0;
 }
 
+int
+ismember_checked(Var lhs, Var rhs, int case_matters)
+{
+    int i;
+
+    for (i = 1; i <= rhs.v.list[0].v.num; i++) {
+	if (equality(lhs, rhs.v.list[i], case_matters)) {
+	    return i;
+	}
+	if (i % DEADLINE_CHECK_WORK == 0 && check_task_deadline())
+	    return -1;
+    }
+    return 0;
+}
+
 Var
 listset(Var list, Var value, int pos)
 {
@@ -361,7 +378,7 @@ print_to_stream(Var v, Stream * s)
 const char *
 value_to_literal(Var v)
 {
-    static Stream *s = 0;
+    static THREAD_LOCAL Stream *s = 0;
 
     if (!s)
 	s = new_stream(100);
@@ -455,6 +472,7 @@ bf_length(Var arglist, Byte next, void *vdata, Objid progr)
 	r.v.num = arglist.v.list[1].v.list[0].v.num;
 	break;
     case TYPE_STR:
+	charge_work(memo_strlen(arglist.v.list[1].v.str));
 	r.type = TYPE_INT;
 	r.v.num = strlen_utf(arglist.v.list[1].v.str);
 	break;
@@ -473,6 +491,7 @@ bf_setadd(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
 
+    charge_work(arglist.v.list[1].v.list[0].v.num);
     r = setadd(var_ref(arglist.v.list[1]), var_ref(arglist.v.list[2]));
     free_var(arglist);
     return make_var_pack(r);
@@ -484,6 +503,7 @@ bf_setremove(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
 
+    charge_work(arglist.v.list[1].v.list[0].v.num);
     r = setremove(var_ref(arglist.v.list[1]), arglist.v.list[2]);
     free_var(arglist);
     return make_var_pack(r);
@@ -494,6 +514,8 @@ static package
 bf_listappend(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
+
+    charge_work(arglist.v.list[1].v.list[0].v.num);
     if (arglist.v.list[0].v.num == 2)
 	r = listappend(var_ref(arglist.v.list[1]), var_ref(arglist.v.list[2]));
     else
@@ -508,6 +530,8 @@ static package
 bf_listinsert(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
+
+    charge_work(arglist.v.list[1].v.list[0].v.num);
     if (arglist.v.list[0].v.num == 2)
 	r = listinsert(var_ref(arglist.v.list[1]), var_ref(arglist.v.list[2]), 1);
     else
@@ -526,6 +550,7 @@ bf_listdelete(Var arglist, Byte next, void *vdata, Objid progr)
 	free_var(arglist);
 	return make_error_pack(E_RANGE);
     } else {
+	charge_work(arglist.v.list[1].v.list[0].v.num);
 	r = listdelete(var_ref(arglist.v.list[1]), arglist.v.list[2].v.num);
     }
     free_var(arglist);
@@ -542,6 +567,7 @@ bf_listset(Var arglist, Byte next, void *vdata, Objid progr)
 	free_var(arglist);
 	return make_error_pack(E_RANGE);
     } else {
+	charge_work(arglist.v.list[1].v.list[0].v.num);
 	r = listset(var_dup(arglist.v.list[1]),
 		    var_ref(arglist.v.list[2]), arglist.v.list[3].v.num);
     }
@@ -566,7 +592,11 @@ bf_is_member(Var arglist, Byte next, void *vdata, Objid progr)
     Var r;
 
     r.type = TYPE_INT;
-    r.v.num = ismember(arglist.v.list[1], arglist.v.list[2], 1);
+    r.v.num = ismember_checked(arglist.v.list[1], arglist.v.list[2], 1);
+    if (r.v.num < 0)		/* the task is aborted at its next tick */
+	r.v.num = 0;
+    else
+	charge_work(r.v.num ? r.v.num : arglist.v.list[2].v.list[0].v.num);
     free_var(arglist);
     return make_var_pack(r);
 }
@@ -587,6 +617,8 @@ bf_strsub(Var arglist, Byte next, void *vdata, Objid progr)
 	r.v.str = str_dup(strsub(arglist.v.list[1].v.str,
 				 arglist.v.list[2].v.str,
 				 arglist.v.list[3].v.str, case_matters));
+	charge_work(memo_strlen(arglist.v.list[1].v.str)
+		    + memo_strlen(r.v.str));
 
 	free_var(arglist);
 	return make_var_pack(r);
@@ -638,6 +670,8 @@ bf_strcmp(Var arglist, Byte next, void *vdata, Objid progr)
 {				/* (string1, string2) */
     Var r;
 
+    charge_work(MIN(memo_strlen(arglist.v.list[1].v.str),
+		    memo_strlen(arglist.v.list[2].v.str)));
     r.type = TYPE_INT;
     r.v.num = signum(strcmp(arglist.v.list[1].v.str, arglist.v.list[2].v.str));
     free_var(arglist);
@@ -655,6 +689,7 @@ bf_index(Var arglist, Byte next, void *vdata, Objid progr)
     r.type = TYPE_INT;
     r.v.num = strindex(arglist.v.list[1].v.str, arglist.v.list[2].v.str,
 		       case_matters);
+    charge_work(memo_strlen(arglist.v.list[1].v.str));
 
     free_var(arglist);
     return make_var_pack(r);
@@ -672,6 +707,7 @@ bf_rindex(Var arglist, Byte next, void *vdata, Objid progr)
     r.type = TYPE_INT;
     r.v.num = strrindex(arglist.v.list[1].v.str, arglist.v.list[2].v.str,
 			case_matters);
+    charge_work(memo_strlen(arglist.v.list[1].v.str));
 
     free_var(arglist);
     return make_var_pack(r);
@@ -683,6 +719,7 @@ bf_tostr(Var arglist, Byte next, void *vdata, Objid progr)
     Var r;
     r.type = TYPE_STR;
     r.v.str = str_dup(list2str(arglist.v.list));
+    charge_work(memo_strlen(r.v.str));
     free_var(arglist);
     return make_var_pack(r);
 }
@@ -694,6 +731,7 @@ bf_toliteral(Var arglist, Byte next, void *vdata, Objid progr)
 
     r.type = TYPE_STR;
     r.v.str = str_dup(value_to_literal(arglist.v.list[1]));
+    charge_work(memo_strlen(r.v.str));
     free_var(arglist);
     return make_var_pack(r);
 }
@@ -768,15 +806,71 @@ get_pattern(const char *string, int case_matters)
 }
 
 #define match_rebase(x) (x == 0 ? 0 : (subject_len - strlen_utf(subject + (x) - 1) + 1))
+
+/* Matches SUBJECT against PAT, leaving the character positions of the match
+ * and of its nine subpatterns in SPANS; safe on a worker thread, given a
+ * pattern of its own.
+ */
+static Match_Result
+match_spans(Pattern pat, const char *subject, int reverse, int spans[10][2])
+{
+    Match_Indices regs[10];
+    Match_Result result = match_pattern(pat, subject, regs, reverse);
+    int i, subject_len;
+
+    if (result == MATCH_SUCCEEDED) {
+	subject_len = strlen_utf(subject);
+	for (i = 0; i < 10; i++) {
+	    spans[i][0] = match_rebase(regs[i].start);
+	    spans[i][1] = match_rebase(regs[i].end + 1) - 1;
+	}
+    }
+    return result;
+}
+
+static Var
+match_value(Match_Result result, const char *subject, int spans[10][2])
+{
+    Var ans;
+    int i;
+
+    switch (result) {
+    case MATCH_SUCCEEDED:
+	ans = new_list(4);
+	ans.v.list[1].type = TYPE_INT;
+	ans.v.list[2].type = TYPE_INT;
+	ans.v.list[4].type = TYPE_STR;
+	ans.v.list[1].v.num = spans[0][0];
+	ans.v.list[2].v.num = spans[0][1];
+	ans.v.list[3] = new_list(9);
+	ans.v.list[4].v.str = str_ref(subject);
+	for (i = 1; i <= 9; i++) {
+	    ans.v.list[3].v.list[i] = new_list(2);
+	    ans.v.list[3].v.list[i].v.list[1].type = TYPE_INT;
+	    ans.v.list[3].v.list[i].v.list[1].v.num = spans[i][0];
+	    ans.v.list[3].v.list[i].v.list[2].type = TYPE_INT;
+	    ans.v.list[3].v.list[i].v.list[2].v.num = spans[i][1];
+	}
+	break;
+    case MATCH_FAILED:
+	ans = new_list(0);
+	break;
+    case MATCH_ABORTED:
+	ans.type = TYPE_ERR;
+	ans.v.err = E_QUOTA;
+	break;
+    }
+
+    return ans;
+}
+
 Var
 do_match(Var arglist, int reverse)
 {
     const char *subject, *pattern;
-    int i;
     Pattern pat;
     Var ans;
-    Match_Indices regs[10];
-    int subject_len;
+    int spans[10][2];
 
     subject = arglist.v.list[1].v.str;
     pattern = arglist.v.list[2].v.str;
@@ -787,56 +881,76 @@ do_match(Var arglist, int reverse)
 	ans.type = TYPE_ERR;
 	ans.v.err = E_INVARG;
     } else
-	switch (match_pattern(pat, subject, regs, reverse)) {
-	case MATCH_SUCCEEDED:
-            subject_len = strlen_utf(subject);
-	    ans = new_list(4);
-	    ans.v.list[1].type = TYPE_INT;
-	    ans.v.list[2].type = TYPE_INT;
-	    ans.v.list[4].type = TYPE_STR;
-	    ans.v.list[1].v.num = match_rebase(regs[0].start);
-	    ans.v.list[2].v.num = match_rebase(regs[0].end + 1) - 1;
-	    ans.v.list[3] = new_list(9);
-	    ans.v.list[4].v.str = str_ref(subject);
-	    for (i = 1; i <= 9; i++) {
-		ans.v.list[3].v.list[i] = new_list(2);
-		ans.v.list[3].v.list[i].v.list[1].type = TYPE_INT;
-		ans.v.list[3].v.list[i].v.list[1].v.num = match_rebase(regs[i].start);
-		ans.v.list[3].v.list[i].v.list[2].type = TYPE_INT;
-		ans.v.list[3].v.list[i].v.list[2].v.num = match_rebase(regs[i].end + 1) - 1;
-	    }
-	    break;
-	case MATCH_FAILED:
-	    ans = new_list(0);
-	    break;
-	case MATCH_ABORTED:
-	    ans.type = TYPE_ERR;
-	    ans.v.err = E_QUOTA;
-	    break;
-	}
+	ans = match_value(match_spans(pat, subject, reverse, spans),
+			  subject, spans);
 
     return ans;
 }
 
-static package
-bf_match(Var arglist, Byte next, void *vdata, Objid progr)
+/* A match() or rmatch() of a long subject runs in the background, with its
+ * own copy of the compiled pattern, since the one in the cache may be
+ * replaced meanwhile.
+ */
+typedef struct match_job {
+    const char *subject;
+    Pattern pattern;
+    int reverse;
+    Match_Result result;
+    int spans[10][2];
+} match_job;
+
+static void
+background_match(void *data)
+{
+    match_job *mj = data;
+
+    mj->result = match_spans(mj->pattern, mj->subject, mj->reverse,
+			     mj->spans);
+}
+
+static Var
+finish_match(void *data, int killed)
 {
+    match_job *mj = data;
     Var ans;
 
-    ans = do_match(arglist, 0);
-    free_var(arglist);
-    if (ans.type == TYPE_ERR)
-	return make_error_pack(ans.v.err);
+    if (killed)
+	ans = zero;
     else
-	return make_var_pack(ans);
+	ans = match_value(mj->result, mj->subject, mj->spans);
+    free_str(mj->subject);
+    free_pattern(mj->pattern);
+    myfree(mj, M_BI_FUNC_DATA);
+
+    return ans;
 }
 
 static package
-bf_rmatch(Var arglist, Byte next, void *vdata, Objid progr)
+match_builtin(Var arglist, int reverse)
 {
     Var ans;
+    const char *subject = arglist.v.list[1].v.str;
+
+    charge_work(memo_strlen(subject));
+    if (memo_strlen(subject) >= BACKGROUND_MIN_BYTES) {
+	int case_matters = (arglist.v.list[0].v.num == 3
+			    && is_true(arglist.v.list[3]));
+	Pattern pat = new_pattern(arglist.v.list[2].v.str, case_matters);
+	match_job *mj;
+
+	if (!pat.ptr) {
+	    free_var(arglist);
+	    return make_error_pack(E_INVARG);
+	}
+	mj = mymalloc(sizeof(match_job), M_BI_FUNC_DATA);
+	mj->subject = str_ref(subject);
+	mj->pattern = pat;
+	mj->reverse = reverse;
+	free_var(arglist);
+	return background_suspend(background_match, finish_match, mj);
+    }
 
-    ans = do_match(arglist, 1);
+    ans = do_match(arglist, reverse);
     free_var(arglist);
     if (ans.type == TYPE_ERR)
 	return make_error_pack(ans.v.err);
@@ -844,6 +958,18 @@ bf_rmatch(Var arglist, Byte next, void *vdata, Objid progr)
 	return make_var_pack(ans);
 }
 
+static package
+bf_match(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    return match_builtin(arglist, 0);
+}
+
+static package
+bf_rmatch(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    return match_builtin(arglist, 1);
+}
+
 int
 invalid_pair(int num1, int num2, int max)
 {
@@ -893,7 +1019,7 @@ bf_substitute(Var arglist, Byte next, void *vdata, Objid progr)
     int template_length, subject_length;
     const char *template, *subject;
     Var subs, ans;
-    int invarg = 0;
+    int invarg = 0, timed_out = 0, copied = 0;
     Stream *s;
     char c = '\0';
 
@@ -907,6 +1033,7 @@ bf_substitute(Var arglist, Byte next, void *vdata, Objid progr)
     }
     subject = subs.v.list[4].v.str;
     subject_length = memo_strlen(subject);
+    charge_work(template_length);
 
     s = new_stream(template_length);
     ans.type = TYPE_STR;
@@ -933,8 +1060,14 @@ bf_substitute(Var arglist, Byte next, void *vdata, Objid progr)
 			int where = skip_utf(subject, start);
 
                         end = where + skip_utf(subject + where, end - start + 1);
+			charge_work(end - where);
+			copied += end - where;
 			for (; where < end; where++)
 			    stream_add_char(s, subject[where]);
+			if (copied >= DEADLINE_CHECK_WORK) {
+			    copied = 0;
+			    timed_out = check_task_deadline();
+			}
 		    }
 		}
 		break;
@@ -942,12 +1075,15 @@ bf_substitute(Var arglist, Byte next, void *vdata, Objid progr)
 	default:
 	    stream_add_char(s, c);
 	}
-	if (invarg)
+	if (invarg || timed_out)	/* any answer will do for a task
+					   about to be aborted */
 	    break;
     }
 
     free_var(arglist);
-    if (!invarg)
+    if (timed_out)
+	ans.v.str = str_dup("");
+    else if (!invarg)
 	ans.v.str = str_dup(reset_stream(s));
     free_stream(s);
     if (invarg)
@@ -967,15 +1103,13 @@ bf_value_bytes(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
-static const char *
-hash_bytes(const char *input, int length)
+static void
+md5_hex(const char *input, int length, char hex[33])
 {
     md5ctx_t context;
     uint8_t result[16];
     int i;
     const char digits[] = "0123456789ABCDEF";
-    char *hex = str_dup("12345678901234567890123456789012");
-    const char *answer = hex;
 
     md5_Init(&context);
     md5_Update(&context, (uint8_t *) input, length);
@@ -984,7 +1118,75 @@ hash_bytes(const char *input, int length)
 	*hex++ = digits[result[i] >> 4];
 	*hex++ = digits[result[i] & 0xF];
     }
-    return answer;
+    *hex = '\0';
+}
+
+static const char *
+hash_bytes(const char *input, int length)
+{
+    char hex[33];
+
+    md5_hex(input, length, hex);
+    return str_dup(hex);
+}
+
+/* Hashing BACKGROUND_MIN_BYTES or more is done in the background.  For
+ * binary_hash(), RAW has room for the decoded bytes, which the worker
+ * decodes INPUT into first.
+ */
+typedef struct hash_job {
+    const char *input;
+    int length;
+    char *raw;
+    char hex[33];
+} hash_job;
+
+static void
+background_hash(void *data)
+{
+    hash_job *hj = data;
+
+    if (hj->raw) {
+	hj->length = binary_to_raw_buffer(hj->input, hj->raw);
+	if (hj->length >= 0)
+	    md5_hex(hj->raw, hj->length, hj->hex);
+    } else
+	md5_hex(hj->input, hj->length, hj->hex);
+}
+
+static Var
+finish_hash(void *data, int killed)
+{
+    hash_job *hj = data;
+    Var r;
+
+    if (hj->length < 0) {
+	r.type = TYPE_ERR;
+	r.v.err = E_INVARG;
+    } else if (killed)
+	r = zero;
+    else {
+	r.type = TYPE_STR;
+	r.v.str = str_dup(hj->hex);
+    }
+    free_str(hj->input);
+    if (hj->raw)
+	myfree(hj->raw, M_STREAM);
+    myfree(hj, M_BI_FUNC_DATA);
+
+    return r;
+}
+
+/* Takes over the reference to INPUT */
+static package
+hash_in_background(const char *input, int length, int binary)
+{
+    hash_job *hj = mymalloc(sizeof(hash_job), M_BI_FUNC_DATA);
+
+    hj->input = input;
+    hj->length = length;
+    hj->raw = binary ? mymalloc(length + 1, M_STREAM) : 0;
+    return background_suspend(background_hash, finish_hash, hj);
 }
 
 static package
@@ -992,8 +1194,17 @@ bf_binary_hash(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
     int length;
-    const char *bytes = binary_to_raw_bytes(arglist.v.list[1].v.str, &length);
+    const char *bytes;
+
+    length = memo_strlen(arglist.v.list[1].v.str);
+    charge_work(length);
+    if (length >= BACKGROUND_MIN_BYTES) {
+	bytes = str_ref(arglist.v.list[1].v.str);
+	free_var(arglist);
+	return hash_in_background(bytes, length, 1);
+    }
 
+    bytes = binary_to_raw_bytes(arglist.v.list[1].v.str, &length);
     free_var(arglist);
     if (!bytes)
 	return make_error_pack(E_INVARG);
@@ -1007,9 +1218,17 @@ bf_string_hash(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
     const char *str = arglist.v.list[1].v.str;
+    int length = memo_strlen(str);
+
+    charge_work(length);
+    if (length >= BACKGROUND_MIN_BYTES) {
+	str = str_ref(str);
+	free_var(arglist);
+	return hash_in_background(str, length, 0);
+    }
 
     r.type = TYPE_STR;
-    r.v.str = hash_bytes(str, memo_strlen(str));
+    r.v.str = hash_bytes(str, length);
     free_var(arglist);
     return make_var_pack(r);
 }
@@ -1019,27 +1238,24 @@ bf_value_hash(Var arglist, Byte next, void *vdata, Objid progr)
 {
     Var r;
     const char *lit = value_to_literal(arglist.v.list[1]);
+    int length = memo_strlen(lit);
 
-    r.type = TYPE_STR;
-    r.v.str = hash_bytes(lit, memo_strlen(lit));
     free_var(arglist);
+    charge_work(length);
+    if (length >= BACKGROUND_MIN_BYTES)
+	return hash_in_background(str_dup(lit), length, 0);
+
+    r.type = TYPE_STR;
+    r.v.str = hash_bytes(lit, length);
     return make_var_pack(r);
 }
 
-static package
-bf_decode_binary(Var arglist, Byte next, void *vdata, Objid progr)
+static Var
+decoded_list(const char *bytes, int length, int fully)
 {
-    int length;
-    const char *bytes = binary_to_raw_bytes(arglist.v.list[1].v.str, &length);
-    int nargs = arglist.v.list[0].v.num;
-    int fully = (nargs >= 2 && is_true(arglist.v.list[2]));
     Var r;
     int i;
 
-    free_var(arglist);
-    if (!bytes)
-	return make_error_pack(E_INVARG);
-
     if (fully) {
 	r = new_list(length);
 	for (i = 1; i <= length; i++) {
@@ -1092,7 +1308,71 @@ bf_decode_binary(Var arglist, Byte next, void *vdata, Objid progr)
 	}
     }
 
-    return make_var_pack(r);
+    return r;
+}
+
+/* Long binary strings are decoded in the background, into RAW. */
+typedef struct binary_job {
+    const char *binary;
+    char *raw;
+    int length;
+    int fully;
+} binary_job;
+
+static void
+background_decode(void *data)
+{
+    binary_job *bj = data;
+
+    bj->length = binary_to_raw_buffer(bj->binary, bj->raw);
+}
+
+static Var
+finish_decode(void *data, int killed)
+{
+    binary_job *bj = data;
+    Var r;
+
+    if (bj->length < 0) {
+	r.type = TYPE_ERR;
+	r.v.err = E_INVARG;
+    } else if (killed)
+	r = zero;
+    else
+	r = decoded_list(bj->raw, bj->length, bj->fully);
+    free_str(bj->binary);
+    myfree(bj->raw, M_STREAM);
+    myfree(bj, M_BI_FUNC_DATA);
+
+    return r;
+}
+
+static package
+bf_decode_binary(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    const char *binary = arglist.v.list[1].v.str;
+    int length = memo_strlen(binary);
+    int nargs = arglist.v.list[0].v.num;
+    int fully = (nargs >= 2 && is_true(arglist.v.list[2]));
+    const char *bytes;
+
+    charge_work(length);
+    if (length >= BACKGROUND_MIN_BYTES) {
+	binary_job *bj = mymalloc(sizeof(binary_job), M_BI_FUNC_DATA);
+
+	bj->binary = str_ref(binary);
+	bj->raw = mymalloc(length + 1, M_STREAM);
+	bj->fully = fully;
+	free_var(arglist);
+	return background_suspend(background_decode, finish_decode, bj);
+    }
+
+    bytes = binary_to_raw_bytes(binary, &length);
+    free_var(arglist);
+    if (!bytes)
+	return make_error_pack(E_INVARG);
+
+    return make_var_pack(decoded_list(bytes, length, fully));
 }
 
 static int
@@ -1121,6 +1401,40 @@ encode_binary(Stream * s, Var v)
     return 1;
 }
 
+/* ... and encoded from a copy of the raw bytes into BINARY. */
+typedef struct encode_job {
+    char *raw;
+    int length;
+    char *binary;
+} encode_job;
+
+static void
+background_encode(void *data)
+{
+    encode_job *ej = data;
+
+    raw_bytes_to_binary_buffer(ej->raw, ej->length, ej->binary);
+}
+
+static Var
+finish_encode(void *data, int killed)
+{
+    encode_job *ej = data;
+    Var r;
+
+    if (killed)
+	r = zero;
+    else {
+	r.type = TYPE_STR;
+	r.v.str = str_dup(ej->binary);
+    }
+    myfree(ej->binary, M_STREAM);
+    myfree(ej->raw, M_STREAM);
+    myfree(ej, M_BI_FUNC_DATA);
+
+    return r;
+}
+
 static package
 bf_encode_binary(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -1136,12 +1450,21 @@ bf_encode_binary(Var arglist, Byte next, void *vdata, Objid progr)
     free_var(arglist);
     length = stream_length(s);
     bytes = reset_stream(s);
-    if (ok) {
-	r.type = TYPE_STR;
-	r.v.str = str_dup(raw_bytes_to_binary(bytes, length));
-	return make_var_pack(r);
-    } else
+    if (!ok)
 	return make_error_pack(E_INVARG);
+    charge_work(length);
+    if (length >= BACKGROUND_MIN_BYTES) {
+	encode_job *ej = mymalloc(sizeof(encode_job), M_BI_FUNC_DATA);
+
+	ej->raw = mymalloc(length, M_STREAM);
+	memcpy(ej->raw, bytes, length);
+	ej->length = length;
+	ej->binary = mymalloc(3 * length + 1, M_STREAM);
+	return background_suspend(background_encode, finish_encode, ej);
+    }
+    r.type = TYPE_STR;
+    r.v.str = str_dup(raw_bytes_to_binary(bytes, length));
+    return make_var_pack(r);
 }
 
 static package bf_tochar(Var arglist, Byte next, void *vdata, Objid progr)
@@ -1267,6 +1590,7 @@ bf_encode_chars(Var arglist, Byte next, void *vdata, Objid progr)
 
     length = stream_length(s);
     bytes = reset_stream(s);
+    charge_work(length);
 
     if (ok) {
 	bytes = recode_chars(bytes, &length, "UTF-8", arglist.v.list[2].v.str);
@@ -1296,6 +1620,7 @@ bf_decode_chars(Var arglist, Byte next, void *vdata, Objid progr)
     int length, ok = 0;
     Var r;
 
+    charge_work(memo_strlen(binary));
     src = binary_to_raw_bytes(binary, &length);
     if (src) {
 	dst = recode_chars(src, &length, arglist.v.list[2].v.str, "UTF-32");
@@ -24,6 +24,11 @@ extern Var listset(Var list, Var value, int pos);
 extern Var listrangeset(Var list, int from, int to, Var value);
 extern Var listconcat(Var first, Var second);
 extern int ismember(Var value, Var list, int case_matters);
+extern int ismember_checked(Var value, Var list, int case_matters);
+				/* Like ismember(), but gives up and returns
+				 * -1 once the running task has used up its
+				 * seconds; see check_task_deadline().
+				 */
 extern Var setadd(Var list, Var value);
 extern Var setremove(Var list, Var value);
 extern Var sublist(Var list, int lower, int upper);
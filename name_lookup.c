@@ -41,7 +41,6 @@
 #include "log.h"
 #include "server.h"
 #include "storage.h"
-#include "timers.h"
 
 /******************************************************************************
  * Utilities
@@ -150,8 +149,9 @@ struct request {
  *****************************************************************************/
 
 static void
-timeout_proc(Timer_ID id, Timer_Data data)
+timeout_proc(int signo)
 {
+    (void) signo;
     _exit(1);
 }
 
@@ -161,12 +161,12 @@ lookup(int to_intermediary, int from_intermediary)
     struct request req;
     static char *buffer = 0;
     static int buflen = 0;
-    Timer_ID id;
     struct hostent *e;
 
     set_server_cmdline("(MOO name-lookup slave)");
-    /* Read requests and do them.  Before each, we set a timer.  If it
-       expires, we exit (in timeout_proc, above).  The intermediary will
+    signal(SIGALRM, timeout_proc);
+    /* Read requests and do them.  Before each, we set an alarm.  If it
+       goes off, we exit (in timeout_proc, above).  The intermediary will
        restart us in that event. */
     for (;;) {
 	if (robust_read(from_intermediary, &req, sizeof(req)) != sizeof(req))
@@ -177,12 +177,12 @@ lookup(int to_intermediary, int from_intermediary)
 		!= req.u.length)
 		_exit(1);
 	    buffer[req.u.length] = 0;
-	    id = set_timer(req.timeout, timeout_proc, 0);
+	    alarm(req.timeout);
 	    /* This cast is to work around systems like NeXT that declare
 	     * gethostbyname() to take a non-const string pointer.
 	     */
 	    e = gethostbyname((void *) buffer);
-	    cancel_timer(id);
+	    alarm(0);
 	    if (e && e->h_length == sizeof(uint32_t))
 		write(to_intermediary, e->h_addr_list[0], e->h_length);
 	    else {
@@ -195,11 +195,11 @@ lookup(int to_intermediary, int from_intermediary)
 	} else {
 	    const char *host_name;
 	    int length;
-	    id = set_timer(req.timeout, timeout_proc, 0);
+	    alarm(req.timeout);
 	    e = gethostbyaddr((void *) &req.u.address.sin_addr,
 			      sizeof(req.u.address.sin_addr),
 			      AF_INET);
-	    cancel_timer(id);
+	    alarm(0);
 	    host_name = e ? e->h_name : "";
 	    length = strlen(host_name);
 	    write(to_intermediary, &length, sizeof(length));
@@ -38,7 +38,6 @@
 #include "options.h"
 #include "server.h"
 #include "streams.h"
-#include "timers.h"
 #include "utils.h"
 
 #include "net_tcp.c"
@@ -177,15 +176,50 @@ proto_close_listener(int fd)
 
 #ifdef OUTBOUND_NETWORK
 
-#include "exceptions.h"
+#include "my-fcntl.h"
+#include "my-sys-time.h"
 #include "structures.h"
 
-static Exception timeout_exception;
-
-static void
-timeout_proc(Timer_ID id, Timer_Data data)
+/* Like connect(), but gives up with ETIMEDOUT after TIMEOUT seconds. */
+static int
+connect_with_timeout(int s, struct sockaddr_in *addr, int timeout)
 {
-    RAISE(timeout_exception, 0);
+    int flags = fcntl(s, F_GETFL, 0);
+    int result, err;
+    socklen_t length = sizeof(err);
+    fd_set output;
+    struct timeval tv;
+
+    if (flags < 0 || fcntl(s, F_SETFL, flags | NONBLOCK_FLAG) < 0)
+	return connect(s, (struct sockaddr *) addr, sizeof(*addr));
+
+    result = connect(s, (struct sockaddr *) addr, sizeof(*addr));
+    if (result < 0 && errno == EINPROGRESS) {
+	FD_ZERO(&output);
+	FD_SET(s, &output);
+	tv.tv_sec = timeout;
+	tv.tv_usec = 0;
+	do
+	    result = select(s + 1, 0, (void *) &output, 0, &tv);
+	while (result < 0 && errno == EINTR);
+	if (result == 0) {
+	    result = -1;
+	    errno = ETIMEDOUT;
+	} else if (result > 0) {
+	    if (getsockopt(s, SOL_SOCKET, SO_ERROR, (void *) &err, &length) < 0)
+		result = -1;
+	    else if (err != 0) {
+		result = -1;
+		errno = err;
+	    } else
+		result = 0;
+	}
+    }
+    err = errno;
+    fcntl(s, F_SETFL, flags);
+    errno = err;
+
+    return result;
 }
 
 enum error
@@ -198,7 +232,6 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
      */
     static const char *host_name;
     static int port;
-    static Timer_ID id;
     size_t length;
     int s, result;
     int timeout = server_int_option("name_lookup_timeout", 5);
@@ -252,18 +285,8 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
 	    return e;
 	}
     }	 
-    TRY {
-	id = set_timer(server_int_option("outbound_connect_timeout", 5),
-		       timeout_proc, 0);
-	result = connect(s, (struct sockaddr *) &addr, sizeof(addr));
-	cancel_timer(id);
-    }
-    EXCEPT(timeout_exception) {
-	result = -1;
-	errno = ETIMEDOUT;
-	reenable_timers();
-    }
-    ENDTRY;
+    result = connect_with_timeout(s, &addr,
+			server_int_option("outbound_connect_timeout", 5));
 
     if (result < 0) {
 	close(s);
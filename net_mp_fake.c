@@ -19,7 +19,7 @@
 
 #include "my-types.h"
 #include "my-stat.h"
-#include "my-unistd.h"		/* sleep() */
+#include "my-unistd.h"		/* usleep() */
 
 #include "net_mplex.h"
 #include "options.h"
@@ -137,10 +137,14 @@ mplex_wait(unsigned timeout)
 	    }
 	}
 
-	if (got_one)
+	if (got_one || timeout == 0)
 	    break;
-	else if (timeout-- > 0)
-	    sleep(1);
+	else {
+	    unsigned nap = timeout < 100000 ? timeout : 100000;
+
+	    usleep(nap);
+	    timeout -= nap;
+	}
     }
 
     return !got_one;
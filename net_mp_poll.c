@@ -80,7 +80,8 @@ mplex_add_writer(int fd)
 int
 mplex_wait(unsigned timeout)
 {
-    int result = poll(ports, max_fd + 1, timeout * 1000);
+    /* Round up, lest a wait of less than a millisecond become a spin. */
+    int result = poll(ports, max_fd + 1, (timeout + 999) / 1000);
 
     if (result < 0) {
 	if (errno != EINTR)
@@ -51,8 +51,8 @@ extern void mplex_add_writer(int fd);
 extern int mplex_wait(unsigned timeout);
 				/* Wait until it is possible either to do the
 				 * appropriate kind of I/O on some descriptor
-				 * in the wait set or until `timeout' seconds
-				 * have elapsed.  Return true iff the timeout
+				 * in the wait set or until `timeout'
+				 * microseconds have elapsed.  Return true iff the timeout
 				 * expired without any I/O becoming possible.
 				 */
 
@@ -185,7 +185,7 @@ network_process_io(int timeout)
 	    state = STATE_OPEN;
 	    got_some = 1;
 	} else if (timeout != 0)
-	    sleep(timeout);
+	    usleep(timeout);
 	break;
 
     case STATE_OPEN:
@@ -215,9 +215,12 @@ network_process_io(int timeout)
 
 	    if (got_some || timeout == 0)
 		goto done;
+	    else {
+		int nap = timeout < 100000 ? timeout : 100000;
 
-	    sleep(1);
-	    timeout--;
+		usleep(nap);
+		timeout -= nap;
+	    }
 	}
     }
 
@@ -242,11 +242,12 @@ proto_close_listener(int fd)
 #ifdef OUTBOUND_NETWORK
 
 #include "exceptions.h"
+#include "my-signal.h"
 
 static Exception timeout_exception;
 
 static void
-timeout_proc(Timer_ID id, Timer_Data data)
+timeout_proc(int signo)
 {
     RAISE(timeout_exception, 0);
 }
@@ -263,7 +264,6 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
     struct t_bind received, requested, *p_requested;
     static const char *host_name;
     static int port;
-    static Timer_ID id;
     int fd, result;
     int timeout = server_int_option("name_lookup_timeout", 5);
     static struct sockaddr_in addr;
@@ -327,10 +327,11 @@ proto_open_connection(Var arglist, int *read_fd, int *write_fd,
     call->addr.buf = (void *) &addr;
 
     TRY {
-	id = set_timer(server_int_option("outbound_connect_timeout", 5),
-		       timeout_proc, 0);
+	/* t_connect() blocks, and timers only run from the main loop. */
+	signal(SIGALRM, timeout_proc);
+	alarm(server_int_option("outbound_connect_timeout", 5));
 	result = t_connect(fd, call, 0);
-	cancel_timer(id);
+	alarm(0);
     }
     EXCEPT(timeout_exception) {
 	result = -1;
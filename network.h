@@ -153,7 +153,8 @@ extern int network_process_io(int timeout);
 				 * pending input, and handle requests for new
 				 * connections.  It is acceptable for the
 				 * network to block for up to 'timeout'
-				 * seconds.  Returns true iff it found some I/O
+				 * microseconds.  Returns true iff it found
+				 * some I/O
 				 * to do (i.e., it didn't use up all of the
 				 * timeout).
 				 */
@@ -235,15 +235,17 @@ bf_max_object(Var arglist, Byte next, void *vdata, Objid progr)
 
 static package
 bf_create(Var arglist, Byte next, void *vdata, Objid progr)
-{				/* (parent [, owner]) */
+{				/* (parent [, owner [, reuse]]) */
     Objid *data = vdata;
     Var r;
 
     if (next == 1) {
 	Objid parent, owner;
+	int nargs = arglist.v.list[0].v.num;
+	int reuse = (nargs >= 3 && is_true(arglist.v.list[3]));
 
 	parent = arglist.v.list[1].v.obj;
-	owner = (arglist.v.list[0].v.num == 2
+	owner = (nargs >= 2
 		 ? arglist.v.list[2].v.obj
 		 : progr);
 	free_var(arglist);
@@ -257,7 +259,9 @@ bf_create(Var arglist, Byte next, void *vdata, Objid progr)
 	    return make_error_pack(E_QUOTA);
 	else {
 	    enum error e;
-	    Objid oid = db_create_object();
+	    Objid oid = (reuse
+			 ? db_create_recycled_object()
+			 : db_create_object());
 	    Var args;
 
 	    db_set_object_name(oid, str_dup(""));
@@ -314,7 +318,6 @@ bf_chparent(Var arglist, Byte next, void *vdata, Objid progr)
 {				/* (object, new_parent) */
     Objid what = arglist.v.list[1].v.obj;
     Objid parent = arglist.v.list[2].v.obj;
-    Objid oid;
 
     free_var(arglist);
     if (!valid(what)
@@ -325,9 +328,8 @@ bf_chparent(Var arglist, Byte next, void *vdata, Objid progr)
 		 && !db_object_allows(parent, progr, FLAG_FERTILE)))
 	return make_error_pack(E_PERM);
     else {
-	for (oid = parent; oid != NOTHING; oid = db_object_parent(oid))
-	    if (oid == what)
-		return make_error_pack(E_RECMOVE);
+	if (valid(parent) && db_object_isa(parent, what))
+	    return make_error_pack(E_RECMOVE);
 
 	if (!db_change_parent(what, parent))
 	    return make_error_pack(E_INVARG);
@@ -353,25 +355,21 @@ bf_parent(Var arglist, Byte next, void *vdata, Objid progr)
     }
 }
 
-struct children_data {
-    Var r;
-    int i;
-};
-
-static int
-add_to_list(void *data, Objid child)
-{
-    struct children_data *d = data;
+static package
+bf_children(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (object) */
+    Objid oid = arglist.v.list[1].v.obj;
 
-    d->i++;
-    d->r.v.list[d->i].type = TYPE_OBJ;
-    d->r.v.list[d->i].v.obj = child;
+    free_var(arglist);
 
-    return 0;
+    if (!valid(oid))
+	return make_error_pack(E_INVARG);
+    else
+	return make_var_pack(db_children_list(oid));
 }
-
+
 static package
-bf_children(Var arglist, Byte next, void *vdata, Objid progr)
+bf_ancestors(Var arglist, Byte next, void *vdata, Objid progr)
 {				/* (object) */
     Objid oid = arglist.v.list[1].v.obj;
 
@@ -379,17 +377,28 @@ bf_children(Var arglist, Byte next, void *vdata, Objid progr)
 
     if (!valid(oid))
 	return make_error_pack(E_INVARG);
-    else {
-	struct children_data d;
+    else
+	return make_var_pack(db_object_ancestors(oid));
+}
 
-	d.r = new_list(db_count_children(oid));
-	d.i = 0;
-	db_for_all_children(oid, add_to_list, &d);
+static package
+bf_isa(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (object, ancestor) */
+    Objid oid = arglist.v.list[1].v.obj;
+    Objid ancestor = arglist.v.list[2].v.obj;
+    Var r;
 
-	return make_var_pack(d.r);
+    free_var(arglist);
+
+    if (!valid(oid))
+	return make_error_pack(E_INVARG);
+    else {
+	r.type = TYPE_INT;
+	r.v.num = db_object_isa(oid, ancestor);
+	return make_var_pack(r);
     }
 }
-
+
 static int
 move_to_nothing(Objid oid)
 {
@@ -597,9 +606,9 @@ register_objects(void)
 {
     register_function("toobj", 1, 1, bf_toobj, TYPE_ANY);
     register_function("typeof", 1, 1, bf_typeof, TYPE_ANY);
-    register_function_with_read_write("create", 1, 2, bf_create,
+    register_function_with_read_write("create", 1, 3, bf_create,
 				      bf_create_read, bf_create_write,
-				      TYPE_OBJ, TYPE_OBJ);
+				      TYPE_OBJ, TYPE_OBJ, TYPE_ANY);
     register_function_with_read_write("recycle", 1, 1, bf_recycle,
 				      bf_recycle_read, bf_recycle_write,
 				      TYPE_OBJ);
@@ -607,6 +616,8 @@ register_objects(void)
     register_function("valid", 1, 1, bf_valid, TYPE_OBJ);
     register_function("parent", 1, 1, bf_parent, TYPE_OBJ);
     register_function("children", 1, 1, bf_children, TYPE_OBJ);
+    register_function("ancestors", 1, 1, bf_ancestors, TYPE_OBJ);
+    register_function("isa", 2, 2, bf_isa, TYPE_OBJ, TYPE_OBJ);
     register_function("chparent", 2, 2, bf_chparent, TYPE_OBJ, TYPE_OBJ);
     register_function("max_object", 0, 0, bf_max_object);
     register_function("players", 0, 0, bf_players);
@@ -37,9 +37,19 @@
  * there may not be enough memory to support two simultaneously running server
  * processes.  Define UNFORKED_CHECKPOINTS to disable server forking for
  * checkpoints.
+ *
+ * Define SNAPSHOT_CHECKPOINTS instead to have checkpoints written by a thread
+ * of the server process itself, which goes on servicing user commands.  The
+ * checkpoint holds the database as it was when the checkpoint started: until
+ * the thread is done with an object, the first change to it saves a copy of
+ * it as it was for the thread to write.  This costs only the memory for
+ * those copies, and none of the pause or the copy-on-write page faults that
+ * fork()ing a large server brings.  It needs POSIX threads and `__thread'
+ * variables.  While there are any WAIFs, checkpoints are forked as usual.
  */
 
 /* #define UNFORKED_CHECKPOINTS */
+/* #define SNAPSHOT_CHECKPOINTS */
 
 /******************************************************************************
  * If OUT_OF_BAND_PREFIX is defined as a non-empty string, then any lines of
@@ -78,6 +88,15 @@
  *	real-time seconds any task is allowed to use without suspending.  If
  *	defined in the database, $server_options.fg_seconds and
  *	$server_options.bg_seconds override these defaults.
+ * DEFAULT_WORK_PER_TICK is how many units of work (bytes of a string or
+ *	elements of a list) built-in functions and a few operators such as
+ *	string `+', `in' and list splicing may go through for one extra tick.
+ *	This way the limits above also bound tasks that do a lot of work in a
+ *	few calls, like substitute() on a megabyte string.  Zero charges every
+ *	operation one tick, however much work it does, as older servers did;
+ *	that is the default, since existing code was written to the old tick
+ *	budgets.  If defined in the database, $server_options.work_per_tick
+ *	overrides this default; 1000 is a reasonable value to opt in with.
  *
  * The *FG* constants are used only for `foreground' tasks (those started by
  * either player input or the server's initiative and that have never
@@ -97,13 +116,21 @@
 #define DEFAULT_FG_SECONDS	5
 #define DEFAULT_BG_SECONDS	3
 
+#define DEFAULT_WORK_PER_TICK	0
+
 /******************************************************************************
  * Debug settings:
  *
  * DEBUG_LOG_TRACEBACKS prints all tracebacks to the server log.
+ *
+ * REFCOUNT_STATS counts the reference-count updates skipped for immortal
+ * values, as reported by refcount_stats(); without it, that count is given
+ * as -1.  The count is bumped on every such addref() and delref(), so leave
+ * it off outside of testing.
  */
 
 #define DEBUG_LOG_TRACEBACKS
+/* #define REFCOUNT_STATS */
 
 /******************************************************************************
  * NETWORK_PROTOCOL must be defined as one of the following:
@@ -290,6 +317,96 @@
 
 #define STRING_INTERNING /* */
 
+/******************************************************************************
+ * Most of the time spent loading a large database goes into compiling its
+ * verb programs.  DB_LOAD_THREADS is the number of threads that do that
+ * compiling; 0 means one per online CPU and 1 means compile everything on the
+ * main thread, as older servers did.  Threads are only used if your system
+ * has POSIX threads and your compiler supports `__thread' variables.
+ ******************************************************************************
+ */
+
+#define DB_LOAD_THREADS 0
+
+/******************************************************************************
+ * A few built-in functions (string_hash(), binary_hash(), value_hash(),
+ * encode_binary(), decode_binary(), match() and rmatch()) do their work on a
+ * pool of BACKGROUND_THREADS worker threads when given at least
+ * BACKGROUND_MIN_BYTES of input, so that one huge call doesn't hold up every
+ * other task and connection.  The calling task is suspended meanwhile, just
+ * as if it had called suspend(0), so other tasks may run in the middle of
+ * such a call and it goes on as a background task afterwards.  Smaller calls
+ * are done on the spot, as before.  Set BACKGROUND_THREADS to 0 to do all of
+ * them on the spot.  Threads are only used if your system has POSIX threads
+ * and NETWORK_PROTOCOL isn't NP_SINGLE.
+ ******************************************************************************
+ */
+
+#define BACKGROUND_THREADS 2
+#define BACKGROUND_MIN_BYTES 65536
+
+/******************************************************************************
+ * EXPERIMENTAL.  Define PARALLEL_TASK_STATS to have the server work out how
+ * much faster it could run its tasks if it ran those that are ready at the
+ * same time on several threads, committing each one's changes to the
+ * database only if it read nothing another had changed meanwhile.  This is
+ * a measurement only: the server has no mode that runs tasks concurrently.
+ * Tasks still run one at a time; the server just keeps track of the
+ * properties and object attributes each one reads and writes, which costs a
+ * little time on every database access.  The wizard-only built-in function
+ * parallel_stats() reports the results, and tests/bench_parallel.sh runs a
+ * workload of independent players under it; see parallel.h for details.
+ ******************************************************************************
+ */
+
+/* #define PARALLEL_TASK_STATS */
+
+/******************************************************************************
+ * Define LAZY_DB_LOAD to have the server load a binary database lazily: at
+ * startup it reads only each object's location, parent, owner, flags and the
+ * like, and the rest of an object (its name, verbs, properties and verb
+ * programs) is read from the database file the first time anything asks for
+ * it.  Objects that are never touched cost little memory, and startup is
+ * much faster.  The input file stays mapped into memory for as long as the
+ * server runs, so it must not be changed in place (renaming or removing it
+ * is fine), and binary checkpoints copy untouched objects straight from it.
+ * Text and compressed databases, and databases saved while any WAIFs
+ * existed, are always loaded in full.
+ ******************************************************************************
+ */
+
+/* #define LAZY_DB_LOAD */
+
+/******************************************************************************
+ * With JOURNAL_CHANGES defined, every change to the database (creating,
+ * recycling, moving or reparenting objects, setting properties, changing
+ * verbs and so on) is appended to a journal file next to the output database
+ * as it happens, and a server that crashes between checkpoints gets those
+ * changes back by replaying the journal when it is next started on the last
+ * checkpoint.  The journal is fsync()ed at most once every JOURNAL_SYNC_MSECS
+ * milliseconds, and always when the server is idle, so a crash of the whole
+ * machine can lose at most that much.  Changes involving WAIF values, and
+ * the task queue, are not journaled; they only survive in checkpoints.
+ ******************************************************************************
+ */
+
+#define JOURNAL_CHANGES
+#define JOURNAL_SYNC_MSECS 100
+
+/******************************************************************************
+ * With INCREMENTAL_CHECKPOINTS set above zero, a checkpoint usually writes
+ * only the objects changed since the last full dump, as a small `delta'
+ * database that names that full dump (kept as a hard link, output-db-file
+ * with `.base' appended) and is loaded on top of it.  A full dump is written
+ * instead after INCREMENTAL_CHECKPOINTS deltas in a row, or once a quarter of
+ * the objects have changed; the dump made at shutdown is always full.  Zero
+ * means every checkpoint is full, as in older servers.  So is every checkpoint
+ * made while any WAIFs exist, since a delta can't save them.
+ ******************************************************************************
+ */
+
+#define INCREMENTAL_CHECKPOINTS 24
+
 /******************************************************************************
  * Store the length of the string WITH the string rather than recomputing
  * it each time it is needed.
@@ -384,6 +501,42 @@
 #  endif
 #endif
 
+#if DB_LOAD_THREADS != 1 && HAVE_PTHREAD_CREATE && HAVE_THREAD_LOCAL
+#  define THREADED_DB_LOAD 1
+#endif
+
+#if HAVE_ZLIB_H && HAVE_DEFLATE
+#  define COMPRESSED_DUMPS 1
+#endif
+
+#if BACKGROUND_THREADS > 0 && HAVE_PTHREAD_CREATE && NETWORK_PROTOCOL != NP_SINGLE
+#  define THREADED_BUILTINS 1
+#endif
+
+#if DB_LOAD_THREADS < 0
+#  error Illegal value for "DB_LOAD_THREADS"
+#endif
+
+#if BACKGROUND_THREADS < 0
+#  error Illegal value for "BACKGROUND_THREADS"
+#endif
+
+#if defined(JOURNAL_CHANGES) && JOURNAL_SYNC_MSECS < 0
+#  error Illegal value for "JOURNAL_SYNC_MSECS"
+#endif
+
+#if defined(SNAPSHOT_CHECKPOINTS) && defined(UNFORKED_CHECKPOINTS)
+#  error Define at most one of "SNAPSHOT_CHECKPOINTS" and "UNFORKED_CHECKPOINTS"
+#endif
+
+#if defined(SNAPSHOT_CHECKPOINTS) && !(HAVE_PTHREAD_CREATE && HAVE_THREAD_LOCAL)
+#  error "SNAPSHOT_CHECKPOINTS" needs POSIX threads and __thread variables
+#endif
+
+#if INCREMENTAL_CHECKPOINTS < 0
+#  error Illegal value for "INCREMENTAL_CHECKPOINTS"
+#endif
+
 #if (NETWORK_PROTOCOL == NP_LOCAL || NETWORK_PROTOCOL == NP_SINGLE) && defined(OUTBOUND_NETWORK)
 #  error You cannot define "OUTBOUND_NETWORK" with that "NETWORK_PROTOCOL"
 #endif
@@ -0,0 +1,308 @@
+/*****************************************************************************
+ * Conflict tracking for tasks run by run_ready_tasks(); see parallel.h
+ *****************************************************************************/
+
+#include "my-string.h"
+
+#include "bf_register.h"
+#include "config.h"
+#include "db.h"
+#include "functions.h"
+#include "list.h"
+#include "options.h"
+#include "parallel.h"
+#include "storage.h"
+#include "structures.h"
+#include "utils.h"
+
+#ifdef PARALLEL_TASK_STATS
+
+/* Each slot touched in the current batch has an entry in an open-addressed
+ * table.  Entries left over from earlier batches count as empty, so a new
+ * batch needn't clear the table.  FINISH is when the last of the batch's
+ * tasks that wrote the slot so far would have committed, in microseconds
+ * from the start of the batch; a task reading the slot can't commit before
+ * then.
+ */
+typedef struct slot_entry {
+    Objid oid;
+    int slot;
+    unsigned batch;
+    unsigned read_by, written_by;	/* task numbers */
+    long finish;
+} slot_entry;
+
+typedef struct {
+    Objid oid;
+    int slot;
+} slot_key;
+
+static slot_entry *table = 0;
+static unsigned table_size = 0, table_used = 0;
+
+static unsigned batch_number = 0;
+static int batch_left = 0;
+static unsigned batch_tasks;
+static long batch_finish, barrier_finish;
+
+static unsigned task_number = 0;
+static long task_ready;		/* when the slots it read were committed */
+static char task_serial, task_deferred;
+static slot_key *task_writes = 0;
+static int task_nwrites = 0, task_max_writes = 0;
+
+int parallel_tracking = 0;
+
+static struct {
+    unsigned batches, tasks;
+    unsigned conflicted, serial, deferred;
+    double usecs, parallel_usecs;
+} stats;
+
+/* Built-in functions with effects outside the database: the output of
+ * DEFERRED ones would be held until the task commits; SERIAL ones make the
+ * task run alone.
+ */
+static const char *deferred_functions[] = {
+    "notify", "server_log"
+};
+
+static const char *serial_functions[] = {
+    "boot_player", "open_network_connection", "listen", "unlisten",
+    "set_connection_option", "force_input", "flush_input",
+    "queued_tasks", "task_info", "kill_task", "resume", "shutdown",
+    "dump_database", "load_server_options"
+};
+
+enum {
+    BF_PURE, BF_DEFERRED, BF_SERIAL
+};
+
+static char bf_kind[MAX_FUNC];
+
+static unsigned
+slot_hash(Objid oid, int slot)
+{
+    return ((unsigned) oid * 2654435761U) ^ ((unsigned) slot * 40503U);
+}
+
+static slot_entry *
+find_slot(Objid oid, int slot)
+{
+    unsigned mask, i;
+    slot_entry *e;
+
+    if (table_used * 2 >= table_size) {
+	slot_entry *old = table;
+	unsigned old_size = table_size;
+
+	table_size = table_size ? table_size * 2 : 1024;
+	table = mymalloc(table_size * sizeof(slot_entry), M_TASK);
+	memset(table, 0, table_size * sizeof(slot_entry));
+	table_used = 0;
+	if (old) {
+	    for (i = 0; i < old_size; i++)
+		if (old[i].batch == batch_number) {
+		    e = find_slot(old[i].oid, old[i].slot);
+		    *e = old[i];
+		}
+	    myfree(old, M_TASK);
+	}
+    }
+    mask = table_size - 1;
+    for (i = slot_hash(oid, slot) & mask;; i = (i + 1) & mask) {
+	e = &table[i];
+	if (e->batch != batch_number) {
+	    e->oid = oid;
+	    e->slot = slot;
+	    e->batch = batch_number;
+	    e->read_by = e->written_by = 0;
+	    e->finish = 0;
+	    table_used++;
+	    return e;
+	}
+	if (e->oid == oid && e->slot == slot)
+	    return e;
+    }
+}
+
+static void
+end_batch(void)
+{
+    if (batch_tasks) {
+	stats.batches++;
+	stats.parallel_usecs += batch_finish;
+    }
+    batch_number++;
+    table_used = 0;
+    batch_left = 0;
+    batch_tasks = 0;
+    batch_finish = barrier_finish = 0;
+}
+
+void
+parallel_begin_task(int batch_size)
+{
+    if (batch_left <= 0) {
+	end_batch();
+	batch_left = batch_size;
+    }
+    task_number++;
+    task_ready = 0;
+    task_serial = task_deferred = 0;
+    task_nwrites = 0;
+    parallel_tracking = 1;
+}
+
+void
+parallel_end_task(long usecs)
+{
+    long start, finish;
+    int i, conflicted = task_ready > barrier_finish;
+
+    parallel_tracking = 0;
+    start = conflicted ? task_ready : barrier_finish;
+    if (task_serial && batch_finish > start)
+	start = batch_finish;
+    finish = start + usecs;
+    for (i = 0; i < task_nwrites; i++) {
+	slot_entry *e = find_slot(task_writes[i].oid, task_writes[i].slot);
+
+	if (e->finish < finish)
+	    e->finish = finish;
+    }
+    if (batch_finish < finish)
+	batch_finish = finish;
+    if (task_serial)
+	barrier_finish = finish;
+
+    batch_tasks++;
+    stats.tasks++;
+    stats.usecs += usecs;
+    stats.conflicted += conflicted;
+    stats.serial += task_serial;
+    stats.deferred += task_deferred;
+    if (--batch_left <= 0)
+	end_batch();
+}
+
+void
+parallel_cancel_task(void)
+{
+    parallel_tracking = 0;
+    end_batch();
+}
+
+void
+parallel_note_read(Objid oid, int slot)
+{
+    slot_entry *e = find_slot(oid, slot);
+
+    if (e->read_by != task_number) {
+	e->read_by = task_number;
+	if (e->finish > task_ready)
+	    task_ready = e->finish;
+    }
+}
+
+void
+parallel_note_write(Objid oid, int slot)
+{
+    slot_entry *e = find_slot(oid, slot);
+
+    if (e->written_by != task_number) {
+	e->written_by = task_number;
+	if (task_nwrites == task_max_writes) {
+	    slot_key *new;
+
+	    task_max_writes = task_max_writes ? task_max_writes * 2 : 64;
+	    new = mymalloc(task_max_writes * sizeof(slot_key), M_TASK);
+	    if (task_writes) {
+		memcpy(new, task_writes, task_nwrites * sizeof(slot_key));
+		myfree(task_writes, M_TASK);
+	    }
+	    task_writes = new;
+	}
+	task_writes[task_nwrites].oid = oid;
+	task_writes[task_nwrites].slot = slot;
+	task_nwrites++;
+    }
+}
+
+void
+parallel_note_serial(void)
+{
+    task_serial = 1;
+}
+
+void
+parallel_note_builtin(unsigned func_id)
+{
+    static int initialized = 0;
+
+    if (!initialized) {
+	unsigned i, n;
+
+	for (i = 0; i < Arraysize(deferred_functions); i++)
+	    if ((n = number_func_by_name(deferred_functions[i]))
+		!= FUNC_NOT_FOUND)
+		bf_kind[n] = BF_DEFERRED;
+	for (i = 0; i < Arraysize(serial_functions); i++)
+	    if ((n = number_func_by_name(serial_functions[i]))
+		!= FUNC_NOT_FOUND)
+		bf_kind[n] = BF_SERIAL;
+	initialized = 1;
+    }
+    if (func_id < MAX_FUNC)
+	switch (bf_kind[func_id]) {
+	case BF_DEFERRED:
+	    task_deferred = 1;
+	    break;
+	case BF_SERIAL:
+	    task_serial = 1;
+	    break;
+	}
+}
+
+static package
+bf_parallel_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Var r;
+
+    free_var(arglist);
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    /* The caller's own batch is still open; count it as it stands, so that
+     * the difference between two calls covers just the tasks between them.
+     */
+    r = new_list(7);
+    r.v.list[1].type = TYPE_INT;
+    r.v.list[1].v.num = stats.batches + (batch_tasks != 0);
+    r.v.list[2].type = TYPE_INT;
+    r.v.list[2].v.num = stats.tasks;
+    r.v.list[3].type = TYPE_INT;
+    r.v.list[3].v.num = stats.conflicted;
+    r.v.list[4].type = TYPE_INT;
+    r.v.list[4].v.num = stats.serial;
+    r.v.list[5].type = TYPE_INT;
+    r.v.list[5].v.num = stats.deferred;
+    r.v.list[6].type = TYPE_FLOAT;
+    r.v.list[6].v.fnum = stats.usecs / 1000000.0;
+    r.v.list[7].type = TYPE_FLOAT;
+    r.v.list[7].v.fnum = (stats.parallel_usecs + batch_finish) / 1000000.0;
+
+    return make_var_pack(r);
+}
+
+#endif				/* PARALLEL_TASK_STATS */
+
+void
+register_parallel(void)
+{
+#ifdef PARALLEL_TASK_STATS
+    register_function("parallel_stats", 0, 0, bf_parallel_stats);
+#endif
+}
+
+char rcsid_parallel[] = "$Id$";
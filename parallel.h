@@ -0,0 +1,80 @@
+/* Measuring how far the tasks run by run_ready_tasks() could run in parallel.
+ *
+ * With PARALLEL_TASK_STATS defined in options.h, each run of a task from
+ * run_ready_tasks() records which parts of the database it reads and writes
+ * and whether it calls a built-in function with effects outside the
+ * database.  The runs are grouped into batches, one for each round over the
+ * task queues that were ready at once, as if the tasks of a batch were run
+ * together on worker threads against the database as it was when the batch
+ * began, each committing in turn unless it had read something an earlier
+ * one wrote, and being run again afterwards if so.  The tasks still run one
+ * at a time, of course; parallel_stats() reports how long the batches would
+ * have taken that way, given enough threads, against how long they took.
+ *
+ * A part of the database is an object and a slot: the index of a property
+ * value in the object's propval array, or one of the PSLOT_ numbers below
+ * for its built-in attributes.  Changes to the object hierarchy, property
+ * and verb definitions and the like aren't tracked slot by slot; a task
+ * making one counts as running alone, after everything before it in its
+ * batch and before everything after.
+ *
+ * Nothing here runs tasks concurrently, and the server can't yet.  The
+ * interpreter keeps the running task's activation stack and tick counts in
+ * globals, reference counts are updated without locks, and the storage
+ * pools, the activation arena and the string and pattern caches are shared
+ * by everything.  Each of those would have to become per-thread or atomic
+ * before worker threads could run MOO code; these numbers are for deciding
+ * whether a workload would gain enough to make that worthwhile.
+ */
+
+#ifndef Parallel_h
+#define Parallel_h
+
+#include "config.h"
+#include "options.h"
+#include "structures.h"
+
+enum {
+    PSLOT_OWNER = -1, PSLOT_NAME = -2, PSLOT_FLAGS = -3,
+    PSLOT_LOCATION = -4, PSLOT_CONTENTS = -5
+};
+
+#ifdef PARALLEL_TASK_STATS
+
+extern int parallel_tracking;	/* true while a tracked task runs */
+
+extern void parallel_begin_task(int batch_size);
+				/* BATCH_SIZE is the number of task queues
+				 * ready to run, used if this task starts a
+				 * new batch.
+				 */
+extern void parallel_end_task(long usecs);
+				/* The task just run took USECS of CPU time. */
+extern void parallel_cancel_task(void);
+				/* Nothing was run after all; ends the batch.
+				 */
+
+extern void parallel_note_read(Objid oid, int slot);
+extern void parallel_note_write(Objid oid, int slot);
+extern void parallel_note_serial(void);
+extern void parallel_note_builtin(unsigned func_id);
+
+#define PARALLEL_READ(oid, slot) \
+	(parallel_tracking ? parallel_note_read(oid, slot) : (void) 0)
+#define PARALLEL_WRITE(oid, slot) \
+	(parallel_tracking ? parallel_note_write(oid, slot) : (void) 0)
+#define PARALLEL_SERIAL() \
+	(parallel_tracking ? parallel_note_serial() : (void) 0)
+#define PARALLEL_BUILTIN(func_id) \
+	(parallel_tracking ? parallel_note_builtin(func_id) : (void) 0)
+
+#else				/* !PARALLEL_TASK_STATS */
+
+#define PARALLEL_READ(oid, slot)	((void) 0)
+#define PARALLEL_WRITE(oid, slot)	((void) 0)
+#define PARALLEL_SERIAL()		((void) 0)
+#define PARALLEL_BUILTIN(func_id)	((void) 0)
+
+#endif				/* PARALLEL_TASK_STATS */
+
+#endif
@@ -45,15 +45,14 @@
 #include "utf.h"
 #include "version.h"
 
-static Stmt    	       *prog_start;
-static int		dollars_ok;
-static DB_Version	language_version;
+static THREAD_LOCAL Stmt    *prog_start;
+static THREAD_LOCAL int	dollars_ok;
+static THREAD_LOCAL DB_Version language_version;
 
 static void	error(const char *, const char *);
 static void	warning(const char *, const char *);
 static int	find_id(char *name);
 static void	yyerror(const char *s);
-static int	yylex(void);
 static Scatter *scatter_from_arglist(Arg_List *);
 static Scatter *add_scatter_item(Scatter *, Scatter *);
 static void	vet_scatter(Scatter *);
@@ -67,6 +66,11 @@ enum loop_exit_kind { LOOP_BREAK, LOOP_CONTINUE };
 static void	check_loop_name(const char *, enum loop_exit_kind);
 %}
 
+/* The parser is reentrant so that verb programs can be compiled on several
+ * threads at once while a database is loading; see read_db_file().
+ */
+%define api.pure
+
 %union {
   Stmt	       *stmt;
   Expr	       *expr;
@@ -82,6 +86,10 @@ static void	check_loop_name(const char *, enum loop_exit_kind);
   Scatter      *scatter;
 }
 
+%{
+static int	yylex(YYSTYPE *);
+%}
+
 %type	<stmt>   statements statement elsepart 
 %type	<arm>    elseifs
 %type   <expr>   expr default
@@ -723,10 +731,10 @@ scatter_item:
 
 %%
 
-static int		lineno, nerrors, must_rename_keywords;
-static Parser_Client	client;
-static void	       *client_data;
-static Names	       *local_names;
+static THREAD_LOCAL int	lineno, nerrors, must_rename_keywords;
+static THREAD_LOCAL Parser_Client client;
+static THREAD_LOCAL void *client_data;
+static THREAD_LOCAL Names *local_names;
 
 static int
 find_id(char *name)
@@ -746,7 +754,7 @@ yyerror(const char *s)
 static const char *
 fmt_error(const char *s, const char *t)
 {
-    static Stream      *str = 0;
+    static THREAD_LOCAL Stream *str = 0;
 
     if (str == 0)
 	str = new_stream(100);
@@ -773,7 +781,7 @@ warning(const char *s, const char *t)
 	error(s, t);
 }
 
-static int unget_buffer[5], unget_count, getc_state;
+static THREAD_LOCAL int unget_buffer[5], unget_count, getc_state;
 
 static int
 lex_getc(void)
@@ -846,10 +854,10 @@ checkrightshift(int iftwo, int ifone, int ifnone)
     return ifnone;
 }
 
-static Stream  *token_stream = 0;
+static THREAD_LOCAL Stream *token_stream = 0;
 
 static int
-yylex(void)
+yylex(YYSTYPE * lvalp)
 {
     int		c;
 
@@ -906,7 +914,7 @@ start_over:
 	} while (my_isdigit(c));
 	lex_ungetc(c);
 
-	yylval.object = negative ? -oid : oid;
+	lvalp->object = negative ? -oid : oid;
 	return tOBJECT;
     }
 
@@ -983,7 +991,7 @@ start_over:
 	lex_ungetc(c);
 
 	if (type == tINTEGER)
-	    yylval.integer = n;
+	    lvalp->integer = n;
 	else {
 	    double	d;
 	    
@@ -992,7 +1000,7 @@ start_over:
 		yyerror("Floating-point literal out of range");
 		d = 0.0;
 	    }
-	    yylval.real = d;
+	    lvalp->real = d;
 	}
 	return type;
     }
@@ -1013,7 +1021,7 @@ start_over:
 		int	t = k->token;
 
 		if (t == tERROR)
-		    yylval.error = k->error;
+		    lvalp->error = k->error;
 		return t;
 	    } else {		/* New keyword being used as an identifier */
 		if (!must_rename_keywords)
@@ -1022,7 +1030,7 @@ start_over:
 	    }
 	}
 	
-	yylval.string = alloc_string(buf);
+	lvalp->string = alloc_string(buf);
 	return tID;
     }
 
@@ -1039,7 +1047,7 @@ start_over:
 	    }
 	    stream_add_utf(token_stream, c);
 	}
-	yylval.string = alloc_string(reset_stream(token_stream));
+	lvalp->string = alloc_string(reset_stream(token_stream));
 	return tSTRING;
     }
 
@@ -1072,7 +1080,7 @@ start_over:
 	    return c;
 	} else {
 	    /* Don't confuse yacc with large Unicode values */
-	    yylval.chr = c;
+	    lvalp->chr = c;
 	    return tCHR;
 	}
     }
@@ -1138,7 +1146,7 @@ struct loop_entry {
     int			is_barrier;
 };
 
-static struct loop_entry *loop_stack;
+static THREAD_LOCAL struct loop_entry *loop_stack;
 
 static void
 push_loop_name(const char *name)
@@ -227,6 +227,8 @@ const char *translate(const char *moopat)
     return reset_stream(s);
 }
 
+static int rmatch_callout(pcre_callout_block *block);
+
 Pattern new_pattern(const char *pattern, int case_matters)
 {
     int options = 0;
@@ -253,6 +255,9 @@ Pattern new_pattern(const char *pattern, int case_matters)
     fprintf(stderr, __FILE__ ": \"%s\" => /%s/\n", pattern, translated);
 # endif
 
+    if (!pcre_callout)
+	pcre_callout = rmatch_callout;
+
     code = pcre_compile(translated, options, &error, &error_offset, 0);
 # if DEBUG
     if (!code) {
@@ -309,6 +314,9 @@ int rmatch_callout(pcre_callout_block *block)
 {
     rmatch_data_t *rmatch = block->callout_data;
 
+    if (!rmatch)
+	return 0;  /* not an rmatch(); carry on with the match */
+
     if (!rmatch->valid || block->current_position > rmatch->ovec[1] ||
 	(block->current_position == rmatch->ovec[1] &&
 	 block->start_match < rmatch->ovec[0])) {
@@ -330,31 +338,31 @@ Match_Result match_pattern(Pattern p, const char *string,
 			   Match_Indices *indices, int is_reverse)
 {
     regexp_t *regexp = p.ptr;
-    pcre_extra *extra = regexp->extra;
+    pcre_extra extra = *regexp->extra;
     int rc, options = 0;
     int ovec[10 * 3];  /* N.B. PCRE needs the top 1/3 for internal use */
     int i, *ov = ovec;
     rmatch_data_t rmatch;
 
+    /*
+     * The callout data goes in a copy of the extra block, and the callout
+     * itself is left in place for every match, so that worker threads can
+     * match at the same time as the main thread.
+     */
     if (is_reverse) {
 	rmatch.valid = 0;
 
-	extra->callout_data = &rmatch;
-	extra->flags |= PCRE_EXTRA_CALLOUT_DATA;
-
-	pcre_callout = rmatch_callout;
-    }
-    else {
-	extra->flags &= ~PCRE_EXTRA_CALLOUT_DATA;
-
-	pcre_callout = 0;
+	extra.callout_data = &rmatch;
+	extra.flags |= PCRE_EXTRA_CALLOUT_DATA;
     }
+    else
+	extra.flags &= ~PCRE_EXTRA_CALLOUT_DATA;
 
 # if !UTF8_CHECK
     options |= PCRE_NO_UTF8_CHECK;
 # endif
 
-    rc = pcre_exec(regexp->code, extra, string, memo_strlen(string), 0,
+    rc = pcre_exec(regexp->code, &extra, string, memo_strlen(string), 0,
 		   options, ovec, sizeof(ovec) / sizeof(ovec[0]));
     if (rc < 0) {
 	switch (rc) {
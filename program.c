@@ -62,6 +62,38 @@ program_ref(Program * p)
     return p;
 }
 
+static void
+immortalize_var(Var v)
+{
+    int i;
+
+    /* Floats live in the Var itself and have no count to skip. */
+    if (v.type == TYPE_STR)
+	make_immortal(v.v.str);
+    else if (v.type == TYPE_LIST) {
+	make_immortal(v.v.list);
+	for (i = 1; i <= v.v.list[0].v.num; i++)
+	    immortalize_var(v.v.list[i]);
+    }
+}
+
+/* Called for each verb program loaded from the database.  Its literals are
+ * pushed by every OP_IMM in every task that runs it, so we stop counting
+ * references to them, and to everything inside a list.  The literals of
+ * such a program are leaked if it's later replaced, which is bounded by the
+ * size of the database.  Programs compiled while the server runs, whether
+ * verb code or eval(), keep counting references, since there's no bound on
+ * those.
+ */
+void
+program_immortalize_literals(Program * p)
+{
+    unsigned i;
+
+    for (i = 0; i < p->num_literals; i++)
+	immortalize_var(p->literals[i]);
+}
+
 int
 program_bytes(Program * p)
 {
@@ -57,6 +57,7 @@ typedef struct {
 extern Program *new_program(void);
 extern Program *null_program(void);
 extern Program *program_ref(Program *);
+extern void program_immortalize_literals(Program *);
 extern int program_bytes(Program *);
 extern void free_program(Program *);
 
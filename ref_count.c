@@ -208,6 +208,20 @@ delref(const void *p)
 }
 #endif
 
+#ifdef REFCOUNT_STATS
+unsigned long refcount_writes_elided = 0;
+#endif
+unsigned long refcount_immortals = 0;
+
+void
+make_immortal(const void *p)
+{
+    if (!is_immortal(p)) {
+	refcount(p) = IMMORTAL_REFCOUNT;
+	refcount_immortals++;
+    }
+}
+
 char rcsid_ref_count[] = "$Id$";
 
 /* 
@@ -16,14 +16,36 @@
  *****************************************************************************/
 
 #include "config.h"
+#include "options.h"
 
 #if 0
 extern void addref(const void *p);
 extern unsigned int delref(const void *p);
 #else
-#define addref(X) (++((int *)(X))[-1])
-#define delref(X) (--((int *)(X))[-1])
+/*
+ * Storage whose refcount is IMMORTAL_REFCOUNT is never freed, and addref()
+ * and delref() leave its count alone.  This is used for literals of
+ * installed verb programs, the canonical empty string and list, and names
+ * interned at db load.  Pushing such a value no longer dirties a cache line
+ * shared by every task, nor a page shared with the checkpoint child.
+ */
+#define IMMORTAL_REFCOUNT	0x40000000
+
+extern unsigned long refcount_immortals;
+extern void make_immortal(const void *p);
+
 #define refcount(X) (((int *)(X))[-1])
+#define is_immortal(X) (refcount(X) == IMMORTAL_REFCOUNT)
+
+#ifdef REFCOUNT_STATS
+extern unsigned long refcount_writes_elided;
+#define IMMORTAL_ELIDED	(refcount_writes_elided++, IMMORTAL_REFCOUNT)
+#else
+#define IMMORTAL_ELIDED	IMMORTAL_REFCOUNT
+#endif
+
+#define addref(X) (is_immortal(X) ? IMMORTAL_ELIDED : ++refcount(X))
+#define delref(X) (is_immortal(X) ? IMMORTAL_ELIDED : --refcount(X))
 #endif
 
 /* 
@@ -61,6 +61,7 @@ typedef enum {
 static Checkpoint_Reason checkpoint_requested = CHKPT_OFF;
 
 static int checkpoint_finished = 0;	/* 1 = failure, 2 = success */
+static int checkpoint_in_progress = 0;	/* a checkpointer child is running */
 
 typedef struct shandle {
     struct shandle *next, **prev;
@@ -438,41 +439,70 @@ main_loop(void)
 
     /* Now, we enter the main server loop */
     while (shutdown_message == 0) {
-	/* Check how long we have until the next task will be ready to run.
-	 * We only care about three cases (== 0, == 1, and > 1), so we can
-	 * map a `never' result from the task subsystem into 2.
+	/* Check how long we have until the next task will be ready to run
+	 * or the next timer is due.  We wait for network I/O until then, but
+	 * never more than a second, so that the housekeeping below still
+	 * happens once a second; a `never' result is as good as two seconds.
 	 */
-	int task_seconds = next_task_start();
-	int seconds_left = task_seconds < 0 ? 2 : task_seconds;
+	int64_t task_usecs = next_task_start();
+	int64_t timer_usecs = next_timer_usecs();
+	int64_t usecs_left = 2000000;
 	shandle *h, *nexth;
 
-	if (checkpoint_requested != CHKPT_OFF) {
+	if (task_usecs >= 0 && task_usecs < usecs_left)
+	    usecs_left = task_usecs;
+	if (timer_usecs >= 0 && timer_usecs < usecs_left)
+	    usecs_left = timer_usecs;
+
+	/* Checkpoints never overlap, lest an older one finish last and
+	 * replace a newer one on disk after its journal is discarded.
+	 */
+	if (checkpoint_requested != CHKPT_OFF && !checkpoint_in_progress) {
+	    struct timeval t0, t1, t2;
+
 	    if (checkpoint_requested == CHKPT_SIGNAL)
 		oklog("CHECKPOINTING due to remote request signal.\n");
 	    checkpoint_requested = CHKPT_OFF;
+	    gettimeofday(&t0, 0);
 	    run_server_task(-1, SYSTEM_OBJECT, "checkpoint_started",
 			    new_list(0), "", 0);
+	    gettimeofday(&t1, 0);
 	    network_process_io(0);
+	    gettimeofday(&t2, 0);
+	    db_checkpoint_overhead(usecs_between(&t0, &t1),
+				   usecs_between(&t1, &t2));
 #ifdef UNFORKED_CHECKPOINTS
 	    call_checkpoint_notifier(db_flush(FLUSH_ALL_NOW));
 #else
-	    if (!db_flush(FLUSH_ALL_NOW))
+	    if (db_flush(FLUSH_ALL_NOW))
+		checkpoint_in_progress = 1;
+	    else
 		call_checkpoint_notifier(0);
 #endif
 	    set_checkpoint_timer(0);
 	}
 #ifndef UNFORKED_CHECKPOINTS
+	if (checkpoint_in_progress && !checkpoint_finished) {
+	    int success;
+
+	    if (db_checkpoint_written(&success))
+		checkpoint_finished = success + 1;
+	}
 	if (checkpoint_finished) {
+	    db_checkpoint_finished(checkpoint_finished - 1);
 	    call_checkpoint_notifier(checkpoint_finished - 1);
 	    checkpoint_finished = 0;
+	    checkpoint_in_progress = 0;
 	}
 #endif
 
-	if (!network_process_io(seconds_left ? 1 : 0) && seconds_left > 1)
+	if (!network_process_io(usecs_left < 1000000 ? usecs_left : 1000000)
+	    && usecs_left >= 2000000)
 	    db_flush(FLUSH_ONE_SECOND);
 	else
 	    db_flush(FLUSH_IF_FULL);
 
+	run_expired_timers();
 	run_ready_tasks();
 
 	{			/* Get rid of old un-logged-in or useless connections */
@@ -1186,6 +1216,7 @@ main(int argc, char **argv)
     char *this_program = str_dup(argv[0]);
     const char *log_file = 0;
     int emergency = 0;
+    int convert = 0;
     Var desc;
     slistener *l;
 
@@ -1199,6 +1230,22 @@ main(int argc, char **argv)
 	case 'e':		/* Emergency wizard mode */
 	    emergency = 1;
 	    break;
+	case 'B':		/* Dump in the binary DB format */
+	    db_set_dump_format(1);
+	    break;
+	case 'T':		/* Dump in the text DB format */
+	    db_set_dump_format(0);
+	    break;
+	case 'z':		/* Compress dumps */
+	    if (!db_set_dump_compression(1)) {
+		fprintf(stderr, "%s: This server can't compress dumps\n",
+			this_program);
+		exit(1);
+	    }
+	    break;
+	case 'c':		/* Just convert the DB and exit */
+	    convert = 1;
+	    break;
 	case 'l':		/* Specified log file */
 	    if (argc > 1) {
 		log_file = argv[1];
@@ -1226,10 +1273,27 @@ main(int argc, char **argv)
     } else
 	set_log_file(stderr);
 
+    if (convert) {
+	/* Load the input DB and write it straight back out to the output DB,
+	 * in the format chosen by -B or -T, without ever running a task.
+	 */
+	if (!db_initialize(&argc, &argv) || argc != 0) {
+	    fprintf(stderr, "Usage: %s -c [-B|-T] [-z] [-l log-file] %s\n",
+		    this_program, db_usage_string());
+	    exit(1);
+	}
+	register_bi_functions();
+	if (!db_load())
+	    exit(1);
+	db_shutdown();
+	exit(0);
+    }
     if (!db_initialize(&argc, &argv)
 	|| !network_initialize(argc, argv, &desc)) {
-	fprintf(stderr, "Usage: %s [-e] [-l log-file] %s %s\n",
+	fprintf(stderr, "Usage: %s [-e] [-B|-T] [-z] [-l log-file] %s %s\n",
 		this_program, db_usage_string(), network_usage_string());
+	fprintf(stderr, "       %s -c [-B|-T] [-z] [-l log-file] %s\n",
+		this_program, db_usage_string());
 	exit(1);
     }
 #if NETWORK_PROTOCOL != NP_SINGLE
@@ -1241,8 +1305,9 @@ main(int argc, char **argv)
 
     oklog("STARTING: Version %s of the LambdaMOO server\n", server_version);
     oklog("          (Using %s protocol)\n", network_protocol_name());
-    oklog("          (Task timeouts measured in %s seconds.)\n",
-	  virtual_timer_available()? "server CPU" : "wall-clock");
+    oklog("          (Task timeouts measured in %s seconds, "
+	  "checked as tasks run.)\n",
+	  cpu_time_available()? "task CPU" : "wall-clock");
 
     register_bi_functions();
 
@@ -1271,6 +1336,19 @@ main(int argc, char **argv)
 	main_loop();
 	network_shutdown();
     }
+#ifndef UNFORKED_CHECKPOINTS
+    if (checkpoint_in_progress && !checkpoint_finished) {
+	oklog("SHUTDOWN: Waiting for checkpoint to finish...\n");
+	while (!checkpoint_finished) {
+	    int success;
+
+	    if (db_checkpoint_written(&success))
+		checkpoint_finished = success + 1;
+	    else
+		sleep(1);
+	}
+    }
+#endif
     db_shutdown();
     free_str(this_program);
 
@@ -1307,6 +1385,20 @@ bf_renumber(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(r);
 }
 
+static package
+bf_owner_references(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    Objid o = arglist.v.list[1].v.obj;
+    free_var(arglist);
+
+    if (!valid(o))
+	return make_error_pack(E_INVARG);
+    else if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    return make_var_pack(db_owner_references(o));
+}
+
 static package
 bf_reset_max_object(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -1365,6 +1457,16 @@ bf_dump_database(Var arglist, Byte next, void *vdata, Objid progr)
     return no_var_pack();
 }
 
+static package
+bf_checkpoint_stats(Var arglist, Byte next, void *vdata, Objid progr)
+{
+    free_var(arglist);
+    if (!is_wizard(progr))
+	return make_error_pack(E_PERM);
+
+    return make_var_pack(db_checkpoint_stats());
+}
+
 static package
 bf_db_disk_size(Var arglist, Byte next, void *vdata, Objid progr)
 {
@@ -1766,11 +1868,14 @@ register_server(void)
 {
     register_function("server_version", 0, 0, bf_server_version);
     register_function("renumber", 1, 1, bf_renumber, TYPE_OBJ);
+    register_function("owner_references", 1, 1, bf_owner_references,
+		      TYPE_OBJ);
     register_function("reset_max_object", 0, 0, bf_reset_max_object);
     register_function("memory_usage", 0, 0, bf_memory_usage);
     register_function("shutdown", 0, 1, bf_shutdown, TYPE_STR);
     register_function("dump_database", 0, 0, bf_dump_database);
     register_function("db_disk_size", 0, 0, bf_db_disk_size);
+    register_function("checkpoint_stats", 0, 0, bf_checkpoint_stats);
     register_function("open_network_connection", 0, -1,
 		      bf_open_network_connection);
     register_function("connected_players", 0, 1, bf_connected_players,
@@ -116,8 +116,8 @@ str_dup(const char *s)
 	if (!emptystring) {
 	    emptystring = (char *) mymalloc(1, M_STRING);
 	    *emptystring = '\0';
+	    make_immortal(emptystring);
 	}
-	addref(emptystring);
 	return emptystring;
     } else {
 	r = (char *) mymalloc(strlen(s) + 1, M_STRING);	/* NO MEMO HERE */
@@ -31,11 +31,13 @@ typedef enum Memory_Type {
     M_BYTECODES, M_FORK_VECTORS, M_LIT_LIST,
     M_PROTOTYPE, M_CODE_GEN, M_DISASSEMBLE, M_DECOMPILE,
 
-    M_RT_STACK, M_RT_ENV, M_BI_FUNC_DATA, M_VM,
+    M_RT_STACK, M_RT_ENV, M_BI_FUNC_DATA, M_VM, M_RT_ARENA,
 
     M_REF_ENTRY, M_REF_TABLE, M_VC_ENTRY, M_VC_TABLE, M_STRING_PTRS,
-    M_INTERN_POINTER, M_INTERN_ENTRY, M_INTERN_HUNK,
+    M_INTERN_POINTER, M_INTERN_ENTRY, M_INTERN_HUNK, M_DB_LOAD,
+    M_DB_DUMP,
     M_XML_DATA,
+    M_TIMER,
 
     M_WAIF, M_WAIF_XTRA,
 
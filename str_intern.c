@@ -2,12 +2,25 @@
 #include "my-string.h"
 
 #include "log.h"
+#include "options.h"
 #include "storage.h"
 #include "str_intern.h"
 #include "utils.h"
 
 #ifdef STRING_INTERNING
 
+#if THREADED_DB_LOAD
+#include <pthread.h>
+
+/* Verb programs compiled on load threads intern their string literals. */
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+#  define LOCK_INTERN_TABLE()	pthread_mutex_lock(&intern_lock)
+#  define UNLOCK_INTERN_TABLE()	pthread_mutex_unlock(&intern_lock)
+#else
+#  define LOCK_INTERN_TABLE()
+#  define UNLOCK_INTERN_TABLE()
+#endif
+
 struct intern_entry {
     const char *s;
     unsigned hash;
@@ -240,12 +253,15 @@ str_intern(const char *s)
     
     hash = str_hash(s);
     
+    LOCK_INTERN_TABLE();
     e = find_interned_string(s, hash);
     
     if (e != NULL) {
         intern_allocations_saved++;
         intern_bytes_saved += memo_strlen(e->s);
-        return str_ref(e->s);
+        r = str_ref(e->s);
+        UNLOCK_INTERN_TABLE();
+        return r;
     }
     
     if (intern_table_count > intern_table_size) {
@@ -255,6 +271,7 @@ str_intern(const char *s)
     r = str_dup(s);
     r = str_ref(r);
     add_interned_string(r, hash);
+    UNLOCK_INTERN_TABLE();
     
     return r;
 }
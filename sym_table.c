@@ -21,6 +21,7 @@
 #include "config.h"
 #include "exceptions.h"
 #include "log.h"
+#include "ref_count.h"
 #include "storage.h"
 #include "structures.h"
 #include "sym_table.h"
@@ -67,6 +68,7 @@ Names *
 new_builtin_names(DB_Version version)
 {
     static Names *builtins[Num_DB_Versions];
+    unsigned i;
 
     if (builtins[version] == 0) {
 	Names *bi = new_names(first_user_slot(version));
@@ -95,6 +97,11 @@ new_builtin_names(DB_Version version)
 	    bi->names[SLOT_INT] = str_dup("INT");
 	    bi->names[SLOT_FLOAT] = str_dup("FLOAT");
 	}
+	/* These are shared by every program compiled for this version,
+	 * possibly on several threads at once during a DB load.
+	 */
+	for (i = 0; i < bi->size; i++)
+	    make_immortal(bi->names[i]);
     }
     return copy_names(builtins[version]);
 }
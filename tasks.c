@@ -15,7 +15,10 @@
     Pavel@Xerox.Com
  *****************************************************************************/
 
+#include "my-stdlib.h"
+#include "my-math.h"
 #include "my-string.h"
+#include "my-sys-time.h"
 #include "my-time.h"
 
 #include "config.h"
@@ -31,6 +34,7 @@
 #include "log.h"
 #include "match.h"
 #include "options.h"
+#include "parallel.h"
 #include "parse_cmd.h"
 #include "parser.h"
 #include "random.h"
@@ -39,6 +43,7 @@
 #include "streams.h"
 #include "structures.h"
 #include "tasks.h"
+#include "timers.h"
 #include "utils.h"
 #include "verbs.h"
 #include "version.h"
@@ -60,12 +65,12 @@ typedef struct forked_task {
     activation a;
     Var *rt_env;
     int f_index;
-    time_t start_time;
+    int64_t start_time;		/* on the monotonic_usecs() clock */
 } forked_task;
 
 typedef struct suspended_task {
     vm the_vm;
-    time_t start_time;
+    int64_t start_time;
     Var value;
 } suspended_task;
 
@@ -77,6 +82,9 @@ typedef struct {
 
 typedef struct task {
     struct task *next;
+    int heap_pos;		/* while waiting, index in waiting_tasks */
+    struct tqueue *bg_queue;	/* otherwise, the tqueue it's ready on */
+    uint64_t seq;		/* orders waiting tasks with equal starts */
     task_kind kind;
     union {
 	input_task input;
@@ -143,7 +151,11 @@ typedef struct tqueue {
     int input_suspended;
 
     task *first_bg, **last_bg;
-    int usage;			/* a kind of inverted priority */
+    double usage;		/* a kind of inverted priority: CPU seconds
+				 * used lately, decaying (see current_usage())
+				 */
+    int64_t usage_time;		/* when usage was last brought up to date */
+    double total_usage;		/* CPU seconds used since tqueue was made */
     int num_bg_tasks;		/* in either here or waiting_tasks */
     char *output_prefix, *output_suffix;
     const char *flush_cmd;
@@ -152,6 +164,7 @@ typedef struct tqueue {
     const char *program_verb;
 
     /* booleans */
+    char active;		/* on active_tqueues, or running a task */
     char hold_input;		/* input tasks must wait for read() */
     char disable_oob;		/* treat all input lines as inband */
     char reading;		/* some task is blocked on read() */
@@ -167,18 +180,161 @@ typedef struct ext_queue {
 #define INPUT_HIWAT	MAX_QUEUED_INPUT
 #define INPUT_LOWAT	(INPUT_HIWAT / 2)
 
-#define NO_USAGE	-1
+/* A tqueue's usage halves every USAGE_HALF_LIFE seconds it isn't charged
+ * for more, so the tqueues that have used the least CPU time lately go
+ * first.  Since all tqueues decay at the same rate, waiting doesn't change
+ * their order on active_tqueues.
+ */
+#define USAGE_HALF_LIFE	60
 
 int current_task_id;
 static tqueue *idle_tqueues = 0, *active_tqueues = 0;
-static task *waiting_tasks = 0;	/* forked and suspended tasks */
 static ext_queue *external_queues = 0;
 
+/* Forked and suspended tasks not yet due, in a binary heap with the one to
+ * run first on top: the earliest start time, or else the first queued.
+ */
+static task **waiting_tasks = 0;
+static int num_waiting = 0, max_waiting = 0;
+static uint64_t waiting_seq = 0;
+
 #define GET_START_TIME(ttt) \
     (ttt->kind == TASK_FORKED \
      ? ttt->t.forked.start_time \
      : ttt->t.suspended.start_time)
 
+/* The start time of a task suspended with no timeout */
+#define FOREVER INT64_MAX
+
+/* Start time for a task due SECONDS from now. */
+static int64_t
+start_time_after(double seconds)
+{
+    int64_t now = monotonic_usecs();
+
+    if (seconds >= (double) (FOREVER - now) / 1000000)
+	return FOREVER;
+    return now + (int64_t) (seconds * 1000000 + 0.5);
+}
+
+/* The DB and queued_tasks() give start times in seconds since the epoch,
+ * rounded to the nearest second.
+ */
+static int64_t
+wall_clock_offset(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec - monotonic_usecs();
+}
+
+static time_t
+start_time_to_wall(int64_t start_time)
+{
+    if (start_time == FOREVER)
+	return INT32_MAX;
+    else if (start_time == 0)
+	return 0;
+    return (start_time + wall_clock_offset() + 500000) / 1000000;
+}
+
+static int64_t
+start_time_from_wall(time_t wall)
+{
+    if (wall >= INT32_MAX)
+	return FOREVER;
+    else if (wall == 0)
+	return 0;
+    return (int64_t) wall * 1000000 - wall_clock_offset();
+}
+
+#define GET_TASK_ID(ttt) \
+    (ttt->kind == TASK_FORKED \
+     ? ttt->t.forked.id \
+     : ttt->t.suspended.the_vm->task_id)
+
+/* Every forked or suspended task, waiting or ready, and every task blocked
+ * in read(), by task id.  Tasks in external queues aren't indexed.
+ */
+typedef struct task_loc {
+    struct task_loc *next;	/* in the same bucket */
+    int id;
+    task *t;			/* the forked or suspended task, or else */
+    tqueue *reader;		/* the tqueue whose read() the task is in */
+} task_loc;
+
+static task_loc **task_index = 0;
+static unsigned task_index_size = 0, task_index_count = 0;
+
+static task_loc **
+task_loc_slot(int id)
+{
+    task_loc **lp;
+
+    if (task_index_size == 0)
+	return 0;
+    for (lp = &task_index[(unsigned) id % task_index_size];
+	 *lp && (*lp)->id != id;
+	 lp = &(*lp)->next)
+	;
+    return lp;
+}
+
+static task_loc *
+find_task_loc(int id)
+{
+    task_loc **lp = task_loc_slot(id);
+
+    return lp ? *lp : 0;
+}
+
+static void
+index_task(int id, task * t, tqueue * reader)
+{
+    task_loc *l = mymalloc(sizeof(task_loc), M_TASK);
+
+    if (task_index_count >= task_index_size) {
+	unsigned old_size = task_index_size, i;
+	task_loc **old_index = task_index;
+
+	task_index_size = old_size ? 2 * old_size : 64;
+	task_index = mymalloc(task_index_size * sizeof(task_loc *), M_TASK);
+	memset(task_index, 0, task_index_size * sizeof(task_loc *));
+	for (i = 0; i < old_size; i++)
+	    while (old_index[i]) {
+		task_loc *m = old_index[i];
+		task_loc **bucket
+		    = &task_index[(unsigned) m->id % task_index_size];
+
+		old_index[i] = m->next;
+		m->next = *bucket;
+		*bucket = m;
+	    }
+	if (old_index)
+	    myfree(old_index, M_TASK);
+    }
+    l->id = id;
+    l->t = t;
+    l->reader = reader;
+    l->next = task_index[(unsigned) id % task_index_size];
+    task_index[(unsigned) id % task_index_size] = l;
+    task_index_count++;
+}
+
+static void
+unindex_task(int id)
+{
+    task_loc **lp = task_loc_slot(id);
+    task_loc *l = lp ? *lp : 0;
+
+    if (!l)
+	panic("UNINDEX_TASK: Task not indexed!");
+    *lp = l->next;
+    myfree(l, M_TASK);
+    task_index_count--;
+}
+
 
 /* 
  *  ICMD_FOR_EACH(DEFINE,verb)
@@ -266,10 +422,27 @@ icmd_set_flags(tqueue * tq, Var list)
 }
 
 
+static double
+current_usage(tqueue * tq, int64_t now)
+{
+    return tq->usage * pow(0.5, (now - tq->usage_time)
+			   / (USAGE_HALF_LIFE * 1000000.0));
+}
+
+static void
+charge_usage(tqueue * tq, int64_t cpu_used)
+{
+    int64_t now = monotonic_usecs();
+
+    tq->usage = current_usage(tq, now) + cpu_used / 1000000.0;
+    tq->usage_time = now;
+    tq->total_usage += cpu_used / 1000000.0;
+}
+
 static void
 deactivate_tqueue(tqueue * tq)
 {
-    tq->usage = NO_USAGE;
+    tq->active = 0;
 
     tq->next = idle_tqueues;
     tq->prev = &idle_tqueues;
@@ -282,8 +455,11 @@ static void
 activate_tqueue(tqueue * tq)
 {
     tqueue **qq = &active_tqueues;
+    int64_t now = monotonic_usecs();
+    double usage = current_usage(tq, now);
 
-    while (*qq && (*qq)->usage <= tq->usage)
+    tq->active = 1;
+    while (*qq && current_usage(*qq, now) <= usage)
 	qq = &((*qq)->next);
 
     tq->next = *qq;
@@ -294,9 +470,7 @@ activate_tqueue(tqueue * tq)
 static void
 ensure_usage(tqueue * tq)
 {
-    if (tq->usage == NO_USAGE) {
-	tq->usage = active_tqueues ? active_tqueues->usage : 0;
-
+    if (!tq->active) {
 	/* Remove tq from idle_tqueues... */
 	*(tq->prev) = tq->next;
 	if (tq->next)
@@ -356,6 +530,9 @@ find_tqueue(Objid player, int create_if_not_found)
     tq->num_bg_tasks = 0;
     tq->last_input_task_id = 0;
 
+    tq->usage = tq->total_usage = 0;
+    tq->usage_time = monotonic_usecs();
+
     return tq;
 }
 
@@ -372,8 +549,10 @@ free_tqueue(tqueue * tq)
 	free_str(tq->flush_cmd);
     if (tq->program_stream)
 	free_stream(tq->program_stream);
-    if (tq->reading)
+    if (tq->reading) {
+	unindex_task(tq->reading_vm->task_id);
 	free_vm(tq->reading_vm, 1);
+    }
 
     *(tq->prev) = tq->next;
     if (tq->next)
@@ -388,6 +567,8 @@ enqueue_bg_task(tqueue * tq, task * t)
     *(tq->last_bg) = t;
     tq->last_bg = &(t->next);
     t->next = 0;
+    t->heap_pos = -1;
+    t->bg_queue = tq;
 }
 
 static task *
@@ -982,34 +1163,110 @@ new_input_task(task_queue q, const char *input, int binary)
     enqueue_input_task(tq, input, 0/*at-rear*/, binary);
 }
 
+static int
+runs_before(task * t1, task * t2)
+{
+    int64_t start1 = GET_START_TIME(t1), start2 = GET_START_TIME(t2);
+
+    return start1 < start2 || (start1 == start2 && t1->seq < t2->seq);
+}
+
+static void
+place_waiting(task * t, int pos)
+{
+    waiting_tasks[pos] = t;
+    t->heap_pos = pos;
+}
+
+static void
+sift_up(task * t, int pos)
+{
+    while (pos > 0 && runs_before(t, waiting_tasks[(pos - 1) / 2])) {
+	place_waiting(waiting_tasks[(pos - 1) / 2], pos);
+	pos = (pos - 1) / 2;
+    }
+    place_waiting(t, pos);
+}
+
+static void
+sift_down(task * t, int pos)
+{
+    int child;
+
+    while ((child = 2 * pos + 1) < num_waiting) {
+	if (child + 1 < num_waiting
+	    && runs_before(waiting_tasks[child + 1], waiting_tasks[child]))
+	    child++;
+	if (!runs_before(waiting_tasks[child], t))
+	    break;
+	place_waiting(waiting_tasks[child], pos);
+	pos = child;
+    }
+    place_waiting(t, pos);
+}
+
 static void
 enqueue_waiting(task * t)
 {				/* either FORKED or SUSPENDED */
-
-    time_t start_time = GET_START_TIME(t);
     Objid progr = (t->kind == TASK_FORKED
 		   ? t->t.forked.a.progr
 		   : progr_of_cur_verb(t->t.suspended.the_vm));
     tqueue *tq = find_tqueue(progr, 1);
 
     tq->num_bg_tasks++;
-    if (!waiting_tasks || start_time < GET_START_TIME(waiting_tasks)) {
-	t->next = waiting_tasks;
-	waiting_tasks = t;
-    } else {
-	task *tt;
+    if (num_waiting == max_waiting) {
+	max_waiting = max_waiting ? 2 * max_waiting : 64;
+	waiting_tasks = (waiting_tasks
+			 ? myrealloc(waiting_tasks,
+				     max_waiting * sizeof(task *), M_TASK)
+			 : mymalloc(max_waiting * sizeof(task *), M_TASK));
+    }
+    t->next = 0;
+    t->seq = waiting_seq++;
+    sift_up(t, num_waiting++);
+    index_task(GET_TASK_ID(t), t, 0);
+}
 
-	for (tt = waiting_tasks; tt->next; tt = tt->next)
-	    if (start_time < GET_START_TIME(tt->next))
-		break;
-	t->next = tt->next;
-	tt->next = t;
+/* Takes T out of waiting_tasks, leaving tq->num_bg_tasks alone. */
+static void
+dequeue_waiting(task * t)
+{
+    task *last = waiting_tasks[--num_waiting];
+
+    if (last != t) {
+	if (t->heap_pos > 0
+	    && runs_before(last, waiting_tasks[(t->heap_pos - 1) / 2]))
+	    sift_up(last, t->heap_pos);
+	else
+	    sift_down(last, t->heap_pos);
     }
 }
 
+static int
+compare_waiting(const void *a, const void *b)
+{
+    task *t1 = *(task * const *) a, *t2 = *(task * const *) b;
+
+    return runs_before(t1, t2) ? -1 : runs_before(t2, t1);
+}
+
+/* Returns a copy of waiting_tasks in the order they'll run, for listing
+ * them; the caller frees it.
+ */
+static task **
+sorted_waiting_tasks(void)
+{
+    task **tasks = mymalloc(num_waiting * sizeof(task *) + 1, M_TASK);
+
+    memcpy(tasks, waiting_tasks, num_waiting * sizeof(task *));
+    qsort(tasks, num_waiting, sizeof(task *), compare_waiting);
+
+    return tasks;
+}
+
 static void
 enqueue_ft(Program * program, activation a, Var * rt_env,
-	   int f_index, time_t start_time, int id)
+	   int f_index, int64_t start_time, int id)
 {
     task *t = (task *) mymalloc(sizeof(task), M_TASK);
 
@@ -1058,7 +1315,7 @@ check_user_task_limit(Objid user)
 }
 
 enum error
-enqueue_forked_task2(activation a, int f_index, unsigned after_seconds, int vid)
+enqueue_forked_task2(activation a, int f_index, double after_seconds, int vid)
 {
     int id;
     Var *rt_env;
@@ -1077,7 +1334,8 @@ enqueue_forked_task2(activation a, int f_index, unsigned after_seconds, int vid)
 	a.rt_env[vid].v.num = id;
     }
     rt_env = copy_rt_env(a.rt_env, a.prog->num_var_names);
-    enqueue_ft(a.prog, a, rt_env, f_index, time(0) + after_seconds, id);
+    enqueue_ft(a.prog, a, rt_env, f_index, start_time_after(after_seconds),
+	       id);
 
     return E_NONE;
 }
@@ -1085,21 +1343,16 @@ enqueue_forked_task2(activation a, int f_index, unsigned after_seconds, int vid)
 enum error
 enqueue_suspended_task(vm the_vm, void *data)
 {
-    int after_seconds = *((int *) data);
-    int now = time(0);
-    int when;
+    double after_seconds = *((double *) data);
     task *t;
 
     if (check_user_task_limit(progr_of_cur_verb(the_vm))) {
 	t = mymalloc(sizeof(task), M_TASK);
 	t->kind = TASK_SUSPENDED;
 	t->t.suspended.the_vm = the_vm;
-	if (now + after_seconds < now)
-	    /* overflow or suspend `forever' code */
-	    when = INT32_MAX;
-	else
-	    when = now + after_seconds;
-	t->t.suspended.start_time = when;
+	t->t.suspended.start_time = (after_seconds < 0	/* `forever' code */
+				     ? FOREVER
+				     : start_time_after(after_seconds));
 	t->t.suspended.value = zero;
 
 	enqueue_waiting(t);
@@ -1120,7 +1373,9 @@ resume_task(vm the_vm, Var value)
     t->t.suspended.start_time = 0;	/* ready now */
     t->t.suspended.value = value;
 
+    tq->num_bg_tasks++;
     enqueue_bg_task(tq, t);
+    index_task(the_vm->task_id, t, 0);
     ensure_usage(tq);
 }
 
@@ -1157,6 +1412,7 @@ make_reading_task(vm the_vm, void *data)
     else {
 	tq->reading = 1;
 	tq->reading_vm = the_vm;
+	index_task(the_vm->task_id, 0, tq);
 	if (tq->first_input)	/* Anything to read? */
 	    ensure_usage(tq);
 	return E_NONE;
@@ -1171,7 +1427,7 @@ last_input_task_id(Objid player)
     return tq ? tq->last_input_task_id : 0;
 }
 
-int
+int64_t
 next_task_start(void)
 {
     tqueue *tq;
@@ -1180,10 +1436,9 @@ next_task_start(void)
 	if (tq->first_input != 0 || tq->first_bg != 0)
 	    return 0;
 
-    if (waiting_tasks != 0) {
-	int wait = (waiting_tasks->kind == TASK_FORKED
-		    ? waiting_tasks->t.forked.start_time
-		    : waiting_tasks->t.suspended.start_time) - time(0);
+    if (num_waiting > 0) {
+	int64_t wait = GET_START_TIME(waiting_tasks[0]) - monotonic_usecs();
+
 	return (wait >= 0) ? wait : 0;
     }
     return -1;
@@ -1192,25 +1447,37 @@ next_task_start(void)
 void
 run_ready_tasks(void)
 {
-    task *t, *next_t;
-    time_t now = time(0);
-    tqueue *tq, *next_tq;
+    task *t;
+    int64_t now = monotonic_usecs();
+    tqueue *tq, *next_tq, **qq;
 
-    for (t = waiting_tasks; t && GET_START_TIME(t) <= now; t = next_t) {
-	Objid progr = (t->kind == TASK_FORKED
-		       ? t->t.forked.a.progr
-		       : progr_of_cur_verb(t->t.suspended.the_vm));
-	tqueue *tq = find_tqueue(progr, 1);
+    while (num_waiting > 0 && GET_START_TIME(waiting_tasks[0]) <= now) {
+	Objid progr;
+	tqueue *tq;
 
-	next_t = t->next;
+	t = waiting_tasks[0];
+	progr = (t->kind == TASK_FORKED
+		 ? t->t.forked.a.progr
+		 : progr_of_cur_verb(t->t.suspended.the_vm));
+	tq = find_tqueue(progr, 1);
+	dequeue_waiting(t);
 	ensure_usage(tq);
 	enqueue_bg_task(tq, t);
     }
-    waiting_tasks = t;
 
     {
 	int did_one = 0;
-	time_t start = time(0);
+	int64_t start = cpu_usecs();
+
+#ifdef PARALLEL_TASK_STATS
+	{
+	    int count = 0;
+
+	    for (tq = active_tqueues; tq; tq = tq->next)
+		count++;
+	    parallel_begin_task(count);
+	}
+#endif
 
 	while (active_tqueues && !did_one) {
 	    /* Loop over tqueues, looking for a task */
@@ -1221,6 +1488,7 @@ run_ready_tasks(void)
 
 		tq->reading = 0;
 		current_task_id = tq->reading_vm->task_id;
+		unindex_task(current_task_id);
 		v.type = TYPE_ERR;
 		v.v.err = E_INVARG;
 		resume_from_previous_vm(tq->reading_vm, v);
@@ -1230,8 +1498,8 @@ run_ready_tasks(void)
 		t = dequeue_input_task(tq, ((tq->hold_input && !tq->reading)
 					    ? DQ_OOB
 					    : DQ_FIRST));
-		if (!t)
-		    t = dequeue_bg_task(tq);
+		if (!t && (t = dequeue_bg_task(tq)) != 0)
+		    unindex_task(GET_TASK_ID(t));
 		if (!t)
 		    break;
 
@@ -1250,6 +1518,7 @@ run_ready_tasks(void)
 
 			tq->reading = 0;
 			current_task_id = tq->reading_vm->task_id;
+			unindex_task(current_task_id);
 			v.type = TYPE_STR;
 			v.v.str = t->t.input.string;
 			resume_from_previous_vm(tq->reading_vm, v);
@@ -1286,19 +1555,29 @@ run_ready_tasks(void)
 		free_task(t, 0);
 	    }
 
-	    active_tqueues = tq->next;
+	    /* The task may have activated tqueues that have used less time
+	     * than this one, which go ahead of it.
+	     */
+	    for (qq = &active_tqueues; *qq != tq; qq = &((*qq)->next))
+		;
+	    *qq = tq->next;
 
 	    if (did_one) {
 		/* Bump the usage level of this tqueue */
-		time_t end = time(0);
-
-		tq->usage += end - start;
+		charge_usage(tq, cpu_usecs() - start);
 		activate_tqueue(tq);
 	    } else {
 		/* There was nothing to do on this tqueue, so deactivate it */
 		deactivate_tqueue(tq);
 	    }
 	}
+
+#ifdef PARALLEL_TASK_STATS
+	if (did_one)
+	    parallel_end_task(cpu_usecs() - start);
+	else
+	    parallel_cancel_task();
+#endif
     }
 
     /* Free any unconnected and empty tqueues */
@@ -1370,7 +1649,8 @@ write_forked_task(forked_task ft)
 {
     int lineno = find_line_number(ft.program, ft.f_index, 0);
 
-    dbio_printf("0 %d %ld %d\n", lineno, (long)ft.start_time, ft.id);
+    dbio_printf("0 %d %ld %d\n", lineno,
+		(long) start_time_to_wall(ft.start_time), ft.id);
     write_activ_as_pi(ft.a);
     write_rt_env(ft.program->var_names, ft.rt_env, ft.program->num_var_names);
     dbio_write_forked_program(ft.program, ft.f_index);
@@ -1379,7 +1659,8 @@ write_forked_task(forked_task ft)
 static void
 write_suspended_task(suspended_task st)
 {
-    dbio_printf("%ld %d ", (long)st.start_time, st.the_vm->task_id);
+    dbio_printf("%ld %d ", (long) start_time_to_wall(st.start_time),
+		st.the_vm->task_id);
     dbio_write_var(st.value);
     write_vm(st.the_vm);
 }
@@ -1389,13 +1670,14 @@ write_task_queue(void)
 {
     int forked_count = 0;
     int suspended_count = 0;
-    task *t;
+    task *t, **waiting = sorted_waiting_tasks();
     tqueue *tq;
+    int i;
 
     dbio_printf("0 clocks\n");	/* for compatibility's sake */
 
-    for (t = waiting_tasks; t; t = t->next)
-	if (t->kind == TASK_FORKED)
+    for (i = 0; i < num_waiting; i++)
+	if (waiting[i]->kind == TASK_FORKED)
 	    forked_count++;
 	else			/* t->kind == TASK_SUSPENDED */
 	    suspended_count++;
@@ -1410,9 +1692,9 @@ write_task_queue(void)
 
     dbio_printf("%d queued tasks\n", forked_count);
 
-    for (t = waiting_tasks; t; t = t->next)
-	if (t->kind == TASK_FORKED)
-	    write_forked_task(t->t.forked);
+    for (i = 0; i < num_waiting; i++)
+	if (waiting[i]->kind == TASK_FORKED)
+	    write_forked_task(waiting[i]->t.forked);
 
     for (tq = active_tqueues; tq; tq = tq->next)
 	for (t = tq->first_bg; t; t = t->next)
@@ -1421,14 +1703,16 @@ write_task_queue(void)
 
     dbio_printf("%d suspended tasks\n", suspended_count);
 
-    for (t = waiting_tasks; t; t = t->next)
-	if (t->kind == TASK_SUSPENDED)
-	    write_suspended_task(t->t.suspended);
+    for (i = 0; i < num_waiting; i++)
+	if (waiting[i]->kind == TASK_SUSPENDED)
+	    write_suspended_task(waiting[i]->t.suspended);
 
     for (tq = active_tqueues; tq; tq = tq->next)
 	for (t = tq->first_bg; t; t = t->next)
 	    if (t->kind == TASK_SUSPENDED)
 		write_suspended_task(t->t.suspended);
+
+    myfree(waiting, M_TASK);
 }
 
 int
@@ -1459,7 +1743,7 @@ read_task_queue(void)
     for (; count > 0; count--) {
 	int first_lineno, id, old_size, st;
 	char c;
-	time_t start_time;
+	int64_t start_time;
 	Program *program;
 	Var *rt_env, *old_rt_env;
 	const char **old_names;
@@ -1471,7 +1755,7 @@ read_task_queue(void)
 	    errlog("READ_TASK_QUEUE: Bad numbers, count = %d.\n", count);
 	    return 0;
 	}
-	start_time = st;
+	start_time = start_time_from_wall(st);
 	if (!read_activ_as_pi(&a)) {
 	    errlog("READ_TASK_QUEUE: Bad activation, count = %d.\n", count);
 	    return 0;
@@ -1512,7 +1796,7 @@ read_task_queue(void)
 		   suspended_count);
 	    return 0;
 	}
-	t->t.suspended.start_time = start_time;
+	t->t.suspended.start_time = start_time_from_wall(start_time);
 	if (c == ' ')
 	    t->t.suspended.value = dbio_read_var();
 	else if (c == '\n')
@@ -1627,12 +1911,24 @@ bf_queue_info(Var arglist, Byte next, void *vdata, Objid progr)
 	    res.v.list[count].v.obj = tq->player;
 	    count--;
 	}
-    } else {
+    } else if (nargs == 1 || !is_true(arglist.v.list[2])) {
 	Objid who = arglist.v.list[1].v.obj;
 	tqueue *tq = find_tqueue(who, 0);
 
 	res.type = TYPE_INT;
 	res.v.num = (tq ? tq->num_bg_tasks : 0);
+    } else {
+	/* {task count, recent CPU seconds, total CPU seconds} */
+	Objid who = arglist.v.list[1].v.obj;
+	tqueue *tq = find_tqueue(who, 0);
+
+	res = new_list(3);
+	res.v.list[1].type = TYPE_INT;
+	res.v.list[1].v.num = (tq ? tq->num_bg_tasks : 0);
+	res.v.list[2].type = TYPE_FLOAT;
+	res.v.list[2].v.fnum = (tq ? current_usage(tq, monotonic_usecs()) : 0);
+	res.v.list[3].type = TYPE_FLOAT;
+	res.v.list[3].v.fnum = (tq ? tq->total_usage : 0);
     }
 
     free_var(arglist);
@@ -1691,11 +1987,11 @@ list_for_forked_task(forked_task ft)
 {
     Var list;
 
-    list = new_list(10);
+    list = new_list(11);
     list.v.list[1].type = TYPE_INT;
     list.v.list[1].v.num = ft.id;
     list.v.list[2].type = TYPE_INT;
-    list.v.list[2].v.num = ft.start_time;
+    list.v.list[2].v.num = start_time_to_wall(ft.start_time);
     list.v.list[3].type = TYPE_INT;
     list.v.list[3].v.num = 0;	/* OBSOLETE: was clock ID */
     list.v.list[4].type = TYPE_INT;
@@ -1712,6 +2008,8 @@ list_for_forked_task(forked_task ft)
     list.v.list[9].v.obj = ft.a.this;
     list.v.list[10].type = TYPE_INT;
     list.v.list[10].v.num = forked_task_bytes(ft);
+    list.v.list[11].type = TYPE_INT;
+    list.v.list[11].v.num = 0;
 
     return list;
 }
@@ -1733,7 +2031,7 @@ list_for_vm(vm the_vm)
 {
     Var list;
 
-    list = new_list(10);
+    list = new_list(11);
 
     list.v.list[1].type = TYPE_INT;
     list.v.list[1].v.num = the_vm->task_id;
@@ -1754,6 +2052,8 @@ list_for_vm(vm the_vm)
     list.v.list[9].v.obj = top_activ(the_vm).this;
     list.v.list[10].type = TYPE_INT;
     list.v.list[10].v.num = suspended_task_bytes(the_vm);
+    list.v.list[11].type = TYPE_INT;
+    list.v.list[11].v.num = the_vm->bytes_saved;
 
     return list;
 }
@@ -1765,7 +2065,7 @@ list_for_suspended_task(suspended_task st)
 
     list = list_for_vm(st.the_vm);
     list.v.list[2].type = TYPE_INT;
-    list.v.list[2].v.num = st.start_time;
+    list.v.list[2].v.num = start_time_to_wall(st.start_time);
 
     return list;
 }
@@ -1823,8 +2123,8 @@ bf_queued_tasks(Var arglist, Byte next, void *vdata, Objid progr)
     Var tasks;
     int show_all = is_wizard(progr);
     tqueue *tq;
-    task *t;
-    int i, count = 0;
+    task *t, **waiting;
+    int i, j, count = 0;
     ext_queue *eq;
     struct qcl_data qdata;
 
@@ -1845,12 +2145,14 @@ bf_queued_tasks(Var arglist, Byte next, void *vdata, Objid progr)
 		count++;
     }
 
-    for (t = waiting_tasks; t; t = t->next)
+    for (j = 0; j < num_waiting; j++) {
+	t = waiting_tasks[j];
 	if (show_all
 	    || (t->kind == TASK_FORKED
 		? t->t.forked.a.progr == progr
 		: progr_of_cur_verb(t->t.suspended.the_vm) == progr))
 	    count++;
+    }
 
     qdata.progr = progr;
     qdata.show_all = show_all;
@@ -1883,7 +2185,9 @@ bf_queued_tasks(Var arglist, Byte next, void *vdata, Objid progr)
 		tasks.v.list[i++] = list_for_suspended_task(t->t.suspended);
     }
 
-    for (t = waiting_tasks; t; t = t->next) {
+    waiting = sorted_waiting_tasks();
+    for (j = 0; j < num_waiting; j++) {
+	t = waiting[j];
 	if (t->kind == TASK_FORKED && (show_all ||
 				       t->t.forked.a.progr == progr))
 	    tasks.v.list[i++] = list_for_forked_task(t->t.forked);
@@ -1892,6 +2196,7 @@ bf_queued_tasks(Var arglist, Byte next, void *vdata, Objid progr)
 		     || show_all))
 	    tasks.v.list[i++] = list_for_suspended_task(t->t.suspended);
     }
+    myfree(waiting, M_TASK);
 
     qdata.tasks = tasks;
     qdata.i = i;
@@ -1902,6 +2207,62 @@ bf_queued_tasks(Var arglist, Byte next, void *vdata, Objid progr)
     return make_var_pack(tasks);
 }
 
+struct icl_data {
+    int id;
+    Var info;
+    Objid owner;
+};
+
+static task_enum_action
+describing_closure(vm the_vm, const char *status, void *data)
+{
+    struct icl_data *idata = data;
+
+    if (the_vm->task_id == idata->id) {
+	idata->info = list_for_vm(the_vm);
+	idata->info.v.list[2].type = TYPE_STR;
+	idata->info.v.list[2].v.str = str_dup(status);
+	idata->owner = progr_of_cur_verb(the_vm);
+	return TEA_STOP;
+    }
+    return TEA_CONTINUE;
+}
+
+static package
+bf_task_info(Var arglist, Byte next, void *vdata, Objid progr)
+{				/* (task_id) */
+    struct icl_data idata;
+    task_loc *l;
+    ext_queue *eq;
+
+    idata.id = arglist.v.list[1].v.num;
+    idata.info.type = TYPE_NONE;
+    free_var(arglist);
+
+    if ((l = find_task_loc(idata.id)) && l->reader) {
+	idata.info = list_for_reading_task(l->reader->player,
+					   l->reader->reading_vm);
+	idata.owner = l->reader->player;
+    } else if (l && l->t->kind == TASK_FORKED) {
+	idata.info = list_for_forked_task(l->t->t.forked);
+	idata.owner = l->t->t.forked.a.progr;
+    } else if (l) {
+	idata.info = list_for_suspended_task(l->t->t.suspended);
+	idata.owner = progr_of_cur_verb(l->t->t.suspended.the_vm);
+    } else
+	for (eq = external_queues; eq; eq = eq->next)
+	    if ((*eq->enumerator) (describing_closure, &idata) != TEA_CONTINUE)
+		break;
+
+    if (idata.info.type == TYPE_NONE)
+	return make_error_pack(E_INVARG);
+    else if (!is_wizard(progr) && progr != idata.owner) {
+	free_var(idata.info);
+	return make_error_pack(E_PERM);
+    }
+    return make_var_pack(idata.info);
+}
+
 struct fcl_data {
     int id;
     vm the_vm;
@@ -1922,28 +2283,14 @@ finding_closure(vm the_vm, const char *status, void *data)
 vm
 find_suspended_task(int id)
 {
-    tqueue *tq;
-    task *t;
+    task_loc *l = find_task_loc(id);
     ext_queue *eq;
     struct fcl_data fdata;
 
-    for (t = waiting_tasks; t; t = t->next)
-	if (t->kind == TASK_SUSPENDED && t->t.suspended.the_vm->task_id == id)
-	    return t->t.suspended.the_vm;
-
-    for (tq = idle_tqueues; tq; tq = tq->next)
-	if (tq->reading && tq->reading_vm->task_id == id)
-	    return tq->reading_vm;
-
-    for (tq = active_tqueues; tq; tq = tq->next) {
-	if (tq->reading && tq->reading_vm->task_id == id)
-	    return tq->reading_vm;
-
-	for (t = tq->first_bg; t; t = t->next)
-	    if (t->kind == TASK_SUSPENDED
-		&& t->t.suspended.the_vm->task_id == id)
-		return t->t.suspended.the_vm;
-    }
+    if (l && l->reader)
+	return l->reader->reading_vm;
+    else if (l)
+	return l->t->kind == TASK_SUSPENDED ? l->t->t.suspended.the_vm : 0;
 
     fdata.id = id;
 
@@ -1985,69 +2332,50 @@ killing_closure(vm the_vm, const char *status, void *data)
 static enum error
 kill_task(int id, Objid owner)
 {
-    task **tt;
+    task_loc *l;
     tqueue *tq;
 
     if (id == current_task_id) {
 	return E_NONE;
     }
-    for (tt = &waiting_tasks; *tt; tt = &((*tt)->next)) {
-	task *t = *tt;
-	Objid progr;
-
-	if (t->kind == TASK_FORKED && t->t.forked.id == id)
-	    progr = t->t.forked.a.progr;
-	else if (t->kind == TASK_SUSPENDED
-		 && t->t.suspended.the_vm->task_id == id)
-	    progr = progr_of_cur_verb(t->t.suspended.the_vm);
-	else
-	    continue;
+    if ((l = find_task_loc(id)) && l->reader) {
+	tq = l->reader;
+	if (!is_wizard(owner) && owner != tq->player)
+	    return E_PERM;
+	unindex_task(id);
+	free_vm(tq->reading_vm, 1);
+	tq->reading = 0;
+	return E_NONE;
+    } else if (l && l->t->heap_pos >= 0) {
+	task *t = l->t;
+	Objid progr = (t->kind == TASK_FORKED
+		       ? t->t.forked.a.progr
+		       : progr_of_cur_verb(t->t.suspended.the_vm));
 
 	if (!is_wizard(owner) && owner != progr)
 	    return E_PERM;
 	tq = find_tqueue(progr, 0);
 	if (tq)
 	    tq->num_bg_tasks--;
-	*tt = t->next;
+	dequeue_waiting(t);
+	unindex_task(id);
 	free_task(t, 1);
 	return E_NONE;
-    }
+    } else if (l) {
+	task *t = l->t, **tt;
 
-    for (tq = idle_tqueues; tq; tq = tq->next) {
-	if (tq->reading && tq->reading_vm->task_id == id) {
-	    if (!is_wizard(owner) && owner != tq->player)
-		return E_PERM;
-	    free_vm(tq->reading_vm, 1);
-	    tq->reading = 0;
-	    return E_NONE;
-	}
-    }
-
-    for (tq = active_tqueues; tq; tq = tq->next) {
-
-	if (tq->reading && tq->reading_vm->task_id == id) {
-	    if (!is_wizard(owner) && owner != tq->player)
-		return E_PERM;
-	    free_vm(tq->reading_vm, 1);
-	    tq->reading = 0;
-	    return E_NONE;
-	}
-	for (tt = &(tq->first_bg); *tt; tt = &((*tt)->next)) {
-	    task *t = *tt;
-
-	    if ((t->kind == TASK_FORKED && t->t.forked.id == id)
-		|| (t->kind == TASK_SUSPENDED
-		    && t->t.suspended.the_vm->task_id == id)) {
-		if (!is_wizard(owner) && owner != tq->player)
-		    return E_PERM;
-		*tt = t->next;
-		if (t->next == 0)
-		    tq->last_bg = tt;
-		tq->num_bg_tasks--;
-		free_task(t, 1);
-		return E_NONE;
-	    }
-	}
+	tq = t->bg_queue;
+	if (!is_wizard(owner) && owner != tq->player)
+	    return E_PERM;
+	for (tt = &(tq->first_bg); *tt != t; tt = &((*tt)->next))
+	    ;
+	*tt = t->next;
+	if (t->next == 0)
+	    tq->last_bg = tt;
+	tq->num_bg_tasks--;
+	unindex_task(id);
+	free_task(t, 1);
+	return E_NONE;
     }
 
     {
@@ -2089,47 +2417,35 @@ bf_kill_task(Var arglist, Byte next, void *vdata, Objid progr)
 static enum error
 do_resume(int id, Var value, Objid progr)
 {
-    task **tt;
+    task_loc *l = find_task_loc(id);
+    task *t;
     tqueue *tq;
 
-    for (tt = &waiting_tasks; *tt; tt = &((*tt)->next)) {
-	task *t = *tt;
-	Objid owner;
+    if (!l || !l->t || l->t->kind != TASK_SUSPENDED)
+	return E_INVARG;
 
-	if (t->kind == TASK_SUSPENDED && t->t.suspended.the_vm->task_id == id)
-	    owner = progr_of_cur_verb(t->t.suspended.the_vm);
-	else
-	    continue;
+    t = l->t;
+    if (t->heap_pos >= 0) {
+	Objid owner = progr_of_cur_verb(t->t.suspended.the_vm);
 
 	if (!is_wizard(progr) && progr != owner)
 	    return E_PERM;
-	t->t.suspended.start_time = time(0);	/* runnable now */
+	t->t.suspended.start_time = monotonic_usecs();	/* runnable now */
 	free_var(t->t.suspended.value);
 	t->t.suspended.value = value;
 	tq = find_tqueue(owner, 1);
-	*tt = t->next;
+	dequeue_waiting(t);
 	ensure_usage(tq);
 	enqueue_bg_task(tq, t);
-	return E_NONE;
-    }
-
-    for (tq = active_tqueues; tq; tq = tq->next) {
-	for (tt = &(tq->first_bg); *tt; tt = &((*tt)->next)) {
-	    task *t = *tt;
-
-	    if (t->kind == TASK_SUSPENDED
-		&& t->t.suspended.the_vm->task_id == id) {
-		if (!is_wizard(progr) && progr != tq->player)
-		    return E_PERM;
-		/* already resumed, but we have a new value for it */
-		free_var(t->t.suspended.value);
-		t->t.suspended.value = value;
-		return E_NONE;
-	    }
-	}
+    } else {
+	if (!is_wizard(progr) && progr != t->bg_queue->player)
+	    return E_PERM;
+	/* already resumed, but we have a new value for it */
+	free_var(t->t.suspended.value);
+	t->t.suspended.value = value;
     }
 
-    return E_INVARG;
+    return E_NONE;
 }
 
 static package
@@ -2226,10 +2542,11 @@ register_tasks(void)
 {
     register_function("task_id", 0, 0, bf_task_id);
     register_function("queued_tasks", 0, 0, bf_queued_tasks);
+    register_function("task_info", 1, 1, bf_task_info, TYPE_INT);
     register_function("kill_task", 1, 1, bf_kill_task, TYPE_INT);
     register_function("output_delimiters", 1, 1, bf_output_delimiters,
 		      TYPE_OBJ);
-    register_function("queue_info", 0, 1, bf_queue_info, TYPE_OBJ);
+    register_function("queue_info", 0, 2, bf_queue_info, TYPE_OBJ, TYPE_ANY);
     register_function("resume", 1, 2, bf_resume, TYPE_INT, TYPE_ANY);
     register_function("force_input", 2, 3, bf_force_input,
 		      TYPE_OBJ, TYPE_STR, TYPE_ANY);
@@ -38,9 +38,11 @@ extern int tasks_set_connection_option(task_queue, const char *,
 extern void new_input_task(task_queue, const char *, int);
 extern void task_suspend_input(task_queue);
 extern enum error enqueue_forked_task2(activation a, int f_index,
-			       unsigned after_seconds, int vid);
+			       double after_seconds, int vid);
 extern enum error enqueue_suspended_task(vm the_vm, void *data);
-				/* data == &(int after_seconds) */
+				/* data == &(double after_seconds),
+				 * negative for no timeout
+				 */
 extern enum error make_reading_task(vm the_vm, void *data);
 				/* data == &(Objid connection) */
 extern void resume_task(vm the_vm, Var value);
@@ -79,7 +81,10 @@ extern void register_task_queue(task_enumerator);
 
 extern Var read_input_now(Objid connection);
 
-extern int next_task_start(void);
+extern int64_t next_task_start(void);
+				/* Microseconds until a task is ready to
+				 * run, or -1 if none is waiting.
+				 */
 extern void run_ready_tasks(void);
 extern enum outcome run_server_task(Objid player, Objid what,
 				    const char *verb, Var args,
@@ -0,0 +1,43 @@
+#!/bin/sh
+# Times call-heavy MOO code, to compare how builds set up and tear down
+# activations.  Each line is the best of RUNS runs, in seconds.  Run from
+# the source directory after building the server:
+#	sh tests/bench_calls.sh
+# and again with MOO set to the other build's server.
+
+MOO=${MOO:-`pwd`/moo}
+RUNS=${RUNS:-5}
+DIR=`mktemp -d /tmp/bench_calls.XXXXXX` || exit 1
+trap 'rm -rf $DIR' 0
+
+cp Minimal.db $DIR/in.db
+cd $DIR
+
+# `wide' and `wdeep' have 40 locals, more than the small frames the
+# allocator keeps ready.
+$MOO -e in.db bench.db > setup.out 2> setup.log <<'END'
+;;o = create(#1); add_property(#0, "server_options", o, {#3, "r"}); add_property(o, "fg_ticks", 2000000000, {#3, "r"}); add_property(o, "fg_seconds", 10000, {#3, "r"}); add_property(o, "max_stack_depth", 200, {#3, "r"});
+;;add_verb(#1, {#3, "rxd", "one"}, {"this", "none", "this"}); set_verb_code(#1, "one", {"return args[1] + 1;"});
+;;add_verb(#1, {#3, "rxd", "fib"}, {"this", "none", "this"}); set_verb_code(#1, "fib", {"n = args[1];", "return n < 2 ? n | this:fib(n - 1) + this:fib(n - 2);"});
+;;add_verb(#1, {#3, "rxd", "deep"}, {"this", "none", "this"}); set_verb_code(#1, "deep", {"n = args[1];", "return n ? this:deep(n - 1) | 0;"});
+;;c = {}; for i in [1..40] c = {@c, tostr("v", i, " = ", i, ";")}; endfor add_verb(#1, {#3, "rxd", "wide"}, {"this", "none", "this"}); set_verb_code(#1, "wide", {@c, "return v1 + v40;"}); add_verb(#1, {#3, "rxd", "wdeep"}, {"this", "none", "this"}); set_verb_code(#1, "wdeep", {@c, "n = args[1];", "return n ? this:wdeep(n - 1) | 0;"});
+quit
+END
+
+run=1
+while [ $run -le $RUNS ]; do
+    $MOO -e bench.db bench.db 2>> run.log <<'END' | sed -n 's/.*=> {"\([a-z0-9]*\)", \(.*\)}$/\1 \2/p' >> times
+;;t = ftime(); for i in [1..5000000] #1:one(i); endfor return {"calls", ftime() - t};
+;;t = ftime(); #1:fib(27); return {"fib27", ftime() - t};
+;;t = ftime(); for i in [1..100000] #1:deep(45); endfor return {"deep45", ftime() - t};
+;;t = ftime(); for i in [1..25000] #1:deep(150); endfor return {"deep150", ftime() - t};
+;;t = ftime(); for i in [1..2000000] #1:wide(i); endfor return {"wide", ftime() - t};
+;;t = ftime(); for i in [1..50000] #1:wdeep(45); endfor return {"wdeep45", ftime() - t};
+abort
+END
+    run=`expr $run + 1`
+done
+
+awk '!($1 in best) || $2 < best[$1] { best[$1] = $2 }
+     !($1 in seen) { seen[$1] = 1; order[++n] = $1 }
+     END { for (i = 1; i <= n; i++) printf "%-8s %.3f\n", order[i], best[order[i]] }' times
@@ -0,0 +1,47 @@
+#!/bin/sh
+# Estimates how tasks from many independent players would scale if ready
+# tasks ran on worker threads.  Needs a server built with
+# PARALLEL_TASK_STATS; tasks still run one at a time, and the speedup is
+# the one parallel_stats() works out.  Run from the source directory:
+#	sh tests/bench_parallel.sh
+#
+# Each line gives the workload, the number of players each running one
+# task at once, the tasks that would have conflicted or run serially, and
+# the CPU seconds taken against those of the batches run in parallel, all
+# summed over ROUNDS rounds.
+
+MOO=${MOO:-`pwd`/moo}
+PORT=${PORT:-7988}
+ROUNDS=${ROUNDS:-3}
+DIR=`mktemp -d /tmp/bench_parallel.XXXXXX` || exit 1
+trap 'rm -rf $DIR' 0
+
+cp Minimal.db $DIR/in.db
+cd $DIR
+
+# 32 programmers, each with a property of their own, have a task resumed
+# at the same moment, so that the next round over the ready queues runs
+# them all as one batch.  `own' changes just that property, `shared' one
+# on #0, and `notify' also sends output, which would be deferred until the
+# task commits.
+sed "s/ROUNDS/$ROUNDS/" <<'END' | $MOO -e in.db bench.db > setup.out 2> setup.log
+;;for i in [1..32] o = create(#1); o.programmer = 1; add_property(o, "n", 0, {o, "rw"}); endfor add_property(#0, "shared", 0, {#3, "rw"});
+;;add_verb(#1, {#3, "rxd", "work"}, {"this", "none", "this"}); set_verb_code(#1, "work", {"{o, kind} = args;", "for j in [1..1000]", "if (kind == \"shared\")", "#0.shared = #0.shared + 1;", "else", "o.n = o.n + 1;", "endif", "endfor", "if (kind == \"notify\")", "notify(o, \"done\");", "endif"});
+;;add_verb(#1, {#3, "rxd", "round"}, {"this", "none", "this"}); set_verb_code(#1, "round", {"{kind, n} = args;", "c = {0, 0, 0.0, 0.0};", "for r in [1..ROUNDS]", "tasks = {};", "for i in [1..n]", "o = toobj(i + 3);", "fork t (0)", "set_task_perms(o);", "suspend();", "this:work(o, kind);", "endfork", "tasks = {@tasks, t};", "endfor", "suspend(0.2);", "s = parallel_stats();", "for t in (tasks)", "resume(t);", "endfor", "suspend(0.5);", "e = parallel_stats();", "c = {c[1] + e[3] - s[3], c[2] + e[4] - s[4], c[3] + e[6] - s[6], c[4] + e[7] - s[7]};", "endfor", "server_log(tostr(\"BENCH \", kind, \" \", n, \" \", c[1], \" \", c[2], \" \", c[3], \" \", c[4]));"});
+;;add_verb(#1, {#3, "rxd", "bench"}, {"this", "none", "this"}); set_verb_code(#1, "bench", {"for kind in ({\"own\", \"shared\", \"notify\"})", "for n in ({1, 2, 4, 8, 16, 32})", "this:round(kind, n);", "endfor", "endfor", "shutdown();"});
+;function_info("parallel_stats")
+quit
+END
+if grep -q '=> E_INVARG' setup.out; then
+    echo "$MOO was built without PARALLEL_TASK_STATS"
+    exit 1
+fi
+
+$MOO -e bench.db bench.db $PORT > run.out 2> run.log <<'END'
+;;fork (0) #1:bench(); endfork
+continue
+END
+
+echo "workload players conflicted serial cpu parallel speedup"
+sed -n 's/.*BENCH //p' run.log |
+    awk '{ printf "%-8s %2d %2d %2d %.6f %.6f %.1fx\n", $1, $2, $3, $4, $5, $6, ($6 > 0 ? $5 / $6 : 0) }'
@@ -0,0 +1,45 @@
+#!/bin/sh
+# Replays a journal when the server is restarted with another output DB.
+#
+# The checkpoint records the name its journal segments are under, so a
+# server started from it finds them whatever DB it dumps to.  Run from the
+# source directory after building the server:
+#	sh tests/journal_name.sh
+
+MOO=${MOO:-`pwd`/moo}
+PORT=${PORT:-7989}
+DIR=`mktemp -d /tmp/journal_name.XXXXXX` || exit 1
+trap 'rm -rf $DIR' 0
+
+cp Minimal.db $DIR/in.db
+cd $DIR
+
+# Make a checkpoint.
+$MOO -e in.db b.db > run1.out 2> run1.log <<'END'
+;create(#1)
+quit
+END
+
+# Change it, then let the server flush its journal and kill it.
+$MOO -e b.db b.db $PORT > run2.out 2> run2.log <<'END' &
+;;#4.name = "changed"; recycle(#4);
+;;#1.name = "root";
+continue
+END
+sleep 2
+kill -9 $! 2> /dev/null
+wait
+
+# Replay the journal on the checkpoint, dumping somewhere else.
+$MOO -e b.db c.db > run3.out 2> run3.log <<'END'
+;{#1.name, valid(#4)}
+abort
+END
+
+if grep -q '=> {"root", 0}' run3.out; then
+    echo "PASS"
+    exit 0
+fi
+echo "FAIL"
+cat run3.log
+exit 1
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Replays a journal holding a property defined with a WAIF value.
+#
+# The WAIF can't be journaled, but the property must be, or the records
+# that address later properties by slot, and its own rename and deletion,
+# don't replay.  Run from the source directory after building the server:
+#	sh tests/journal_waif.sh
+
+MOO=${MOO:-`pwd`/moo}
+PORT=${PORT:-7987}
+DIR=`mktemp -d /tmp/journal_waif.XXXXXX` || exit 1
+trap 'rm -rf $DIR' 0
+
+cp Minimal.db $DIR/in.db
+cd $DIR
+
+# Make a checkpoint, with a verb for making WAIFs.
+$MOO -e in.db test.db > run1.out 2> run1.log <<'END'
+;;add_verb(#1, {#3, "rxd", "mkwaif"}, {"this", "none", "this"}); set_verb_code(#1, "mkwaif", {"return new_waif();"});
+quit
+END
+
+# Change it, then let the server flush its journal and kill it.
+$MOO -e test.db test.db $PORT > run2.out 2> run2.log <<'END' &
+;;add_property(#3, "wp", #1:mkwaif(), {#3, "rw"}); add_property(#3, "after", 5, {#3, "rw"});
+;;set_property_info(#3, "wp", {#3, "r", "wp2"}); #3.after = 6;
+;;delete_property(#3, "wp2"); #3.after = 7;
+continue
+END
+sleep 2
+kill -9 $! 2> /dev/null
+wait
+
+# Replay the journal on the checkpoint.
+$MOO -e test.db test.db > run3.out 2> run3.log <<'END'
+;{#3.after, properties(#3)}
+abort
+END
+
+if grep -q '=> {7, {"after"}}' run3.out; then
+    echo "PASS"
+    exit 0
+fi
+echo "FAIL"
+cat run3.log
+exit 1
@@ -20,259 +20,215 @@
 #include "my-sys-time.h"
 #include "my-time.h"
 #include "my-unistd.h"
+#if HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
 
 #include "config.h"
+#include "storage.h"
 #include "timers.h"
 
-#if (defined(MACH) && defined(CMU)) || !defined(SIGVTALRM)
-/* Virtual interval timers are broken on Mach 3.0 */
-#  undef ITIMER_VIRTUAL
-#endif
+/* Ordinary timers wait in a heap ordered by deadline, on the
+ * monotonic_usecs() clock.  Nothing happens in signal context: the main
+ * loop waits for network I/O no longer than next_timer_usecs() and then
+ * calls run_expired_timers(), which runs their procs.  The CPU time of a
+ * running task is limited without a timer: the interpreter compares
+ * cpu_usecs() with the task's deadline as it goes; see
+ * check_task_deadline() in execute.c.
+ */
 
 typedef struct Timer_Entry Timer_Entry;
 struct Timer_Entry {
-    Timer_Entry *next;
-    time_t when;
+    int64_t when;
     Timer_Proc proc;
     Timer_Data data;
     Timer_ID id;
 };
 
-static Timer_Entry *active_timers = 0;
-static Timer_Entry *free_timers = 0;
-static Timer_Entry *virtual_timer = 0;
+static Timer_Entry *timer_heap = 0;
+static int num_timers = 0, max_timers = 0;
 static Timer_ID next_id = 0;
 
-static Timer_Entry *
-allocate_timer(void)
+/* Timers due at the same moment run in the order they were set. */
+static int
+runs_before(Timer_Entry * a, Timer_Entry * b)
 {
-    if (free_timers) {
-	Timer_Entry *this = free_timers;
-
-	free_timers = this->next;
-	return this;
-    } else
-	return (Timer_Entry *) malloc(sizeof(Timer_Entry));
+    return a->when < b->when || (a->when == b->when && a->id < b->id);
 }
 
 static void
-free_timer(Timer_Entry * this)
+sift_up(Timer_Entry e, int i)
 {
-    this->next = free_timers;
-    free_timers = this;
+    while (i > 0 && runs_before(&e, &timer_heap[(i - 1) / 2])) {
+	timer_heap[i] = timer_heap[(i - 1) / 2];
+	i = (i - 1) / 2;
+    }
+    timer_heap[i] = e;
 }
 
-static void restart_timers(void);
-
 static void
-wakeup_call(int signo)
+sift_down(Timer_Entry e, int i)
 {
-    Timer_Entry *this = active_timers;
-    Timer_Proc proc = this->proc;
-    Timer_ID id = this->id;
-    Timer_Data data = this->data;
-
-    active_timers = active_timers->next;
-    free_timer(this);
-    restart_timers();
-    if (proc)
-	(*proc) (id, data);
+    int child;
+
+    while ((child = 2 * i + 1) < num_timers) {
+	if (child + 1 < num_timers
+	    && runs_before(&timer_heap[child + 1], &timer_heap[child]))
+	    child++;
+	if (!runs_before(&timer_heap[child], &e))
+	    break;
+	timer_heap[i] = timer_heap[child];
+	i = child;
+    }
+    timer_heap[i] = e;
 }
 
-
-#ifdef ITIMER_VIRTUAL
 static void
-virtual_wakeup_call(int signo)
+remove_timer(int i)
 {
-    Timer_Entry *this = virtual_timer;
-    Timer_Proc proc = this->proc;
-    Timer_ID id = this->id;
-    Timer_Data data = this->data;
-
-    virtual_timer = 0;
-    free_timer(this);
-    if (proc)
-	(*proc) (id, data);
+    Timer_Entry last = timer_heap[--num_timers];
+
+    if (i == num_timers)
+	return;
+    else if (i > 0 && runs_before(&last, &timer_heap[(i - 1) / 2]))
+	sift_up(last, i);
+    else
+	sift_down(last, i);
 }
-#endif
 
-static void
-stop_timers()
+Timer_ID
+set_timer(unsigned seconds, Timer_Proc proc, Timer_Data data)
 {
-    alarm(0);
-    signal(SIGALRM, SIG_IGN);
-    signal(SIGALRM, wakeup_call);
-
-#ifdef ITIMER_VIRTUAL
-    {
-	struct itimerval itimer, oitimer;
-
-	itimer.it_value.tv_sec = 0;
-	itimer.it_value.tv_usec = 0;
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_usec = 0;
-
-	setitimer(ITIMER_VIRTUAL, &itimer, &oitimer);
-	signal(SIGVTALRM, SIG_IGN);
-	signal(SIGVTALRM, virtual_wakeup_call);
-	if (virtual_timer)
-	    virtual_timer->when = oitimer.it_value.tv_sec;
+    Timer_Entry this;
+
+    this.id = next_id++;
+    this.when = monotonic_usecs() + (int64_t) seconds * 1000000;
+    this.proc = proc;
+    this.data = data;
+
+    if (num_timers == max_timers) {
+	max_timers = max_timers ? 2 * max_timers : 8;
+	timer_heap = (timer_heap
+		      ? myrealloc(timer_heap, max_timers * sizeof(Timer_Entry),
+				  M_TIMER)
+		      : mymalloc(max_timers * sizeof(Timer_Entry), M_TIMER));
     }
-#endif
+    sift_up(this, num_timers++);
+
+    return this.id;
 }
 
-static void
-restart_timers()
+unsigned
+timer_wakeup_interval(Timer_ID id)
 {
-    if (active_timers) {
-	time_t now = time(0);
-
-	signal(SIGALRM, wakeup_call);
-
-	if (now < active_timers->when)	/* first timer is in the future */
-	    alarm(active_timers->when - now);
-	else
-	    kill(getpid(), SIGALRM);	/* we're already late... */
-    }
-#ifdef ITIMER_VIRTUAL
-
-    if (virtual_timer) {
-	signal(SIGVTALRM, virtual_wakeup_call);
-
-	if (virtual_timer->when > 0) {
-	    struct itimerval itimer;
+    int64_t when = -1;
+    int i;
 
-	    itimer.it_value.tv_sec = virtual_timer->when;
-	    itimer.it_value.tv_usec = 0;
-	    itimer.it_interval.tv_sec = 0;
-	    itimer.it_interval.tv_usec = 0;
+    for (i = 0; i < num_timers; i++)
+	if (timer_heap[i].id == id)
+	    when = timer_heap[i].when;
 
-	    setitimer(ITIMER_VIRTUAL, &itimer, 0);
-	} else
-	    kill(getpid(), SIGVTALRM);
-    }
-#endif
+    if (when < 0 || when <= monotonic_usecs())
+	return 0;
+    return (when - monotonic_usecs()) / 1000000;
 }
 
-Timer_ID
-set_timer(unsigned seconds, Timer_Proc proc, Timer_Data data)
+int64_t
+next_timer_usecs(void)
 {
-    Timer_Entry *this = allocate_timer();
-    Timer_Entry **t;
+    int64_t left;
 
-    this->id = next_id++;
-    this->when = time(0) + seconds;
-    this->proc = proc;
-    this->data = data;
-
-    stop_timers();
+    if (num_timers == 0)
+	return -1;
+    left = timer_heap[0].when - monotonic_usecs();
+    return left > 0 ? left : 0;
+}
 
-    t = &active_timers;
-    while (*t && this->when >= (*t)->when)
-	t = &((*t)->next);
-    this->next = *t;
-    *t = this;
+void
+run_expired_timers(void)
+{
+    int64_t now = monotonic_usecs();
 
-    restart_timers();
+    while (num_timers > 0 && timer_heap[0].when <= now) {
+	Timer_Entry this = timer_heap[0];
 
-    return this->id;
+	remove_timer(0);
+	if (this.proc)
+	    (*this.proc) (this.id, this.data);
+    }
 }
 
-Timer_ID
-set_virtual_timer(unsigned seconds, Timer_Proc proc, Timer_Data data)
+long
+usecs_between(struct timeval *start, struct timeval *end)
 {
-#ifdef ITIMER_VIRTUAL
-
-    if (virtual_timer)
-	return -1;
-
-    stop_timers();
+    return (end->tv_sec - start->tv_sec) * 1000000L
+	+ end->tv_usec - start->tv_usec;
+}
 
-    virtual_timer = allocate_timer();
-    virtual_timer->id = next_id++;
-    virtual_timer->when = seconds;
-    virtual_timer->proc = proc;
-    virtual_timer->data = data;
+int64_t
+monotonic_usecs(void)
+{
+    struct timeval tv;
 
-    restart_timers();
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
 
-    return virtual_timer->id;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    gettimeofday(&tv, 0);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
-#else				/* !ITIMER_VIRTUAL */
+int64_t
+cpu_usecs(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
 
-    return set_timer(seconds, proc, data);
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+	return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+#if HAVE_GETRUSAGE
+    {
+	struct rusage ru;
 
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+	    return ((int64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+		    + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+    }
 #endif
+    return monotonic_usecs();
 }
 
 int
-virtual_timer_available()
+cpu_time_available(void)
 {
-#ifdef ITIMER_VIRTUAL
+#if (HAVE_CLOCK_GETTIME && defined(CLOCK_THREAD_CPUTIME_ID)) || HAVE_GETRUSAGE
     return 1;
 #else
     return 0;
 #endif
 }
 
-unsigned
-timer_wakeup_interval(Timer_ID id)
-{
-    Timer_Entry *t;
-
-#ifdef ITIMER_VIRTUAL
-
-    if (virtual_timer && virtual_timer->id == id) {
-	struct itimerval itimer;
-
-	getitimer(ITIMER_VIRTUAL, &itimer);
-	return itimer.it_value.tv_sec;
-    }
-#endif
-
-    for (t = active_timers; t; t = t->next)
-	if (t->id == id)
-	    return t->when - time(0);;
-
-    return 0;
-}
-
 void
 timer_sleep(unsigned seconds)
 {
-    set_timer(seconds, 0, 0);
-    pause();
+    sleep(seconds);
 }
 
 int
 cancel_timer(Timer_ID id)
 {
-    Timer_Entry **t = &active_timers;
-    int found = 0;
-
-    stop_timers();
-
-    if (virtual_timer && virtual_timer->id == id) {
-	free_timer(virtual_timer);
-	virtual_timer = 0;
-	found = 1;
-    } else {
-	while (*t) {
-	    if ((*t)->id == id) {
-		Timer_Entry *tt = *t;
-
-		*t = tt->next;
-		found = 1;
-		free_timer(tt);
-		break;
-	    }
-	    t = &((*t)->next);
-	}
-    }
+    int i;
 
-    restart_timers();
+    for (i = 0; i < num_timers; i++)
+	if (timer_heap[i].id == id) {
+	    remove_timer(i);
+	    return 1;
+	}
 
-    return found;
+    return 0;
 }
 
 void
@@ -18,6 +18,7 @@
 #ifndef Timers_H
 #define Timers_H 1
 
+#include "my-sys-time.h"
 #include "my-time.h"
 
 typedef int Timer_ID;
@@ -25,12 +26,41 @@ typedef void *Timer_Data;
 typedef void (*Timer_Proc) (Timer_ID, Timer_Data);
 
 extern Timer_ID set_timer(unsigned, Timer_Proc, Timer_Data);
-extern Timer_ID set_virtual_timer(unsigned, Timer_Proc, Timer_Data);
+				/* The proc is called from the main loop, by
+				 * run_expired_timers(), once the given
+				 * number of seconds have passed.
+				 */
 extern int cancel_timer(Timer_ID);
 extern void reenable_timers(void);
 extern unsigned timer_wakeup_interval(Timer_ID);
 extern void timer_sleep(unsigned seconds);
-extern int virtual_timer_available(void);
+
+extern int64_t next_timer_usecs(void);
+				/* Microseconds until the next set_timer()
+				 * timer is due, or -1 if there are none.
+				 */
+extern void run_expired_timers(void);
+
+extern long usecs_between(struct timeval *start, struct timeval *end);
+				/* Microseconds from START to END, as filled
+				 * in by gettimeofday().
+				 */
+extern int64_t monotonic_usecs(void);
+				/* Microseconds on a clock that never jumps
+				 * when the system time is reset; only
+				 * differences between its values mean
+				 * anything.
+				 */
+extern int64_t cpu_usecs(void);
+				/* Microseconds of CPU time used by the
+				 * calling thread (or, failing a way to tell,
+				 * by the whole server, or failing that,
+				 * monotonic_usecs()).
+				 */
+extern int cpu_time_available(void);
+				/* Whether cpu_usecs() can measure CPU time
+				 * rather than falling back on the clock.
+				 */
 
 #endif				/* !Timers_H */
 
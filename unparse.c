@@ -33,7 +33,7 @@
 #include "streams.h"
 #include "utils.h"
 
-static Program *prog;
+static THREAD_LOCAL Program *prog;
 
 const char *
 unparse_error(enum error e)
@@ -227,9 +227,9 @@ init_expr_tables()
 
 /********** globals *********************************/
 
-static Unparser_Receiver receiver;
-static void *receiver_data;
-static int fully_parenthesize, indent_code;
+static THREAD_LOCAL Unparser_Receiver receiver;
+static THREAD_LOCAL void *receiver_data;
+static THREAD_LOCAL int fully_parenthesize, indent_code;
 
 /********** AST to receiver procedures **************/
 
@@ -408,43 +408,49 @@ value_bytes(Var v)
     return size;
 }
 
-const char *
-raw_bytes_to_binary(const char *buffer, int buflen)
+/* Writes the binary string for the BUFLEN bytes in BUFFER to BINARY, which
+ * must have room for 3 * BUFLEN + 1 characters, returning its length.  This
+ * and binary_to_raw_buffer() touch nothing else, so built-in functions may
+ * call them from worker threads.
+ */
+int
+raw_bytes_to_binary_buffer(const char *buffer, int buflen, char *binary)
 {
-    static Stream *s = 0;
+    static const char digits[] = "0123456789abcdef";
+    char *out = binary;
     int i;
 
-    if (!s)
-	s = new_stream(100);
-
     for (i = 0; i < buflen; i++) {
 	unsigned char c = buffer[i];
 
 	if (c >= 32 && c < 126)
-	    stream_add_char(s, c);
-	else
-	    stream_printf(s, "~%02x", (int) c);
+	    *out++ = c;
+	else {
+	    *out++ = '~';
+	    *out++ = digits[c >> 4];
+	    *out++ = digits[c & 0xF];
+	}
     }
+    *out = '\0';
 
-    return reset_stream(s);
+    return out - binary;
 }
 
-const char *
-binary_to_raw_bytes(const char *binary, int *buflen)
+/* Writes the bytes of the binary string BINARY to RAW, which must have room
+ * for strlen(BINARY) of them, returning their number, or -1 if BINARY is
+ * malformed.
+ */
+int
+binary_to_raw_buffer(const char *binary, char *raw)
 {
-    static Stream *s = 0;
     const char *ptr = binary;
-
-    if (!s)
-	s = new_stream(100);
-    else
-	reset_stream(s);
+    char *out = raw;
 
     while (*ptr) {
 	unsigned char c = *ptr++;
 
 	if (c != '~')
-	    stream_add_char(s, c);
+	    *out++ = c;
 	else {
 	    int i;
 	    char cc = 0;
@@ -458,15 +464,54 @@ binary_to_raw_bytes(const char *binary, int *buflen)
 		else if ('a' <= c && c <= 'f')
 		    cc = (cc << 4) + (c - 'a' + 10);
 		else
-		    return 0;
+		    return -1;
 	    }
 
-	    stream_add_char(s, cc);
+	    *out++ = cc;
 	}
     }
 
-    *buflen = stream_length(s);
-    return reset_stream(s);
+    return out - raw;
+}
+
+static char *
+scratch_buffer(char **buffer, int *size, int needed)
+{
+    if (needed > *size) {
+	if (*buffer)
+	    myfree(*buffer, M_STREAM);
+	*size = needed > 100 ? needed : 100;
+	*buffer = mymalloc(*size, M_STREAM);
+    }
+    return *buffer;
+}
+
+const char *
+raw_bytes_to_binary(const char *buffer, int buflen)
+{
+    static char *binary = 0;
+    static int size = 0;
+
+    scratch_buffer(&binary, &size, 3 * buflen + 1);
+    raw_bytes_to_binary_buffer(buffer, buflen, binary);
+
+    return binary;
+}
+
+const char *
+binary_to_raw_bytes(const char *binary, int *buflen)
+{
+    static char *raw = 0;
+    static int size = 0;
+    int length = strlen(binary);
+
+    scratch_buffer(&raw, &size, length + 1);
+    if ((length = binary_to_raw_buffer(binary, raw)) < 0)
+	return 0;
+    raw[length] = '\0';
+    *buflen = length;
+
+    return raw;
 }
 
 char rcsid_utils[] = "$Id$";
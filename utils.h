@@ -81,6 +81,9 @@ extern int value_bytes(Var);
 
 extern const char *raw_bytes_to_binary(const char *buffer, int buflen);
 extern const char *binary_to_raw_bytes(const char *binary, int *rawlen);
+extern int raw_bytes_to_binary_buffer(const char *buffer, int buflen,
+				      char *binary);
+extern int binary_to_raw_buffer(const char *binary, char *raw);
 
 #endif
 
@@ -506,7 +506,7 @@ bf_set_verb_code(Var arglist, Byte next, void *vdata, Objid progr)
     }
     program = parse_list_as_program(code, &errors);
     if (program) {
-	if (task_timed_out)
+	if (check_task_deadline())
 	    free_program(program);
 	else
 	    db_set_verb_program(h, program);
@@ -96,7 +96,7 @@ gen_waif_propdefs(Object *o)
 	 * counting relevant properties.
 	 */
 	cnt = 0;
-	for(p = o; p; p = dbpriv_find_object(p->parent))
+	for(p = o; p; p = dbpriv_find_object(dbpriv_parent[p->id]))
 	    for (i = 0; i < p->propdefs.cur_length; ++i)
 		if (p->propdefs.l[i].name[0] == WAIF_PROP_PREFIX)
 		    ++cnt;
@@ -109,7 +109,7 @@ gen_waif_propdefs(Object *o)
 	wpd->refcount = 1;
 	wpd->length = cnt;
 	cnt = 0;
-	for(p = o; p; p = dbpriv_find_object(p->parent)) {
+	for(p = o; p; p = dbpriv_find_object(dbpriv_parent[p->id])) {
 	    Propdef *pd = p->propdefs.l;
 
 	    for (i = 0; i < p->propdefs.cur_length; ++i, ++pd)
@@ -782,6 +782,15 @@ waif_bytes(Waif *w)
 static Waif **saved_waifs;
 static unsigned long n_saved_waifs;
 
+/* Incremental checkpoints can't save waifs: a waif held by a changed object
+ * and an unchanged one would come back as two.
+ */
+int
+waifs_in_use()
+{
+	return waif_count != 0;
+}
+
 void
 waif_before_saving()
 {
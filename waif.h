@@ -47,6 +47,7 @@ extern void waif_before_saving();
 extern void waif_after_saving();
 extern void waif_before_loading();
 extern void waif_after_loading();
+extern int waifs_in_use();
 extern void write_waif(Var);
 extern Var read_waif();
 extern void free_waif_propdefs(WaifPropdefs *);                                 